@@ -4,6 +4,12 @@
 #include <iostream>
 #include <random>
 #include <cassert>
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <iomanip>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "buffer.hpp"
 
@@ -12,64 +18,270 @@
 ////////////////////////////////////////////
 // CircularBuffer methods
 ////////////////////////////////////////////
-void CircularBuffer::initialise(uint32_t bufferCapacity)
+
+CircularBuffer::~CircularBuffer()
 {
-    capacity = bufferCapacity;
-    buffer.resize(capacity);
-    readPos = 0;
-    writePos = 0;
+    freeStorage(buffer, mirrored);
 }
 
 /**
- * Write `N` bytes from `inBuffer` to the circular buffer.
- * 
- * Optionally write `offset` bytes into the buffer 
- * (i.e. `offset` bytes ahead of the write pointer).
+ * Allocate `bufferCapacity` bytes of storage (rounded up to a power of
+ * two, and if `mirror`ed, to a page), empty.
  */
-bool CircularBuffer::writeN(std::vector<uint8_t> &inBuffer, int N, int offset)
+void CircularBuffer::initialise(uint32_t bufferCapacity, bool mirror)
 {
-    assert(N <= inBuffer.size());
-    if (availableToWrite() < N)
-        return false;
+    freeStorage(buffer, mirrored);
+
+    capacity = std::bit_ceil(std::max(bufferCapacity, 1u));
+    if (mirror)
+        capacity = std::max<uint32_t>(capacity, sysconf(_SC_PAGESIZE));
+    mask = capacity - 1;
+    buffer = allocateStorage(mirror);
+    reset();
+}
+
+/**
+ * Reallocate the buffer's storage from the calling thread, keeping its
+ * contents (i.e. move it to the calling thread's NUMA node, as the kernel
+ * places pages on the node of the core first touching them).
+ *
+ * NOTE: neither reader nor writer may use the buffer meanwhile.
+ */
+void CircularBuffer::reallocate()
+{
+    bool wasMirrored = mirrored;
+    uint8_t *storage = allocateStorage(mirrored);
+    memcpy(storage, buffer, capacity);
+    freeStorage(buffer, wasMirrored);
+    buffer = storage;
+}
+
+uint8_t *CircularBuffer::allocateStorage(bool mirror)
+{
+    mirrored = false;
+    if (!mirror)
+        return new uint8_t[capacity];
+
+    /**
+     * Reserve 2 * capacity bytes of address space, then map the memfd's
+     * pages over both halves of it.
+     */
+    uint8_t *storage = nullptr;
+    int fd = memfd_create("circular-buffer", MFD_CLOEXEC);
+    if (fd >= 0 && ftruncate(fd, capacity) == 0)
+    {
+        void *base = mmap(nullptr, 2 * (size_t)capacity, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base != MAP_FAILED)
+        {
+            storage = static_cast<uint8_t*>(base);
+            for (uint8_t *half : { storage, storage + capacity })
+            {
+                if (mmap(half, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                         fd, 0) == MAP_FAILED)
+                {
+                    munmap(base, 2 * (size_t)capacity);
+                    storage = nullptr;
+                    break;
+                }
+            }
+        }
+    }
+    if (fd >= 0)
+        close(fd);  // the mappings keep the pages
 
-    for (int i = 0; i < N; i++)
+    if (!storage)
     {
-        int ind = (readPos + i) % capacity;
-        buffer[ind] = inBuffer[i];
+        // say so once, rather than for every connection
+        static std::atomic<bool> warned{false};
+        if (!warned.exchange(true))
+            perror("Failed to mirror circular buffer (using flat storage)");
+        return new uint8_t[capacity];
     }
 
-    writePos = (writePos + N) % capacity;
+    mirrored = true;
+    return storage;
+}
+
+void CircularBuffer::freeStorage(uint8_t *storage, bool wasMirrored)
+{
+    if (wasMirrored)
+        munmap(storage, 2 * (size_t)capacity);
+    else
+        delete[] storage;
+}
+
+/**
+ * Empty the buffer, both positions starting again from stream offset
+ * `pos`.
+ */
+void CircularBuffer::reset(uint64_t pos)
+{
+    readPos.store(pos, std::memory_order_relaxed);
+    writePos.store(pos, std::memory_order_relaxed);
+}
+
+void CircularBuffer::copyIn(uint64_t pos, const uint8_t *data, uint32_t N)
+{
+    uint32_t index = pos & mask;
+    uint32_t first = mirrored ? N : std::min(N, capacity - index);
+    memcpy(buffer + index, data, first);
+    memcpy(buffer, data + first, N - first);
+}
+
+void CircularBuffer::copyOut(uint64_t pos, uint8_t *out, uint32_t N)
+{
+    uint32_t index = pos & mask;
+    uint32_t first = mirrored ? N : std::min(N, capacity - index);
+    memcpy(out, buffer + index, first);
+    memcpy(out + first, buffer, N - first);
+}
+
+/**
+ * Write `N` bytes from `data` after the write pointer (writer).
+ *
+ * Returns false (writing nothing) if they don't fit.
+ */
+bool CircularBuffer::writeN(const uint8_t *data, uint32_t N)
+{
+    uint64_t pos = writePos.load(std::memory_order_relaxed);
+    uint64_t used = pos - readPos.load(std::memory_order_acquire);
+    if (capacity - used < N)
+        return false;
+
+    copyIn(pos, data, N);
+
+    // publish the bytes to the reader
+    writePos.store(pos + N, std::memory_order_release);
     return true;
 }
 
 /**
- * Read `N` bytes from the circular buffer into `outBuffer`.
- * 
- * Optionally read from `offset` bytes into the buffer
- * (i.e. `offset` bytes ahead of the read pointer).
+ * Copy `N` bytes from `data` to stream offset `pos`, at or beyond the write
+ * pointer, without publishing them (writer).
+ *
+ * Returns false (writing nothing) if they don't fit.
  */
-bool CircularBuffer::readN(std::vector<uint8_t> &outBuffer, int N, int offset)
+bool CircularBuffer::writeAt(const uint8_t *data, uint32_t N, uint64_t pos)
 {
-    assert(N <= outBuffer.size());
-    if (availableToRead() < N)
+    if (pos < writePos.load(std::memory_order_relaxed) ||
+        pos + N > readPos.load(std::memory_order_acquire) + capacity)
         return false;
-    
-    for (int i = 0; i < N; i++)
-    {
-        int ind = (readPos + i) % capacity;
-        outBuffer[i] = buffer[ind];
-    }
 
-    readPos = (readPos + N) % capacity;
+    copyIn(pos, data, N);
     return true;
 }
 
+/**
+ * Read `N` bytes after the read pointer into `out` (reader).
+ *
+ * Returns false (reading nothing) if fewer are available.
+ */
+bool CircularBuffer::readN(uint8_t *out, uint32_t N)
+{
+    uint64_t pos = readPos.load(std::memory_order_relaxed);
+    uint64_t used = writePos.load(std::memory_order_acquire) - pos;
+    if (used < N)
+        return false;
+
+    copyOut(pos, out, N);
+
+    // hand the space back to the writer
+    readPos.store(pos + N, std::memory_order_release);
+    return true;
+}
+
+/**
+ * Copy `N` bytes, from `offset` bytes after the read pointer, into `out`,
+ * without consuming them (reader).
+ */
+bool CircularBuffer::peekN(uint8_t *out, uint32_t N, uint32_t offset)
+{
+    return peekAt(out, N, readPos.load(std::memory_order_relaxed) + offset);
+}
+
+/**
+ * Copy the `N` bytes at stream offset `pos` (from the read pointer on)
+ * into `out`, without consuming them (reader).
+ */
+bool CircularBuffer::peekAt(uint8_t *out, uint32_t N, uint64_t pos)
+{
+    if (pos < readPos.load(std::memory_order_relaxed) ||
+        pos + N > writePos.load(std::memory_order_acquire))
+        return false;
+
+    copyOut(pos, out, N);
+    return true;
+}
+
+/**
+ * Consume `N` bytes after the read pointer, handing their space back to
+ * the writer (reader).
+ */
+void CircularBuffer::discardN(uint32_t N)
+{
+    readPos.store(readPos.load(std::memory_order_relaxed) + N, std::memory_order_release);
+}
+
+/**
+ * Returns the `N` bytes at stream offset `pos` (from the read pointer on)
+ * in place, or nullptr if they aren't contiguous (i.e. wrap around flat
+ * storage) or aren't all in the buffer (reader).
+ */
+const uint8_t *CircularBuffer::viewAt(uint64_t pos, uint32_t N)
+{
+    if (pos < readPos.load(std::memory_order_relaxed) ||
+        pos + N > writePos.load(std::memory_order_acquire))
+        return nullptr;
+
+    uint32_t index = pos & mask;
+    if (!mirrored && index + N > capacity)
+        return nullptr;
+    return buffer + index;
+}
+
+/**
+ * Returns the bytes after the read pointer, in place: all of them if
+ * mirrored, else those before the end of the storage (reader).
+ */
+std::span<const uint8_t> CircularBuffer::readableSpan()
+{
+    uint64_t pos = readPos.load(std::memory_order_relaxed);
+    uint32_t used = writePos.load(std::memory_order_acquire) - pos;
+    uint32_t index = pos & mask;
+    if (!mirrored)
+        used = std::min(used, capacity - index);
+    return { buffer + index, used };
+}
+
+/**
+ * Returns the room after the write pointer, in place: all of it if
+ * mirrored, else that before the end of the storage (writer).
+ */
+std::span<uint8_t> CircularBuffer::writableSpan()
+{
+    uint64_t pos = writePos.load(std::memory_order_relaxed);
+    uint32_t room = capacity - (pos - readPos.load(std::memory_order_acquire));
+    uint32_t index = pos & mask;
+    if (!mirrored)
+        room = std::min(room, capacity - index);
+    return { buffer + index, room };
+}
+
+/**
+ * Publish `N` bytes written in place after the write pointer (writer).
+ */
+void CircularBuffer::commitN(uint32_t N)
+{
+    writePos.store(writePos.load(std::memory_order_relaxed) + N, std::memory_order_release);
+}
+
 /**
  * Returns num. bytes able to be read after the read pointer.
  */
 uint32_t CircularBuffer::availableToRead()
 {
-    return (writePos - readPos + capacity) % capacity;
+    return writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_acquire);
 }
 
 /**
@@ -106,7 +318,7 @@ namespace CircularBufferTests
         /**
          * Initialise
          */
-        uint32_t capacity = 4000;
+        uint32_t capacity = 4096;
         CircularBuffer cb;
         cb.initialise(capacity);
 
@@ -120,12 +332,12 @@ namespace CircularBufferTests
         std::vector<uint8_t> inBuffer;
         populateRandomBuffer(inBuffer, N);
 
-        cb.writeN(inBuffer, N, 0);
+        cb.writeN(inBuffer.data(), N);
         ASSERT_THAT(cb.availableToRead() == N);
         ASSERT_THAT(cb.availableToWrite() == capacity - N);
 
         std::vector<uint8_t> outBuffer(N);
-        cb.readN(outBuffer, N, 0);
+        cb.readN(outBuffer.data(), N);
         ASSERT_THAT(inBuffer == outBuffer);
 
         /**
@@ -134,45 +346,170 @@ namespace CircularBufferTests
         int M = 2000;
         populateRandomBuffer(inBuffer, M);
 
-        cb.writeN(inBuffer, M, 0);
+        cb.writeN(inBuffer.data(), M);
 
         outBuffer.resize(M);
-        cb.readN(outBuffer, M, 0);
+        cb.readN(outBuffer.data(), M);
         ASSERT_THAT(inBuffer == outBuffer);
-        ASSERT_THAT(cb.writePos == (N + M) % cb.capacity);
-        ASSERT_THAT(cb.readPos == (N + M) % cb.capacity);
+        ASSERT_THAT(cb.writePos == N + M);
+        ASSERT_THAT(cb.readPos == N + M);
     }
 
-    /**
-     * TODO:
-     */
     void testReadWriteWithOffset()
     {
+        uint32_t capacity = 1024;
+        CircularBuffer cb;
+        cb.initialise(capacity);
+
+        /**
+         * Move the pointers near the end of the storage, so the bytes
+         * written next wrap around
+         */
+        cb.reset(3 * capacity - 100);
+
+        int N = 300;
+        std::vector<uint8_t> inBuffer;
+        populateRandomBuffer(inBuffer, N);
+        ASSERT_THAT(cb.writeN(inBuffer.data(), N));
+
+        /**
+         * Peek at bytes either side of the wrap, by offset and by stream
+         * offset, without consuming them
+         */
+        std::vector<uint8_t> outBuffer(200);
+        ASSERT_THAT(cb.peekN(outBuffer.data(), 200, 50));
+        ASSERT_THAT(std::equal(outBuffer.begin(), outBuffer.end(), inBuffer.begin() + 50));
+
+        ASSERT_THAT(cb.peekAt(outBuffer.data(), 200, cb.readOffset() + 100));
+        ASSERT_THAT(std::equal(outBuffer.begin(), outBuffer.end(), inBuffer.begin() + 100));
+        ASSERT_THAT(cb.availableToRead() == N);
+
+        /**
+         * Peeking past the written bytes (or before the read pointer) fails
+         */
+        ASSERT_THAT(!cb.peekN(outBuffer.data(), 200, 101));
+        cb.discardN(10);
+        ASSERT_THAT(!cb.peekAt(outBuffer.data(), 1, cb.readOffset() - 1));
+    }
+
+    void testOutOfOrderWrites()
+    {
+        uint32_t capacity = 1024;
+        CircularBuffer cb;
+        cb.initialise(capacity);
+        cb.reset(capacity - 100);
 
+        int N = 600;
+        std::vector<uint8_t> inBuffer;
+        populateRandomBuffer(inBuffer, N);
+
+        /**
+         * Write the second half first (across the wrap), unpublished
+         */
+        uint64_t start = cb.writeOffset();
+        ASSERT_THAT(cb.writeAt(inBuffer.data() + 300, 300, start + 300));
+        ASSERT_THAT(cb.availableToRead() == 0);
+
+        /**
+         * Writes before the write pointer, or past the room, fail
+         */
+        ASSERT_THAT(!cb.writeAt(inBuffer.data(), 1, start - 1));
+        ASSERT_THAT(!cb.writeAt(inBuffer.data(), 1, start + capacity));
+
+        /**
+         * Filling the hole, and publishing both halves, reads them in order
+         */
+        ASSERT_THAT(cb.writeAt(inBuffer.data(), 300, start));
+        cb.commitN(N);
+        ASSERT_THAT(cb.availableToRead() == N);
+
+        std::vector<uint8_t> outBuffer(N);
+        ASSERT_THAT(cb.readN(outBuffer.data(), N));
+        ASSERT_THAT(outBuffer == inBuffer);
+    }
+
+    void testMirroredViews()
+    {
+        uint32_t capacity = 4096;
+        CircularBuffer flat, mirrored;
+        flat.initialise(capacity);
+        mirrored.initialise(capacity, true);
+        ASSERT_THAT(mirrored.mirrored);
+
+        /**
+         * Write bytes wrapping around the end of the storage
+         */
+        int N = 300;
+        std::vector<uint8_t> inBuffer;
+        populateRandomBuffer(inBuffer, N);
+        for (CircularBuffer *cb : { &flat, &mirrored })
+        {
+            cb->reset(3 * capacity - 100);
+            ASSERT_THAT(cb->writeN(inBuffer.data(), N));
+        }
+
+        /**
+         * Flat storage only has them in place up to the wrap
+         */
+        ASSERT_THAT(flat.viewAt(flat.readOffset(), N) == nullptr);
+        ASSERT_THAT(flat.readableSpan().size() == 100);
+        ASSERT_THAT(flat.writableSpan().size() == capacity - N);
+
+        /**
+         * Mirrored storage has them all in place, wrapping or not
+         */
+        const uint8_t *view = mirrored.viewAt(mirrored.readOffset(), N);
+        ASSERT_THAT(view != nullptr);
+        ASSERT_THAT(std::equal(inBuffer.begin(), inBuffer.end(), view));
+
+        std::span<const uint8_t> readable = mirrored.readableSpan();
+        ASSERT_THAT(readable.size() == N && readable.data() == view);
+        ASSERT_THAT(mirrored.viewAt(mirrored.readOffset() + 1, N) == nullptr);
+
+        /**
+         * Bytes written in place are read back by copy, once committed
+         */
+        std::span<uint8_t> writable = mirrored.writableSpan();
+        ASSERT_THAT(writable.size() == capacity - N);
+        std::copy(inBuffer.begin(), inBuffer.end(), writable.begin());
+        ASSERT_THAT(mirrored.availableToRead() == N);
+        mirrored.commitN(N);
+        ASSERT_THAT(mirrored.availableToRead() == 2 * N);
+
+        std::vector<uint8_t> outBuffer(2 * N);
+        ASSERT_THAT(mirrored.readN(outBuffer.data(), 2 * N));
+        ASSERT_THAT(std::equal(inBuffer.begin(), inBuffer.end(), outBuffer.begin()));
+        ASSERT_THAT(std::equal(inBuffer.begin(), inBuffer.end(), outBuffer.begin() + N));
+
+        /**
+         * Moving the storage keeps its mirroring
+         */
+        mirrored.reallocate();
+        ASSERT_THAT(mirrored.mirrored);
     }
 
     void testCapacityReached()
     {
-        int capacity = 2000;
+        int capacity = 2048;
         CircularBuffer cb;
         cb.initialise(capacity);
 
         int N = 1500;
         std::vector<uint8_t> inBuffer;
         populateRandomBuffer(inBuffer, N);
-        cb.writeN(inBuffer, N, 0);
+        cb.writeN(inBuffer.data(), N);
 
         int M = 500;
         std::vector<uint8_t> outBuffer(M);
-        cb.readN(outBuffer, M, 0);
+        cb.readN(outBuffer.data(), M);
 
-        ASSERT_THAT(cb.availableToWrite() == 1000);
+        ASSERT_THAT(cb.availableToWrite() == 1048);
 
         /**
          * Write X > availableToWrite() bytes
          */
         int X = 1100;
-        bool res = cb.writeN(inBuffer, X, 0);
+        bool res = cb.writeN(inBuffer.data(), X);
         ASSERT_THAT(!res);
         ASSERT_THAT(cb.writePos == 1500 && cb.readPos == 500);
     }
@@ -186,6 +523,9 @@ namespace CircularBufferTests
         std::vector<std::pair<std::string, std::function<void()>>> tests = 
         {
             TEST(testSimpleReadWrite),
+            TEST(testReadWriteWithOffset),
+            TEST(testOutOfOrderWrites),
+            TEST(testMirroredViews),
             TEST(testCapacityReached)
         };
 
@@ -196,11 +536,130 @@ namespace CircularBufferTests
     }
 };
 
-/*
-ideas / todo
-    - implement read/write at particular offset
-    - maybe need a way to tell if parts are occupied
-        - bitmap?
-    - maybe make writes more efficient with segmented memcpy() ops?
-        - i.e. first half / second half if it wraps around?
-*/
\ No newline at end of file
+////////////////////////////////////////////
+// CircularBuffer benchmarks
+////////////////////////////////////////////
+
+namespace CircularBufferBenchmarks
+{
+    /**
+     * The ring CircularBuffer replaced: byte-wise copies, indexed modulo
+     * the capacity, through std::vector arguments, at 32-bit positions.
+     */
+    struct ByteWiseBuffer
+    {
+        std::vector<uint8_t> buffer;
+        uint32_t capacity;
+        std::atomic<uint32_t> readPos{0};
+        std::atomic<uint32_t> writePos{0};
+
+        ByteWiseBuffer(uint32_t capacity) : buffer(capacity), capacity(capacity) {}
+
+        bool writeN(std::vector<uint8_t> &inBuffer, int N)
+        {
+            uint32_t pos = writePos.load(std::memory_order_relaxed);
+            uint32_t used = pos - readPos.load(std::memory_order_acquire);
+            if (capacity - used < (uint32_t)N)
+                return false;
+
+            for (int i = 0; i < N; i++)
+                buffer[(pos + i) % capacity] = inBuffer[i];
+
+            writePos.store(pos + N, std::memory_order_release);
+            return true;
+        }
+
+        bool readN(std::vector<uint8_t> &outBuffer, int N)
+        {
+            uint32_t pos = readPos.load(std::memory_order_relaxed);
+            uint32_t used = writePos.load(std::memory_order_acquire) - pos;
+            if (used < (uint32_t)N)
+                return false;
+
+            for (int i = 0; i < N; i++)
+                outBuffer[i] = buffer[(pos + i) % capacity];
+
+            readPos.store(pos + N, std::memory_order_release);
+            return true;
+        }
+    };
+
+    /**
+     * Streams `totalBytes` through `cb` in `chunkSize` writes, each read
+     * back (copied out) before the next, with the chunk staged in a vector
+     * first (as callers of the byte-wise ring had to), and reports the
+     * throughput.
+     */
+    template <typename Buffer, typename Write, typename Read>
+    double measure(Buffer &cb, uint32_t chunkSize, uint64_t totalBytes, Write write, Read read)
+    {
+        std::vector<uint8_t> source, chunk(chunkSize), sink(chunkSize);
+        CircularBufferTests::populateRandomBuffer(source, chunkSize);
+
+        uint64_t checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t moved = 0; moved < totalBytes; moved += chunkSize)
+        {
+            write(cb, source, chunk);
+            read(cb, sink);
+            checksum += sink[moved % chunkSize];
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        // keep the copies from being optimised away
+        static volatile uint64_t observed;
+        observed = checksum;
+        return totalBytes / elapsed.count() / (1 << 20);
+    }
+
+    /**
+     * Streams bytes through a buffer of each implementation, writing and
+     * reading them in chunks of a few sizes, and reports the throughput.
+     */
+    void runAll()
+    {
+        const uint32_t capacity = 1 << 16;
+        const uint64_t totalBytes = 1ULL << 28;
+
+        std::cout << "CircularBuffer throughput (MiB/s), " << (capacity >> 10) << " KiB buffer" << std::endl;
+        std::cout << std::setw(12) << "chunk (B)" << std::setw(14) << "byte-wise"
+                  << std::setw(14) << "memcpy" << std::setw(10) << "speedup"
+                  << std::setw(14) << "mirrored" << std::endl;
+
+        for (uint32_t chunkSize : { 64, 536, 1460, 4096, 16384 })
+        {
+            // an odd start, so chunks straddle the end of the storage
+            ByteWiseBuffer old(capacity);
+            old.readPos = old.writePos = capacity - chunkSize / 2;
+            double before = measure(old, chunkSize, totalBytes,
+                [chunkSize](ByteWiseBuffer &cb, std::vector<uint8_t> &source, std::vector<uint8_t> &chunk) {
+                    chunk.assign(source.begin(), source.end());
+                    cb.writeN(chunk, chunkSize);
+                },
+                [chunkSize](ByteWiseBuffer &cb, std::vector<uint8_t> &sink) {
+                    cb.readN(sink, chunkSize);
+                });
+
+            double after[2];
+            for (bool mirror : { false, true })
+            {
+                CircularBuffer cb;
+                cb.initialise(capacity, mirror);
+                cb.reset(capacity - chunkSize / 2);
+                after[mirror] = measure(cb, chunkSize, totalBytes,
+                    [chunkSize](CircularBuffer &cb, std::vector<uint8_t> &source, std::vector<uint8_t> &) {
+                        cb.writeN(source.data(), chunkSize);
+                    },
+                    [chunkSize](CircularBuffer &cb, std::vector<uint8_t> &sink) {
+                        cb.readN(sink.data(), chunkSize);
+                    });
+            }
+
+            std::cout << std::fixed << std::setprecision(0)
+                      << std::setw(12) << chunkSize << std::setw(14) << before
+                      << std::setw(14) << after[0] << std::setw(9) << std::setprecision(1)
+                      << after[0] / before << "x" << std::setprecision(0)
+                      << std::setw(14) << after[1] << std::endl;
+        }
+    }
+};
\ No newline at end of file
@@ -1,37 +1,140 @@
 #pragma once
+#include <atomic>
 #include <cstdint>
+#include <span>
 #include <vector>
 #include <iostream>
 
 /**
  * General-purpose circular buffer.
+ *
+ * Safe for one writer thread and one reader thread without locks: each
+ * side only advances its own position, publishing it (release) once the
+ * bytes are copied, and reads the other side's (acquire) to size its
+ * operation, so bytes are never seen before they are written.
+ *
+ * Positions are 64-bit offsets into the stream the buffer carries (i.e.
+ * num. bytes ever written / read), so never wrap: TCP sequence numbers,
+ * which do, are mapped to them by the streams (see SendStream::seqOf()
+ * and RecvStream::offsetOf()). The capacity is a power of two, so a
+ * position's index is its low bits, and each copy in or out is at most
+ * two memcpy()s (before and after the end of the storage).
+ *
+ * Optionally, the storage is mirrored: the same (memfd) pages are mapped
+ * twice, back to back, so the bytes of any region of the buffer, wrapping
+ * or not, are contiguous in memory (i.e. one memcpy(), or none, as callers
+ * use the bytes in place through viewAt(), readableSpan() and
+ * writableSpan()). Each mirrored buffer costs two mappings (see
+ * vm.max_map_count); if they can't be made, the storage is flat.
  */
 class CircularBuffer
 {
 public:
-    std::vector<uint8_t> buffer;
-    uint32_t capacity; 
+    uint8_t *buffer = nullptr;  // storage (mapped twice over 2 * capacity bytes, if mirrored)
+    uint32_t capacity = 0;
+    uint32_t mask;              // capacity - 1
+    bool mirrored = false;
 
-    uint32_t readPos;               
-    uint32_t writePos;  
+    /* reader's and writer's positions, on separate cache lines */
+    alignas(64) std::atomic<uint64_t> readPos;
+    alignas(64) std::atomic<uint64_t> writePos;
 
-    void initialise(uint32_t bufferCapacity);
+    CircularBuffer() = default;
+    ~CircularBuffer();
+
+    CircularBuffer(const CircularBuffer&) = delete;
+    CircularBuffer &operator=(const CircularBuffer&) = delete;
+
+    /**
+     * Allocate `bufferCapacity` bytes of storage (rounded up to a power of
+     * two, and if `mirror`ed, to a page), empty.
+     */
+    void initialise(uint32_t bufferCapacity, bool mirror = false);
+
+    /**
+     * Reallocate the buffer's storage from the calling thread, keeping
+     * its contents (i.e. move it to the calling thread's NUMA node).
+     */
+    void reallocate();
+
+    /**
+     * Empty the buffer, both positions starting again from stream offset
+     * `pos`.
+     *
+     * NOTE: neither reader nor writer may use the buffer meanwhile.
+     */
+    void reset(uint64_t pos = 0);
+
+    /**
+     * Write `N` bytes from `data` after the write pointer (writer).
+     *
+     * Returns false (writing nothing) if they don't fit.
+     */
+    bool writeN(const uint8_t *data, uint32_t N);
+    bool writeN(std::span<const uint8_t> data) { return writeN(data.data(), data.size()); }
+
+    /**
+     * Copy `N` bytes from `data` to stream offset `pos`, at or beyond the
+     * write pointer, without publishing them (writer): commitN() does once
+     * the bytes before them are written too.
+     *
+     * Returns false (writing nothing) if they don't fit.
+     */
+    bool writeAt(const uint8_t *data, uint32_t N, uint64_t pos);
+
+    /**
+     * Read `N` bytes after the read pointer into `out` (reader).
+     *
+     * Returns false (reading nothing) if fewer are available.
+     */
+    bool readN(uint8_t *out, uint32_t N);
+    bool readN(std::span<uint8_t> out) { return readN(out.data(), out.size()); }
+
+    /**
+     * Copy `N` bytes, from `offset` bytes after the read pointer, into
+     * `out`, without consuming them (reader).
+     */
+    bool peekN(uint8_t *out, uint32_t N, uint32_t offset);
+
+    /**
+     * Copy the `N` bytes at stream offset `pos` (from the read pointer on)
+     * into `out`, without consuming them (reader).
+     */
+    bool peekAt(uint8_t *out, uint32_t N, uint64_t pos);
+
+    /**
+     * Consume `N` bytes after the read pointer, handing their space back
+     * to the writer (reader).
+     */
+    void discardN(uint32_t N);
+
+    /**
+     * Returns the `N` bytes at stream offset `pos` (from the read pointer
+     * on) in place, or nullptr if they aren't contiguous (i.e. wrap around
+     * flat storage) or aren't all in the buffer (reader).
+     */
+    const uint8_t *viewAt(uint64_t pos, uint32_t N);
+
+    /**
+     * Returns the bytes after the read pointer, in place: all of them if
+     * mirrored, else those before the end of the storage (reader).
+     *
+     * They stay in the buffer until consumed with discardN().
+     */
+    std::span<const uint8_t> readableSpan();
 
     /**
-     * Write `N` bytes from `inBuffer` to the circular buffer.
-     * 
-     * Optionally write `offset` bytes into the buffer 
-     * (i.e. `offset` bytes ahead of the write pointer).
+     * Returns the room after the write pointer, in place: all of it if
+     * mirrored, else that before the end of the storage (writer).
+     *
+     * Bytes written to it are published with commitN().
      */
-    bool writeN(std::vector<uint8_t> &inBuffer, int N, int offset);
+    std::span<uint8_t> writableSpan();
 
     /**
-     * Read `N` bytes from the circular buffer into `outBuffer`.
-     * 
-     * Optionally read from `offset` bytes into the buffer
-     * (i.e. `offset` bytes ahead of the read pointer).
+     * Publish `N` bytes written in place after the write pointer (writer).
      */
-    bool readN(std::vector<uint8_t> &outBuffer, int N, int offset);
+    void commitN(uint32_t N);
 
     /**
      * Returns num. bytes able to be read after the read pointer.
@@ -42,6 +145,34 @@ public:
      * Returns num. bytes able to be written after the write pointer.
      */
     uint32_t availableToWrite();
+
+    /**
+     * Returns the stream offsets of the read and write pointers.
+     */
+    uint64_t readOffset() { return readPos.load(std::memory_order_relaxed); }
+    uint64_t writeOffset() { return writePos.load(std::memory_order_relaxed); }
+
+private:
+    /**
+     * Allocates `capacity` bytes of storage, mapped twice over if `mirror`
+     * (falling back to flat storage if it can't be), setting `mirrored`.
+     */
+    uint8_t *allocateStorage(bool mirror);
+
+    /**
+     * Frees storage `storage` (mapped twice over if `wasMirrored`).
+     */
+    void freeStorage(uint8_t *storage, bool wasMirrored);
+
+    /**
+     * Copy `N` bytes from `data` into the storage at stream offset `pos`.
+     */
+    void copyIn(uint64_t pos, const uint8_t *data, uint32_t N);
+
+    /**
+     * Copy `N` bytes from the storage at stream offset `pos` into `out`.
+     */
+    void copyOut(uint64_t pos, uint8_t *out, uint32_t N);
 };
 
 namespace CircularBufferTests
@@ -53,7 +184,21 @@ namespace CircularBufferTests
 
     void testSimpleReadWrite();
     void testReadWriteWithOffset();
+    void testOutOfOrderWrites();
+    void testMirroredViews();
     void testCapacityReached();
 
     void runAll();
-};
\ No newline at end of file
+};
+
+/**
+ * Microbenchmarks of the buffer, against the byte-wise ring it replaced.
+ */
+namespace CircularBufferBenchmarks
+{
+    /**
+     * Streams bytes through a buffer of each implementation, writing and
+     * reading them in chunks of a few sizes, and reports the throughput.
+     */
+    void runAll();
+};
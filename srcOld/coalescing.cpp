@@ -0,0 +1,57 @@
+#include <cstdint>
+#include <vector>
+
+#include "coalescing.hpp"
+
+#include "config.hpp"
+#include "ip.hpp"
+#include "tcp.hpp"
+
+////////////////////////////////////////////
+// Coalescer methods
+////////////////////////////////////////////
+Coalescer::Coalescer()
+{
+    segmentsMerged = 0;
+}
+
+void Coalescer::coalesce(std::vector<PacketView> &segments, int numSegments)
+{
+    int head = 0;
+    for (int i = 1; i < numSegments; i++)
+    {
+        if (canMerge(segments[head], segments[i]))
+        {
+            segments[head].merge(segments[i]);
+            segmentsMerged++;
+            continue;
+        }
+        head = i;
+    }
+}
+
+bool Coalescer::canMerge(const PacketView &head, const PacketView &segment)
+{
+    // same flow
+    if (head.saddr() != segment.saddr() ||
+        head.daddr() != segment.daddr() ||
+        head.sourcePort() != segment.sourcePort() ||
+        head.destPort() != segment.destPort())
+        return false;
+
+    // plain data segments only (PSH ends a run)
+    auto isData = [](const PacketView &packet) {
+        return packet.ACK() && !packet.SYN() && !packet.FIN() && !packet.RST() && !packet.URG() &&
+               packet.doff() == sizeof(TcpHeader) / 4 && packet.payloadSize() > 0;
+    };
+    if (!isData(head) || !isData(segment) || head.PSH())
+        return false;
+
+    // in order, with the ACK not going backwards
+    if (segment.seqNum() != head.seqNum() + head.payloadSize())
+        return false;
+    if ((int32_t)(segment.ackNum() - head.ackNum()) < 0)
+        return false;
+
+    return sizeof(IpHeader) + sizeof(TcpHeader) + head.payloadSize() + segment.payloadSize() <= GRO_MAX_SIZE;
+}
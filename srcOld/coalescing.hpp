@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "packet.hpp"
+
+/**
+ * Generic receive offload (GRO).
+ *
+ * Within a received batch, consecutive in-order data segments of the same
+ * flow are merged into one logical segment before the state machine sees
+ * them, so the per-segment cost of TCP processing (handler dispatch, ACK
+ * processing, recv buffer write, ...) is paid once per run of segments
+ * rather than once per segment.
+ *
+ * A segment is merged into the one before it if:
+ *      - both are of the same flow (addresses and ports)
+ *      - it starts where the previous one's payload ends
+ *      - both carry data, with ACK (and nothing but ACK/PSH) set
+ *      - the previous one doesn't have PSH set (PSH ends a run)
+ *      - its ACK doesn't go backwards
+ *      - neither carry TCP options
+ *      - the merged segment still fits an IP packet
+ *
+ * The merged segment takes the sequence number of the first segment, and
+ * the ACK, window and flags of the last. Payloads aren't copied together:
+ * the merged segments stay in the batch, behind the segment they were
+ * merged into, which lists them as its fragments (see PacketView).
+ */
+class Coalescer
+{
+public:
+    Coalescer();
+
+    /**
+     * Merges the first `numSegments` segments of `segments` in place. A
+     * segment others were merged into is followed by them (i.e. its
+     * numFragments() - 1 segments), which the caller skips.
+     */
+    void coalesce(std::vector<PacketView> &segments, int numSegments);
+
+    /* num. segments merged into the segment before them */
+    uint64_t segmentsMerged;
+
+private:
+    /**
+     * Returns true if `segment` can be merged onto the end of `head`.
+     */
+    bool canMerge(const PacketView &head, const PacketView &segment);
+};
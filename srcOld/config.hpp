@@ -1,3 +1,102 @@
 #define MTU (1 << 15)
 #define SEND_BUFFER_CAPACITY (1 << 12)
-#define RECV_BUFFER_CAPACITY (1 << 12)
\ No newline at end of file
+#define RECV_BUFFER_CAPACITY (1 << 12)
+
+/* map stream buffers' pages twice, back to back, so any region of them is contiguous (2 mappings per buffer, see vm.max_map_count) */
+#define STREAM_BUFFERS_MIRRORED 0
+/* AF_PACKET (TPACKET_V3) ring geometry */
+#define PACKET_RING_BLOCK_SIZE (1 << 18)
+#define PACKET_RING_RX_BLOCK_NR 64
+#define PACKET_RING_TX_BLOCK_NR 16
+#define PACKET_RING_MIN_FRAME_SIZE (1 << 11)
+#define PACKET_RING_RETIRE_TOV_MS 1
+
+/* AF_XDP UMEM and ring geometry */
+#define XSK_NUM_FRAMES 4096
+#define XSK_FRAME_SIZE 4096
+#define XSK_RING_SIZE 2048
+#define XSK_MAX_LOCAL_PORTS 1024
+#define XSK_MAX_QUEUES 64
+
+/* max. num. packets per link batch (recvmmsg/sendmmsg, ring walks) */
+#define LINK_BATCH_SIZE 64
+
+/* max. size of a received IP packet (i.e. the link's max. frame, less its headers) one engine hands over to another, sizing the handoff rings' slots */
+#define LINK_MAX_FRAME_SIZE 2048
+
+/* seconds between engine stats reports */
+#define ENGINE_STATS_INTERVAL 5
+
+/* io_uring geometry */
+#define URING_ENTRIES 256
+#define URING_RX_BUFFERS 256
+#define URING_TX_SLOTS 128
+#define URING_SQPOLL_IDLE_MS 1000
+
+/* max. num. local ports matched by the raw socket's classic BPF filter */
+#define SOCKET_FILTER_MAX_PORTS 1024
+
+/* receive buffer size (bytes) of raw sockets shared between engines */
+#define SOCKET_SHARED_RCVBUF (8 * 1024 * 1024)
+
+/* in-memory virtual wire geometry */
+#define VIRTUAL_WIRE_MAX_ENDPOINTS 16
+#define VIRTUAL_WIRE_QUEUE_SIZE 4096
+#define VIRTUAL_WIRE_POLL_NS 20000
+
+/* max. size (IP total length) of a super-segment handed to segmentation */
+#define GSO_MAX_SIZE ((1 << 16) - 1)
+
+/* max. size (IP total length) of a segment merged by receive coalescing */
+#define GRO_MAX_SIZE ((1 << 16) - 1)
+
+/* initial num. slots of the engine's connection (4-tuple) table */
+#define CONNECTION_TABLE_INITIAL_CAPACITY 1024
+
+/* RSS indirection table size (flows are spread over engines as a NIC spreads them over queues) */
+#define RSS_INDIRECTION_TABLE_SIZE 128
+
+/* max. num. engines (i.e. engine threads), and size of each engine-to-engine handoff ring */
+#define ENGINE_MAX_ENGINES 8
+#define ENGINE_HANDOFF_RING_SIZE 1024
+
+/* max. time (ms) an engine of a multi-engine group waits on its link before checking its handoff rings */
+#define ENGINE_POLL_TIMEOUT_MS 1
+
+/* engine timer wheel tick (us), i.e. the resolution of TCP timers */
+#define TIMER_WHEEL_TICK_US 100
+
+/* retransmission timeout (us): initial, doubling with each retransmission up to the max., and num. retransmissions before giving up */
+#define TCP_INITIAL_RTO_US 200000
+#define TCP_MAX_RTO_US 10000000
+#define TCP_MAX_RETRANSMITS 8
+
+/* max. num. ranges of bytes received out of order (i.e. separated by holes) a connection keeps */
+#define TCP_REASSEMBLY_MAX_RANGES 16
+
+/* max. time (us) an ACK of received bytes waits to ride on a segment of ours, and num. unacknowledged MSS-sized segments acknowledged at once */
+#define TCP_DELAYED_ACK_US 5000
+#define TCP_DELAYED_ACK_SEGMENTS 2
+
+/* time (us) a closed connection lingers in TIME_WAIT (2 MSL), and max. time one waits in FIN-WAIT-2 for the peer's FIN */
+#define TCP_TIME_WAIT_US 60000000
+#define TCP_FIN_WAIT_2_US 60000000
+
+/* initial num. slots of the engine's TIME_WAIT table */
+#define TIME_WAIT_TABLE_INITIAL_CAPACITY 1024
+
+/* max. num. free TCBs (with their buffers) an engine's pool keeps for reuse */
+#define TCB_POOL_MAX_FREE 4096
+
+/* max. num. handshakes (i.e. SYNs sent, not yet established) an engine has in flight */
+#define ENGINE_MAX_OPENING 32
+
+/* max. num. established connections waiting on each of a listener's accept queues */
+#define LISTENER_BACKLOG 4096
+
+/* num. slots of each engine's command queue (application threads -> engine) */
+#define ENGINE_COMMAND_QUEUE_SIZE 1024
+
+/* echo benchmark defaults: message size (bytes), and round trips per connection */
+#define ECHO_DEFAULT_MESSAGE_SIZE 64
+#define ECHO_DEFAULT_ROUNDS 100
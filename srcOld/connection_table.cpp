@@ -0,0 +1,269 @@
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <functional>
+#include <arpa/inet.h>
+
+#include "connection_table.hpp"
+
+#include "config.hpp"
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// FlowKey methods
+////////////////////////////////////////////
+
+/**
+ * Mixes the key's 96 bits down to 32 (murmur3's 64-bit finaliser over
+ * both halves).
+ */
+uint32_t FlowKey::hash() const
+{
+    uint64_t h = ((uint64_t)localAddr << 32) | remoteAddr;
+    h ^= ((uint64_t)localPort << 16 | remotePort) * 0x9e3779b97f4a7c15ULL;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
+
+////////////////////////////////////////////
+// ConnectionTable methods
+////////////////////////////////////////////
+ConnectionTable::ConnectionTable(uint32_t initialCapacity)
+{
+    uint32_t capacity = 1;
+    while (capacity < initialCapacity)
+        capacity <<= 1;
+
+    slots.assign(capacity, Slot{});
+    mask = capacity - 1;
+    numEntries = 0;
+}
+
+uint32_t ConnectionTable::probe(const FlowKey &key, uint32_t hash)
+{
+    uint32_t i = hash & mask;
+    while (slots[i].tcb && !(slots[i].hash == hash && slots[i].key == key))
+        i = (i + 1) & mask;
+    return i;
+}
+
+Tcb* ConnectionTable::find(const FlowKey &key)
+{
+    return slots[probe(key, key.hash())].tcb;
+}
+
+bool ConnectionTable::insert(const FlowKey &key, Tcb *tcb)
+{
+    // keep load factor at most 1/2, so probe runs stay short
+    if (2 * (numEntries + 1) > slots.size())
+        grow();
+
+    uint32_t hash = key.hash();
+    uint32_t i = probe(key, hash);
+    if (slots[i].tcb)
+        return false;
+
+    slots[i] = { key, hash, tcb };
+    numEntries++;
+    return true;
+}
+
+bool ConnectionTable::erase(const FlowKey &key)
+{
+    uint32_t i = probe(key, key.hash());
+    if (!slots[i].tcb)
+        return false;
+
+    /**
+     * Backward shift deletion: move later entries of the probe run into
+     * the hole, if doing so doesn't put them before their home slot.
+     */
+    uint32_t j = i;
+    while (1)
+    {
+        j = (j + 1) & mask;
+        if (!slots[j].tcb)
+            break;
+
+        uint32_t home = slots[j].hash & mask;
+        bool movable = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+        if (movable)
+        {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+
+    slots[i] = Slot{};
+    numEntries--;
+    return true;
+}
+
+void ConnectionTable::grow()
+{
+    std::vector<Slot> old = std::move(slots);
+    slots.assign(old.size() * 2, Slot{});
+    mask = slots.size() - 1;
+
+    for (Slot &slot : old)
+    {
+        if (!slot.tcb)
+            continue;
+        uint32_t i = slot.hash & mask;
+        while (slots[i].tcb)
+            i = (i + 1) & mask;
+        slots[i] = slot;
+    }
+}
+
+////////////////////////////////////////////
+// ConnectionTable tests
+////////////////////////////////////////////
+
+namespace ConnectionTableTests
+{
+    /* capacity of the tables tested (never grown, as they stay under half full) */
+    const uint32_t CAPACITY = 64;
+
+    /**
+     * Returns `count` distinct keys whose home slot, in a table of
+     * CAPACITY slots, is `home`.
+     */
+    std::vector<FlowKey> keysWithHome(uint32_t home, uint32_t count)
+    {
+        std::vector<FlowKey> keys;
+        for (uint32_t port = 1; port <= UINT16_MAX && keys.size() < count; port++)
+        {
+            FlowKey key = { inet_addr("10.0.0.1"), inet_addr("10.0.0.2"), 8080, (uint16_t)port };
+            if ((key.hash() & (CAPACITY - 1)) == home)
+                keys.push_back(key);
+        }
+        return keys;
+    }
+
+    /**
+     * Returns a distinct (never dereferenced) TCB pointer for each index.
+     */
+    Tcb* tcbFor(uint32_t i)
+    {
+        static uint64_t tcbs[16];
+        return reinterpret_cast<Tcb*>(&tcbs[i]);
+    }
+
+    /**
+     * Returns a table holding `keys`, keys[i] mapping to tcbFor(i).
+     */
+    ConnectionTable tableOf(const std::vector<FlowKey> &keys)
+    {
+        ConnectionTable table(CAPACITY);
+        for (uint32_t i = 0; i < keys.size(); i++)
+            ASSERT_THAT(table.insert(keys[i], tcbFor(i)));
+        return table;
+    }
+
+    /**
+     * For each key of `keys`, erases it from a table holding them all, and
+     * checks the rest are still found.
+     */
+    void eraseEach(const std::vector<FlowKey> &keys)
+    {
+        for (uint32_t erased = 0; erased < keys.size(); erased++)
+        {
+            ConnectionTable table = tableOf(keys);
+            ASSERT_THAT(table.erase(keys[erased]));
+            ASSERT_THAT(!table.erase(keys[erased]));
+            ASSERT_THAT(table.size() == keys.size() - 1);
+
+            for (uint32_t i = 0; i < keys.size(); i++)
+                ASSERT_THAT(table.find(keys[i]) == (i == erased ? nullptr : tcbFor(i)));
+
+            /**
+             * Re-inserting fills the run back in
+             */
+            ASSERT_THAT(table.insert(keys[erased], tcbFor(erased)));
+            for (uint32_t i = 0; i < keys.size(); i++)
+                ASSERT_THAT(table.find(keys[i]) == tcbFor(i));
+        }
+    }
+
+    void testCollidingKeys()
+    {
+        std::vector<FlowKey> keys = keysWithHome(5, 5);
+        ASSERT_THAT(keys.size() == 5);
+
+        ConnectionTable table = tableOf({ keys[0], keys[1], keys[2], keys[3] });
+        ASSERT_THAT(table.size() == 4);
+        for (uint32_t i = 0; i < 4; i++)
+            ASSERT_THAT(table.find(keys[i]) == tcbFor(i));
+
+        /**
+         * Duplicates are refused, and a colliding key never inserted isn't
+         * found
+         */
+        ASSERT_THAT(!table.insert(keys[2], tcbFor(9)));
+        ASSERT_THAT(table.find(keys[2]) == tcbFor(2));
+        ASSERT_THAT(table.find(keys[4]) == nullptr);
+        ASSERT_THAT(!table.erase(keys[4]));
+        ASSERT_THAT(table.size() == 4);
+    }
+
+    void testEraseFromProbeRun()
+    {
+        /**
+         * One run of colliding keys, then one with keys homed in the middle
+         * of it (which can't shift back past their home)
+         */
+        eraseEach(keysWithHome(20, 6));
+
+        std::vector<FlowKey> keys = keysWithHome(20, 3);
+        for (const FlowKey &key : keysWithHome(21, 2))
+            keys.push_back(key);
+        for (const FlowKey &key : keysWithHome(23, 2))
+            keys.push_back(key);
+        eraseEach(keys);
+
+        // inserted in the other order, so keys homed later sit earlier in the run
+        eraseEach({ keys.rbegin(), keys.rend() });
+    }
+
+    void testEraseAcrossWrap()
+    {
+        /**
+         * A run starting at the table's last slots, and wrapping to its first
+         */
+        std::vector<FlowKey> keys = keysWithHome(CAPACITY - 2, 3);
+        for (const FlowKey &key : keysWithHome(CAPACITY - 1, 2))
+            keys.push_back(key);
+        for (const FlowKey &key : keysWithHome(0, 2))
+            keys.push_back(key);
+        for (const FlowKey &key : keysWithHome(2, 1))
+            keys.push_back(key);
+        eraseEach(keys);
+        eraseEach({ keys.rbegin(), keys.rend() });
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "ConnectionTable Tests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = 
+        {
+            TEST(testCollidingKeys),
+            TEST(testEraseFromProbeRun),
+            TEST(testEraseAcrossWrap)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+    }
+};
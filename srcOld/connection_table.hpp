@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <netinet/ip.h>
+
+#include "config.hpp"
+
+struct Tcb;
+
+/**
+ * Identifies a connection by its binary 4-tuple, from our point of view.
+ *
+ * Addresses are network order, ports host order (i.e. as in a deserialised
+ * Packet). A listener's key has its remote address and port zeroed.
+ */
+struct FlowKey
+{
+    in_addr_t localAddr;
+    in_addr_t remoteAddr;
+    uint16_t localPort;
+    uint16_t remotePort;
+
+    bool operator==(const FlowKey &other) const
+    {
+        return localAddr == other.localAddr && remoteAddr == other.remoteAddr &&
+               localPort == other.localPort && remotePort == other.remotePort;
+    }
+
+    /**
+     * Returns the key matching listeners on this key's local address and port.
+     */
+    FlowKey listenerKey() const
+    {
+        return { localAddr, 0, localPort, 0 };
+    }
+
+    uint32_t hash() const;
+};
+
+/**
+ * Open addressing (linear probing) hash table from flow keys to TCBs.
+ *
+ * Slots are stored inline in one flat array, each caching its key's hash,
+ * so a lookup is (usually) a single cache miss, and never allocates.
+ * Deletion shifts later entries of the probe run back rather than leaving
+ * tombstones, so lookups stay short however many connections come and go.
+ *
+ * The table doesn't own its TCBs.
+ */
+class ConnectionTable
+{
+public:
+    ConnectionTable(uint32_t initialCapacity = CONNECTION_TABLE_INITIAL_CAPACITY);
+
+    /**
+     * Returns the TCB with key `key`, or nullptr if there is none.
+     */
+    Tcb* find(const FlowKey &key);
+
+    /**
+     * Adds TCB `tcb` with key `key`, growing the table if needed.
+     *
+     * Returns false if `key` is already present.
+     */
+    bool insert(const FlowKey &key, Tcb *tcb);
+
+    /**
+     * Removes the TCB with key `key`.
+     *
+     * Returns false if `key` isn't present.
+     */
+    bool erase(const FlowKey &key);
+
+    uint32_t size() { return numEntries; }
+
+private:
+    struct Slot
+    {
+        FlowKey key;
+        uint32_t hash;
+        Tcb *tcb;               // nullptr if slot is empty
+    };
+
+    std::vector<Slot> slots;
+    uint32_t mask;              // capacity - 1 (capacity is a power of 2)
+    uint32_t numEntries;
+
+    /**
+     * Returns the index of the slot holding `key`, or of the empty slot
+     * ending its probe run if `key` isn't present.
+     */
+    uint32_t probe(const FlowKey &key, uint32_t hash);
+
+    /**
+     * Doubles the table's capacity, rehashing every entry.
+     */
+    void grow();
+};
+
+namespace ConnectionTableTests
+{
+    void testCollidingKeys();
+    void testEraseFromProbeRun();
+    void testEraseAcrossWrap();
+
+    void runAll();
+};
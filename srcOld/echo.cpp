@@ -0,0 +1,122 @@
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "echo.hpp"
+#include "tcp_connection.hpp"
+
+namespace Echo
+{
+    /**
+     * Echoes back the bytes `connection` receives until it has echoed
+     * `numBytes`, or the connection closes.
+     *
+     * Bytes are sent straight from the receive buffer, in place.
+     */
+    static Task session(TcpConnection connection, uint64_t numBytes, Stats &stats)
+    {
+        uint64_t echoed = 0;
+        while (echoed < numBytes)
+        {
+            std::span<const uint8_t> received = co_await connection.co_recvView();
+            if (received.empty())
+                break;
+
+            uint32_t sent = co_await connection.co_send(received.data(), received.size());
+            connection.consume(received.size());
+            if (sent < received.size())
+                break;
+            echoed += sent;
+        }
+
+        connection.close();
+        stats.sessionsDone.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Accepts connections of `listener` on the engine it runs on, serving
+     * each with session(), until the server's acceptors accepted
+     * `numConnections` between them.
+     */
+    static Task acceptor(Executor &executor, std::shared_ptr<Listener> listener,
+                         uint32_t numConnections, uint64_t bytesPerConnection, Stats &stats)
+    {
+        TcpListener tcpListener(executor, listener);
+        while (true)
+        {
+            TcpConnection connection = co_await tcpListener.co_accept();
+            if (!connection.isOpen())
+                break;
+            Tcb *tcb = connection.tcb.get();
+
+            // serve each connection on the engine owning it
+            executor.spawn(session(std::move(connection), bytesPerConnection, stats), tcb);
+
+            // the last one: the other engines' acceptors are done too
+            if (stats.accepted.fetch_add(1, std::memory_order_relaxed) + 1 == numConnections)
+            {
+                listener->stopWaiting();
+                break;
+            }
+        }
+    }
+
+    void server(Executor &executor, std::shared_ptr<Listener> listener,
+                uint32_t numConnections, uint64_t bytesPerConnection, Stats &stats)
+    {
+        for (uint32_t i = 0; i < executor.numEngines(); i++)
+            executor.spawnOn(acceptor(executor, listener, numConnections, bytesPerConnection, stats), i);
+    }
+
+    Task client(Executor &executor, in_addr_t sourceAddr, uint16_t sourcePort,
+                in_addr_t destAddr, uint16_t destPort,
+                uint32_t messageSize, uint32_t rounds, Stats &stats)
+    {
+        TcpConnection connection = co_await TcpConnection::co_connect(
+            executor, sourceAddr, sourcePort, destAddr, destPort);
+        if (!connection.isOpen())
+        {
+            stats.clientsFailed.fetch_add(1, std::memory_order_relaxed);
+            stats.clientsDone.fetch_add(1, std::memory_order_relaxed);
+            co_return;
+        }
+
+        std::vector<uint8_t> message(messageSize), echo(messageSize);
+        for (uint32_t i = 0; i < messageSize; i++)
+            message[i] = (uint8_t)(sourcePort + i);
+
+        bool failed = false;
+        for (uint32_t round = 0; round < rounds && !failed; round++)
+        {
+            if (co_await connection.co_send(message.data(), messageSize) < messageSize)
+            {
+                failed = true;
+                break;
+            }
+
+            uint32_t received = 0;
+            while (received < messageSize)
+            {
+                uint32_t n = co_await connection.co_recv(echo.data() + received, messageSize - received);
+                if (n == 0)
+                    break;
+                received += n;
+            }
+
+            if (received < messageSize || echo != message)
+                failed = true;
+            else
+                stats.roundTrips.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        connection.close();
+        if (failed)
+        {
+            std::cout << "Echo client " << sourcePort << ": bad echo" << std::endl;
+            stats.clientsFailed.fetch_add(1, std::memory_order_relaxed);
+        }
+        stats.clientsDone.fetch_add(1, std::memory_order_relaxed);
+    }
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <netinet/ip.h>
+
+#include "executor.hpp"
+#include "listener.hpp"
+
+/**
+ * Echo server and client, built on the coroutine connection API (see
+ * TcpConnection), for benchmarking it: each client connection sends a
+ * message, waits for it to be echoed back (a round trip), and repeats.
+ */
+namespace Echo
+{
+    /**
+     * Progress of the server's and clients' connections (updated by
+     * engine threads).
+     */
+    struct Stats
+    {
+        std::atomic<uint64_t> roundTrips{0};
+        std::atomic<uint32_t> accepted{0};
+        std::atomic<uint32_t> clientsDone{0};
+        std::atomic<uint32_t> clientsFailed{0};
+        std::atomic<uint32_t> sessionsDone{0};
+    };
+
+    /**
+     * Accepts `numConnections` connections of `listener`, each echoing
+     * back the bytes it receives until it has echoed `bytesPerConnection`
+     * (then closing it).
+     *
+     * Starts an acceptor on each engine of `executor`, accepting from its
+     * engine's own accept queue first (see Listener).
+     */
+    void server(Executor &executor, std::shared_ptr<Listener> listener,
+                uint32_t numConnections, uint64_t bytesPerConnection, Stats &stats);
+
+    /**
+     * Connects from `sourceAddr`:`sourcePort` to the server at
+     * `destAddr`:`destPort` (addresses in network order), then makes
+     * `rounds` round trips of a `messageSize` byte message (then closes
+     * the connection).
+     */
+    Task client(Executor &executor, in_addr_t sourceAddr, uint16_t sourcePort,
+                in_addr_t destAddr, uint16_t destPort,
+                uint32_t messageSize, uint32_t rounds, Stats &stats);
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <utility>
+
+#include "tcp.hpp"
+
+/**
+ * Fire-and-forget coroutine, started once handed to an executor (see
+ * Executor::spawn()), and freed when it returns.
+ */
+class Task
+{
+public:
+    struct promise_type
+    {
+        Task get_return_object()
+        {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+    Task(Task &&other) : handle(std::exchange(other.handle, nullptr)) {}
+    Task(const Task&) = delete;
+
+    /* a task never spawned never runs */
+    ~Task()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    /**
+     * Gives up ownership of the coroutine (to whoever resumes it).
+     */
+    std::coroutine_handle<> release()
+    {
+        return std::exchange(handle, nullptr);
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+/**
+ * Operation a coroutine awaits on a connection, carried out by the
+ * connection's engine thread, which also resumes the coroutine once the
+ * operation completes.
+ */
+struct AsyncOp
+{
+    enum Kind
+    {
+        READ,       // completes as the connection becomes readable
+        WRITE       // completes as the connection becomes writable (or established)
+    };
+
+    AsyncOp(Kind kind) : kind(kind) {}
+
+    Kind kind;
+    std::coroutine_handle<> handle;
+
+    /**
+     * Makes as much progress on the operation as connection `tcb` allows
+     * (on its engine thread).
+     *
+     * Returns true once the operation is complete.
+     */
+    virtual bool tryComplete(Tcb &tcb) = 0;
+};
+
+/**
+ * Runs coroutines on engine threads: a coroutine awaiting an operation on
+ * a connection is resumed by the engine owning that connection, so it only
+ * ever touches the connection from that engine's thread.
+ */
+class Executor
+{
+public:
+    virtual ~Executor() = default;
+
+    /**
+     * Starts operation `op` (of a suspending coroutine) on `tcb`'s engine,
+     * which resumes the coroutine once it completes.
+     *
+     * Returns false if `op` completed at once, i.e. the coroutine is not
+     * to suspend (nor be resumed).
+     */
+    virtual bool await(const std::shared_ptr<Tcb> &tcb, AsyncOp *op) = 0;
+
+    /**
+     * Resumes coroutine `handle` on `tcb`'s engine (or the first engine,
+     * for no `tcb`).
+     */
+    virtual void post(Tcb *tcb, std::coroutine_handle<> handle) = 0;
+
+    /**
+     * Resumes coroutine `handle` on engine `engine`.
+     */
+    virtual void postTo(uint32_t engine, std::coroutine_handle<> handle) = 0;
+
+    /**
+     * Has `command.tcb`'s engine carry out `command`: right away if the
+     * caller runs that engine, else once it has room in its command queue.
+     */
+    virtual void execute(Command command) = 0;
+
+    /**
+     * Returns the index of the engine the calling thread runs, or 0 if it
+     * runs none.
+     */
+    virtual uint32_t currentEngine() = 0;
+
+    /**
+     * Returns the num. engines.
+     */
+    virtual uint32_t numEngines() = 0;
+
+    /**
+     * Starts `task` on `tcb`'s engine (or the first engine, for no `tcb`).
+     */
+    void spawn(Task task, Tcb *tcb = nullptr)
+    {
+        post(tcb, task.release());
+    }
+
+    /**
+     * Starts `task` on engine `engine`.
+     */
+    void spawnOn(Task task, uint32_t engine)
+    {
+        postTo(engine, task.release());
+    }
+};
@@ -0,0 +1,325 @@
+#include <string.h>
+#include <cstddef>
+#include <vector>
+#include <iostream>
+#include <functional>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "header_template.hpp"
+
+#include "ip.hpp"
+#include "tcp.hpp"
+#include "packet.hpp"
+#include "test_utils.hpp"
+
+static_assert(HeaderTemplate::SIZE == sizeof(IpHeader) + sizeof(TcpHeader));
+
+/* offsets of the TCP data offset and flags bytes */
+#define TCP_DOFF_OFFSET 12
+#define TCP_FLAGS_OFFSET 13
+
+namespace
+{
+    /**
+     * Returns the unfolded one's complement sum of the 16-bit words of
+     * `data` (of even size `size`).
+     */
+    uint32_t sumWords(const uint8_t *data, size_t size)
+    {
+        uint32_t sum = 0;
+        for (size_t i = 0; i + 1 < size; i += 2)
+        {
+            uint16_t word;
+            memcpy(&word, data + i, sizeof(word));
+            sum += word;
+        }
+        return sum;
+    }
+
+    /**
+     * Folds one's complement sum `sum` to 16 bits.
+     */
+    uint16_t fold(uint32_t sum)
+    {
+        while (sum >> 16)
+            sum = (sum & 0xffff) + (sum >> 16);
+        return (uint16_t)sum;
+    }
+}
+
+////////////////////////////////////////////
+// HeaderTemplate methods
+////////////////////////////////////////////
+void HeaderTemplate::initialise(in_addr_t saddr, in_addr_t daddr, uint16_t sourcePort, uint16_t destPort)
+{
+    IpHeader ipHeader = {};
+    ipHeader.version = 4;
+    ipHeader.ihl = sizeof(ipHeader) / 4;
+    ipHeader.ttl = 64;
+    ipHeader.protocol = IPPROTO_TCP;
+    ipHeader.saddr = saddr;
+    ipHeader.daddr = daddr;
+
+    TcpHeader tcpHeader = {};
+    tcpHeader.sourcePort = htons(sourcePort);
+    tcpHeader.destPort = htons(destPort);
+    tcpHeader.doff = sizeof(tcpHeader) / 4;
+
+    memcpy(headers, &ipHeader, sizeof(ipHeader));
+    memcpy(headers + sizeof(ipHeader), &tcpHeader, sizeof(tcpHeader));
+
+    // total length and checksums zeroed, as are the TCP header's patched fields (but for doff)
+    ipSum = sumWords(headers, sizeof(ipHeader));
+    pseudoSum = (saddr & 0xffff) + (saddr >> 16) + (daddr & 0xffff) + (daddr >> 16) + htons(IPPROTO_TCP);
+    tcpSum = pseudoSum + sumWords(headers + sizeof(ipHeader), TCP_DOFF_OFFSET);
+}
+
+/**
+ * Writes the headers of a super-segment carrying `payloadSize` bytes into
+ * `out`, the TCP checksum holding only the pseudo-header sum.
+ */
+void HeaderTemplate::writeHeaders(uint8_t *out, uint32_t seqNum, uint32_t ackNum, uint16_t window,
+                                  uint8_t flags, uint32_t payloadSize) const
+{
+    memcpy(out, headers, SIZE);
+
+    uint16_t totLen = htons(SIZE + payloadSize);
+    uint16_t ipChecksum = ~fold(ipSum + totLen);
+    memcpy(out + offsetof(IpHeader, totLen), &totLen, sizeof(totLen));
+    memcpy(out + offsetof(IpHeader, checksum), &ipChecksum, sizeof(ipChecksum));
+
+    uint8_t *tcp = out + sizeof(IpHeader);
+    patch(tcp, seqNum, ackNum, window, flags);
+
+    uint16_t tcpChecksum = fold(pseudoSum + htons(sizeof(TcpHeader) + payloadSize));
+    memcpy(tcp + offsetof(TcpHeader, checksum), &tcpChecksum, sizeof(tcpChecksum));
+}
+
+/**
+ * Writes a segment carrying no payload into `slot`, with its IP header
+ * only if `includeIpHeader`.
+ *
+ * Returns the segment's size.
+ */
+uint32_t HeaderTemplate::writeSegment(uint8_t *slot, bool includeIpHeader, uint32_t seqNum,
+                                      uint32_t ackNum, uint16_t window, uint8_t flags) const
+{
+    uint8_t *tcp = slot;
+    if (includeIpHeader)
+    {
+        memcpy(slot, headers, SIZE);
+
+        uint16_t totLen = htons(SIZE);
+        uint16_t ipChecksum = ~fold(ipSum + totLen);
+        memcpy(slot + offsetof(IpHeader, totLen), &totLen, sizeof(totLen));
+        memcpy(slot + offsetof(IpHeader, checksum), &ipChecksum, sizeof(ipChecksum));
+
+        tcp = slot + sizeof(IpHeader);
+    }
+    else
+        memcpy(tcp, headers + sizeof(IpHeader), sizeof(TcpHeader));
+
+    uint32_t sum = tcpSum + patch(tcp, seqNum, ackNum, window, flags) + htons(sizeof(TcpHeader));
+    uint16_t tcpChecksum = ~fold(sum);
+    memcpy(tcp + offsetof(TcpHeader, checksum), &tcpChecksum, sizeof(tcpChecksum));
+
+    return includeIpHeader ? SIZE : sizeof(TcpHeader);
+}
+
+uint32_t HeaderTemplate::patch(uint8_t *tcp, uint32_t seqNum, uint32_t ackNum, uint16_t window,
+                               uint8_t flags)
+{
+    uint32_t seq = htonl(seqNum);
+    uint32_t ack = htonl(ackNum);
+    uint16_t win = htons(window);
+    memcpy(tcp + offsetof(TcpHeader, seqNum), &seq, sizeof(seq));
+    memcpy(tcp + offsetof(TcpHeader, ackNum), &ack, sizeof(ack));
+    memcpy(tcp + offsetof(TcpHeader, window), &win, sizeof(win));
+    tcp[TCP_FLAGS_OFFSET] = flags;
+
+    uint16_t flagsWord;
+    memcpy(&flagsWord, tcp + TCP_DOFF_OFFSET, sizeof(flagsWord));
+    return (seq & 0xffff) + (seq >> 16) + (ack & 0xffff) + (ack >> 16) + flagsWord + win;
+}
+
+////////////////////////////////////////////
+// HeaderTemplate tests
+////////////////////////////////////////////
+
+namespace HeaderTemplateTests
+{
+    struct Fields
+    {
+        uint32_t seqNum;
+        uint32_t ackNum;
+        uint16_t window;
+        uint8_t flags;
+    };
+
+    /* per-segment fields written, some chosen so their sums carry */
+    const std::vector<Fields> FIELDS = {
+        { 1000, 0, 0, HeaderTemplate::SYN },
+        { 0xffffffff, 0xfffffffe, 0xffff, HeaderTemplate::SYN | HeaderTemplate::ACK },
+        { 0x80000000, 0x12345678, 512, HeaderTemplate::ACK },
+        { 42, 43, 0xfff0, HeaderTemplate::FIN | HeaderTemplate::PSH | HeaderTemplate::ACK },
+        { 0, 0xffffffff, 1, HeaderTemplate::RST }
+    };
+
+    const uint32_t SADDR = inet_addr("10.0.0.1");
+    const uint32_t DADDR = inet_addr("192.168.255.254");
+    const uint16_t SOURCE_PORT = 8080;
+    const uint16_t DEST_PORT = 65535;
+
+    HeaderTemplate templateOf()
+    {
+        HeaderTemplate headers;
+        headers.initialise(SADDR, DADDR, SOURCE_PORT, DEST_PORT);
+        return headers;
+    }
+
+    /**
+     * Returns true if the IP header at `ip` has its checksum right, as
+     * recomputed from scratch.
+     */
+    bool ipChecksumValid(const uint8_t *ip)
+    {
+        IpHeader ipHeader;
+        memcpy(&ipHeader, ip, sizeof(ipHeader));
+        uint16_t checksum = ipHeader.checksum;
+        ipHeader.checksum = 0;
+        return ipHeader.calculateChecksum() == checksum;
+    }
+
+    /**
+     * Returns true if TCP segment `tcp` of size `size` has its checksum
+     * right, as recomputed from scratch.
+     */
+    bool tcpChecksumValid(const uint8_t *tcp, uint32_t size)
+    {
+        std::vector<uint8_t> segment(tcp, tcp + size);
+        uint16_t checksum;
+        memcpy(&checksum, segment.data() + offsetof(TcpHeader, checksum), sizeof(checksum));
+        memset(segment.data() + offsetof(TcpHeader, checksum), 0, sizeof(checksum));
+        return Packet::calculateTcpChecksum(segment.data(), size, SADDR, DADDR) == checksum;
+    }
+
+    /**
+     * Returns true if the TCP header at `tcp` holds `fields`, and the
+     * template's ports.
+     */
+    bool holdsFields(const uint8_t *tcp, const Fields &fields)
+    {
+        TcpHeader tcpHeader;
+        memcpy(&tcpHeader, tcp, sizeof(tcpHeader));
+        tcpHeader.networkToHostOrder();
+        return tcpHeader.sourcePort == SOURCE_PORT && tcpHeader.destPort == DEST_PORT &&
+               tcpHeader.seqNum == fields.seqNum && tcpHeader.ackNum == fields.ackNum &&
+               tcpHeader.window == fields.window && tcpHeader.doff == 5 &&
+               tcp[TCP_FLAGS_OFFSET] == fields.flags && tcpHeader.urgPtr == 0;
+    }
+
+    void testWriteSegment()
+    {
+        HeaderTemplate headers = templateOf();
+        for (const Fields &fields : FIELDS)
+        {
+            uint8_t slot[HeaderTemplate::SIZE + 8];
+            memset(slot, 0xee, sizeof(slot));
+            uint32_t size = headers.writeSegment(slot, true, fields.seqNum, fields.ackNum,
+                                                 fields.window, fields.flags);
+            ASSERT_THAT(size == HeaderTemplate::SIZE);
+            ASSERT_THAT(slot[size] == 0xee);
+
+            /**
+             * A well-formed packet, with both checksums right
+             */
+            PacketView view;
+            ASSERT_THAT(view.parse(slot, size));
+            ASSERT_THAT(view.size() == size && view.payloadSize() == 0);
+            ASSERT_THAT(view.saddr() == SADDR && view.daddr() == DADDR);
+            ASSERT_THAT(holdsFields(slot + sizeof(IpHeader), fields));
+
+            ASSERT_THAT(ipChecksumValid(slot));
+            ASSERT_THAT(tcpChecksumValid(slot + sizeof(IpHeader), sizeof(TcpHeader)));
+        }
+    }
+
+    void testWriteSegmentWithoutIpHeader()
+    {
+        HeaderTemplate headers = templateOf();
+        for (const Fields &fields : FIELDS)
+        {
+            uint8_t slot[sizeof(TcpHeader) + 8];
+            memset(slot, 0xee, sizeof(slot));
+            uint32_t size = headers.writeSegment(slot, false, fields.seqNum, fields.ackNum,
+                                                 fields.window, fields.flags);
+            ASSERT_THAT(size == sizeof(TcpHeader));
+            ASSERT_THAT(slot[size] == 0xee);
+
+            ASSERT_THAT(holdsFields(slot, fields));
+            ASSERT_THAT(tcpChecksumValid(slot, size));
+
+            /**
+             * The same TCP header as written with the IP header
+             */
+            uint8_t withIp[HeaderTemplate::SIZE];
+            headers.writeSegment(withIp, true, fields.seqNum, fields.ackNum, fields.window, fields.flags);
+            ASSERT_THAT(memcmp(slot, withIp + sizeof(IpHeader), size) == 0);
+        }
+    }
+
+    void testWriteHeaders()
+    {
+        HeaderTemplate headers = templateOf();
+        for (uint32_t payloadSize : { 0u, 1u, 1460u, 65535u - HeaderTemplate::SIZE })
+        {
+            for (const Fields &fields : FIELDS)
+            {
+                std::vector<uint8_t> packet(HeaderTemplate::SIZE + payloadSize);
+                for (uint32_t i = 0; i < payloadSize; i++)
+                    packet[HeaderTemplate::SIZE + i] = i * 7 + 3;
+                headers.writeHeaders(packet.data(), fields.seqNum, fields.ackNum, fields.window,
+                                     fields.flags, payloadSize);
+
+                PacketView view;
+                ASSERT_THAT(view.parse(packet.data(), packet.size()));
+                ASSERT_THAT(view.payloadSize() == payloadSize);
+                ASSERT_THAT(ipChecksumValid(packet.data()));
+                ASSERT_THAT(holdsFields(packet.data() + sizeof(IpHeader), fields));
+
+                /**
+                 * The TCP checksum holds the folded pseudo-header sum, so
+                 * finishing it as offload does (summing the segment, that
+                 * field included) gives the checksum computed from scratch
+                 */
+                std::vector<uint8_t> segment(packet.begin() + sizeof(IpHeader), packet.end());
+                segment.push_back(0);   // pad to even size
+                uint16_t finished = ~fold(sumWords(segment.data(), segment.size()));
+
+                memset(segment.data() + offsetof(TcpHeader, checksum), 0, sizeof(uint16_t));
+                uint16_t checksum = Packet::calculateTcpChecksum(segment.data(), segment.size() - 1, SADDR, DADDR);
+                ASSERT_THAT(finished == checksum);
+            }
+        }
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "HeaderTemplate Tests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = 
+        {
+            TEST(testWriteSegment),
+            TEST(testWriteSegmentWithoutIpHeader),
+            TEST(testWriteHeaders)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+    }
+};
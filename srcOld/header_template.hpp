@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <netinet/in.h>
+
+/**
+ * Pre-built IP and TCP headers (network order, no options) of the segments
+ * of a connection.
+ *
+ * Built once, as the connection's addresses and ports are known, so a
+ * segment's headers are a copy of the template, patched with only what
+ * differs per segment: sequence and ack. numbers, window, flags, and the
+ * lengths and checksums that follow. Checksums start from the sums of the
+ * template's constant fields (pseudo-header included), taken as it's
+ * built, so per segment only the patched fields are summed.
+ */
+class HeaderTemplate
+{
+public:
+    /* size of the headers (IP and TCP) */
+    static constexpr uint32_t SIZE = 40;
+
+    /* TCP flags (bits of the TCP header's flags byte) */
+    enum Flags : uint8_t
+    {
+        FIN = 0x01,
+        SYN = 0x02,
+        RST = 0x04,
+        PSH = 0x08,
+        ACK = 0x10
+    };
+
+    /**
+     * Builds the template of segments from `saddr` to `daddr` (network
+     * order), and port `sourcePort` to `destPort` (host order).
+     */
+    void initialise(in_addr_t saddr, in_addr_t daddr, uint16_t sourcePort, uint16_t destPort);
+
+    /**
+     * Writes the headers (SIZE bytes) of a super-segment carrying
+     * `payloadSize` bytes into `out`, with sequence number `seqNum`, ack.
+     * number `ackNum`, window `window` and flags `flags` (see Flags).
+     *
+     * As for Packet::serialise() with a partial checksum, the TCP checksum
+     * field only holds the folded pseudo-header sum (i.e. the segmenter, or
+     * offload, finishes it).
+     */
+    void writeHeaders(uint8_t *out, uint32_t seqNum, uint32_t ackNum, uint16_t window,
+                      uint8_t flags, uint32_t payloadSize) const;
+
+    /**
+     * Writes a segment carrying no payload (i.e. a SYN, ACK, FIN or RST)
+     * into `slot`, with its IP header only if `includeIpHeader`, and both
+     * checksums complete.
+     *
+     * Returns the segment's size.
+     */
+    uint32_t writeSegment(uint8_t *slot, bool includeIpHeader, uint32_t seqNum, uint32_t ackNum,
+                          uint16_t window, uint8_t flags) const;
+
+private:
+    uint8_t headers[SIZE];
+
+    /* unfolded sums of the IP header's constant words, the pseudo-header's (less the TCP length), and of both with the TCP header's constant words */
+    uint32_t ipSum;
+    uint32_t pseudoSum;
+    uint32_t tcpSum;
+
+    /**
+     * Patches the TCP header at `tcp` with `seqNum`, `ackNum`, `window`
+     * and `flags`, returning the sum of the patched words.
+     */
+    static uint32_t patch(uint8_t *tcp, uint32_t seqNum, uint32_t ackNum, uint16_t window,
+                          uint8_t flags);
+};
+
+namespace HeaderTemplateTests
+{
+    void testWriteSegment();
+    void testWriteSegmentWithoutIpHeader();
+    void testWriteHeaders();
+
+    void runAll();
+};
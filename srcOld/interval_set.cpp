@@ -0,0 +1,220 @@
+#include <cstdint>
+#include <string.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include "interval_set.hpp"
+
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// IntervalSet methods
+////////////////////////////////////////////
+
+/**
+ * Adds range [start, end), merging it with the ranges it overlaps or
+ * touches.
+ *
+ * Returns false (adding nothing) if it would take more ranges than
+ * TCP_REASSEMBLY_MAX_RANGES.
+ */
+bool IntervalSet::insert(uint64_t start, uint64_t end)
+{
+    // ranges [first, last) overlap or touch the new one
+    uint32_t first = 0;
+    while (first < numRanges && ranges[first].end < start)
+        first++;
+
+    uint32_t last = first;
+    while (last < numRanges && ranges[last].start <= end)
+        last++;
+
+    if (first == last)
+    {
+        if (numRanges == TCP_REASSEMBLY_MAX_RANGES)
+            return false;
+
+        memmove(&ranges[first + 1], &ranges[first], (numRanges - first) * sizeof(Range));
+        ranges[first] = { start, end };
+        numRanges++;
+        return true;
+    }
+
+    // merge them all into the first
+    ranges[first].start = std::min(ranges[first].start, start);
+    ranges[first].end = std::max(ranges[last - 1].end, end);
+    memmove(&ranges[first + 1], &ranges[last], (numRanges - last) * sizeof(Range));
+    numRanges -= last - first - 1;
+    return true;
+}
+
+/**
+ * Removes the ranges continuing the bytes up to `offset` (i.e. starting at
+ * or before it), returning the end of the run (`offset` if none do).
+ */
+uint64_t IntervalSet::takeContiguous(uint64_t offset)
+{
+    uint32_t n = 0;
+    while (n < numRanges && ranges[n].start <= offset)
+    {
+        offset = std::max(offset, ranges[n].end);
+        n++;
+    }
+
+    memmove(&ranges[0], &ranges[n], (numRanges - n) * sizeof(Range));
+    numRanges -= n;
+    return offset;
+}
+
+////////////////////////////////////////////
+// IntervalSet tests
+////////////////////////////////////////////
+
+namespace IntervalSetTests
+{
+    void testDisjointInserts()
+    {
+        IntervalSet set;
+        ASSERT_THAT(set.empty());
+
+        /**
+         * Ranges apart stay apart, in whatever order they come
+         */
+        ASSERT_THAT(set.insert(30, 40));
+        ASSERT_THAT(set.insert(10, 20));
+        ASSERT_THAT(set.insert(50, 60));
+        ASSERT_THAT(set.size() == 3);
+
+        // none continue the bytes up to 0
+        ASSERT_THAT(set.takeContiguous(0) == 0);
+        ASSERT_THAT(set.size() == 3);
+
+        /**
+         * Taken in order, one at a time
+         */
+        ASSERT_THAT(set.takeContiguous(10) == 20);
+        ASSERT_THAT(set.size() == 2);
+        ASSERT_THAT(set.takeContiguous(30) == 40);
+        ASSERT_THAT(set.takeContiguous(50) == 60);
+        ASSERT_THAT(set.empty());
+    }
+
+    void testMergeOverlappingAndAdjacent()
+    {
+        IntervalSet set;
+
+        /**
+         * Overlapping, and touching (either end), ranges merge
+         */
+        ASSERT_THAT(set.insert(10, 20));
+        ASSERT_THAT(set.insert(15, 25));
+        ASSERT_THAT(set.size() == 1);
+        ASSERT_THAT(set.insert(25, 30));
+        ASSERT_THAT(set.insert(5, 10));
+        ASSERT_THAT(set.size() == 1);
+
+        // a range within one changes nothing
+        ASSERT_THAT(set.insert(12, 18));
+        ASSERT_THAT(set.size() == 1);
+
+        /**
+         * A range spanning several merges them all (and bridges the holes)
+         */
+        ASSERT_THAT(set.insert(40, 50));
+        ASSERT_THAT(set.insert(60, 70));
+        ASSERT_THAT(set.insert(80, 90));
+        ASSERT_THAT(set.size() == 4);
+        ASSERT_THAT(set.insert(45, 80));
+        ASSERT_THAT(set.size() == 2);
+
+        /**
+         * A range filling the hole between the last two merges them
+         */
+        ASSERT_THAT(set.insert(30, 40));
+        ASSERT_THAT(set.size() == 1);
+        ASSERT_THAT(set.takeContiguous(5) == 90);
+        ASSERT_THAT(set.empty());
+    }
+
+    void testMaxRanges()
+    {
+        IntervalSet set;
+
+        /**
+         * Fill the set with disjoint ranges
+         */
+        for (uint64_t i = 0; i < TCP_REASSEMBLY_MAX_RANGES; i++)
+            ASSERT_THAT(set.insert(100 * i + 10, 100 * i + 20));
+        ASSERT_THAT(set.size() == TCP_REASSEMBLY_MAX_RANGES);
+
+        /**
+         * Another disjoint range (before, between, or after them) is refused
+         */
+        ASSERT_THAT(!set.insert(0, 5));
+        ASSERT_THAT(!set.insert(50, 60));
+        ASSERT_THAT(!set.insert(100 * TCP_REASSEMBLY_MAX_RANGES + 10, 100 * TCP_REASSEMBLY_MAX_RANGES + 20));
+        ASSERT_THAT(set.size() == TCP_REASSEMBLY_MAX_RANGES);
+        ASSERT_THAT(set.takeContiguous(0) == 0);
+
+        /**
+         * Ranges merging with those held still go in
+         */
+        ASSERT_THAT(set.insert(20, 30));
+        ASSERT_THAT(set.insert(30, 110));
+        ASSERT_THAT(set.size() == TCP_REASSEMBLY_MAX_RANGES - 1);
+
+        // making room for one more
+        ASSERT_THAT(set.insert(0, 5));
+        ASSERT_THAT(set.size() == TCP_REASSEMBLY_MAX_RANGES);
+    }
+
+    void testTakeContiguous()
+    {
+        IntervalSet set;
+        ASSERT_THAT(set.takeContiguous(42) == 42);
+
+        ASSERT_THAT(set.insert(10, 20));
+        ASSERT_THAT(set.insert(30, 40));
+
+        /**
+         * An offset within a range takes it
+         */
+        ASSERT_THAT(set.takeContiguous(15) == 20);
+        ASSERT_THAT(set.size() == 1);
+
+        /**
+         * An offset past a range's end takes it too, keeping the offset
+         */
+        ASSERT_THAT(set.insert(50, 60));
+        ASSERT_THAT(set.takeContiguous(45) == 45);
+        ASSERT_THAT(set.size() == 1);
+
+        /**
+         * The rest is taken once the offset reaches it
+         */
+        ASSERT_THAT(set.takeContiguous(50) == 60);
+        ASSERT_THAT(set.empty());
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "IntervalSet Tests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = 
+        {
+            TEST(testDisjointInserts),
+            TEST(testMergeOverlappingAndAdjacent),
+            TEST(testMaxRanges),
+            TEST(testTakeContiguous)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+    }
+};
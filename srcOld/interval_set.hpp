@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+
+#include "config.hpp"
+
+/**
+ * Set of disjoint, half-open ranges [start, end) of stream offsets: which
+ * bytes a receive buffer holds beyond a hole (i.e. received out of order).
+ *
+ * The ranges are kept sorted (those overlapping or touching merged) in a
+ * fixed array of at most TCP_REASSEMBLY_MAX_RANGES, as a connection has
+ * few holes at once, so it never allocates, and scans are short.
+ */
+class IntervalSet
+{
+public:
+    /**
+     * Adds range [start, end), merging it with the ranges it overlaps or
+     * touches.
+     *
+     * Returns false (adding nothing) if it would take more ranges than
+     * TCP_REASSEMBLY_MAX_RANGES.
+     */
+    bool insert(uint64_t start, uint64_t end);
+
+    /**
+     * Removes the ranges continuing the bytes up to `offset` (i.e. starting
+     * at or before it), returning the end of the run (`offset` if none do).
+     */
+    uint64_t takeContiguous(uint64_t offset);
+
+    void clear() { numRanges = 0; }
+    bool empty() { return numRanges == 0; }
+    uint32_t size() { return numRanges; }
+
+private:
+    struct Range
+    {
+        uint64_t start;
+        uint64_t end;
+    };
+
+    Range ranges[TCP_REASSEMBLY_MAX_RANGES];
+    uint32_t numRanges = 0;
+};
+
+namespace IntervalSetTests
+{
+    void testDisjointInserts();
+    void testMergeOverlappingAndAdjacent();
+    void testMaxRanges();
+    void testTakeContiguous();
+
+    void runAll();
+};
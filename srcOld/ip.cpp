@@ -82,4 +82,12 @@ void IpHeader::networkToHostOrder()
     id = ntohs(id);
     fragOff = ntohs(fragOff);
     checksum = ntohs(checksum);
-}
\ No newline at end of file
+}
+
+void IpHeader::hostToNetworkOrder()
+{
+    totLen = htons(totLen);
+    id = htons(id);
+    fragOff = htons(fragOff);
+    checksum = htons(checksum);
+}
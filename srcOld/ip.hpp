@@ -23,4 +23,5 @@ struct __attribute__((packed)) IpHeader
     uint16_t calculateChecksum();
     std::string toString();
     void networkToHostOrder();
+    void hostToNetworkOrder();
 };
\ No newline at end of file
@@ -0,0 +1,664 @@
+#include <unistd.h>
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <linux/filter.h>
+#include <stdexcept>
+#include <memory>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string.h>
+
+#include "link.hpp"
+#include "config.hpp"
+#include "tun_link.hpp"
+#include "packet_ring_link.hpp"
+#include "xdp_link.hpp"
+#include "uring_link.hpp"
+#include "virtual_link.hpp"
+#include "pcap_link.hpp"
+
+////////////////////////////////////////////
+// LinkConfig methods
+////////////////////////////////////////////
+
+/**
+ * Parse link type from its name (i.e. "raw", "tun", "packet", "xdp", "uring", "virtual", "pcap").
+ */
+LinkType LinkConfig::parseType(const std::string &name)
+{
+    if (name == "raw")
+        return RAW_SOCKET;
+    if (name == "tun")
+        return TUN;
+    if (name == "packet")
+        return PACKET_RING;
+    if (name == "xdp")
+        return XDP;
+    if (name == "uring" || name == "uring-sqpoll")
+        return URING;
+    if (name == "virtual")
+        return VIRTUAL;
+    if (name == "pcap")
+        return PCAP;
+    throw std::runtime_error("Unknown link type: " + name);
+}
+
+////////////////////////////////////////////
+// LinkStats methods
+////////////////////////////////////////////
+std::string LinkStats::toString()
+{
+    auto perSyscall = [](uint64_t packets, uint64_t syscalls)
+    {
+        return syscalls ? (double)packets / syscalls : 0.0;
+    };
+
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(2);
+    oss << "RX: " << rxPackets << " packets, " << rxSyscalls << " syscalls ("
+        << perSyscall(rxPackets, rxSyscalls) << " packets/syscall)" << "\n";
+    oss << "TX: " << txPackets << " packets, " << txSyscalls << " syscalls ("
+        << perSyscall(txPackets, txSyscalls) << " packets/syscall)" << "\n";
+    return oss.str();
+}
+
+////////////////////////////////////////////
+// LinkBackend methods
+////////////////////////////////////////////
+
+/**
+ * Opens the link backend described by `config`.
+ *
+ * Throws a runtime error if the backend can't be opened.
+ *
+ * NOTE: io_uring falls back to the raw socket if the kernel can't support it.
+ * With `capturePath` set, the backend is wrapped to record its traffic.
+ */
+std::unique_ptr<LinkBackend> LinkBackend::open(LinkConfig &config)
+{
+    std::unique_ptr<LinkBackend> link = openBackend(config);
+    link->setPollTimeout(config.pollTimeoutMs);
+    link->queueCpus = config.queueCpus;
+
+    if (!config.capturePath.empty())
+        link = std::make_unique<CaptureLink>(std::move(link), config.capturePath);
+
+    if (config.numQueues > 1 && !link->setQueue(config.queueIndex, config.numQueues))
+        throw std::runtime_error("Link (" + link->name() + ") can't be shared between engines");
+    return link;
+}
+
+/**
+ * Opens the (bare) backend of type `config.type`.
+ */
+std::unique_ptr<LinkBackend> LinkBackend::openBackend(LinkConfig &config)
+{
+    switch (config.type)
+    {
+        case RAW_SOCKET:
+            return std::make_unique<RawSocketLink>(inet_addr(config.sourceAddr.c_str()));
+        case TUN:
+            return std::make_unique<TunLink>(config.interfaceName, config.queueIndex);
+        case PACKET_RING:
+            return std::make_unique<PacketRingLink>(config.interfaceName, config.peerMac);
+        case XDP:
+            return std::make_unique<XdpLink>(config.interfaceName, config.queueIndex,
+                                             config.peerMac, config.localPorts);
+        case URING:
+            try
+            {
+                return std::make_unique<UringLink>(inet_addr(config.sourceAddr.c_str()), config.sqPoll);
+            }
+            catch (const std::runtime_error &e)
+            {
+                std::cout << "io_uring unavailable (" << e.what() << "), "
+                          << "falling back to raw socket" << std::endl;
+                return std::make_unique<RawSocketLink>(inet_addr(config.sourceAddr.c_str()));
+            }
+        case VIRTUAL:
+            return std::make_unique<VirtualLink>(config.wire, inet_addr(config.sourceAddr.c_str()));
+        case PCAP:
+            return std::make_unique<PcapLink>(config.replayPath, config.replayTimed, config.replayLoops);
+        default:
+            throw std::runtime_error("Undefined link type");
+    }
+}
+
+/**
+ * Receive a single IP packet without copying it, pointing `packet` at
+ * the packet in backend-owned memory. The packet stays valid until the
+ * next receive call.
+ *
+ * Returns the packet size, or -1 on failure.
+ */
+ssize_t LinkBackend::peekPacket(const uint8_t **packet)
+{
+    if (peekBuffer.empty())
+        peekBuffer.resize(MTU);
+
+    ssize_t packetSize = recvPacket(peekBuffer);
+    *packet = peekBuffer.data();
+    return packetSize;
+}
+
+/**
+ * Receive up to `maxPackets` IP packets into `packets`, without copying
+ * them. Blocks until at least one packet is available. The packets
+ * stay valid until the next receive call.
+ *
+ * Returns num. packets received, or -1 on failure.
+ */
+int LinkBackend::recvBatch(LinkPacket *packets, int maxPackets)
+{
+    const uint8_t *packet;
+    ssize_t packetSize = peekPacket(&packet);
+    if (packetSize < 0)
+        return -1;
+
+    packets[0].data = packet;
+    packets[0].size = packetSize;
+    return 1;
+}
+
+/**
+ * Queue the serialised packet `packet` of size `size` to `destAddr`,
+ * to be sent on the next flush().
+ *
+ * Returns num. bytes queued, or -1 on failure.
+ */
+ssize_t LinkBackend::queuePacket(const uint8_t *packet, size_t size, in_addr_t destAddr)
+{
+    return sendPacket(packet, size, destAddr);
+}
+
+/**
+ * Returns a TX slot of at least `size` bytes to write the next packet to
+ * queue into, or nullptr on failure.
+ */
+uint8_t *LinkBackend::txSlot(size_t size)
+{
+    if (size > MTU)
+    {
+        fprintf(stderr, "Packet too large to queue\n");
+        return nullptr;
+    }
+
+    if (txScratch.empty())
+        txScratch.resize(MTU);
+    return txScratch.data();
+}
+
+/**
+ * Queue the packet of size `size` written into the slot txSlot() last
+ * returned to `destAddr`.
+ *
+ * Returns num. bytes queued, or -1 on failure.
+ */
+ssize_t LinkBackend::queueSlot(size_t size, in_addr_t destAddr)
+{
+    return queuePacket(txScratch.data(), size, destAddr);
+}
+
+/**
+ * Queue the super-segment of headers `headers` (of size `headerSize`) and
+ * payload `payload` (of size `payloadSize`) to `destAddr`, as packets
+ * carrying at most `mss` payload bytes each.
+ *
+ * Returns num. packets queued, or -1 on failure.
+ */
+int LinkBackend::queueSuperSegment(const uint8_t *headers, size_t headerSize,
+                                   const uint8_t *payload, size_t payloadSize,
+                                   uint16_t mss, in_addr_t destAddr)
+{
+    return segmenter.segment(headers, headerSize, payload, payloadSize, mss, *this, destAddr);
+}
+
+/**
+ * Send all queued packets.
+ *
+ * Returns num. packets sent, or -1 on failure.
+ */
+int LinkBackend::flush()
+{
+    return 0;
+}
+
+/**
+ * Restrict delivery to packets destined to one of the local ports `ports`.
+ *
+ * Returns false on failure.
+ */
+bool LinkBackend::setLocalPorts(const std::vector<uint16_t> &ports)
+{
+    return true;
+}
+
+/**
+ * Restrict delivery to queue `queueIndex` (of `numQueues`) of the link's traffic.
+ *
+ * Returns false if the backend can't be shared.
+ */
+bool LinkBackend::setQueue(uint32_t queueIndex, uint32_t numQueues)
+{
+    return numQueues == 1;
+}
+
+/**
+ * Sets the max. time (ms) a receive waits for packets (-1 = forever,
+ * 0 = return at once, i.e. busy-poll).
+ */
+void LinkBackend::setPollTimeout(int timeoutMs)
+{
+    pollTimeoutMs = timeoutMs;
+}
+
+/**
+ * Waits (for at most the poll timeout) for `fd` to become readable.
+ *
+ * Returns 1 if readable, 0 on timeout, or -1 on failure.
+ */
+int LinkBackend::waitReadable(int fd)
+{
+    struct pollfd pfd = { fd, POLLIN | POLLERR, 0 };
+    int ret = poll(&pfd, 1, pollTimeoutMs);
+    if (ret < 0)
+    {
+        if (errno == EINTR)
+            return 0;
+        perror("poll() failed");
+        return -1;
+    }
+    return ret > 0 ? 1 : 0;
+}
+
+////////////////////////////////////////////
+// RawSocketLink methods
+////////////////////////////////////////////
+RawSocketLink::RawSocketLink(in_addr_t bindAddr)
+{
+    this->bindAddr = bindAddr;
+    this->queueIndex = 0;
+    this->numQueues = 1;
+    this->sock = openRawSocket(bindAddr);
+    if (this->sock < 0)
+        throw std::runtime_error("Failed socket creation");
+
+    /**
+     * Set up the recvmmsg()/sendmmsg() message arrays once, each message
+     * owning a fixed MTU-sized slice of one contiguous buffer.
+     */
+    rxBuffers.resize((size_t)LINK_BATCH_SIZE * MTU);
+    rxIovecs.resize(LINK_BATCH_SIZE);
+    rxMsgs.resize(LINK_BATCH_SIZE);
+
+    txBuffers.resize((size_t)LINK_BATCH_SIZE * MTU);
+    txIovecs.resize(LINK_BATCH_SIZE);
+    txAddrs.resize(LINK_BATCH_SIZE);
+    txMsgs.resize(LINK_BATCH_SIZE);
+    txQueued = 0;
+
+    for (int i = 0; i < LINK_BATCH_SIZE; i++)
+    {
+        rxIovecs[i].iov_base = rxBuffers.data() + (size_t)i * MTU;
+        rxIovecs[i].iov_len = MTU;
+        rxMsgs[i] = {};
+        rxMsgs[i].msg_hdr.msg_iov = &rxIovecs[i];
+        rxMsgs[i].msg_hdr.msg_iovlen = 1;
+
+        txIovecs[i].iov_base = txBuffers.data() + (size_t)i * MTU;
+        txAddrs[i] = {};
+        txAddrs[i].sin_family = AF_INET;
+        txMsgs[i] = {};
+        txMsgs[i].msg_hdr.msg_iov = &txIovecs[i];
+        txMsgs[i].msg_hdr.msg_iovlen = 1;
+        txMsgs[i].msg_hdr.msg_name = &txAddrs[i];
+        txMsgs[i].msg_hdr.msg_namelen = sizeof(txAddrs[i]);
+    }
+}
+
+RawSocketLink::~RawSocketLink()
+{
+    if (sock >= 0)
+        close(sock);
+}
+
+/**
+ * Opens a raw IP socket, bound to `bindAddr`.
+ *
+ * Returns the socket, or -1 on failure.
+ */
+int RawSocketLink::openRawSocket(in_addr_t bindAddr)
+{
+    int sock = socket(AF_INET, SOCK_RAW, IPPROTO_TCP);
+    if (sock < 0)
+    {
+        perror("Failed socket creation");
+        return -1;
+    }
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = bindAddr;
+
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)))
+    {
+        perror("Failed bind");
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+/**
+ * Attaches (or replaces) a classic BPF filter to raw socket `sock`,
+ * accepting only TCP packets destined to `localAddr` and one of the
+ * local ports `ports`.
+ *
+ * The program runs on the IP packet (absolute loads are in host order):
+ *
+ *      ld  [16]                    ; destination address
+ *      jeq #localAddr, 1, 0
+ *      ret #0
+ *      ldh [6]                     ; non-first fragments carry no TCP header
+ *      jset #0x1fff, 0, 1
+ *      ret #0
+ *      ldxb 4*([0] & 0xf)          ; X = IP header length
+ *      ldh [x + 2]                 ; destination port
+ *      jeq #port, 0, 1             ; ... once per local port
+ *      ret #-1
+ *      ret #0
+ *
+ * Each port test jumps at most one instruction, so the 8-bit jump offsets
+ * never limit the num. ports. An unbound (INADDR_ANY) socket skips the
+ * address test, and an empty port set skips the port tests.
+ *
+ * Returns false on failure.
+ */
+bool RawSocketLink::attachFilter(int sock, in_addr_t localAddr, const std::vector<uint16_t> &ports,
+                                 uint32_t queueIndex, uint32_t numQueues)
+{
+    if (ports.size() > SOCKET_FILTER_MAX_PORTS)
+    {
+        fprintf(stderr, "Too many local ports to filter (%zu)\n", ports.size());
+        return false;
+    }
+
+    std::vector<struct sock_filter> prog;
+    prog.reserve(12 + 2 * ports.size() + 1);
+
+    /**
+     * Our share of flows: skb->hash mod numQueues == queueIndex. The kernel's
+     * hash needn't agree with our RSS hash (on loopback it's the sending
+     * socket's), so a packet may land on an engine not owning its flow, and
+     * be handed off: we can't filter on ports then, as they're the owner's.
+     */
+    if (numQueues > 1)
+    {
+        prog.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_RXHASH)));
+        prog.push_back(BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, numQueues));
+        prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, queueIndex, 1, 0));
+        prog.push_back(BPF_STMT(BPF_RET | BPF_K, 0));
+    }
+
+    if (localAddr != INADDR_ANY)
+    {
+        prog.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 16));
+        prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(localAddr), 1, 0));
+        prog.push_back(BPF_STMT(BPF_RET | BPF_K, 0));
+    }
+
+    if (!ports.empty() && numQueues == 1)
+    {
+        prog.push_back(BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6));
+        prog.push_back(BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 0, 1));
+        prog.push_back(BPF_STMT(BPF_RET | BPF_K, 0));
+        prog.push_back(BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0));
+        prog.push_back(BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2));
+        for (uint16_t port : ports)
+        {
+            prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 1));
+            prog.push_back(BPF_STMT(BPF_RET | BPF_K, 0xffffffff));
+        }
+        prog.push_back(BPF_STMT(BPF_RET | BPF_K, 0));
+    }
+    else
+        prog.push_back(BPF_STMT(BPF_RET | BPF_K, 0xffffffff));
+
+    struct sock_fprog fprog = {};
+    fprog.len = prog.size();
+    fprog.filter = prog.data();
+
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0)
+    {
+        perror("SO_ATTACH_FILTER failed");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Sets the receive buffer size of raw socket `sock` to `size` bytes, past
+ * the rmem_max limit where we are allowed to.
+ *
+ * Returns false on failure.
+ */
+bool RawSocketLink::setReceiveBuffer(int sock, int size)
+{
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == 0)
+        return true;
+
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0)
+    {
+        perror("SO_RCVBUF failed");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Regenerates the socket's filter for the local ports `ports`.
+ *
+ * Returns false on failure.
+ */
+bool RawSocketLink::setLocalPorts(const std::vector<uint16_t> &ports)
+{
+    localPorts = ports;
+    return attachFilter(sock, bindAddr, localPorts, queueIndex, numQueues);
+}
+
+/**
+ * Regenerates the socket's filter to only accept flows of queue `queueIndex`
+ * (of `numQueues`), by the kernel's flow hash.
+ *
+ * No longer filtering on ports, the socket queues far more traffic (and the
+ * handshake isn't retransmitted), so its receive buffer is grown too.
+ *
+ * Returns false on failure.
+ */
+bool RawSocketLink::setQueue(uint32_t queueIndex, uint32_t numQueues)
+{
+    this->queueIndex = queueIndex;
+    this->numQueues = numQueues;
+    if (numQueues > 1 && !setReceiveBuffer(sock, SOCKET_SHARED_RCVBUF))
+        return false;
+    return attachFilter(sock, bindAddr, localPorts, queueIndex, numQueues);
+}
+
+/**
+ * Receive a single IP packet into `packetBuffer`.
+ *
+ * Returns the packet size, or -1 on failure.
+ */
+ssize_t RawSocketLink::recvPacket(std::vector<uint8_t> &packetBuffer)
+{
+    ssize_t packetSize = recvfrom(
+        sock,
+        packetBuffer.data(),
+        packetBuffer.size(),
+        0,
+        NULL,
+        NULL
+    );
+    stats.rxSyscalls++;
+
+    if (packetSize < 0 || packetSize > packetBuffer.size())
+    {
+        perror("Packet receive failed");
+        return -1;
+    }
+
+    stats.rxPackets++;
+    return packetSize;
+}
+
+/**
+ * Send the serialised packet `packet` of size `size` to `destAddr`.
+ *
+ * Returns num. bytes sent, or -1 on failure.
+ */
+ssize_t RawSocketLink::sendPacket(const uint8_t *packet, size_t size, in_addr_t destAddr)
+{
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = destAddr;
+
+    ssize_t bytesSent = sendto(
+        sock,
+        packet,
+        size,
+        0,
+        (struct sockaddr*)&addr,
+        sizeof(addr)
+    );
+    stats.txSyscalls++;
+
+    if (bytesSent < 0 || bytesSent != size)
+    {
+        perror("sendto() failed");
+        return -1;
+    }
+
+    stats.txPackets++;
+    return bytesSent;
+}
+
+/**
+ * Receive up to `maxPackets` IP packets into `packets` with a single
+ * recvmmsg(), blocking only until the first one arrives.
+ *
+ * Returns num. packets received, or -1 on failure.
+ */
+int RawSocketLink::recvBatch(LinkPacket *packets, int maxPackets)
+{
+    if (maxPackets > LINK_BATCH_SIZE)
+        maxPackets = LINK_BATCH_SIZE;
+
+    // with a poll timeout, only block in poll()
+    int flags = MSG_WAITFORONE | (pollTimeoutMs >= 0 ? MSG_DONTWAIT : 0);
+
+    int n;
+    while (1)
+    {
+        n = recvmmsg(sock, rxMsgs.data(), maxPackets, flags, NULL);
+        stats.rxSyscalls++;
+        if (n >= 0)
+            break;
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            perror("recvmmsg() failed");
+            return -1;
+        }
+
+        // nothing queued - wait (at most the poll timeout) for something to be
+        stats.rxSyscalls++;
+        int ret = waitReadable(sock);
+        if (ret <= 0)
+            return ret;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        packets[i].data = (const uint8_t*)rxIovecs[i].iov_base;
+        packets[i].size = rxMsgs[i].msg_len;
+    }
+
+    stats.rxPackets += n;
+    return n;
+}
+
+/**
+ * Queue the serialised packet `packet` of size `size` to `destAddr`,
+ * to be sent on the next flush(). Flushes first if the queue is full.
+ *
+ * Returns num. bytes queued, or -1 on failure.
+ */
+ssize_t RawSocketLink::queuePacket(const uint8_t *packet, size_t size, in_addr_t destAddr)
+{
+    uint8_t *slot = txSlot(size);
+    if (!slot)
+        return -1;
+
+    memcpy(slot, packet, size);
+    return queueSlot(size, destAddr);
+}
+
+/**
+ * Returns the buffer of the next sendmmsg() message, flushing the batch
+ * first if it's full.
+ */
+uint8_t *RawSocketLink::txSlot(size_t size)
+{
+    if (size > MTU)
+    {
+        fprintf(stderr, "Packet too large to queue\n");
+        return nullptr;
+    }
+
+    if (txQueued == LINK_BATCH_SIZE && flush() < 0)
+        return nullptr;
+
+    return (uint8_t*)txIovecs[txQueued].iov_base;
+}
+
+ssize_t RawSocketLink::queueSlot(size_t size, in_addr_t destAddr)
+{
+    txIovecs[txQueued].iov_len = size;
+    txAddrs[txQueued].sin_addr.s_addr = destAddr;
+    txQueued++;
+    return size;
+}
+
+/**
+ * Send all queued packets with a single sendmmsg() (more, if the kernel
+ * only takes part of the batch).
+ *
+ * Returns num. packets sent, or -1 on failure.
+ */
+int RawSocketLink::flush()
+{
+    int sent = 0;
+    while (sent < txQueued)
+    {
+        int n = sendmmsg(sock, txMsgs.data() + sent, txQueued - sent, 0);
+        stats.txSyscalls++;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("sendmmsg() failed");
+            txQueued = 0;
+            return -1;
+        }
+        sent += n;
+    }
+
+    stats.txPackets += sent;
+    txQueued = 0;
+    return sent;
+}
@@ -0,0 +1,355 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <sys/types.h>
+#include <netinet/ip.h>
+#include <sys/socket.h>
+
+#include "config.hpp"
+#include "segmentation.hpp"
+
+/**
+ * Represents the set of available link backends
+ */
+enum LinkType
+{
+    RAW_SOCKET,
+    TUN,
+    PACKET_RING,
+    XDP,
+    URING,
+    VIRTUAL,
+    PCAP
+};
+
+class VirtualWire;
+
+/**
+ * Link backend configuration
+ */
+struct LinkConfig
+{
+    LinkType type = RAW_SOCKET;
+
+    /* local address (raw socket binds to it) */
+    std::string sourceAddr;
+
+    /* network interface / device name (e.g. TUN device name) */
+    std::string interfaceName;
+
+    /* queue of a multi-queue device owned by this engine, of `numQueues` (i.e. engines) */
+    uint32_t queueIndex = 0;
+    uint32_t numQueues = 1;
+
+    /* cores the engines of each queue are pinned to (i.e. queue q's to queueCpus[q]), empty if unpinned */
+    std::vector<int> queueCpus;
+
+    /* max. time (ms) a receive waits for packets (-1 = forever) */
+    int pollTimeoutMs = -1;
+
+    /* engine: after activity, spin on the link (i.e. receive without waiting) for this long (us) before waiting again (0 = never spin) */
+    uint32_t busyPollUs = 0;
+
+    /* engine: max. size of a received IP packet handed over to another engine (larger ones are dropped) */
+    uint32_t maxFrameSize = LINK_MAX_FRAME_SIZE;
+
+    /* peer's MAC address, for backends below the IP layer (default broadcast) */
+    std::string peerMac;
+
+    /* local ports whose traffic the backend should deliver (i.e. XDP redirect) */
+    std::vector<uint16_t> localPorts;
+
+    /* io_uring: let a kernel thread poll the submission queue */
+    bool sqPoll = false;
+
+    /* in-process wire a virtual link attaches to (at `sourceAddr`) */
+    std::shared_ptr<VirtualWire> wire;
+
+    /* pcap/pcapng file to replay, at recorded timestamps or full speed, `replayLoops` times */
+    std::string replayPath;
+    bool replayTimed = false;
+    uint32_t replayLoops = 1;
+
+    /* if set, every packet sent/received is also recorded to this pcap file */
+    std::string capturePath;
+
+    /**
+     * Parse link type from its name (i.e. "raw", "tun", "packet", "xdp", "uring", "virtual", "pcap").
+     */
+    static LinkType parseType(const std::string &name);
+};
+
+/**
+ * Received packet, referencing backend-owned memory
+ */
+struct LinkPacket
+{
+    const uint8_t *data;
+    uint32_t size;
+};
+
+/**
+ * Link backend I/O counters
+ */
+struct LinkStats
+{
+    uint64_t rxPackets = 0;
+    uint64_t rxSyscalls = 0;
+    uint64_t txPackets = 0;
+    uint64_t txSyscalls = 0;
+
+    std::string toString();
+};
+
+/**
+ * Link-layer backend through which the segment thread sends and
+ * receives raw IP packets.
+ *
+ * Each engine thread owns its own backend instance.
+ */
+class LinkBackend
+{
+public:
+    virtual ~LinkBackend() = default;
+
+    /**
+     * Opens the link backend described by `config`.
+     *
+     * Throws a runtime error if the backend can't be opened.
+     *
+     * NOTE: io_uring falls back to the raw socket if the kernel can't support it.
+     * With `capturePath` set, the backend is wrapped to record its traffic.
+     */
+    static std::unique_ptr<LinkBackend> open(LinkConfig &config);
+
+    /**
+     * Receive a single IP packet into `packetBuffer`.
+     *
+     * Returns the packet size, or -1 on failure.
+     */
+    virtual ssize_t recvPacket(std::vector<uint8_t> &packetBuffer) = 0;
+
+    /**
+     * Receive a single IP packet without copying it, pointing `packet` at
+     * the packet in backend-owned memory. The packet stays valid until the
+     * next receive call.
+     *
+     * Returns the packet size, or -1 on failure.
+     *
+     * NOTE: by default, receives into an internal buffer (i.e. one copy).
+     */
+    virtual ssize_t peekPacket(const uint8_t **packet);
+
+    /**
+     * Send the serialised packet `packet` of size `size` to `destAddr`.
+     *
+     * Returns num. bytes sent, or -1 on failure.
+     */
+    virtual ssize_t sendPacket(const uint8_t *packet, size_t size, in_addr_t destAddr) = 0;
+
+    /**
+     * Receive up to `maxPackets` IP packets into `packets`, without copying
+     * them. Blocks until at least one packet is available, or for at most
+     * the link's poll timeout, if set. The packets stay valid until the
+     * next receive call.
+     *
+     * Returns num. packets received (0 on timeout), or -1 on failure.
+     *
+     * NOTE: by default, receives a single packet via peekPacket().
+     */
+    virtual int recvBatch(LinkPacket *packets, int maxPackets);
+
+    /**
+     * Queue the serialised packet `packet` of size `size` to `destAddr`,
+     * to be sent on the next flush().
+     *
+     * Returns num. bytes queued, or -1 on failure.
+     *
+     * NOTE: by default, sends the packet immediately.
+     */
+    virtual ssize_t queuePacket(const uint8_t *packet, size_t size, in_addr_t destAddr);
+
+    /**
+     * Returns a TX slot of at least `size` bytes (at most MTU) to write the
+     * next packet to queue into in place, or nullptr on failure. The
+     * packet written must then be queued by queueSlot().
+     *
+     * NOTE: by default, a scratch buffer, which queueSlot() hands to
+     * queuePacket() (i.e. one copy).
+     */
+    virtual uint8_t *txSlot(size_t size);
+
+    /**
+     * Queue the packet of size `size` written into the slot txSlot() last
+     * returned to `destAddr`, to be sent on the next flush().
+     *
+     * Returns num. bytes queued, or -1 on failure.
+     */
+    virtual ssize_t queueSlot(size_t size, in_addr_t destAddr);
+
+    /**
+     * Queue the super-segment of serialised headers `headers` (of size
+     * `headerSize`, always with the IP header) and TCP payload `payload`
+     * (of size `payloadSize`, which may exceed `mss`) to `destAddr`, as
+     * packets carrying at most `mss` payload bytes each, to be sent on the
+     * next flush().
+     *
+     * Returns num. packets queued, or -1 on failure.
+     *
+     * NOTE: by default, segments in software (see Segmenter).
+     */
+    virtual int queueSuperSegment(const uint8_t *headers, size_t headerSize,
+                                  const uint8_t *payload, size_t payloadSize,
+                                  uint16_t mss, in_addr_t destAddr);
+
+    /**
+     * Send all queued packets.
+     *
+     * Returns num. packets sent, or -1 on failure.
+     */
+    virtual int flush();
+
+    /**
+     * Restrict delivery to packets destined to one of the local ports
+     * `ports`. The engine calls it whenever its set of local ports changes.
+     *
+     * Returns false on failure.
+     *
+     * NOTE: by default, does nothing (i.e. the engine filters in userspace).
+     */
+    virtual bool setLocalPorts(const std::vector<uint16_t> &ports);
+
+    /**
+     * Sets the max. time (ms) a receive waits for packets (-1 = forever,
+     * 0 = return at once, i.e. busy-poll).
+     */
+    virtual void setPollTimeout(int timeoutMs);
+
+    /**
+     * Restrict delivery to this backend's share (i.e. queue `queueIndex`,
+     * of `numQueues`) of the link's traffic, so engines sharing the link
+     * each receive a disjoint set of flows.
+     *
+     * Returns false if the backend can't be shared.
+     *
+     * NOTE: by default, only a single queue is supported.
+     */
+    virtual bool setQueue(uint32_t queueIndex, uint32_t numQueues);
+
+    /**
+     * Returns true if outgoing packets must carry their own IP header
+     * (i.e. we own the whole L3 path), false if the kernel prepends one.
+     */
+    virtual bool requiresIpHeader() = 0;
+
+    virtual std::string name() = 0;
+
+    LinkStats stats;
+
+protected:
+    /* backing buffer of the default peekPacket() */
+    std::vector<uint8_t> peekBuffer;
+
+    /* backing buffer of the default txSlot() */
+    std::vector<uint8_t> txScratch;
+
+    /* software segmentation of the default queueSuperSegment() */
+    Segmenter segmenter;
+
+    /* max. time (ms) a receive waits for packets (-1 = forever) */
+    int pollTimeoutMs = -1;
+
+    /* cores the engines of each queue are pinned to, empty if unpinned (see LinkConfig) */
+    std::vector<int> queueCpus;
+
+    /**
+     * Waits (for at most the poll timeout) for `fd` to become readable.
+     *
+     * Returns 1 if readable, 0 on timeout, or -1 on failure.
+     */
+    int waitReadable(int fd);
+
+private:
+    /**
+     * Opens the (bare) backend of type `config.type`.
+     */
+    static std::unique_ptr<LinkBackend> openBackend(LinkConfig &config);
+};
+
+/**
+ * Raw IP socket backend.
+ *
+ * Packets still pass through the kernel IP layer, and the kernel TCP stack
+ * sees our traffic.
+ */
+class RawSocketLink : public LinkBackend
+{
+public:
+    RawSocketLink(in_addr_t bindAddr);
+    ~RawSocketLink();
+
+    ssize_t recvPacket(std::vector<uint8_t> &packetBuffer) override;
+    ssize_t sendPacket(const uint8_t *packet, size_t size, in_addr_t destAddr) override;
+    int recvBatch(LinkPacket *packets, int maxPackets) override;
+    ssize_t queuePacket(const uint8_t *packet, size_t size, in_addr_t destAddr) override;
+    uint8_t *txSlot(size_t size) override;
+    ssize_t queueSlot(size_t size, in_addr_t destAddr) override;
+    int flush() override;
+    bool setLocalPorts(const std::vector<uint16_t> &ports) override;
+    bool setQueue(uint32_t queueIndex, uint32_t numQueues) override;
+    bool requiresIpHeader() override { return false; }
+    std::string name() override { return "raw"; }
+
+    /**
+     * Opens a raw IP socket, bound to `bindAddr`.
+     *
+     * Returns the socket, or -1 on failure.
+     */
+    static int openRawSocket(in_addr_t bindAddr);
+
+    /**
+     * Attaches (or replaces) a classic BPF filter to raw socket `sock`,
+     * accepting only TCP packets destined to `localAddr` and one of the
+     * local ports `ports`, so the kernel drops all other TCP traffic
+     * before it is queued on the socket.
+     *
+     * With `numQueues` > 1, instead of filtering on ports, only accepts
+     * packets whose kernel flow hash falls in queue `queueIndex`.
+     *
+     * Returns false on failure.
+     */
+    static bool attachFilter(int sock, in_addr_t localAddr, const std::vector<uint16_t> &ports,
+                             uint32_t queueIndex = 0, uint32_t numQueues = 1);
+
+    /**
+     * Sets the receive buffer size of raw socket `sock` to `size` bytes,
+     * past the rmem_max limit where we are allowed to.
+     *
+     * Returns false on failure.
+     */
+    static bool setReceiveBuffer(int sock, int size);
+
+private:
+    int sock;
+    in_addr_t bindAddr;
+
+    /* filter state (see attachFilter()) */
+    std::vector<uint16_t> localPorts;
+    uint32_t queueIndex;
+    uint32_t numQueues;
+
+    /* recvmmsg() state: one MTU-sized buffer per message */
+    std::vector<uint8_t> rxBuffers;
+    std::vector<struct iovec> rxIovecs;
+    std::vector<struct mmsghdr> rxMsgs;
+
+    /* sendmmsg() state: queued packets and their destinations */
+    std::vector<uint8_t> txBuffers;
+    std::vector<struct iovec> txIovecs;
+    std::vector<struct sockaddr_in> txAddrs;
+    std::vector<struct mmsghdr> txMsgs;
+    int txQueued;
+};
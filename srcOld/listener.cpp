@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#include "listener.hpp"
+#include "tcp.hpp"
+
+////////////////////////////////////////////
+// Listener methods
+////////////////////////////////////////////
+Listener::Listener(in_addr_t localAddr, uint16_t localPort, uint32_t numShards, uint32_t backlog)
+    : localAddr(localAddr),
+      localPort(localPort),
+      shards(numShards),
+      backlog(backlog)
+{
+    if (numShards == 0)
+        throw std::runtime_error("Listener needs at least one accept queue");
+}
+
+/**
+ * Returns true if shard `shard` holds `backlog` connections.
+ */
+bool Listener::isFull(uint32_t shard)
+{
+    return shards[shard].size.load(std::memory_order_relaxed) >= backlog;
+}
+
+/**
+ * Queues established connection `tcb` on shard `shard`.
+ *
+ * Returns false if the shard is full.
+ */
+bool Listener::enqueue(uint32_t shard, std::shared_ptr<Tcb> tcb)
+{
+    AcceptQueue &queue = shards[shard];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.connections.size() >= backlog)
+            return false;
+
+        queue.connections.push_back(std::move(tcb));
+        queue.size.store(queue.connections.size(), std::memory_order_relaxed);
+    }
+
+    // pairs with acceptOrWait(): either we see its waiter, or it sees our connection
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (numWaiters.load(std::memory_order_relaxed) > 0)
+        wakeWaiters(shard);
+    return true;
+}
+
+/**
+ * Takes the oldest established connection, from shard `shard` if it has
+ * one, else from the first other non-empty shard (skipping shards another
+ * acceptor holds, rather than queuing behind it).
+ *
+ * Returns nullptr if there is none to accept.
+ */
+std::shared_ptr<Tcb> Listener::accept(uint32_t shard)
+{
+    shard %= shards.size();
+
+    std::shared_ptr<Tcb> tcb = pop(shard, true);
+    if (tcb)
+    {
+        acceptedLocal.fetch_add(1, std::memory_order_relaxed);
+        return tcb;
+    }
+
+    for (size_t i = 1; i < shards.size(); i++)
+    {
+        tcb = pop((shard + i) % shards.size(), false);
+        if (tcb)
+        {
+            acceptedStolen.fetch_add(1, std::memory_order_relaxed);
+            return tcb;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * As accept(), but if there is no connection to accept, registers `waiter`
+ * to be handed the next one instead (unless waits are stopped, in which
+ * case it is turned away).
+ *
+ * Returns the connection, or nullptr if `waiter` was registered (or
+ * turned away).
+ */
+std::shared_ptr<Tcb> Listener::acceptOrWait(uint32_t shard, AcceptWaiter *waiter)
+{
+    std::lock_guard<std::mutex> lock(waitersMutex);
+    numWaiters.fetch_add(1, std::memory_order_relaxed);
+
+    // pairs with enqueue(): either we see its connection, or it sees our waiter
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::shared_ptr<Tcb> tcb = accept(shard);
+    if (tcb || waitingStopped)
+    {
+        numWaiters.fetch_sub(1, std::memory_order_relaxed);
+        waiter->turnedAway = !tcb;
+        return tcb;
+    }
+
+    waiter->shard = shard % shards.size();
+    waiter->turnedAway = false;
+    waiters.push_back(waiter);
+    return nullptr;
+}
+
+/**
+ * Hands every waiting acceptor nullptr, and turns away those that would
+ * wait from now on.
+ */
+void Listener::stopWaiting()
+{
+    std::deque<AcceptWaiter*> stopped;
+    {
+        std::lock_guard<std::mutex> lock(waitersMutex);
+        waitingStopped = true;
+        stopped.swap(waiters);
+        numWaiters.store(0, std::memory_order_relaxed);
+    }
+
+    for (AcceptWaiter *waiter : stopped)
+        waiter->accepted(nullptr);
+}
+
+/**
+ * Hands queued connections (from shard `shard` first) to waiting acceptors:
+ * each to the oldest waiter on its own shard if there is one (so it needn't
+ * steal), else to the oldest waiter.
+ */
+void Listener::wakeWaiters(uint32_t shard)
+{
+    std::vector<std::pair<AcceptWaiter*, std::shared_ptr<Tcb>>> handed;
+    {
+        std::lock_guard<std::mutex> lock(waitersMutex);
+        while (!waiters.empty())
+        {
+            auto waiter = std::find_if(waiters.begin(), waiters.end(),
+                                       [&](AcceptWaiter *w) { return w->shard == shard; });
+            if (waiter == waiters.end())
+                waiter = waiters.begin();
+
+            // from the waiter's own shard, or stolen for it (counted as such)
+            std::shared_ptr<Tcb> tcb = accept((*waiter)->shard);
+            if (!tcb)
+                break;
+
+            handed.emplace_back(*waiter, std::move(tcb));
+            waiters.erase(waiter);
+            numWaiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    // outside the lock, as acceptors may resume (and wait again) right away
+    for (auto &[waiter, tcb] : handed)
+        waiter->accepted(std::move(tcb));
+}
+
+/**
+ * Pops the oldest connection of shard `shard`, waiting for its lock only
+ * if `wait` is set.
+ *
+ * Returns nullptr if there is none (or the lock is taken).
+ */
+std::shared_ptr<Tcb> Listener::pop(uint32_t shard, bool wait)
+{
+    AcceptQueue &queue = shards[shard];
+    if (queue.size.load(std::memory_order_relaxed) == 0)
+        return nullptr;
+
+    std::unique_lock<std::mutex> lock(queue.mutex, std::defer_lock);
+    if (wait)
+        lock.lock();
+    else if (!lock.try_lock())
+        return nullptr;
+
+    if (queue.connections.empty())
+        return nullptr;
+
+    std::shared_ptr<Tcb> tcb = std::move(queue.connections.front());
+    queue.connections.pop_front();
+    queue.size.store(queue.connections.size(), std::memory_order_relaxed);
+    return tcb;
+}
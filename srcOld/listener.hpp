@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <netinet/ip.h>
+
+#include "config.hpp"
+
+struct Tcb;
+
+/**
+ * Acceptor waiting on a listener for its next established connection.
+ */
+struct AcceptWaiter
+{
+    /**
+     * Hands established connection `tcb` to the acceptor (called by the
+     * engine thread that established it).
+     */
+    virtual void accepted(std::shared_ptr<Tcb> tcb) = 0;
+
+    /* shard (i.e. engine) the acceptor waits on */
+    uint32_t shard = 0;
+
+    /* set if the acceptor was turned away rather than registered (see Listener::stopWaiting()) */
+    bool turnedAway = false;
+};
+
+/**
+ * Passive open on a local address and port, shared by all engines of a
+ * group (i.e. as with SO_REUSEPORT, every engine listens on the port).
+ *
+ * A SYN to the port spawns a child connection on the engine owning its
+ * 4-tuple; once established, the child is queued on that engine's own
+ * accept queue (shard), so engines never contend with each other.
+ *
+ * accept() pulls from the caller's shard first, and steals from the
+ * others only when it is empty, so acceptors running alongside each
+ * engine mostly take their own lock only.
+ *
+ * Acceptors may instead wait (acceptOrWait()), in which case connections
+ * are handed to them directly as they are established, to those waiting
+ * on the connection's own shard first.
+ */
+class Listener
+{
+public:
+    Listener(in_addr_t localAddr, uint16_t localPort, uint32_t numShards,
+             uint32_t backlog = LISTENER_BACKLOG);
+
+    /* local address (network order) and port listened on */
+    const in_addr_t localAddr;
+    const uint16_t localPort;
+
+    /**
+     * Returns true if shard `shard` holds `backlog` connections, i.e.
+     * its engine should drop new SYNs.
+     */
+    bool isFull(uint32_t shard);
+
+    /**
+     * Queues established connection `tcb` on shard `shard` (engine).
+     *
+     * Returns false if the shard is full.
+     */
+    bool enqueue(uint32_t shard, std::shared_ptr<Tcb> tcb);
+
+    /**
+     * Takes the oldest established connection, from shard `shard` if it
+     * has one, else from the first other non-empty shard.
+     *
+     * Returns nullptr if there is none to accept.
+     */
+    std::shared_ptr<Tcb> accept(uint32_t shard);
+
+    /**
+     * As accept(), but if there is no connection to accept, registers
+     * `waiter` to be handed the next one instead.
+     *
+     * Returns the connection, or nullptr if `waiter` was registered (or,
+     * once waits are stopped, turned away).
+     */
+    std::shared_ptr<Tcb> acceptOrWait(uint32_t shard, AcceptWaiter *waiter);
+
+    /**
+     * Hands every waiting acceptor nullptr (i.e. no connection), and turns
+     * away those that would wait from now on, e.g. once an application
+     * accepted all the connections it serves.
+     */
+    void stopWaiting();
+
+    /* num. connections accepted from the caller's shard, and stolen from others' */
+    std::atomic<uint64_t> acceptedLocal{0};
+    std::atomic<uint64_t> acceptedStolen{0};
+
+private:
+    /**
+     * Accept queue of one engine, on its own cache line(s).
+     */
+    struct alignas(64) AcceptQueue
+    {
+        std::mutex mutex;
+        std::deque<std::shared_ptr<Tcb>> connections;
+
+        /* queue length, read without the lock by stealers skipping empty queues */
+        std::atomic<uint32_t> size{0};
+    };
+
+    std::vector<AcceptQueue> shards;
+    uint32_t backlog;
+
+    /**
+     * Acceptors waiting for a connection, and how many (read without the
+     * lock by engines queuing connections).
+     */
+    std::mutex waitersMutex;
+    std::deque<AcceptWaiter*> waiters;
+    std::atomic<uint32_t> numWaiters{0};
+    bool waitingStopped = false;
+
+    /**
+     * Hands queued connections (from shard `shard` first) to waiting acceptors.
+     */
+    void wakeWaiters(uint32_t shard);
+
+    /**
+     * Pops the oldest connection of shard `shard`, waiting for its lock
+     * only if `wait` is set.
+     *
+     * Returns nullptr if there is none (or the lock is taken).
+     */
+    std::shared_ptr<Tcb> pop(uint32_t shard, bool wait);
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+ * Bounded, lock-free multi-producer/single-consumer queue.
+ *
+ * Each slot carries a sequence number telling producers and the consumer
+ * whose turn it is: producers claim a slot by advancing the enqueue
+ * position (CAS), fill it, then publish it by bumping its sequence number,
+ * so a slow producer only ever delays the consumer, never other producers.
+ *
+ * Items are moved in and out of preallocated slots.
+ */
+template <typename T>
+class MpscQueue
+{
+public:
+    MpscQueue(uint32_t size)
+        : slots(size)
+    {
+        if (size == 0 || (size & (size - 1)))
+            throw std::runtime_error("MPSC queue size must be a power of two");
+
+        mask = size - 1;
+        for (uint32_t i = 0; i < size; i++)
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        enqueuePos.store(0, std::memory_order_relaxed);
+        dequeuePos = 0;
+    }
+
+    /**
+     * Moves `item` onto the queue (any thread).
+     *
+     * Returns false if the queue is full.
+     */
+    bool push(T &item)
+    {
+        Slot *slot;
+        uint64_t pos = enqueuePos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            slot = &slots[pos & mask];
+            uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+            int64_t diff = (int64_t)(sequence - pos);
+            if (diff == 0)
+            {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+
+        slot->item = std::move(item);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Moves the oldest item off the queue into `item` (consumer).
+     *
+     * Returns false if the queue is empty.
+     */
+    bool pop(T &item)
+    {
+        Slot &slot = slots[dequeuePos & mask];
+        uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if ((int64_t)(sequence - (dequeuePos + 1)) < 0)
+            return false;
+
+        item = std::move(slot.item);
+        slot.sequence.store(dequeuePos + mask + 1, std::memory_order_release);
+        dequeuePos++;
+        return true;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<uint64_t> sequence;
+        T item;
+    };
+
+    std::vector<Slot> slots;
+    uint64_t mask;
+
+    /* producers' claim position, and the consumer's position, on separate cache lines */
+    alignas(64) std::atomic<uint64_t> enqueuePos;
+    alignas(64) uint64_t dequeuePos;
+};
@@ -3,11 +3,16 @@
 #include <cstring>
 #include <sstream>
 #include <cassert>
+#include <cstddef>
+#include <iostream>
+#include <functional>
+#include <netinet/in.h>
 
 #include "packet.hpp"
 
 #include "ip.hpp"
 #include "tcp.hpp"
+#include "test_utils.hpp"
 
 ////////////////////////////////////////////
 // Packet methods
@@ -23,15 +28,38 @@ uint32_t Packet::payloadSize()
     return ipHeader.totLen - combinedHeaderSize();
 }
 
+/**
+ * Initialise the IP header of an outgoing packet from `saddr` to `daddr`
+ * (both network order).
+ */
+void Packet::initialiseIpHeader(uint32_t saddr, uint32_t daddr)
+{
+    ipHeader = {};
+    ipHeader.version = 4;
+    ipHeader.ihl = sizeof(ipHeader) / 4;
+    ipHeader.totLen = combinedHeaderSize() + payload.size();
+    ipHeader.ttl = 64;
+    ipHeader.protocol = IPPROTO_TCP;
+    ipHeader.saddr = saddr;
+    ipHeader.daddr = daddr;
+}
+
 Packet Packet::deserialise(std::vector<uint8_t>& buffer, uint32_t packetSize)
+{
+    if (buffer.size() < packetSize)
+        throw std::runtime_error("Packet larger than its buffer");
+    return deserialise(buffer.data(), packetSize);
+}
+
+Packet Packet::deserialise(const uint8_t *buffer, uint32_t packetSize)
 {
     Packet packet;
 
     size_t requiredSize = sizeof(packet.ipHeader) + sizeof(packet.tcpHeader);
-    if (buffer.size() < requiredSize) 
+    if (packetSize < requiredSize) 
         throw std::runtime_error("Packet too small to contain TCP/IP headers");
 
-    auto it = buffer.begin();
+    const uint8_t *it = buffer;
 
     // ip header
     std::copy(it, it + sizeof(packet.ipHeader), reinterpret_cast<uint8_t*>(&packet.ipHeader));
@@ -55,7 +83,13 @@ Packet Packet::deserialise(std::vector<uint8_t>& buffer, uint32_t packetSize)
     return packet;
 }
 
-std::vector<uint8_t> Packet::serialise(bool includeIpHeader)
+/**
+ * Serialise the packet (network order), optionally with its IP header.
+ *
+ * With `partialChecksum`, the TCP checksum field only holds the folded
+ * pseudo-header sum.
+ */
+std::vector<uint8_t> Packet::serialise(bool includeIpHeader, bool partialChecksum)
 {
     ssize_t size = sizeof(tcpHeader) + payload.size();
     if (includeIpHeader)
@@ -64,15 +98,20 @@ std::vector<uint8_t> Packet::serialise(bool includeIpHeader)
     std::vector<uint8_t> buffer(size);
     auto it = buffer.begin();
 
-    // ip header - perhaps networkToHostOrder call here?
+    // ip header
     if (includeIpHeader)
     {
+        ipHeader.hostToNetworkOrder();
+        ipHeader.checksum = 0;
+        ipHeader.checksum = ipHeader.calculateChecksum();
         memcpy(&(*it), &ipHeader, sizeof(ipHeader));
         it += sizeof(ipHeader);
     }
+    uint8_t *segment = &(*it);
 
     // tcp header
     tcpHeader.hostToNetworkOrder();
+    tcpHeader.checksum = 0;
     memcpy(&(*it), &tcpHeader, sizeof(tcpHeader));
     it += sizeof(tcpHeader);
 
@@ -80,9 +119,69 @@ std::vector<uint8_t> Packet::serialise(bool includeIpHeader)
     if (payload.size())
         memcpy(&(*it), payload.data(), payload.size());
 
+    // tcp checksum, patched in place
+    uint16_t checksum;
+    if (partialChecksum)
+    {
+        // pseudo-header only (i.e. as checksum offload expects it)
+        uint32_t sum = (ipHeader.saddr & 0xffff) + (ipHeader.saddr >> 16)
+                     + (ipHeader.daddr & 0xffff) + (ipHeader.daddr >> 16)
+                     + htons(IPPROTO_TCP) + htons(sizeof(tcpHeader) + payload.size());
+        while (sum >> 16)
+            sum = (sum & 0xffff) + (sum >> 16);
+        checksum = sum;
+    }
+    else
+        checksum = calculateTcpChecksum(
+            segment, sizeof(tcpHeader) + payload.size(), ipHeader.saddr, ipHeader.daddr
+        );
+    memcpy(segment + offsetof(TcpHeader, checksum), &checksum, sizeof(checksum));
+
     return buffer;
 }
 
+/**
+ * Calculate the TCP checksum of the network ordered TCP segment `segment`
+ * of size `segmentSize`, sent from `saddr` to `daddr`.
+ *
+ * From RFC 793:
+ *
+ * "The checksum field is the 16 bit one's complement of the one's
+ * complement sum of all 16 bit words in the header and text ... [and]
+ * a 96 bit pseudo header conceptually prefixed to the TCP header."
+ */
+uint16_t Packet::calculateTcpChecksum(const uint8_t *segment, uint32_t segmentSize,
+                                      uint32_t saddr, uint32_t daddr)
+{
+    uint32_t sum = 0;
+
+    // pseudo header (addresses already network ordered)
+    sum += (saddr & 0xffff) + (saddr >> 16);
+    sum += (daddr & 0xffff) + (daddr >> 16);
+    sum += htons(IPPROTO_TCP);
+    sum += htons(segmentSize);
+
+    // segment
+    uint32_t i = 0;
+    for (; i + 1 < segmentSize; i += 2)
+    {
+        uint16_t word;
+        memcpy(&word, segment + i, sizeof(word));
+        sum += word;
+    }
+    if (i < segmentSize)
+    {
+        uint16_t word = 0;
+        memcpy(&word, segment + i, 1);
+        sum += word;
+    }
+
+    // fold to 16 bits, then one's complement
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
 std::string Packet::toString(bool showIpHeader, bool showPayload)
 {
     std::ostringstream oss;
@@ -102,4 +201,298 @@ std::string Packet::toString(bool showIpHeader, bool showPayload)
     }
     oss << "####################################" << "\n";
     return oss.str();
-}
\ No newline at end of file
+}
+
+////////////////////////////////////////////
+// PacketView methods
+////////////////////////////////////////////
+bool PacketView::parse(const uint8_t *packet, uint32_t packetSize)
+{
+    if (packetSize < sizeof(IpHeader) + sizeof(TcpHeader))
+        return false;
+
+    // ip header
+    uint32_t ipHeaderSize = (packet[0] & 0x0f) * 4;
+    uint32_t length = ntohs(load<uint16_t>(packet + offsetof(IpHeader, totLen)));
+    if ((packet[0] >> 4) != 4 || ipHeaderSize < sizeof(IpHeader) ||
+        packet[offsetof(IpHeader, protocol)] != IPPROTO_TCP)
+        return false;
+
+    // the link may pad the packet, but not cut it short
+    if (length > packetSize || length < ipHeaderSize + sizeof(TcpHeader))
+        return false;
+
+    // tcp header (options skipped)
+    const uint8_t *tcpHeader = packet + ipHeaderSize;
+    uint32_t tcpHeaderSize = (tcpHeader[DOFF_OFFSET] >> 4) * 4;
+    if (tcpHeaderSize < sizeof(TcpHeader) || ipHeaderSize + tcpHeaderSize > length)
+        return false;
+
+    ip = packet;
+    tcp = tcpHeader;
+    latest = tcpHeader;
+    payloadData = tcpHeader + tcpHeaderSize;
+    totLen = length;
+    ownPayloadSize = length - ipHeaderSize - tcpHeaderSize;
+    totalPayloadSize = ownPayloadSize;
+    merged = nullptr;
+    numMerged = 0;
+    return true;
+}
+
+/**
+ * Appends `segment`, which must follow the segments already merged into
+ * this one in its batch (GRO).
+ */
+void PacketView::merge(const PacketView &segment)
+{
+    if (!merged)
+        merged = &segment;
+    assert(&segment == merged + numMerged);
+
+    numMerged++;
+    latest = segment.tcp;
+    totalPayloadSize += segment.ownPayloadSize;
+}
+
+std::string PacketView::toString(bool showIpHeader, bool showPayload) const
+{
+    IpHeader ipHeader;
+    TcpHeader tcpHeader;
+    memcpy(&ipHeader, ip, sizeof(ipHeader));
+    memcpy(&tcpHeader, tcp, sizeof(tcpHeader));
+    ipHeader.networkToHostOrder();
+    tcpHeader.networkToHostOrder();
+
+    // as merged (i.e. the last fragment's ACK, window and PSH)
+    tcpHeader.ackNum = ackNum();
+    tcpHeader.window = window();
+    tcpHeader.PSH = PSH();
+
+    std::ostringstream oss;
+
+    oss << "####################################" << "\n";
+    if (showIpHeader)
+        oss << ipHeader.toString() << "\n";
+    oss << tcpHeader.toString();
+    if (showPayload && payloadSize() > 0)
+    {
+        oss << "\nPayload" << "\n\n";
+        oss << "  ";
+        for (uint32_t i = 0; i < numFragments(); i++)
+        {
+            std::span<const uint8_t> payload = fragment(i).payload();
+            oss << std::string(reinterpret_cast<const char*>(payload.data()), payload.size());
+        }
+        oss << "\n";
+    }
+    oss << "####################################" << "\n";
+    return oss.str();
+}
+
+////////////////////////////////////////////
+// PacketView tests
+////////////////////////////////////////////
+
+namespace PacketViewTests
+{
+    const std::string DATA = "hello";
+
+    /**
+     * Returns a serialised packet from 10.0.0.2:40000 to 10.0.0.1:8080,
+     * with TCP options `options` (a multiple of 4 bytes) and payload DATA.
+     */
+    std::vector<uint8_t> packetOf(const std::vector<uint8_t> &options = {})
+    {
+        Packet packet;
+        packet.tcpHeader = {};
+        packet.tcpHeader.sourcePort = 40000;
+        packet.tcpHeader.destPort = 8080;
+        packet.tcpHeader.seqNum = 1000;
+        packet.tcpHeader.ackNum = 2000;
+        packet.tcpHeader.doff = (sizeof(TcpHeader) + options.size()) / 4;
+        packet.tcpHeader.ACK = 1;
+        packet.tcpHeader.PSH = 1;
+        packet.tcpHeader.window = 512;
+
+        // (serialised as though payload)
+        packet.payload = options;
+        packet.payload.insert(packet.payload.end(), DATA.begin(), DATA.end());
+
+        packet.initialiseIpHeader(inet_addr("10.0.0.2"), inet_addr("10.0.0.1"));
+        return packet.serialise(true);
+    }
+
+    /**
+     * Sets the IP total length field of serialised packet `bytes`.
+     */
+    void setTotLen(std::vector<uint8_t> &bytes, uint16_t totLen)
+    {
+        uint16_t field = htons(totLen);
+        memcpy(bytes.data() + offsetof(IpHeader, totLen), &field, sizeof(field));
+    }
+
+    /**
+     * Returns true if `view` views `bytes` as packetOf() built it, with
+     * `optionsSize` bytes of options.
+     */
+    bool viewsPacket(const PacketView &view, const std::vector<uint8_t> &bytes, uint32_t optionsSize)
+    {
+        uint32_t headersSize = sizeof(IpHeader) + sizeof(TcpHeader) + optionsSize;
+        std::span<const uint8_t> payload = view.payload();
+
+        return view.data() == bytes.data() && view.size() == headersSize + DATA.size() &&
+               view.saddr() == inet_addr("10.0.0.2") && view.daddr() == inet_addr("10.0.0.1") &&
+               view.sourcePort() == 40000 && view.destPort() == 8080 &&
+               view.seqNum() == 1000 && view.ackNum() == 2000 && view.window() == 512 &&
+               view.doff() == headersSize / 4 - sizeof(IpHeader) / 4 &&
+               view.ACK() && view.PSH() && !view.SYN() && !view.FIN() && !view.RST() &&
+               payload.data() == bytes.data() + headersSize && payload.size() == DATA.size() &&
+               view.payloadSize() == DATA.size() && view.numFragments() == 1 &&
+               memcmp(payload.data(), DATA.data(), DATA.size()) == 0;
+    }
+
+    void testParse()
+    {
+        std::vector<uint8_t> bytes = packetOf();
+        PacketView view;
+        ASSERT_THAT(view.parse(bytes.data(), bytes.size()));
+        ASSERT_THAT(viewsPacket(view, bytes, 0));
+
+        /**
+         * Headers alone (i.e. no payload)
+         */
+        setTotLen(bytes, sizeof(IpHeader) + sizeof(TcpHeader));
+        ASSERT_THAT(view.parse(bytes.data(), sizeof(IpHeader) + sizeof(TcpHeader)));
+        ASSERT_THAT(view.payload().size() == 0 && view.payloadSize() == 0);
+    }
+
+    void testParseWithOptions()
+    {
+        // MSS 1460, NOP, NOP, SACK permitted, NOP, NOP, NOP, NOP
+        std::vector<uint8_t> options = { 2, 4, 0x05, 0xb4, 1, 1, 4, 2, 1, 1, 1, 1 };
+        std::vector<uint8_t> bytes = packetOf(options);
+
+        PacketView view;
+        ASSERT_THAT(view.parse(bytes.data(), bytes.size()));
+        ASSERT_THAT(view.doff() == 8);
+        ASSERT_THAT(viewsPacket(view, bytes, options.size()));
+    }
+
+    void testTruncated()
+    {
+        std::vector<uint8_t> bytes = packetOf();
+        PacketView view;
+
+        /**
+         * Too short for the headers, or for the total length
+         */
+        ASSERT_THAT(!view.parse(bytes.data(), 0));
+        ASSERT_THAT(!view.parse(bytes.data(), sizeof(IpHeader)));
+        ASSERT_THAT(!view.parse(bytes.data(), sizeof(IpHeader) + sizeof(TcpHeader) - 1));
+        ASSERT_THAT(!view.parse(bytes.data(), bytes.size() - 1));
+
+        // a failed parse leaves the view as it was
+        ASSERT_THAT(view.parse(bytes.data(), bytes.size()));
+        ASSERT_THAT(!view.parse(bytes.data(), sizeof(IpHeader)));
+        ASSERT_THAT(viewsPacket(view, bytes, 0));
+    }
+
+    void testHeaderLengths()
+    {
+        PacketView view;
+
+        /**
+         * IHL less than 5, or past the total length
+         */
+        for (uint8_t ihl : { 0, 4, 15 })
+        {
+            std::vector<uint8_t> bytes = packetOf();
+            bytes[0] = (bytes[0] & 0xf0) | ihl;
+            ASSERT_THAT(!view.parse(bytes.data(), bytes.size()));
+        }
+
+        /**
+         * doff less than 5, or past the total length
+         */
+        uint32_t doffOffset = sizeof(IpHeader) + 12;
+        for (uint8_t doff : { 0, 4, 7 })
+        {
+            std::vector<uint8_t> bytes = packetOf();
+            bytes[doffOffset] = (bytes[doffOffset] & 0x0f) | (doff << 4);
+            ASSERT_THAT(!view.parse(bytes.data(), bytes.size()));
+        }
+
+        // a doff reaching exactly the total length leaves no payload
+        std::vector<uint8_t> bytes = packetOf({ 1, 1, 1, 1 });
+        setTotLen(bytes, sizeof(IpHeader) + sizeof(TcpHeader) + 4);
+        ASSERT_THAT(view.parse(bytes.data(), bytes.size()));
+        ASSERT_THAT(view.doff() == 6 && view.payloadSize() == 0);
+        ASSERT_THAT(view.payload().data() == bytes.data() + sizeof(IpHeader) + sizeof(TcpHeader) + 4);
+    }
+
+    void testTotalLength()
+    {
+        PacketView view;
+        std::vector<uint8_t> bytes = packetOf();
+        uint32_t size = bytes.size();
+
+        /**
+         * A total length larger than what was received, or too small for
+         * the headers
+         */
+        setTotLen(bytes, size + 1);
+        ASSERT_THAT(!view.parse(bytes.data(), size));
+        setTotLen(bytes, sizeof(IpHeader) + sizeof(TcpHeader) - 1);
+        ASSERT_THAT(!view.parse(bytes.data(), size));
+
+        /**
+         * Link padding past the total length isn't part of the packet
+         */
+        bytes = packetOf();
+        bytes.resize(size + 20, 0xee);
+        ASSERT_THAT(view.parse(bytes.data(), bytes.size()));
+        ASSERT_THAT(viewsPacket(view, bytes, 0));
+        ASSERT_THAT(view.size() == size);
+    }
+
+    void testNotTcp()
+    {
+        PacketView view;
+
+        std::vector<uint8_t> bytes = packetOf();
+        bytes[offsetof(IpHeader, protocol)] = IPPROTO_UDP;
+        ASSERT_THAT(!view.parse(bytes.data(), bytes.size()));
+
+        bytes = packetOf();
+        bytes[offsetof(IpHeader, protocol)] = IPPROTO_ICMP;
+        ASSERT_THAT(!view.parse(bytes.data(), bytes.size()));
+
+        // nor IPv4
+        bytes = packetOf();
+        bytes[0] = (6 << 4) | (bytes[0] & 0x0f);
+        ASSERT_THAT(!view.parse(bytes.data(), bytes.size()));
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "PacketView Tests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = 
+        {
+            TEST(testParse),
+            TEST(testParseWithOptions),
+            TEST(testTruncated),
+            TEST(testHeaderLengths),
+            TEST(testTotalLength),
+            TEST(testNotTcp)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+    }
+};
@@ -3,7 +3,10 @@
 #include <string>
 #include <vector>
 #include <cstring>
+#include <cstddef>
 #include <sstream>
+#include <span>
+#include <arpa/inet.h>
 
 #include "ip.hpp"
 #include "tcp.hpp"
@@ -21,9 +24,145 @@ struct Packet
 
     uint32_t payloadSize();
 
+    /**
+     * Initialise the IP header of an outgoing packet from `saddr` to `daddr`
+     * (both network order).
+     *
+     * NOTE: the addresses are required for the TCP checksum's pseudo-header,
+     * even if the IP header itself isn't serialised.
+     */
+    void initialiseIpHeader(uint32_t saddr, uint32_t daddr);
+
     static Packet deserialise(std::vector<uint8_t>& buffer, uint32_t packetSize);
+    static Packet deserialise(const uint8_t *buffer, uint32_t packetSize);
+
+    /**
+     * Serialise the packet (network order), optionally with its IP header.
+     *
+     * With `partialChecksum`, the TCP checksum field only holds the folded
+     * pseudo-header sum (i.e. the segment itself is left to whoever segments
+     * or offloads it), sparing a pass over super-segments' payloads.
+     */
+    std::vector<uint8_t> serialise(bool includeIpHeader, bool partialChecksum = false);
 
-    std::vector<uint8_t> serialise(bool includeIpHeader);
+    /**
+     * Calculate the TCP checksum of the network ordered TCP segment `segment`
+     * of size `segmentSize`, sent from `saddr` to `daddr`.
+     */
+    static uint16_t calculateTcpChecksum(const uint8_t *segment, uint32_t segmentSize,
+                                         uint32_t saddr, uint32_t daddr);
 
     std::string toString(bool showIpHeader = true, bool showPayload = false);
-};
\ No newline at end of file
+};
+
+/**
+ * Non-owning view of a received IP packet (i.e. ip header, tcp header and
+ * tcp payload), over the link's buffer.
+ *
+ * Nothing is copied as a view is parsed: header fields are read (and
+ * converted to host order) only as they're asked for, and the payload is a
+ * span of the link's buffer, so it's copied once, into the receive buffer.
+ * A view is only valid while the link buffer it's over is (i.e. until the
+ * link's next receive call).
+ *
+ * Addresses are left in network order (as FlowKey has them).
+ *
+ * Segments merged into a view (GRO, see Coalescer) stay views of their own,
+ * which follow it in its batch: the view's payload is then made of its
+ * fragments (itself, then the merged segments, in order), and its ACK,
+ * window and PSH are those of the last.
+ */
+struct PacketView
+{
+    /**
+     * Validates `packet` of size `packetSize` as a TCP/IP packet (header
+     * lengths, total length, protocol), and views it.
+     *
+     * Returns false if it isn't one (leaving the view as it was).
+     */
+    bool parse(const uint8_t *packet, uint32_t packetSize);
+
+    /* the viewed IP packet (without any link padding beyond its total length) */
+    const uint8_t *data() const { return ip; }
+    uint32_t size() const { return totLen; }
+
+    uint32_t saddr() const { return load<uint32_t>(ip + offsetof(IpHeader, saddr)); }
+    uint32_t daddr() const { return load<uint32_t>(ip + offsetof(IpHeader, daddr)); }
+
+    uint16_t sourcePort() const { return ntohs(load<uint16_t>(tcp + offsetof(TcpHeader, sourcePort))); }
+    uint16_t destPort() const { return ntohs(load<uint16_t>(tcp + offsetof(TcpHeader, destPort))); }
+    uint32_t seqNum() const { return ntohl(load<uint32_t>(tcp + offsetof(TcpHeader, seqNum))); }
+    uint32_t ackNum() const { return ntohl(load<uint32_t>(latest + offsetof(TcpHeader, ackNum))); }
+    uint16_t window() const { return ntohs(load<uint16_t>(latest + offsetof(TcpHeader, window))); }
+
+    /* tcp header size, in 32-bit words (i.e. 5, unless it carries options) */
+    uint8_t doff() const { return tcp[DOFF_OFFSET] >> 4; }
+
+    bool FIN() const { return tcp[FLAGS_OFFSET] & 0x01; }
+    bool SYN() const { return tcp[FLAGS_OFFSET] & 0x02; }
+    bool RST() const { return tcp[FLAGS_OFFSET] & 0x04; }
+    bool PSH() const { return latest[FLAGS_OFFSET] & 0x08; }
+    bool ACK() const { return tcp[FLAGS_OFFSET] & 0x10; }
+    bool URG() const { return tcp[FLAGS_OFFSET] & 0x20; }
+
+    /**
+     * Payload of this segment alone (i.e. without the segments merged into
+     * it).
+     */
+    std::span<const uint8_t> payload() const { return { payloadData, ownPayloadSize }; }
+
+    /**
+     * Payload size, merged segments included.
+     */
+    uint32_t payloadSize() const { return totalPayloadSize; }
+
+    /**
+     * Num. fragments the payload is made of, and fragment `i` of them (i.e.
+     * this segment, then those merged into it).
+     */
+    uint32_t numFragments() const { return 1 + numMerged; }
+    const PacketView &fragment(uint32_t i) const { return i == 0 ? *this : merged[i - 1]; }
+
+    /**
+     * Appends `segment`, which must follow the segments already merged into
+     * this one in its batch (GRO).
+     */
+    void merge(const PacketView &segment);
+
+    std::string toString(bool showIpHeader = true, bool showPayload = false) const;
+
+private:
+    static constexpr uint32_t DOFF_OFFSET = 12;
+    static constexpr uint32_t FLAGS_OFFSET = 13;
+
+    const uint8_t *ip = nullptr;
+    const uint8_t *tcp = nullptr;
+    const uint8_t *latest = nullptr;        // tcp header of the last fragment
+    const uint8_t *payloadData = nullptr;
+    uint32_t totLen = 0;
+    uint32_t ownPayloadSize = 0;
+    uint32_t totalPayloadSize = 0;
+
+    const PacketView *merged = nullptr;     // first merged segment (following this one)
+    uint32_t numMerged = 0;
+
+    template <typename T>
+    static T load(const uint8_t *p)
+    {
+        T value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+};
+
+namespace PacketViewTests
+{
+    void testParse();
+    void testParseWithOptions();
+    void testTruncated();
+    void testHeaderLengths();
+    void testTotalLength();
+    void testNotTcp();
+
+    void runAll();
+};
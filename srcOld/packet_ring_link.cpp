@@ -0,0 +1,525 @@
+#include <unistd.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <linux/filter.h>
+#include <stdexcept>
+
+#include "packet_ring_link.hpp"
+
+#include "config.hpp"
+#include "utils.hpp"
+
+////////////////////////////////////////////
+// PacketRingLink methods
+////////////////////////////////////////////
+PacketRingLink::PacketRingLink(const std::string &interfaceName, const std::string &peerMac)
+{
+    this->ring = (uint8_t*)MAP_FAILED;
+    this->rxBlockIndex = 0;
+    this->rxPacketsLeft = 0;
+    this->rxFrame = nullptr;
+    this->txFrameIndex = 0;
+    this->txQueued = 0;
+
+    if (!initialiseEthHeader(interfaceName, peerMac))
+        throw std::runtime_error("Failed Ethernet header initialisation");
+
+    this->sock = initialisePacketSocket(interfaceName);
+    if (this->sock < 0)
+        throw std::runtime_error("Failed packet socket creation");
+}
+
+PacketRingLink::~PacketRingLink()
+{
+    if (ring != MAP_FAILED)
+        munmap(ring, ringSize);
+    if (sock >= 0)
+        close(sock);
+}
+
+/**
+ * Opens the AF_PACKET socket, sets up and maps its rings, and binds
+ * it to `interfaceName`.
+ */
+int PacketRingLink::initialisePacketSocket(const std::string &interfaceName)
+{
+    ifIndex = if_nametoindex(interfaceName.c_str());
+    if (ifIndex == 0)
+    {
+        perror("Unknown interface");
+        return -1;
+    }
+
+    // protocol 0, so nothing is queued until we bind (below)
+    int sock = socket(AF_PACKET, SOCK_RAW, 0);
+    if (sock < 0)
+    {
+        perror("Failed socket creation");
+        return -1;
+    }
+
+    int version = TPACKET_V3;
+    if (setsockopt(sock, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+    {
+        perror("PACKET_VERSION failed");
+        close(sock);
+        return -1;
+    }
+
+    // we don't want our own TX frames looped back to us (best effort, 4.20+)
+    int one = 1;
+    setsockopt(sock, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+
+    /**
+     * Frames must hold a full MTU-sized packet plus the Ethernet and
+     * TPACKET headers, rounded up to a power of two.
+     */
+    int mtu = SystemUtils::getMTU(interfaceName);
+    if (mtu < 0)
+    {
+        close(sock);
+        return -1;
+    }
+    uint32_t frameSize = PACKET_RING_MIN_FRAME_SIZE;
+    while (frameSize < TPACKET3_HDRLEN + ETH_HLEN + mtu)
+        frameSize <<= 1;
+
+    // RX ring (block-based)
+    rxReq = {};
+    rxReq.tp_block_size = PACKET_RING_BLOCK_SIZE;
+    rxReq.tp_block_nr = PACKET_RING_RX_BLOCK_NR;
+    rxReq.tp_frame_size = frameSize;
+    rxReq.tp_frame_nr = (rxReq.tp_block_size / frameSize) * rxReq.tp_block_nr;
+    rxReq.tp_retire_blk_tov = PACKET_RING_RETIRE_TOV_MS;
+    if (setsockopt(sock, SOL_PACKET, PACKET_RX_RING, &rxReq, sizeof(rxReq)) < 0)
+    {
+        perror("PACKET_RX_RING failed");
+        close(sock);
+        return -1;
+    }
+
+    // TX ring (frame-based, block timeout must be zero)
+    txReq = {};
+    txReq.tp_block_size = PACKET_RING_BLOCK_SIZE;
+    txReq.tp_block_nr = PACKET_RING_TX_BLOCK_NR;
+    txReq.tp_frame_size = frameSize;
+    txReq.tp_frame_nr = (txReq.tp_block_size / frameSize) * txReq.tp_block_nr;
+    if (setsockopt(sock, SOL_PACKET, PACKET_TX_RING, &txReq, sizeof(txReq)) < 0)
+    {
+        perror("PACKET_TX_RING failed");
+        close(sock);
+        return -1;
+    }
+
+    // both rings are mapped with a single mmap(), RX first
+    size_t rxRingSize = (size_t)rxReq.tp_block_size * rxReq.tp_block_nr;
+    size_t txRingSize = (size_t)txReq.tp_block_size * txReq.tp_block_nr;
+    ringSize = rxRingSize + txRingSize;
+    ring = (uint8_t*)mmap(NULL, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED, sock, 0);
+    if (ring == MAP_FAILED)
+    {
+        perror("Failed ring mmap");
+        close(sock);
+        return -1;
+    }
+    rxRing = ring;
+    txRing = ring + rxRingSize;
+
+    struct sockaddr_ll addr = {};
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_IP);
+    addr.sll_ifindex = ifIndex;
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        perror("Failed bind");
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+/**
+ * Builds the Ethernet header template from the interface's MAC and
+ * `peerMac` (defaults to broadcast).
+ */
+bool PacketRingLink::initialiseEthHeader(const std::string &interfaceName, const std::string &peerMac)
+{
+    if (!SystemUtils::getMacAddress(interfaceName, ethHeader.h_source))
+        return false;
+
+    memset(ethHeader.h_dest, 0xff, ETH_ALEN);
+    if (!peerMac.empty() && !SystemUtils::parseMacAddress(peerMac, ethHeader.h_dest))
+    {
+        fprintf(stderr, "Invalid peer MAC: '%s'\n", peerMac.c_str());
+        return false;
+    }
+
+    ethHeader.h_proto = htons(ETH_P_IP);
+    return true;
+}
+
+/**
+ * Returns the next received frame, waiting for the kernel to retire
+ * a block if none are ready.
+ *
+ * NOTE:
+ *
+ * A block is only handed back to the kernel on the call *after* its last
+ * frame was returned, so the previously returned frame stays valid until
+ * the next call.
+ */
+struct tpacket3_hdr *PacketRingLink::nextRxFrame()
+{
+    while (1)
+    {
+        if (rxFrame == nullptr)
+        {
+            auto *block = (struct tpacket_block_desc*)(rxRing + rxBlockIndex * rxReq.tp_block_size);
+            uint32_t status = __atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE);
+            if (!(status & TP_STATUS_USER))
+            {
+                struct pollfd pfd = { sock, POLLIN | POLLERR, 0 };
+                stats.rxSyscalls++;
+                if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+                {
+                    perror("poll() failed");
+                    return nullptr;
+                }
+                continue;
+            }
+
+            rxPacketsLeft = block->hdr.bh1.num_pkts;
+            rxFrame = (struct tpacket3_hdr*)((uint8_t*)block + block->hdr.bh1.offset_to_first_pkt);
+        }
+
+        if (rxPacketsLeft == 0)
+        {
+            releaseRxBlock();
+            continue;
+        }
+
+        struct tpacket3_hdr *frame = rxFrame;
+        rxPacketsLeft--;
+        rxFrame = (struct tpacket3_hdr*)((uint8_t*)rxFrame + rxFrame->tp_next_offset);
+        return frame;
+    }
+}
+
+/**
+ * Joins the interface's packet fanout group, so the kernel spreads flows
+ * (by its flow hash) over the group's sockets, one per engine.
+ *
+ * With pinned engines, the group instead steers each packet to the engine
+ * pinned to the core the kernel received it on (see joinCpuFanout()).
+ *
+ * NOTE: the kernel, not `queueIndex`, decides which flows are ours.
+ *
+ * Returns false on failure.
+ */
+bool PacketRingLink::setQueue(uint32_t queueIndex, uint32_t numQueues)
+{
+    if (queueCpus.size() == numQueues && joinCpuFanout())
+        return true;
+
+    int fanout = (ifIndex & 0xffff) | (PACKET_FANOUT_HASH << 16);
+    if (setsockopt(sock, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) < 0)
+    {
+        perror("PACKET_FANOUT failed");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Joins the interface's packet fanout group with a classic BPF program
+ * picking the group's socket (i.e. engine, as they join in order) pinned
+ * to the receiving core, so a packet is handled on the core (and NUMA
+ * node) its softirq ran on. Packets received on other cores are spread
+ * by flow hash:
+ *
+ *      ld #cpu
+ *      jeq #queueCpus[q], 0, 1     ; ... once per queue q
+ *      ret #q
+ *      ld #rxhash
+ *      mod #numQueues
+ *      ret a
+ *
+ * Returns false if the kernel doesn't support BPF fanout.
+ */
+bool PacketRingLink::joinCpuFanout()
+{
+    int fanout = (ifIndex & 0xffff) | (PACKET_FANOUT_CBPF << 16);
+    if (setsockopt(sock, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) < 0)
+    {
+        perror("PACKET_FANOUT (cbpf) failed");
+        return false;
+    }
+
+    std::vector<struct sock_filter> prog;
+    prog.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU)));
+    for (uint32_t q = 0; q < queueCpus.size(); q++)
+    {
+        prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)queueCpus[q], 0, 1));
+        prog.push_back(BPF_STMT(BPF_RET | BPF_K, q));
+    }
+    prog.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_RXHASH)));
+    prog.push_back(BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)queueCpus.size()));
+    prog.push_back(BPF_STMT(BPF_RET | BPF_A, 0));
+
+    struct sock_fprog fprog = {};
+    fprog.len = prog.size();
+    fprog.filter = prog.data();
+
+    // the program is the group's: each engine joining sets the same one
+    if (setsockopt(sock, SOL_PACKET, PACKET_FANOUT_DATA, &fprog, sizeof(fprog)) < 0)
+    {
+        perror("PACKET_FANOUT_DATA failed");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Returns the current RX block to the kernel, and moves on to the next.
+ */
+void PacketRingLink::releaseRxBlock()
+{
+    auto *block = (struct tpacket_block_desc*)(rxRing + rxBlockIndex * rxReq.tp_block_size);
+    __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+
+    rxBlockIndex = (rxBlockIndex + 1) % rxReq.tp_block_nr;
+    rxFrame = nullptr;
+    rxPacketsLeft = 0;
+}
+
+/**
+ * Receive a single IP packet into `packetBuffer`.
+ *
+ * Returns the packet size, or -1 on failure.
+ */
+ssize_t PacketRingLink::recvPacket(std::vector<uint8_t> &packetBuffer)
+{
+    const uint8_t *packet;
+    ssize_t packetSize = peekPacket(&packet);
+    if (packetSize < 0)
+        return -1;
+
+    if (packetSize > packetBuffer.size())
+    {
+        fprintf(stderr, "Packet receive failed: packet larger than buffer\n");
+        return -1;
+    }
+
+    memcpy(packetBuffer.data(), packet, packetSize);
+    return packetSize;
+}
+
+/**
+ * Points `packet` at the IP packet carried by RX frame `frame`.
+ *
+ * Returns the packet size, or -1 if the frame isn't an IPv4 TCP packet
+ * for us (i.e. should be skipped).
+ */
+ssize_t PacketRingLink::framePacket(struct tpacket3_hdr *frame, const uint8_t **packet)
+{
+    auto *sll = (struct sockaddr_ll*)((uint8_t*)frame + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+    if (sll->sll_pkttype == PACKET_OUTGOING)
+        return -1;
+
+    uint8_t *data = (uint8_t*)frame + frame->tp_net;
+    uint32_t dataSize = frame->tp_snaplen - (frame->tp_net - frame->tp_mac);
+    if (dataSize < sizeof(struct iphdr))
+        return -1;
+
+    struct iphdr *ip = (struct iphdr*)data;
+    if (ip->version != 4 || ip->protocol != IPPROTO_TCP)
+        return -1;
+
+    // strip any Ethernet padding (minimum frame size)
+    uint16_t totLen = ntohs(ip->tot_len);
+    if (totLen > dataSize)
+        return -1;
+
+    *packet = data;
+    return totLen;
+}
+
+/**
+ * Receive a single IP packet without copying it, pointing `packet` at
+ * the packet in the RX ring. The packet stays valid until the next
+ * receive call.
+ *
+ * Anything that isn't an IPv4 TCP packet is skipped.
+ *
+ * Returns the packet size, or -1 on failure.
+ */
+ssize_t PacketRingLink::peekPacket(const uint8_t **packet)
+{
+    while (1)
+    {
+        struct tpacket3_hdr *frame = nextRxFrame();
+        if (frame == nullptr)
+            return -1;
+
+        ssize_t packetSize = framePacket(frame, packet);
+        if (packetSize < 0)
+            continue;
+
+        stats.rxPackets++;
+        return packetSize;
+    }
+}
+
+/**
+ * Receive up to `maxPackets` IP packets into `packets`, without copying
+ * them, blocking only until the first one arrives.
+ *
+ * NOTE:
+ *
+ * A batch never spans RX blocks, as the current block is only returned
+ * to the kernel on the next receive call.
+ *
+ * Returns num. packets received, or -1 on failure.
+ */
+int PacketRingLink::recvBatch(LinkPacket *packets, int maxPackets)
+{
+    // with a poll timeout, only wait (in poll()) if no block is ready
+    if (pollTimeoutMs >= 0 && rxPacketsLeft == 0)
+    {
+        if (rxFrame != nullptr)
+            releaseRxBlock();
+
+        auto *block = (struct tpacket_block_desc*)(rxRing + rxBlockIndex * rxReq.tp_block_size);
+        if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+        {
+            stats.rxSyscalls++;
+            int ret = waitReadable(sock);
+            if (ret <= 0)
+                return ret;
+        }
+    }
+
+    const uint8_t *packet;
+    ssize_t packetSize = peekPacket(&packet);
+    if (packetSize < 0)
+        return -1;
+
+    packets[0].data = packet;
+    packets[0].size = packetSize;
+    int n = 1;
+
+    while (n < maxPackets && rxPacketsLeft > 0)
+    {
+        packetSize = framePacket(nextRxFrame(), &packet);
+        if (packetSize < 0)
+            continue;
+
+        packets[n].data = packet;
+        packets[n].size = packetSize;
+        n++;
+    }
+
+    stats.rxPackets += n - 1;
+    return n;
+}
+
+/**
+ * Send the serialised packet `packet` of size `size` to `destAddr`.
+ *
+ * `packet` must carry its own IP header, so `destAddr` is unused.
+ *
+ * Returns num. bytes sent, or -1 on failure.
+ */
+ssize_t PacketRingLink::sendPacket(const uint8_t *packet, size_t size, in_addr_t destAddr)
+{
+    if (queuePacket(packet, size, destAddr) < 0 || flush() < 0)
+        return -1;
+    return size;
+}
+
+/**
+ * Write the serialised packet `packet` of size `size` into the next TX
+ * slot, to be sent on the next flush().
+ *
+ * Returns num. bytes queued, or -1 on failure.
+ */
+ssize_t PacketRingLink::queuePacket(const uint8_t *packet, size_t size, in_addr_t destAddr)
+{
+    size_t dataOffset = TPACKET3_HDRLEN - sizeof(struct sockaddr_ll);
+    size_t frameLen = sizeof(ethHeader) + size;
+    if (dataOffset + frameLen > txReq.tp_frame_size)
+    {
+        fprintf(stderr, "Packet too large for TX ring frame\n");
+        return -1;
+    }
+
+    auto *frame = (struct tpacket3_hdr*)(txRing + txFrameIndex * txReq.tp_frame_size);
+
+    // wait for the kernel to finish with the slot
+    while (1)
+    {
+        uint32_t status = __atomic_load_n(&frame->tp_status, __ATOMIC_ACQUIRE);
+        if (status == TP_STATUS_AVAILABLE)
+            break;
+        if (status & TP_STATUS_WRONG_FORMAT)
+        {
+            fprintf(stderr, "TX ring frame rejected by kernel\n");
+            return -1;
+        }
+
+        // ring full of our own unsent frames - send them first
+        if (txQueued > 0 && flush() < 0)
+            return -1;
+
+        struct pollfd pfd = { sock, POLLOUT | POLLERR, 0 };
+        stats.txSyscalls++;
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+        {
+            perror("poll() failed");
+            return -1;
+        }
+    }
+
+    uint8_t *data = (uint8_t*)frame + dataOffset;
+    memcpy(data, &ethHeader, sizeof(ethHeader));
+    memcpy(data + sizeof(ethHeader), packet, size);
+
+    frame->tp_len = frameLen;
+    frame->tp_snaplen = frameLen;
+    frame->tp_next_offset = 0;
+    __atomic_store_n(&frame->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+    txFrameIndex = (txFrameIndex + 1) % txReq.tp_frame_nr;
+    txQueued++;
+    return size;
+}
+
+/**
+ * Kick the kernel to transmit all queued TX slots with a single send().
+ *
+ * Returns num. packets sent, or -1 on failure.
+ */
+int PacketRingLink::flush()
+{
+    if (txQueued == 0)
+        return 0;
+
+    int queued = txQueued;
+    txQueued = 0;
+
+    stats.txSyscalls++;
+    if (send(sock, NULL, 0, 0) < 0)
+    {
+        perror("send() failed");
+        return -1;
+    }
+
+    stats.txPackets += queued;
+    return queued;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+#include "link.hpp"
+
+/**
+ * AF_PACKET backend using TPACKET_V3 memory-mapped rings.
+ *
+ * RX is a block-based ring: the kernel fills whole blocks of frames and
+ * hands each block over at once, so we walk every frame of a block without
+ * any per-packet syscalls (we only poll() once we run out of ready blocks).
+ *
+ * TX is a frame-based ring: outgoing frames are written straight into a ring
+ * slot (queuePacket), and a single send() asks the kernel to transmit all
+ * pending slots (flush).
+ *
+ * As we sit below the IP layer, we build our own Ethernet header, using the
+ * interface's MAC as the source and `LinkConfig::peerMac` as the destination.
+ *
+ * To exercise it over a veth pair in a network namespace, e.g.
+ *
+ *      ip netns add rackns
+ *      ip link add rack0 type veth peer name rack1 netns rackns
+ *      ip link set rack0 up
+ *      ip -n rackns link set rack1 up
+ *
+ * and run one end on `rack0` and the other (via `ip netns exec rackns`) on
+ * `rack1`. Leave both ends without IP addresses, so neither kernel stack
+ * claims (and RSTs) our traffic.
+ */
+class PacketRingLink : public LinkBackend
+{
+public:
+    PacketRingLink(const std::string &interfaceName, const std::string &peerMac);
+    ~PacketRingLink();
+
+    ssize_t recvPacket(std::vector<uint8_t> &packetBuffer) override;
+    ssize_t peekPacket(const uint8_t **packet) override;
+    ssize_t sendPacket(const uint8_t *packet, size_t size, in_addr_t destAddr) override;
+    int recvBatch(LinkPacket *packets, int maxPackets) override;
+    ssize_t queuePacket(const uint8_t *packet, size_t size, in_addr_t destAddr) override;
+    int flush() override;
+    bool setQueue(uint32_t queueIndex, uint32_t numQueues) override;
+    bool requiresIpHeader() override { return true; }
+    std::string name() override { return "packet"; }
+
+private:
+    int sock;
+    unsigned int ifIndex;
+
+    /* mmap'd RX ring, immediately followed by the TX ring */
+    uint8_t *ring;
+    size_t ringSize;
+
+    /* RX ring layout */
+    struct tpacket_req3 rxReq;
+    uint8_t *rxRing;
+    uint32_t rxBlockIndex;                      // block we are currently walking
+    uint32_t rxPacketsLeft;                     // frames left in the current block
+    struct tpacket3_hdr *rxFrame;               // next frame of the current block
+
+    /* TX ring layout */
+    struct tpacket_req3 txReq;
+    uint8_t *txRing;
+    uint32_t txFrameIndex;                      // next TX slot to fill
+    uint32_t txQueued;                          // slots filled since the last flush
+
+    /* Ethernet header prepended to each outgoing packet */
+    struct ethhdr ethHeader;
+
+    /**
+     * Opens the AF_PACKET socket, sets up and maps its rings, and binds
+     * it to `interfaceName`.
+     */
+    int initialisePacketSocket(const std::string &interfaceName);
+
+    /**
+     * Builds the Ethernet header template from the interface's MAC and
+     * `peerMac` (defaults to broadcast).
+     */
+    bool initialiseEthHeader(const std::string &interfaceName, const std::string &peerMac);
+
+    /**
+     * Returns the next received frame, waiting for the kernel to retire
+     * a block if none are ready.
+     */
+    struct tpacket3_hdr *nextRxFrame();
+
+    /**
+     * Returns the current RX block to the kernel, and moves on to the next.
+     */
+    void releaseRxBlock();
+
+    /**
+     * Joins the fanout group steering packets to the engine pinned to the
+     * core they were received on.
+     */
+    bool joinCpuFanout();
+
+    /**
+     * Points `packet` at the IP packet carried by RX frame `frame`.
+     *
+     * Returns the packet size, or -1 if the frame should be skipped.
+     */
+    ssize_t framePacket(struct tpacket3_hdr *frame, const uint8_t **packet);
+};
@@ -0,0 +1,678 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+#include <stdexcept>
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "pcap_link.hpp"
+
+#include "rss.hpp"
+
+#include "config.hpp"
+#include "utils.hpp"
+
+/* pcap magic numbers (microsecond / nanosecond timestamps) */
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+
+/* pcapng block types */
+#define PCAPNG_SECTION_HEADER 0x0a0d0d0a
+#define PCAPNG_INTERFACE_DESC 0x00000001
+#define PCAPNG_PACKET 0x00000002
+#define PCAPNG_SIMPLE_PACKET 0x00000003
+#define PCAPNG_ENHANCED_PACKET 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_OPT_IF_TSRESOL 9
+
+/* link types */
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_LINUX_SLL2 276
+
+namespace
+{
+    uint16_t read16(const uint8_t *p, bool swap)
+    {
+        uint16_t v;
+        memcpy(&v, p, sizeof(v));
+        return swap ? __builtin_bswap16(v) : v;
+    }
+
+    uint32_t read32(const uint8_t *p, bool swap)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return swap ? __builtin_bswap32(v) : v;
+    }
+
+    /**
+     * pcapng interface, as described by its IDB
+     */
+    struct PcapngInterface
+    {
+        uint32_t linkType;
+
+        /* timestamp units per second */
+        uint64_t unitsPerSec;
+    };
+
+    /**
+     * Converts `units` timestamp units (`unitsPerSec` per second) to ns.
+     */
+    uint64_t unitsToNs(uint64_t units, uint64_t unitsPerSec)
+    {
+        return (units / unitsPerSec) * 1000000000ULL
+             + (units % unitsPerSec) * 1000000000ULL / unitsPerSec;
+    }
+}
+
+////////////////////////////////////////////
+// PcapLink methods
+////////////////////////////////////////////
+PcapLink::PcapLink(const std::string &path, bool timed, uint32_t loops)
+{
+    this->timed = timed;
+    this->loops = loops ? loops : 1;
+    this->cursor = 0;
+    this->loopsDone = 0;
+    this->replayStart = 0;
+    this->loopStart = 0;
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Failed to open capture file");
+        throw std::runtime_error("Failed to open capture: " + path);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < 4)
+    {
+        close(fd);
+        throw std::runtime_error("Empty capture: " + path);
+    }
+
+    this->fileSize = st.st_size;
+    this->file = (uint8_t*)mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (this->file == MAP_FAILED)
+    {
+        perror("Failed capture mmap");
+        throw std::runtime_error("Failed to map capture: " + path);
+    }
+
+    uint32_t magic = read32(file, false);
+    bool loaded = magic == PCAPNG_SECTION_HEADER ? loadPcapng() : loadPcap();
+    if (!loaded)
+    {
+        munmap(file, fileSize);
+        throw std::runtime_error("Malformed capture: " + path);
+    }
+
+    std::cout << "Loaded " << records.size() << " TCP packets from " << path << std::endl;
+}
+
+PcapLink::~PcapLink()
+{
+    munmap(file, fileSize);
+}
+
+/**
+ * Indexes a classic pcap file.
+ *
+ * Returns false if the file is malformed.
+ */
+bool PcapLink::loadPcap()
+{
+    if (fileSize < 24)
+        return false;
+
+    // magic tells both byte order and timestamp resolution
+    uint32_t magic = read32(file, false);
+    bool swap;
+    bool nanos;
+    if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS)
+        swap = false;
+    else if (__builtin_bswap32(magic) == PCAP_MAGIC_US || __builtin_bswap32(magic) == PCAP_MAGIC_NS)
+        swap = true;
+    else
+        return false;
+    nanos = read32(file, swap) == PCAP_MAGIC_NS;
+
+    uint32_t linkType = read32(file + 20, swap) & 0x0fffffff;
+
+    size_t offset = 24;
+    while (offset + 16 <= fileSize)
+    {
+        const uint8_t *hdr = file + offset;
+        uint64_t secs = read32(hdr, swap);
+        uint64_t frac = read32(hdr + 4, swap);
+        uint32_t capLen = read32(hdr + 8, swap);
+
+        offset += 16;
+        if (capLen > fileSize - offset)
+            break;  // truncated last record
+
+        uint64_t timestamp = secs * 1000000000ULL + (nanos ? frac : frac * 1000);
+        addFrame(file + offset, capLen, linkType, timestamp);
+        offset += capLen;
+    }
+    return true;
+}
+
+/**
+ * Indexes a pcapng file.
+ *
+ * Each section (SHB) has its own byte order and interfaces (IDBs); packets
+ * (EPB, SPB, obsolete PB) refer to the interfaces of their section.
+ *
+ * Returns false if the file is malformed.
+ */
+bool PcapLink::loadPcapng()
+{
+    std::vector<PcapngInterface> interfaces;
+    bool swap = false;
+
+    size_t offset = 0;
+    while (offset + 12 <= fileSize)
+    {
+        const uint8_t *block = file + offset;
+        uint32_t type = read32(block, false);
+
+        // the SHB sets the byte order of its whole section
+        if (type == PCAPNG_SECTION_HEADER)
+        {
+            uint32_t byteOrder = read32(block + 8, false);
+            if (byteOrder == PCAPNG_BYTE_ORDER_MAGIC)
+                swap = false;
+            else if (__builtin_bswap32(byteOrder) == PCAPNG_BYTE_ORDER_MAGIC)
+                swap = true;
+            else
+                return false;
+            interfaces.clear();
+        }
+        else
+            type = read32(block, swap);
+
+        uint32_t length = read32(block + 4, swap);
+        if (length < 12 || length % 4 || length > fileSize - offset)
+            return offset > 0;  // truncated last block
+
+        const uint8_t *body = block + 8;
+        uint32_t bodyLen = length - 12;
+
+        switch (type)
+        {
+            case PCAPNG_INTERFACE_DESC:
+            {
+                if (bodyLen < 8)
+                    return false;
+
+                PcapngInterface iface;
+                iface.linkType = read16(body, swap);
+                iface.unitsPerSec = 1000000;
+
+                // options: look for if_tsresol
+                uint32_t optOffset = 8;
+                while (optOffset + 4 <= bodyLen)
+                {
+                    uint16_t code = read16(body + optOffset, swap);
+                    uint16_t optLen = read16(body + optOffset + 2, swap);
+                    if (code == 0)
+                        break;
+                    if (code == PCAPNG_OPT_IF_TSRESOL && optLen >= 1)
+                    {
+                        uint8_t resol = body[optOffset + 4];
+                        uint64_t base = (resol & 0x80) ? 2 : 10;
+                        iface.unitsPerSec = 1;
+                        for (int i = 0; i < (resol & 0x7f); i++)
+                            iface.unitsPerSec *= base;
+                    }
+                    optOffset += 4 + ((optLen + 3) & ~3u);
+                }
+                if (iface.unitsPerSec == 0)
+                    iface.unitsPerSec = 1000000;    // resolution overflowed 64 bits
+                interfaces.push_back(iface);
+                break;
+            }
+            case PCAPNG_ENHANCED_PACKET:
+            case PCAPNG_PACKET:
+            {
+                if (bodyLen < 20)
+                    return false;
+
+                uint32_t ifId = type == PCAPNG_ENHANCED_PACKET ? read32(body, swap)
+                                                                : read16(body, swap);
+                uint64_t units = ((uint64_t)read32(body + 4, swap) << 32) | read32(body + 8, swap);
+                uint32_t capLen = read32(body + 12, swap);
+                if (ifId >= interfaces.size() || capLen > bodyLen - 20)
+                    return false;
+
+                PcapngInterface &iface = interfaces[ifId];
+                addFrame(body + 20, capLen, iface.linkType, unitsToNs(units, iface.unitsPerSec));
+                break;
+            }
+            case PCAPNG_SIMPLE_PACKET:
+            {
+                if (bodyLen < 4 || interfaces.empty())
+                    return false;
+
+                // no timestamp (nor captured length) - replays at full speed
+                uint32_t capLen = std::min(read32(body, swap), bodyLen - 4);
+                addFrame(body + 4, capLen, interfaces[0].linkType, 0);
+                break;
+            }
+            default:
+                break;  // name resolution, stats, custom ... - not needed
+        }
+
+        offset += length;
+    }
+    return true;
+}
+
+/**
+ * Adds the IPv4 TCP packet carried by link-layer frame `frame`
+ * (of link type `linkType`), if any, to the records.
+ */
+void PcapLink::addFrame(const uint8_t *frame, uint32_t size, uint32_t linkType, uint64_t timestamp)
+{
+    uint32_t headerLen;
+    switch (linkType)
+    {
+        case LINKTYPE_RAW:
+        case LINKTYPE_IPV4:
+            headerLen = 0;
+            break;
+        case LINKTYPE_NULL:
+            // host-order address family of the capturing machine
+            if (size < 4 || (read32(frame, false) != AF_INET &&
+                             read32(frame, true) != AF_INET))
+                return;
+            headerLen = 4;
+            break;
+        case LINKTYPE_ETHERNET:
+        {
+            if (size < 14)
+                return;
+            headerLen = 14;
+            uint16_t etherType = read16(frame + 12, false);
+            if (etherType == htons(0x8100) && size >= 18)
+            {
+                // 802.1Q tag
+                etherType = read16(frame + 16, false);
+                headerLen = 18;
+            }
+            if (etherType != htons(0x0800))
+                return;
+            break;
+        }
+        case LINKTYPE_LINUX_SLL:
+            if (size < 16 || read16(frame + 14, false) != htons(0x0800))
+                return;
+            headerLen = 16;
+            break;
+        case LINKTYPE_LINUX_SLL2:
+            if (size < 20 || read16(frame, false) != htons(0x0800))
+                return;
+            headerLen = 20;
+            break;
+        default:
+            return;
+    }
+
+    const uint8_t *packet = frame + headerLen;
+    uint32_t packetSize = size - headerLen;
+    if (packetSize < sizeof(struct iphdr))
+        return;
+
+    const struct iphdr *ipHeader = (const struct iphdr*)packet;
+    if (ipHeader->version != 4 || ipHeader->protocol != IPPROTO_TCP)
+        return;
+
+    // drop Ethernet padding
+    uint32_t totalLen = ntohs(ipHeader->tot_len);
+    if (totalLen >= ipHeader->ihl * 4 && totalLen < packetSize)
+        packetSize = totalLen;
+
+    records.push_back({ packet, packetSize, timestamp });
+}
+
+/**
+ * Receive a single IP packet into `packetBuffer`.
+ *
+ * Returns the packet size, or -1 on failure (or end of replay).
+ */
+ssize_t PcapLink::recvPacket(std::vector<uint8_t> &packetBuffer)
+{
+    LinkPacket packet;
+    int n;
+    while ((n = recvBatch(&packet, 1)) == 0)
+        ;
+    if (n < 0)
+        return -1;
+
+    if (packet.size > packetBuffer.size())
+    {
+        fprintf(stderr, "Packet receive failed: packet larger than buffer\n");
+        return -1;
+    }
+
+    memcpy(packetBuffer.data(), packet.data, packet.size);
+    return packet.size;
+}
+
+/**
+ * Keeps only the records of flows RSS steers to queue `queueIndex` (of
+ * `numQueues`), so engines replaying the same capture split it by flow,
+ * as a NIC would.
+ */
+bool PcapLink::setQueue(uint32_t queueIndex, uint32_t numQueues)
+{
+    auto otherQueue = [&](const PcapRecord &record) {
+        const struct iphdr *ip = (const struct iphdr*)record.data;
+        if (record.size < ip->ihl * 4 + 4u)
+            return queueIndex != 0;
+
+        uint16_t ports[2];
+        memcpy(ports, record.data + ip->ihl * 4, sizeof(ports));
+
+        uint32_t hash = Rss::hash(ip->saddr, ip->daddr, ntohs(ports[0]), ntohs(ports[1]));
+        return Rss::queue(hash, numQueues) != queueIndex;
+    };
+
+    records.erase(std::remove_if(records.begin(), records.end(), otherQueue), records.end());
+    return true;
+}
+
+/**
+ * Returns the monotonic time (ns) `record` is due in the current pass,
+ * i.e. its offset from the first packet of the capture.
+ *
+ * NOTE: packets captured out of timestamp order are due immediately.
+ */
+uint64_t PcapLink::replayTime(const PcapRecord &record)
+{
+    uint64_t firstTimestamp = records[0].timestamp;
+    if (record.timestamp < firstTimestamp)
+        return loopStart;
+    return loopStart + (record.timestamp - firstTimestamp);
+}
+
+/**
+ * Receive the next (up to `maxPackets`) packets of the capture into
+ * `packets`, without copying them. In timed mode, waits for the first
+ * one to be due, and only returns due packets.
+ *
+ * Returns num. packets received, or -1 once the replay is over.
+ */
+int PcapLink::recvBatch(LinkPacket *packets, int maxPackets)
+{
+    uint64_t now = TimeUtils::getMonotonicTimeNs();
+    if (replayStart == 0)
+        replayStart = loopStart = now;
+
+    if (cursor == records.size())
+    {
+        if (++loopsDone >= loops || records.empty())
+        {
+            uint64_t elapsed = now - replayStart;
+            uint64_t replayed = stats.rxPackets;
+            std::cout << "Replay finished: " << replayed << " packets in "
+                      << elapsed / 1000 << " us ("
+                      << (replayed ? elapsed / replayed : 0) << " ns/packet)" << std::endl;
+            return -1;
+        }
+        cursor = 0;
+        loopStart = now;
+    }
+
+    if (timed)
+    {
+        uint64_t dueAt = replayTime(records[cursor]);
+        if (pollTimeoutMs >= 0 && dueAt > now + (uint64_t)pollTimeoutMs * 1000000)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(pollTimeoutMs));
+            return 0;
+        }
+        if (dueAt > now)
+        {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(dueAt - now));
+            now = TimeUtils::getMonotonicTimeNs();
+        }
+
+        int n = 0;
+        while (n < maxPackets && cursor < records.size() &&
+               replayTime(records[cursor]) <= now)
+        {
+            packets[n].data = records[cursor].data;
+            packets[n].size = records[cursor].size;
+            cursor++;
+            n++;
+        }
+        stats.rxPackets += n;
+        return n;
+    }
+
+    int n = 0;
+    while (n < maxPackets && cursor < records.size())
+    {
+        packets[n].data = records[cursor].data;
+        packets[n].size = records[cursor].size;
+        cursor++;
+        n++;
+    }
+    stats.rxPackets += n;
+    return n;
+}
+
+/**
+ * Drops the serialised packet `packet` (there is no one to send it to).
+ *
+ * Returns num. bytes "sent".
+ */
+ssize_t PcapLink::sendPacket(const uint8_t *packet, size_t size, in_addr_t destAddr)
+{
+    stats.txPackets++;
+    return size;
+}
+
+////////////////////////////////////////////
+// PcapWriter methods
+////////////////////////////////////////////
+PcapWriter::PcapWriter(const std::string &path)
+{
+    file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        perror("Failed to open capture file");
+        throw std::runtime_error("Failed to open capture: " + path);
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+
+    struct
+    {
+        uint32_t magic;
+        uint16_t versionMajor;
+        uint16_t versionMinor;
+        int32_t thisZone;
+        uint32_t sigFigs;
+        uint32_t snapLen;
+        uint32_t linkType;
+    } header = { PCAP_MAGIC_NS, 2, 4, 0, 0, MTU, LINKTYPE_RAW };
+
+    fwrite(&header, sizeof(header), 1, file);
+}
+
+PcapWriter::~PcapWriter()
+{
+    fclose(file);
+}
+
+/**
+ * Appends IP packet `packet` of size `size`, timestamped now.
+ */
+void PcapWriter::write(const uint8_t *packet, size_t size)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    uint32_t recordHeader[4] = {
+        (uint32_t)ts.tv_sec, (uint32_t)ts.tv_nsec, (uint32_t)size, (uint32_t)size
+    };
+    fwrite(recordHeader, sizeof(recordHeader), 1, file);
+    fwrite(packet, 1, size, file);
+}
+
+/**
+ * Pushes buffered records to the file.
+ */
+void PcapWriter::flush()
+{
+    fflush(file);
+}
+
+////////////////////////////////////////////
+// CaptureLink methods
+////////////////////////////////////////////
+CaptureLink::CaptureLink(std::unique_ptr<LinkBackend> link, const std::string &path)
+    : link(std::move(link)), writer(path)
+{
+}
+
+/**
+ * Returns the num. leading bytes of outgoing packet `packet` the wrapped
+ * backend doesn't want (i.e. the IP header, if the kernel prepends one).
+ */
+size_t CaptureLink::headerToStrip(const uint8_t *packet)
+{
+    if (link->requiresIpHeader())
+        return 0;
+    return ((const struct iphdr*)packet)->ihl * 4;
+}
+
+/**
+ * Receive a single IP packet into `packetBuffer`, recording it.
+ *
+ * Returns the packet size, or -1 on failure.
+ */
+ssize_t CaptureLink::recvPacket(std::vector<uint8_t> &packetBuffer)
+{
+    ssize_t packetSize = link->recvPacket(packetBuffer);
+    if (packetSize > 0)
+        writer.write(packetBuffer.data(), packetSize);
+    stats = link->stats;
+    return packetSize;
+}
+
+/**
+ * Receive a single IP packet without copying it, recording it.
+ *
+ * Returns the packet size, or -1 on failure.
+ */
+ssize_t CaptureLink::peekPacket(const uint8_t **packet)
+{
+    ssize_t packetSize = link->peekPacket(packet);
+    if (packetSize > 0)
+        writer.write(*packet, packetSize);
+    stats = link->stats;
+    return packetSize;
+}
+
+/**
+ * Receive up to `maxPackets` IP packets into `packets`, recording them.
+ *
+ * Returns num. packets received, or -1 on failure.
+ */
+int CaptureLink::recvBatch(LinkPacket *packets, int maxPackets)
+{
+    int n = link->recvBatch(packets, maxPackets);
+    for (int i = 0; i < n; i++)
+        writer.write(packets[i].data, packets[i].size);
+    stats = link->stats;
+    return n;
+}
+
+/**
+ * Record, then send, the serialised packet `packet` of size `size` to `destAddr`.
+ *
+ * Returns num. bytes sent, or -1 on failure.
+ */
+ssize_t CaptureLink::sendPacket(const uint8_t *packet, size_t size, in_addr_t destAddr)
+{
+    writer.write(packet, size);
+
+    size_t strip = headerToStrip(packet);
+    ssize_t bytesSent = link->sendPacket(packet + strip, size - strip, destAddr);
+    stats = link->stats;
+    return bytesSent;
+}
+
+/**
+ * Record, then queue, the serialised packet `packet` of size `size` to `destAddr`.
+ *
+ * Returns num. bytes queued, or -1 on failure.
+ */
+ssize_t CaptureLink::queuePacket(const uint8_t *packet, size_t size, in_addr_t destAddr)
+{
+    writer.write(packet, size);
+
+    size_t strip = headerToStrip(packet);
+    ssize_t bytesQueued = link->queuePacket(packet + strip, size - strip, destAddr);
+    stats = link->stats;
+    return bytesQueued;
+}
+
+/**
+ * Send all queued packets, and push the batch's records to the file
+ * (so a killed engine still leaves a usable capture behind).
+ *
+ * Returns num. packets sent, or -1 on failure.
+ */
+int CaptureLink::flush()
+{
+    int n = link->flush();
+    writer.flush();
+    stats = link->stats;
+    return n;
+}
+
+/**
+ * Restrict delivery to packets destined to one of the local ports `ports`.
+ *
+ * Returns false on failure.
+ */
+bool CaptureLink::setLocalPorts(const std::vector<uint16_t> &ports)
+{
+    return link->setLocalPorts(ports);
+}
+
+/**
+ * Restrict delivery to queue `queueIndex` (of `numQueues`) of the link's traffic.
+ *
+ * Returns false if the wrapped backend can't be shared.
+ */
+bool CaptureLink::setQueue(uint32_t queueIndex, uint32_t numQueues)
+{
+    return link->setQueue(queueIndex, numQueues);
+}
+
+/**
+ * Sets the max. time (ms) a receive of the wrapped backend waits for packets.
+ */
+void CaptureLink::setPollTimeout(int timeoutMs)
+{
+    link->setPollTimeout(timeoutMs);
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "link.hpp"
+
+/**
+ * IPv4 packet of a loaded capture, referencing the mapped file.
+ */
+struct PcapRecord
+{
+    const uint8_t *data;
+    uint32_t size;
+
+    /* capture timestamp (ns) */
+    uint64_t timestamp;
+};
+
+/**
+ * Capture file replay backend.
+ *
+ * The whole pcap or pcapng file is mapped and indexed up front, keeping
+ * only its IPv4 TCP packets (stripped of their Ethernet / Linux cooked /
+ * loopback headers), so replaying is just walking an array of pointers
+ * into the mapping: received packets are never copied.
+ *
+ * Packets are replayed either at full speed, or at their recorded
+ * timestamps (relative to the first packet). Sent packets are dropped.
+ *
+ * Once the last pass over the file is done, receiving fails, and the
+ * replay rate (i.e. per-packet cost of the engine's receive path) is
+ * reported.
+ */
+class PcapLink : public LinkBackend
+{
+public:
+    PcapLink(const std::string &path, bool timed, uint32_t loops);
+    ~PcapLink();
+
+    ssize_t recvPacket(std::vector<uint8_t> &packetBuffer) override;
+    ssize_t sendPacket(const uint8_t *packet, size_t size, in_addr_t destAddr) override;
+    int recvBatch(LinkPacket *packets, int maxPackets) override;
+    bool setQueue(uint32_t queueIndex, uint32_t numQueues) override;
+    bool requiresIpHeader() override { return true; }
+    std::string name() override { return "pcap"; }
+
+private:
+    /* mapped capture file */
+    uint8_t *file;
+    size_t fileSize;
+
+    std::vector<PcapRecord> records;
+
+    /* replay settings */
+    bool timed;
+    uint32_t loops;
+
+    /* replay progress */
+    size_t cursor;
+    uint32_t loopsDone;
+    uint64_t replayStart;                       // monotonic time (ns) of the first receive
+    uint64_t loopStart;                         // monotonic time (ns) the current pass started
+
+    /**
+     * Indexes a classic pcap file.
+     */
+    bool loadPcap();
+
+    /**
+     * Indexes a pcapng file.
+     */
+    bool loadPcapng();
+
+    /**
+     * Returns the monotonic time (ns) `record` is due in the current pass.
+     */
+    uint64_t replayTime(const PcapRecord &record);
+
+    /**
+     * Adds the IPv4 TCP packet carried by link-layer frame `frame`
+     * (of link type `linkType`), if any, to the records.
+     */
+    void addFrame(const uint8_t *frame, uint32_t size, uint32_t linkType, uint64_t timestamp);
+};
+
+/**
+ * Classic pcap file writer, recording bare IPv4 packets (LINKTYPE_RAW)
+ * with nanosecond timestamps.
+ */
+class PcapWriter
+{
+public:
+    PcapWriter(const std::string &path);
+    ~PcapWriter();
+
+    /**
+     * Appends IP packet `packet` of size `size`, timestamped now.
+     */
+    void write(const uint8_t *packet, size_t size);
+
+    /**
+     * Pushes buffered records to the file.
+     */
+    void flush();
+
+private:
+    FILE *file;
+};
+
+/**
+ * Backend wrapper recording every packet sent or received through the
+ * wrapped backend to a pcap file.
+ *
+ * To record whole IP packets, the engine always hands us packets with
+ * their IP header, which we strip again for backends where the kernel
+ * prepends its own (i.e. the raw socket).
+ */
+class CaptureLink : public LinkBackend
+{
+public:
+    CaptureLink(std::unique_ptr<LinkBackend> link, const std::string &path);
+
+    ssize_t recvPacket(std::vector<uint8_t> &packetBuffer) override;
+    ssize_t peekPacket(const uint8_t **packet) override;
+    ssize_t sendPacket(const uint8_t *packet, size_t size, in_addr_t destAddr) override;
+    int recvBatch(LinkPacket *packets, int maxPackets) override;
+    ssize_t queuePacket(const uint8_t *packet, size_t size, in_addr_t destAddr) override;
+    int flush() override;
+    bool setLocalPorts(const std::vector<uint16_t> &ports) override;
+    bool setQueue(uint32_t queueIndex, uint32_t numQueues) override;
+    void setPollTimeout(int timeoutMs) override;
+    bool requiresIpHeader() override { return true; }
+    std::string name() override { return link->name() + "+capture"; }
+
+private:
+    std::unique_ptr<LinkBackend> link;
+    PcapWriter writer;
+
+    /**
+     * Returns the num. leading bytes of outgoing packet `packet` the
+     * wrapped backend doesn't want (i.e. the IP header, if the kernel
+     * prepends one).
+     */
+    size_t headerToStrip(const uint8_t *packet);
+};
@@ -0,0 +1,95 @@
+#include <cerrno>
+#include <stdexcept>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "readiness.hpp"
+#include "tcp.hpp"
+
+////////////////////////////////////////////
+// ReadinessNotifier methods
+////////////////////////////////////////////
+ReadinessNotifier::ReadinessNotifier()
+{
+    eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd < 0)
+    {
+        perror("eventfd() failed");
+        throw std::runtime_error("Failed readiness notifier creation");
+    }
+}
+
+ReadinessNotifier::~ReadinessNotifier()
+{
+    close(eventFd);
+}
+
+/**
+ * Reports `events` on connection `tcb` (engine thread).
+ */
+void ReadinessNotifier::notify(Tcb &tcb, uint32_t events)
+{
+    // already queued - the application picks the new events up with the rest
+    if (tcb.readyEvents.fetch_or(events, std::memory_order_acq_rel) != 0)
+        return;
+
+    // keep the connection alive until polled
+    tcb.readyRef = tcb.shared_from_this();
+
+    Tcb *next = head.load(std::memory_order_relaxed);
+    do
+    {
+        tcb.readyNext = next;
+    }
+    while (!head.compare_exchange_weak(next, &tcb, std::memory_order_release,
+                                       std::memory_order_relaxed));
+
+    // the list turned non-empty: a new edge
+    if (!next)
+    {
+        uint64_t one = 1;
+        if (write(eventFd, &one, sizeof(one)) < 0)
+            perror("eventfd write failed");
+    }
+}
+
+/**
+ * Moves up to `maxEvents` ready connections, oldest first, into `events`
+ * (application thread).
+ *
+ * Returns num. ready connections moved, 0 once there are none left.
+ */
+int ReadinessNotifier::poll(ReadyEvent *events, int maxEvents)
+{
+    if (!taken)
+    {
+        // reset the eventfd before taking the list, so a connection queued after we do signals afresh
+        uint64_t count;
+        if (read(eventFd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            perror("eventfd read failed");
+
+        // reverse the list, to report connections in the order they became ready
+        Tcb *tcb = head.exchange(nullptr, std::memory_order_acquire);
+        while (tcb)
+        {
+            Tcb *next = tcb->readyNext;
+            tcb->readyNext = taken;
+            taken = tcb;
+            tcb = next;
+        }
+    }
+
+    int n = 0;
+    while (n < maxEvents && taken)
+    {
+        Tcb *tcb = taken;
+        taken = tcb->readyNext;
+
+        // done with the list node before the engine may queue it again
+        events[n].tcb = std::move(tcb->readyRef);
+        events[n].events = tcb->readyEvents.exchange(0, std::memory_order_acq_rel);
+        n++;
+    }
+    return n;
+}
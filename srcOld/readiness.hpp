@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+struct Tcb;
+
+/**
+ * Readiness of a connection, as reported to the application.
+ */
+struct ReadyEvent
+{
+    enum Events : uint32_t
+    {
+        READABLE = 1 << 0,  // bytes arrived in the receive buffer (or, for a listener, a connection to accept)
+        WRITABLE = 1 << 1,  // established, or room was made in the send buffer
+        ERROR = 1 << 2,     // the connection failed: its handshake, or it was reset (by the peer, or as retransmissions gave up)
+        HANGUP = 1 << 3     // the peer closed the connection (FIN), or it was aborted or reset
+    };
+
+    std::shared_ptr<Tcb> tcb;
+    uint32_t events;
+};
+
+/**
+ * Edge-triggered readiness notifications of one engine's connections, for
+ * an application's own event loop (epoll, poll, ...).
+ *
+ * The engine queues each connection that becomes ready on a lock-free list
+ * (intrusively, through the TCB, so a connection is queued once however
+ * many events it gathers before the application looks), and signals the
+ * notifier's eventfd as the list turns non-empty. The application watches
+ * the eventfd (e.g. EPOLLIN | EPOLLET) and, once it fires, drains the list
+ * with poll() until it returns 0, as it would read a socket until EAGAIN.
+ *
+ * One engine thread notifies, and one application thread polls.
+ */
+class ReadinessNotifier
+{
+public:
+    ReadinessNotifier();
+    ~ReadinessNotifier();
+
+    ReadinessNotifier(const ReadinessNotifier&) = delete;
+    ReadinessNotifier &operator=(const ReadinessNotifier&) = delete;
+
+    /**
+     * Returns the eventfd to watch for readability.
+     */
+    int fd() const { return eventFd; }
+
+    /**
+     * Reports `events` on connection `tcb` (engine thread).
+     */
+    void notify(Tcb &tcb, uint32_t events);
+
+    /**
+     * Moves up to `maxEvents` ready connections, oldest first, into
+     * `events` (application thread).
+     *
+     * Returns num. ready connections moved, 0 once there are none left.
+     */
+    int poll(ReadyEvent *events, int maxEvents);
+
+private:
+    int eventFd;
+
+    /* most recently queued connection (the list runs newest to oldest) */
+    std::atomic<Tcb*> head{nullptr};
+
+    /* connections taken off the list but not yet polled, oldest first (application thread) */
+    Tcb *taken = nullptr;
+};
@@ -0,0 +1,79 @@
+#include <cstdint>
+#include <cstring>
+#include <netinet/in.h>
+
+#include "rss.hpp"
+
+#include "config.hpp"
+
+/* size (bytes) of the TCP/IPv4 hash input */
+#define RSS_INPUT_SIZE 12
+
+namespace
+{
+    /**
+     * Default (Microsoft) RSS key, as used by most NIC drivers.
+     */
+    const uint8_t rssKey[40] = {
+        0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+        0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+        0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+        0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+        0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+    };
+
+    /**
+     * Toeplitz hash, one lookup per input byte.
+     *
+     * Each set input bit XORs in the 32-bit key window starting at that
+     * bit, so the contribution of a whole byte at a given input position
+     * is fixed by its value, and can be precomputed.
+     */
+    struct ToeplitzTable
+    {
+        uint32_t table[RSS_INPUT_SIZE][256];
+
+        ToeplitzTable()
+        {
+            for (int pos = 0; pos < RSS_INPUT_SIZE; pos++)
+            {
+                // key bits [8 * pos, 8 * pos + 40), i.e. the windows of the byte's 8 bits
+                uint64_t key = 0;
+                for (int i = 0; i < 5; i++)
+                    key = (key << 8) | rssKey[pos + i];
+
+                for (int value = 0; value < 256; value++)
+                {
+                    uint32_t result = 0;
+                    for (int bit = 0; bit < 8; bit++)
+                    {
+                        if (value & (0x80 >> bit))
+                            result ^= (uint32_t)(key >> (8 - bit));
+                    }
+                    table[pos][value] = result;
+                }
+            }
+        }
+    };
+}
+
+uint32_t Rss::hash(in_addr_t saddr, in_addr_t daddr, uint16_t sourcePort, uint16_t destPort)
+{
+    static const ToeplitzTable toeplitz;
+
+    uint8_t input[RSS_INPUT_SIZE];
+    uint16_t ports[2] = { htons(sourcePort), htons(destPort) };
+    memcpy(input, &saddr, 4);
+    memcpy(input + 4, &daddr, 4);
+    memcpy(input + 8, ports, 4);
+
+    uint32_t result = 0;
+    for (int pos = 0; pos < RSS_INPUT_SIZE; pos++)
+        result ^= toeplitz.table[pos][input[pos]];
+    return result;
+}
+
+uint32_t Rss::queue(uint32_t hash, uint32_t numQueues)
+{
+    return (hash % RSS_INDIRECTION_TABLE_SIZE) % numQueues;
+}
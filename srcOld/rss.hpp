@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <netinet/ip.h>
+
+/**
+ * Receive side scaling (RSS) compatible flow steering.
+ *
+ * Flows are hashed with the Toeplitz hash NICs use for RSS, over the same
+ * input (source address, destination address, source port, destination
+ * port, all network order) and with the same default key, so a NIC left
+ * at its defaults spreads flows over its queues exactly as the engines
+ * partition them.
+ */
+namespace Rss
+{
+    /**
+     * Returns the Toeplitz hash of the TCP/IPv4 4-tuple of a packet from
+     * `saddr`:`sourcePort` to `daddr`:`destPort` (addresses network order,
+     * ports host order).
+     */
+    uint32_t hash(in_addr_t saddr, in_addr_t daddr, uint16_t sourcePort, uint16_t destPort);
+
+    /**
+     * Returns the queue (of `numQueues`) a default RSS indirection table
+     * (i.e. entry i holding queue i mod `numQueues`) maps hash `hash` to.
+     */
+    uint32_t queue(uint32_t hash, uint32_t numQueues);
+}
@@ -0,0 +1,198 @@
+#include <string.h>
+#include <cstddef>
+#include <cstdio>
+#include <algorithm>
+#include <netinet/in.h>
+
+#include "segmentation.hpp"
+
+#include "config.hpp"
+#include "ip.hpp"
+#include "tcp.hpp"
+#include "link.hpp"
+
+/* offsets of the TCP data offset and flags bytes */
+#define TCP_DOFF_OFFSET 12
+#define TCP_FLAGS_OFFSET 13
+
+/* TCP flags (of the flags byte) only the last packet of a super-segment carries */
+#define TCP_FLAGS_LAST_ONLY 0x09    // FIN | PSH
+
+namespace
+{
+    /**
+     * Adds the 16-bit words of `data` (of size `size`) to one's complement
+     * sum `sum`, unfolded.
+     */
+    uint64_t addWords(const uint8_t *data, size_t size, uint64_t sum)
+    {
+        size_t i = 0;
+        for (; i + 4 <= size; i += 4)
+        {
+            uint32_t words;
+            memcpy(&words, data + i, sizeof(words));
+            sum += words;
+        }
+        for (; i + 2 <= size; i += 2)
+        {
+            uint16_t word;
+            memcpy(&word, data + i, sizeof(word));
+            sum += word;
+        }
+        if (i < size)
+        {
+            uint16_t word = 0;
+            memcpy(&word, data + i, 1);
+            sum += word;
+        }
+        return sum;
+    }
+
+    /**
+     * Folds one's complement sum `sum` to 16 bits.
+     */
+    uint16_t fold(uint64_t sum)
+    {
+        while (sum >> 16)
+            sum = (sum & 0xffff) + (sum >> 16);
+        return (uint16_t)sum;
+    }
+
+    /**
+     * Updates (network order) checksum `checksum` for a (network order)
+     * 16-bit field changing from `from` to `to` (RFC 1624, eqn. 3).
+     */
+    uint16_t updateChecksum(uint16_t checksum, uint16_t from, uint16_t to)
+    {
+        uint32_t sum = (uint16_t)~checksum + (uint16_t)~from + to;
+        return ~fold(sum);
+    }
+}
+
+////////////////////////////////////////////
+// Segmenter methods
+////////////////////////////////////////////
+Segmenter::Segmenter()
+{
+}
+
+/**
+ * Slices the super-segment of headers `headers` (of size `headerSize`) and
+ * payload `payload` (of size `payloadSize`) into packets carrying at most
+ * `mss` payload bytes each, queuing them on `link` to `destAddr`.
+ *
+ * Returns num. packets queued, or -1 on failure.
+ */
+int Segmenter::segment(const uint8_t *headers, size_t headerSize,
+                       const uint8_t *payload, size_t payloadSize, uint16_t mss,
+                       LinkBackend &link, in_addr_t destAddr)
+{
+    if (headerSize < sizeof(IpHeader) + sizeof(TcpHeader) || mss == 0)
+    {
+        fprintf(stderr, "Malformed super-segment\n");
+        return -1;
+    }
+
+    IpHeader ipTemplate;
+    memcpy(&ipTemplate, headers, sizeof(ipTemplate));
+    size_t ipHeaderSize = ipTemplate.ihl * 4;
+
+    const uint8_t *tcpTemplate = headers + ipHeaderSize;
+    size_t tcpHeaderSize = (tcpTemplate[TCP_DOFF_OFFSET] >> 4) * 4;
+    if (tcpHeaderSize < sizeof(TcpHeader) || ipHeaderSize + tcpHeaderSize != headerSize)
+    {
+        fprintf(stderr, "Malformed super-segment\n");
+        return -1;
+    }
+
+    uint32_t seqTemplate;
+    memcpy(&seqTemplate, tcpTemplate + offsetof(TcpHeader, seqNum), sizeof(seqTemplate));
+    seqTemplate = ntohl(seqTemplate);
+
+    uint8_t flagsTemplate = tcpTemplate[TCP_FLAGS_OFFSET];
+
+    /**
+     * Sum the template's TCP header once - with its checksum, sequence
+     * number, and flags word zeroed, as those are added per packet - plus
+     * the constant part of the pseudo-header.
+     */
+    uint8_t header[60];
+    memcpy(header, tcpTemplate, tcpHeaderSize);
+    memset(header + offsetof(TcpHeader, seqNum), 0, sizeof(uint32_t));
+    memset(header + TCP_DOFF_OFFSET, 0, sizeof(uint16_t));
+    memset(header + offsetof(TcpHeader, checksum), 0, sizeof(uint16_t));
+
+    uint64_t headerSum = addWords(header, tcpHeaderSize, 0);
+    headerSum += (ipTemplate.saddr & 0xffff) + (ipTemplate.saddr >> 16);
+    headerSum += (ipTemplate.daddr & 0xffff) + (ipTemplate.daddr >> 16);
+    headerSum += htons(IPPROTO_TCP);
+
+    // each packet is stamped straight into a TX slot of the link, headers first
+    bool includeIpHeader = link.requiresIpHeader();
+    uint16_t idTemplate = ntohs(ipTemplate.id);
+
+    int numPackets = 0;
+    size_t offset = 0;
+    do
+    {
+        size_t chunk = std::min<size_t>(mss, payloadSize - offset);
+        bool last = offset + chunk == payloadSize;
+
+        size_t packetSize = (includeIpHeader ? headerSize : tcpHeaderSize) + chunk;
+        uint8_t *slot = link.txSlot(packetSize);
+        if (!slot)
+            return -1;
+
+        uint8_t *ip = slot;
+        uint8_t *tcp = includeIpHeader ? slot + ipHeaderSize : slot;
+        if (includeIpHeader)
+            memcpy(ip, headers, headerSize);
+        else
+            memcpy(tcp, tcpTemplate, tcpHeaderSize);
+
+        // TCP header: sequence number and flags
+        uint32_t seq = htonl(seqTemplate + (uint32_t)offset);
+        memcpy(tcp + offsetof(TcpHeader, seqNum), &seq, sizeof(seq));
+
+        uint8_t flags = last ? flagsTemplate : (flagsTemplate & ~TCP_FLAGS_LAST_ONLY);
+        tcp[TCP_FLAGS_OFFSET] = flags;
+
+        // payload
+        memcpy(tcp + tcpHeaderSize, payload + offset, chunk);
+
+        // TCP checksum: template sum + patched fields + length + payload
+        uint16_t segmentSize = tcpHeaderSize + chunk;
+        uint64_t sum = headerSum;
+        sum += (seq & 0xffff) + (seq >> 16);
+        uint16_t flagsWord;
+        memcpy(&flagsWord, tcp + TCP_DOFF_OFFSET, sizeof(flagsWord));
+        sum += flagsWord;
+        sum += htons(segmentSize);
+        sum = addWords(payload + offset, chunk, sum);
+
+        uint16_t tcpChecksum = ~fold(sum);
+        memcpy(tcp + offsetof(TcpHeader, checksum), &tcpChecksum, sizeof(tcpChecksum));
+
+        if (includeIpHeader)
+        {
+            // IP header: total length and id, patching the template's checksum
+            uint16_t totLen = htons(ipHeaderSize + segmentSize);
+            uint16_t id = htons(idTemplate + numPackets);
+            uint16_t checksum = ipTemplate.checksum;
+            checksum = updateChecksum(checksum, ipTemplate.totLen, totLen);
+            checksum = updateChecksum(checksum, ipTemplate.id, id);
+
+            memcpy(ip + offsetof(IpHeader, totLen), &totLen, sizeof(totLen));
+            memcpy(ip + offsetof(IpHeader, id), &id, sizeof(id));
+            memcpy(ip + offsetof(IpHeader, checksum), &checksum, sizeof(checksum));
+        }
+
+        if (link.queueSlot(packetSize, destAddr) < 0)
+            return -1;
+
+        numPackets++;
+        offset += chunk;
+    } while (offset < payloadSize);
+
+    return numPackets;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <netinet/ip.h>
+
+class LinkBackend;
+
+/**
+ * Software segmentation offload (GSO).
+ *
+ * Rather than serialising one Packet per MSS of data, the engine serialises
+ * a single super-segment (i.e. an IP packet whose TCP payload spans many
+ * MSS), and the segmenter slices it into MSS-sized packets. Its headers
+ * and payload are separate, so the payload is read in place (e.g. from a
+ * connection's send buffer), copied only into each packet.
+ *
+ * Each packet is stamped straight into a TX slot of the link (see
+ * LinkBackend::txSlot()), its headers from the super-segment's (the header
+ * template), patching only what differs per packet: IP total length and id,
+ * TCP sequence number, and the PSH/FIN flags (last packet only).
+ *
+ * Checksums are incremental: the IP checksum is patched from the template's
+ * (RFC 1624), and the TCP checksum starts from the template's header sum
+ * (taken once per super-segment), so per packet we only sum its payload
+ * and the patched fields.
+ */
+class Segmenter
+{
+public:
+    Segmenter();
+
+    /**
+     * Slices the super-segment of serialised IP and TCP headers `headers`
+     * (of size `headerSize`) and payload `payload` (of size `payloadSize`)
+     * into packets carrying at most `mss` payload bytes each, queuing them
+     * on `link` to `destAddr`.
+     *
+     * Packets carry their IP header only if the link requires it.
+     *
+     * Returns num. packets queued, or -1 on failure.
+     */
+    int segment(const uint8_t *headers, size_t headerSize,
+                const uint8_t *payload, size_t payloadSize, uint16_t mss,
+                LinkBackend &link, in_addr_t destAddr);
+};
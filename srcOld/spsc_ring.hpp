@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+/**
+ * Bounded, lock-free single-producer/single-consumer ring.
+ *
+ * Producer and consumer positions live on separate cache lines, and each
+ * side keeps a cached copy of the other's, only reloading it (i.e. taking
+ * a cache miss) once the ring looks full / empty.
+ *
+ * Items are moved in and out of preallocated slots, or written and read
+ * in place (see claim() and peek()), which large items (i.e. packets)
+ * are. Slots are default-initialised, so those of plain types are only
+ * touched (i.e. faulted in) as they're used.
+ */
+template <typename T>
+class SpscRing
+{
+public:
+    SpscRing(uint32_t size)
+        : slots(new T[size])
+    {
+        if (size == 0 || (size & (size - 1)))
+            throw std::runtime_error("SPSC ring size must be a power of two");
+
+        mask = size - 1;
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+        cachedHead = 0;
+        cachedTail = 0;
+        peekPos = 0;
+    }
+
+    /**
+     * Returns slot `i`, e.g. to point a slot at storage of its own before
+     * the ring is used (not thread-safe).
+     */
+    T &slot(uint32_t i)
+    {
+        return slots[i & mask];
+    }
+
+    /**
+     * Moves `item` onto the ring (producer).
+     *
+     * Returns false if the ring is full.
+     */
+    bool push(T &item)
+    {
+        uint64_t pos = tail.load(std::memory_order_relaxed);
+        if (pos - cachedHead > mask)
+        {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (pos - cachedHead > mask)
+                return false;
+        }
+
+        slots[pos & mask] = std::move(item);
+        tail.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Moves the oldest item off the ring into `item` (consumer).
+     *
+     * Returns false if the ring is empty.
+     */
+    bool pop(T &item)
+    {
+        uint64_t pos = head.load(std::memory_order_relaxed);
+        if (pos == cachedTail)
+        {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (pos == cachedTail)
+                return false;
+        }
+
+        item = std::move(slots[pos & mask]);
+        head.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Returns the slot the next item goes into, to write it in place, or
+     * nullptr if the ring is full (producer). The item is pushed by
+     * publish().
+     */
+    T *claim()
+    {
+        uint64_t pos = tail.load(std::memory_order_relaxed);
+        if (pos - cachedHead > mask)
+        {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (pos - cachedHead > mask)
+                return nullptr;
+        }
+        return &slots[pos & mask];
+    }
+
+    /**
+     * Pushes the item written into the slot claim() returned (producer).
+     */
+    void publish()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * Returns the oldest item not yet peeked at, in place, or nullptr if
+     * there is none (consumer). Items peeked at stay in their slots until
+     * release().
+     *
+     * NOTE: not to be mixed with pop().
+     */
+    T *peek()
+    {
+        if (peekPos == cachedTail)
+        {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (peekPos == cachedTail)
+                return nullptr;
+        }
+        return &slots[peekPos++ & mask];
+    }
+
+    /**
+     * Frees the slots of the items peeked at (consumer).
+     */
+    void release()
+    {
+        head.store(peekPos, std::memory_order_release);
+    }
+
+private:
+    std::unique_ptr<T[]> slots;
+    uint32_t mask;
+
+    /* consumer's position (and how far it peeked), and its copy of the producer's */
+    alignas(64) std::atomic<uint64_t> head;
+    uint64_t peekPos;
+    uint64_t cachedTail;
+
+    /* producer's position, and its copy of the consumer's */
+    alignas(64) std::atomic<uint64_t> tail;
+    uint64_t cachedHead;
+};
@@ -1,29 +1,51 @@
 #include <random>
 #include <sstream>
 #include <cassert>
+#include <algorithm>
+#include <functional>
 
 #include "stream.hpp"
 
 #include "utils.hpp"
 #include "crypto.hpp"
+#include "test_utils.hpp"
 
 ////////////////////////////////////////////
 // SendStream methods
 ////////////////////////////////////////////
-SendStream::SendStream(uint32_t bufferCapacity)
+SendStream::SendStream(uint32_t bufferCapacity, bool mirrored)
 {
     // initialise send buffer
-    sendBuffer.initialise(bufferCapacity);
+    sendBuffer.initialise(bufferCapacity, mirrored);
 
+    reset();
+}
+
+/**
+ * Returns the stream to its initial state (with a new ISS), dropping any
+ * bytes in the send buffer.
+ */
+void SendStream::reset()
+{
+    WND = 0; // zero for now, update once we know peer's window
+    MSS = DEFAULT_MSS;
+    initialiseSequence(generateISS());
+}
+
+/**
+ * Start the stream at initial sequence number `ISS`, dropping any bytes
+ * in the send buffer.
+ */
+void SendStream::initialiseSequence(uint32_t ISS)
+{
     // set stream parameters
-    ISS = generateISS();
+    this->ISS = ISS;
     UNA = ISS;
     NXT = ISS + 1;
-    WND = 0; // zero for now, update once we know peer's window
+    MAX = NXT;
 
-    // set r/w pointers
-    sendBuffer.readPos = NXT;
-    sendBuffer.writePos = NXT;
+    // stream offset 0 is the first byte after the SYN (see seqOf())
+    sendBuffer.reset();
 }
 
 /**
@@ -40,7 +62,30 @@ bool SendStream::readPayloadFromSendBuffer(std::vector<uint8_t> &payload)
     }
 
     payload.resize(maxAvailableBytes);
-    sendBuffer.readN(payload, maxAvailableBytes, 0);
+    sendBuffer.readN(payload.data(), maxAvailableBytes);
+    return true;
+}
+
+/**
+ * Takes in the peer's acknowledgement of the sequence numbers before
+ * `ackNum`.
+ *
+ * Returns false if `ackNum` is unacceptable.
+ */
+bool SendStream::acknowledge(uint32_t ackNum)
+{
+    // duplicate, or acknowledging sequence numbers not yet sent
+    if ((int32_t)(ackNum - UNA) < 0 || (int32_t)(MAX - ackNum) < 0)
+        return false;
+
+    // acknowledging bytes sent before we went back to resend: the peer held them, so skip them
+    if ((int32_t)(ackNum - NXT) > 0)
+        NXT = ackNum;
+
+    // (our FIN, acknowledged last, isn't in the send buffer)
+    uint32_t acked = ackNum - UNA;
+    UNA = ackNum;
+    sendBuffer.discardN(std::min(acked, sendBuffer.availableToRead()));
     return true;
 }
 
@@ -67,8 +112,8 @@ uint32_t SendStream::generateISS()
      */
     uint32_t unixEpochTime = TimeUtils::getUnixEpochTime();
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    // seeded once per thread: seeding per call costs more than the hash
+    thread_local std::mt19937 gen(std::random_device{}());
     std::uniform_int_distribution<uint32_t> dis(0, UINT32_MAX);
     uint32_t randomOffset = dis(gen);
 
@@ -81,6 +126,7 @@ std::string SendStream::toString()
     std::ostringstream oss;
     oss << "UNA: " << UNA << "\n"
         << "NXT: " << NXT << "\n"
+        << "MAX: " << MAX << "\n"
         << "WND: " << WND << "\n"
         << "ISS: " << ISS << "\n";
 
@@ -90,10 +136,22 @@ std::string SendStream::toString()
 ////////////////////////////////////////////
 // RecvStream methods
 ////////////////////////////////////////////
-RecvStream::RecvStream(uint32_t bufferCapacity)
+RecvStream::RecvStream(uint32_t bufferCapacity, bool mirrored)
 {
     // initialise receive buffer
-    recvBuffer.initialise(bufferCapacity);
+    recvBuffer.initialise(bufferCapacity, mirrored);
+
+    reset();
+}
+
+/**
+ * Returns the stream to its initial state, dropping any bytes in the
+ * receive buffer.
+ */
+void RecvStream::reset()
+{
+    recvBuffer.reset();
+    reassembly.clear();
 
     // for now, set RCV.WND to its max (i.e. available write-space in buffer)
     // TODO: init to be determined by congestion control alg.
@@ -105,22 +163,48 @@ RecvStream::RecvStream(uint32_t bufferCapacity)
 }
 
 /**
- * Write received `payload` to the receive buffer.
+ * Write received payload `payload` (of size `N`), starting at sequence
+ * number `seq`, to the receive buffer, in order or not.
+ *
+ * Returns num. bytes NXT moved by.
  */
-bool RecvStream::writePayloadToRecvBuffer(std::vector<uint8_t> &payload)
+uint32_t RecvStream::writeSegment(uint32_t seq, const uint8_t *payload, uint32_t N)
 {
-    // write segment data
-    if (!recvBuffer.writeN(payload, payload.size(), 0))
+    // drop the bytes already received (i.e. before NXT)...
+    if ((int32_t)(seq - NXT) < 0)
     {
-        std::cout << "Failed recv buffer write: segment payload to large" << std::endl;
-        return false;
+        uint32_t old = NXT - seq;
+        if (old >= N)
+            return 0;
+        seq += old;
+        payload += old;
+        N -= old;
     }
 
-    // update stream state
-    this->NXT = recvBuffer.writePos;
-    this->WND = recvBuffer.availableToWrite();
+    // ...and those beyond the window (i.e. the room in the buffer)
+    uint64_t next = recvBuffer.writeOffset();
+    uint64_t offset = offsetOf(seq);
+    uint32_t room = recvBuffer.availableToWrite();
+    if (offset - next >= room)
+        return 0;
+    N = std::min<uint64_t>(N, room - (offset - next));
 
-    return true;
+    recvBuffer.writeAt(payload, N, offset);
+
+    // out of order: held until the hole before it fills (dropped if too many holes)
+    if (offset != next)
+    {
+        reassembly.insert(offset, offset + N);
+        return 0;
+    }
+
+    // in order: publish it, and what was received out of order after it
+    uint32_t advanced = reassembly.takeContiguous(offset + N) - next;
+    recvBuffer.commitN(advanced);
+
+    NXT += advanced;
+    WND = recvBuffer.availableToWrite();
+    return advanced;
 }
 
 std::string RecvStream::toString()
@@ -131,4 +215,348 @@ std::string RecvStream::toString()
         << "IRS: " << IRS << "\n";
 
     return oss.str();
-}
\ No newline at end of file
+}
+
+////////////////////////////////////////////
+// RecvStream tests
+////////////////////////////////////////////
+
+namespace SendStreamTests
+{
+    /* send buffer capacity of the tested streams */
+    const uint32_t CAPACITY = 4096;
+
+    /**
+     * Starts `stream` at ISS `ISS`, its SYN acknowledged, having sent `N`
+     * bytes (left in its send buffer).
+     */
+    void startSending(SendStream &stream, uint32_t ISS, uint32_t N)
+    {
+        stream.initialiseSequence(ISS);
+        stream.UNA = stream.NXT;
+
+        std::vector<uint8_t> bytes(N, 0xab);
+        stream.sendBuffer.writeN(bytes.data(), N);
+        stream.advance(N);
+    }
+
+    void testAcknowledge()
+    {
+        SendStream stream(CAPACITY);
+        startSending(stream, 1000, 300);
+        ASSERT_THAT(stream.NXT == 1301 && stream.MAX == 1301);
+
+        /**
+         * Each acknowledgement drops the bytes it covers
+         */
+        ASSERT_THAT(stream.acknowledge(1101));
+        ASSERT_THAT(stream.UNA == 1101 && stream.sendBuffer.availableToRead() == 200);
+        ASSERT_THAT(!stream.allAcknowledged());
+
+        /**
+         * Duplicates, and acknowledgements of bytes not sent, are refused
+         */
+        ASSERT_THAT(!stream.acknowledge(1100));
+        ASSERT_THAT(!stream.acknowledge(1302));
+        ASSERT_THAT(stream.UNA == 1101 && stream.sendBuffer.availableToRead() == 200);
+
+        // (an acknowledgement of nothing new is a window update)
+        ASSERT_THAT(stream.acknowledge(1101));
+
+        ASSERT_THAT(stream.acknowledge(1301));
+        ASSERT_THAT(stream.sendBuffer.availableToRead() == 0 && stream.allAcknowledged());
+
+        /**
+         * Across the wrap of the sequence space, with our FIN
+         */
+        startSending(stream, 0xffffff00, 0x200);
+        stream.advance(1);
+        ASSERT_THAT(stream.MAX == 0x102);
+        ASSERT_THAT(stream.acknowledge(0x101));
+        ASSERT_THAT(stream.sendBuffer.availableToRead() == 0 && !stream.allAcknowledged());
+        ASSERT_THAT(stream.acknowledge(0x102) && stream.allAcknowledged());
+    }
+
+    void testGoBackPartialAck()
+    {
+        /**
+         * Every byte and our FIN sent, then gone back to resend from UNA
+         * (i.e. retransmission timeout)
+         */
+        SendStream stream(CAPACITY);
+        startSending(stream, 1000, 300);
+        stream.advance(1);
+        ASSERT_THAT(stream.MAX == 1302);
+        stream.NXT = stream.UNA;
+
+        /**
+         * The peer held what followed the lost segment, so acknowledges it
+         * all, skipping NXT past it
+         */
+        ASSERT_THAT(stream.acknowledge(1201));
+        ASSERT_THAT(stream.NXT == 1201 && stream.UNA == 1201);
+        ASSERT_THAT(stream.sendBuffer.availableToRead() == 100);
+
+        /**
+         * Every byte acknowledged, but not our FIN (dropped, as it arrived
+         * out of order): the buffer is empty and UNA == NXT, yet the FIN
+         * still wants resending
+         */
+        ASSERT_THAT(stream.acknowledge(1301));
+        ASSERT_THAT(stream.NXT == 1301 && stream.UNA == 1301);
+        ASSERT_THAT(stream.sendBuffer.availableToRead() == 0);
+        ASSERT_THAT(!stream.allAcknowledged());
+
+        // FIN resent, and acknowledged
+        stream.advance(1);
+        ASSERT_THAT(stream.NXT == stream.MAX);
+        ASSERT_THAT(stream.acknowledge(1302) && stream.allAcknowledged());
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "SendStream Tests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = 
+        {
+            TEST(testAcknowledge),
+            TEST(testGoBackPartialAck)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+    }
+};
+
+namespace RecvStreamTests
+{
+    /* receive buffer capacity of the tested streams */
+    const uint32_t CAPACITY = 4096;
+
+    /**
+     * Returns `N` bytes of a recognisable stream (byte i's value depends
+     * on i).
+     */
+    std::vector<uint8_t> streamBytes(uint32_t N)
+    {
+        std::vector<uint8_t> bytes(N);
+        for (uint32_t i = 0; i < N; i++)
+            bytes[i] = (uint8_t)(i * 7 + i / 256);
+        return bytes;
+    }
+
+    /**
+     * Returns true if the first `N` bytes readable from `stream` are those
+     * of `bytes`.
+     */
+    bool readsBack(RecvStream &stream, std::vector<uint8_t> &bytes, uint32_t N)
+    {
+        std::vector<uint8_t> out(N);
+        return stream.recvBuffer.readN(out.data(), N) &&
+               std::equal(out.begin(), out.end(), bytes.begin());
+    }
+
+    void testInOrderSegments()
+    {
+        RecvStream stream(CAPACITY);
+        stream.NXT = 1000;
+        std::vector<uint8_t> bytes = streamBytes(300);
+
+        /**
+         * Each segment moves NXT (and the write pointer) past it, shrinking
+         * the window
+         */
+        ASSERT_THAT(stream.writeSegment(1000, bytes.data(), 100) == 100);
+        ASSERT_THAT(stream.NXT == 1100);
+        ASSERT_THAT(stream.WND == CAPACITY - 100);
+
+        ASSERT_THAT(stream.writeSegment(1100, bytes.data() + 100, 200) == 200);
+        ASSERT_THAT(stream.NXT == 1300);
+        ASSERT_THAT(stream.WND == CAPACITY - 300);
+        ASSERT_THAT(stream.reassembly.empty());
+
+        ASSERT_THAT(stream.recvBuffer.availableToRead() == 300);
+        ASSERT_THAT(readsBack(stream, bytes, 300));
+    }
+
+    void testTrimsReceivedBytes()
+    {
+        RecvStream stream(CAPACITY);
+        stream.NXT = 1000;
+        std::vector<uint8_t> bytes = streamBytes(300);
+
+        ASSERT_THAT(stream.writeSegment(1000, bytes.data(), 100) == 100);
+
+        /**
+         * A segment wholly received already (i.e. retransmitted) changes
+         * nothing
+         */
+        ASSERT_THAT(stream.writeSegment(1000, bytes.data(), 100) == 0);
+        ASSERT_THAT(stream.writeSegment(1050, bytes.data() + 50, 50) == 0);
+        ASSERT_THAT(stream.NXT == 1100);
+
+        /**
+         * One straddling NXT only adds its new bytes
+         */
+        ASSERT_THAT(stream.writeSegment(1050, bytes.data() + 50, 150) == 100);
+        ASSERT_THAT(stream.NXT == 1200);
+        ASSERT_THAT(stream.recvBuffer.availableToRead() == 200);
+        ASSERT_THAT(readsBack(stream, bytes, 200));
+    }
+
+    void testClampsToWindow()
+    {
+        RecvStream stream(CAPACITY);
+        stream.NXT = 1000;
+        std::vector<uint8_t> bytes = streamBytes(CAPACITY + 500);
+
+        /**
+         * Bytes beyond the room in the buffer are dropped
+         */
+        ASSERT_THAT(stream.writeSegment(1000, bytes.data(), CAPACITY - 100) == CAPACITY - 100);
+        ASSERT_THAT(stream.writeSegment(1000 + CAPACITY - 100, bytes.data() + CAPACITY - 100, 500) == 100);
+        ASSERT_THAT(stream.NXT == 1000 + CAPACITY);
+        ASSERT_THAT(stream.WND == 0);
+
+        /**
+         * With no room, nothing is taken, in order or not
+         */
+        ASSERT_THAT(stream.writeSegment(1000 + CAPACITY, bytes.data(), 100) == 0);
+        ASSERT_THAT(stream.writeSegment(1000 + CAPACITY + 100, bytes.data(), 100) == 0);
+        ASSERT_THAT(stream.reassembly.empty());
+        ASSERT_THAT(readsBack(stream, bytes, CAPACITY));
+
+        /**
+         * Once read, out of order bytes beyond the window are dropped too
+         */
+        stream.WND = stream.recvBuffer.availableToWrite();
+        ASSERT_THAT(stream.WND == CAPACITY);
+        ASSERT_THAT(stream.writeSegment(stream.NXT + CAPACITY, bytes.data(), 100) == 0);
+        ASSERT_THAT(stream.reassembly.empty());
+        ASSERT_THAT(stream.writeSegment(stream.NXT + CAPACITY - 50, bytes.data(), 100) == 0);
+        ASSERT_THAT(stream.reassembly.size() == 1);
+    }
+
+    void testOutOfOrderHoleFill()
+    {
+        /**
+         * Start just before the sequence space wraps, so the segments
+         * straddle it
+         */
+        RecvStream stream(CAPACITY);
+        uint32_t start = 0xffffff00;
+        stream.NXT = start;
+        std::vector<uint8_t> bytes = streamBytes(400);
+
+        /**
+         * Segments past a hole are held, moving nothing
+         */
+        ASSERT_THAT(stream.writeSegment(start + 300, bytes.data() + 300, 100) == 0);
+        ASSERT_THAT(stream.writeSegment(start + 100, bytes.data() + 100, 100) == 0);
+        ASSERT_THAT(stream.reassembly.size() == 2);
+        ASSERT_THAT(stream.NXT == start);
+        ASSERT_THAT(stream.WND == CAPACITY);
+        ASSERT_THAT(stream.recvBuffer.availableToRead() == 0);
+
+        // filling the hole between them merges them, still held
+        ASSERT_THAT(stream.writeSegment(start + 200, bytes.data() + 200, 100) == 0);
+        ASSERT_THAT(stream.reassembly.size() == 1);
+        ASSERT_THAT(stream.NXT == start);
+
+        /**
+         * Filling the first hole releases everything held after it
+         */
+        ASSERT_THAT(stream.writeSegment(start, bytes.data(), 100) == 400);
+        ASSERT_THAT(stream.NXT == start + 400);
+        ASSERT_THAT(stream.WND == CAPACITY - 400);
+        ASSERT_THAT(stream.reassembly.empty());
+
+        ASSERT_THAT(stream.recvBuffer.availableToRead() == 400);
+        ASSERT_THAT(readsBack(stream, bytes, 400));
+    }
+
+    void testTooManyHoles()
+    {
+        RecvStream stream(CAPACITY);
+        stream.NXT = 1000;
+        std::vector<uint8_t> bytes = streamBytes(CAPACITY);
+
+        /**
+         * Hold 10-byte segments, 10 bytes apart, one more than we have
+         * ranges for (i.e. the last is dropped)
+         */
+        for (uint32_t i = 1; i <= TCP_REASSEMBLY_MAX_RANGES + 1; i++)
+            ASSERT_THAT(stream.writeSegment(1000 + 20 * i, bytes.data() + 20 * i, 10) == 0);
+        ASSERT_THAT(stream.reassembly.size() == TCP_REASSEMBLY_MAX_RANGES);
+
+        /**
+         * Each hole filled releases the segment after it
+         */
+        ASSERT_THAT(stream.writeSegment(1000, bytes.data(), 20) == 30);
+        ASSERT_THAT(stream.reassembly.size() == TCP_REASSEMBLY_MAX_RANGES - 1);
+
+        uint32_t last = 20 * TCP_REASSEMBLY_MAX_RANGES;
+        for (uint32_t i = 30; i < last; i += 20)
+            ASSERT_THAT(stream.writeSegment(1000 + i, bytes.data() + i, 10) == 20);
+        ASSERT_THAT(stream.reassembly.empty());
+        ASSERT_THAT(stream.NXT == 1000 + last + 10);
+
+        /**
+         * The dropped segment must come again
+         */
+        uint32_t dropped = 20 * (TCP_REASSEMBLY_MAX_RANGES + 1);
+        ASSERT_THAT(stream.writeSegment(1000 + last + 10, bytes.data() + last + 10, 10) == 10);
+        ASSERT_THAT(stream.NXT == 1000 + dropped);
+        ASSERT_THAT(stream.writeSegment(1000 + dropped, bytes.data() + dropped, 10) == 10);
+
+        ASSERT_THAT(readsBack(stream, bytes, dropped + 10));
+    }
+
+    void testInWindow()
+    {
+        RecvStream stream(CAPACITY);
+        stream.NXT = 0xffffff00;
+        stream.WND = 0x200;
+
+        ASSERT_THAT(stream.inWindow(0xffffff00));
+        ASSERT_THAT(stream.inWindow(0xffffffff));
+        ASSERT_THAT(stream.inWindow(0xff));
+        ASSERT_THAT(!stream.inWindow(0x100));
+        ASSERT_THAT(!stream.inWindow(0xfffffeff));
+        ASSERT_THAT(!stream.inWindow(0x7fffff00));
+
+        /**
+         * A closed window takes in NXT alone
+         */
+        stream.WND = 0;
+        ASSERT_THAT(stream.inWindow(0xffffff00));
+        ASSERT_THAT(!stream.inWindow(0xffffff01));
+        ASSERT_THAT(!stream.inWindow(0xfffffeff));
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "RecvStream Tests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = 
+        {
+            TEST(testInOrderSegments),
+            TEST(testTrimsReceivedBytes),
+            TEST(testClampsToWindow),
+            TEST(testOutOfOrderHoleFill),
+            TEST(testTooManyHoles),
+            TEST(testInWindow)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+    }
+};
@@ -4,6 +4,7 @@
 #include <vector>
 
 #include "buffer.hpp"
+#include "interval_set.hpp"
 
 /**
  * Represents the send stream of the TCP connection.
@@ -13,16 +14,36 @@ struct SendStream
     /* stream parameters */
     uint32_t UNA;       // una pointer (seq nums to ack)
     uint32_t NXT;       // next pointer (seq nums to send)
+    uint32_t MAX;       // highest seq num sent + 1 (NXT, unless gone back to resend)
     uint32_t WND;       // send window
     uint32_t ISS;       // initial send sequence number
+    uint16_t MSS;       // max. segment size (payload bytes per segment)
 
     /* send buffer */
     CircularBuffer sendBuffer;
 
-    /* TOADD: retransmission queue */
+    /**
+     * Bytes stay in the send buffer until acknowledged (i.e. its read
+     * pointer is UNA), so they can be retransmitted.
+     *
+     * The buffer's positions are 64-bit stream offsets, byte 0 being the
+     * one after our SYN: seqOf() maps them to sequence numbers.
+     */
+
+    /* Param constructor (see CircularBuffer for `mirrored`) */
+    SendStream(uint32_t bufferCapacity, bool mirrored = false);
 
-    /* Param constructor */
-    SendStream(uint32_t bufferCapacity);
+    /**
+     * Returns the stream to its initial state (with a new ISS), dropping
+     * any bytes in the send buffer.
+     */
+    void reset();
+
+    /**
+     * Start the stream at initial sequence number `ISS`, dropping any
+     * bytes in the send buffer.
+     */
+    void initialiseSequence(uint32_t ISS);
 
     /**
      * Read into the to-be-sent payload `payload` the maximum number of 
@@ -35,6 +56,39 @@ struct SendStream
      */
     uint32_t generateISS();
 
+    /**
+     * Moves NXT past `N` sent sequence numbers (and MAX with it).
+     */
+    void advance(uint32_t N)
+    {
+        NXT += N;
+        if ((int32_t)(NXT - MAX) > 0)
+            MAX = NXT;
+    }
+
+    /**
+     * Returns the sequence number of the byte at stream offset `offset`.
+     */
+    uint32_t seqOf(uint64_t offset) { return ISS + 1 + (uint32_t)offset; }
+
+    /**
+     * Takes in the peer's acknowledgement of the sequence numbers before
+     * `ackNum`: moves UNA up to it (and NXT, past bytes it acknowledges
+     * that were sent before going back to resend), dropping the
+     * acknowledged bytes from the send buffer.
+     *
+     * Returns false if `ackNum` is unacceptable (i.e. before UNA, or past
+     * what was sent), leaving the stream as it was.
+     */
+    bool acknowledge(uint32_t ackNum);
+
+    /**
+     * Returns true if every sequence number sent is acknowledged (our FIN
+     * included, once sent: it is past the buffer's last byte, so the peer
+     * may acknowledge every byte but not it).
+     */
+    bool allAcknowledged() { return UNA == MAX; }
+
     std::string toString();
 };
 
@@ -48,18 +102,76 @@ struct RecvStream
     uint32_t WND;       // receive window
     uint32_t IRS;       // initial receive sequence number (connection peer's ISS)
 
-    /* recv buffer */
+    /* recv buffer (positions are stream offsets, byte 0 being the one after the peer's SYN) */
     CircularBuffer recvBuffer;
 
     /**
-     * Param constructor
+     * Bytes received out of order sit in the receive buffer, past its
+     * write pointer (i.e. NXT), at the offsets they belong at, their
+     * ranges kept in `reassembly`. Once the hole before them fills, the
+     * write pointer and NXT move over them at once.
      */
-    RecvStream(uint32_t bufferCapacity);
+    IntervalSet reassembly;
 
     /**
-     * Write received `payload` to the receive buffer.
+     * Param constructor (see CircularBuffer for `mirrored`)
      */
-    bool writePayloadToRecvBuffer(std::vector<uint8_t> &payload);
+    RecvStream(uint32_t bufferCapacity, bool mirrored = false);
+
+    /**
+     * Returns the stream to its initial state, dropping any bytes in the
+     * receive buffer.
+     */
+    void reset();
+
+    /**
+     * Write received payload `payload` (of size `N`), starting at sequence
+     * number `seq`, to the receive buffer, in order or not, dropping the
+     * bytes already received or beyond the window.
+     *
+     * Returns num. bytes NXT moved by: those of the payload and, if it
+     * filled a hole, those received out of order after it (0 if out of
+     * order, or none were new).
+     */
+    uint32_t writeSegment(uint32_t seq, const uint8_t *payload, uint32_t N);
+
+    /**
+     * Returns the stream offset of the byte with sequence number `seq`,
+     * taken to be within 2^31 of NXT (i.e. of the receive window).
+     */
+    uint64_t offsetOf(uint32_t seq)
+    {
+        return recvBuffer.writeOffset() + (int64_t)(int32_t)(seq - NXT);
+    }
+
+    /**
+     * Returns true if sequence number `seq` is in the receive window (i.e.
+     * NXT, if the window is closed), as a RST's must be to be taken in.
+     */
+    bool inWindow(uint32_t seq)
+    {
+        return seq == NXT || seq - NXT < WND;
+    }
 
     std::string toString();
-};
\ No newline at end of file
+};
+
+namespace SendStreamTests
+{
+    void testAcknowledge();
+    void testGoBackPartialAck();
+
+    void runAll();
+};
+
+namespace RecvStreamTests
+{
+    void testInOrderSegments();
+    void testTrimsReceivedBytes();
+    void testClampsToWindow();
+    void testOutOfOrderHoleFill();
+    void testTooManyHoles();
+    void testInWindow();
+
+    void runAll();
+};
@@ -0,0 +1,75 @@
+#include "tcb_pool.hpp"
+#include "config.hpp"
+#include "tcp.hpp"
+
+////////////////////////////////////////////
+// TcbPool methods
+////////////////////////////////////////////
+TcbPool::~TcbPool()
+{
+    freeList(cached);
+    freeList(returned.load(std::memory_order_acquire));
+}
+
+/**
+ * Returns a TCB in its initial state, reused if one is free (engine
+ * thread).
+ *
+ * NOTE: the returned reference's control block is still allocated.
+ */
+std::shared_ptr<Tcb> TcbPool::acquire()
+{
+    if (!cached)
+        cached = returned.exchange(nullptr, std::memory_order_acquire);
+
+    Tcb *tcb = cached;
+    if (tcb)
+    {
+        cached = tcb->poolNext;
+        numFree.fetch_sub(1, std::memory_order_relaxed);
+        tcb->reset();
+        reused++;
+    }
+    else
+    {
+        tcb = new Tcb();
+        allocated++;
+    }
+
+    return std::shared_ptr<Tcb>(tcb, Recycler{ shared_from_this() });
+}
+
+/**
+ * Hands `tcb` back to the pool, once the last reference to it is dropped
+ * (any thread).
+ */
+void TcbPool::release(Tcb *tcb)
+{
+    if (numFree.fetch_add(1, std::memory_order_relaxed) >= TCB_POOL_MAX_FREE)
+    {
+        numFree.fetch_sub(1, std::memory_order_relaxed);
+        delete tcb;
+        return;
+    }
+
+    // don't keep the listener alive while pooled
+    tcb->listener.reset();
+
+    Tcb *head = returned.load(std::memory_order_relaxed);
+    do
+    {
+        tcb->poolNext = head;
+    }
+    while (!returned.compare_exchange_weak(head, tcb, std::memory_order_release,
+                                           std::memory_order_relaxed));
+}
+
+void TcbPool::freeList(Tcb *tcb)
+{
+    while (tcb)
+    {
+        Tcb *next = tcb->poolNext;
+        delete tcb;
+        tcb = next;
+    }
+}
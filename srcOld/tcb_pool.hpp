@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+struct Tcb;
+
+/**
+ * Pool of TCBs (buffers included) an engine spawns connections from, so a
+ * server churning through connections doesn't allocate, nor touch fresh
+ * memory, per connection.
+ *
+ * A TCB taken from the pool returns to it once its last reference is
+ * dropped, by whichever thread that is (the engine, as the connection is
+ * released, or the application, done with it): onto a lock-free stack
+ * many threads push to, which the engine takes whole once its own cache
+ * of free TCBs runs out (so no ABA). Returned TCBs are reset as they are
+ * taken again, on the engine thread.
+ *
+ * The pool keeps at most TCB_POOL_MAX_FREE free TCBs, freeing any more.
+ */
+class TcbPool : public std::enable_shared_from_this<TcbPool>
+{
+public:
+    TcbPool() = default;
+    ~TcbPool();
+
+    TcbPool(const TcbPool&) = delete;
+    TcbPool &operator=(const TcbPool&) = delete;
+
+    /**
+     * Returns a TCB in its initial state, reused if one is free (engine
+     * thread).
+     */
+    std::shared_ptr<Tcb> acquire();
+
+    /* num. TCBs allocated, and reused (engine thread) */
+    uint64_t allocated = 0;
+    uint64_t reused = 0;
+
+private:
+    /* TCBs returned by any thread (pushed), and those the engine took (popped one by one) */
+    std::atomic<Tcb*> returned{nullptr};
+    Tcb *cached = nullptr;
+
+    std::atomic<uint32_t> numFree{0};
+
+    /**
+     * Hands `tcb` back to the pool, once the last reference to it is
+     * dropped (any thread).
+     */
+    void release(Tcb *tcb);
+
+    /**
+     * Deleter of the pool's TCBs, which lets go of the pool as it runs: the
+     * TCB's weak reference to itself keeps the deleter around while pooled.
+     */
+    struct Recycler
+    {
+        std::shared_ptr<TcbPool> pool;
+
+        void operator()(Tcb *tcb) { std::shared_ptr<TcbPool>(std::move(pool))->release(tcb); }
+    };
+
+    /**
+     * Frees the TCBs of list `tcb`.
+     */
+    static void freeList(Tcb *tcb);
+};
@@ -9,6 +9,14 @@
 #include <sstream>
 #include <iomanip>
 #include <random>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <deque>
+#include <chrono>
+#include <unordered_map>
+#include <climits>
+#include <sys/epoll.h>
 
 #include "tcp.hpp"
 #include "ip.hpp"
@@ -17,6 +25,20 @@
 #include "config.hpp"
 #include "packet.hpp"
 #include "stream.hpp"
+#include "link.hpp"
+#include "coalescing.hpp"
+#include "connection_table.hpp"
+#include "rss.hpp"
+#include "spsc_ring.hpp"
+#include "mpsc_queue.hpp"
+#include "listener.hpp"
+#include "virtual_link.hpp"
+#include "executor.hpp"
+#include "echo.hpp"
+#include "tcp_connection.hpp"
+#include "readiness.hpp"
+#include "time_wait.hpp"
+#include "tcb_pool.hpp"
 
 ////////////////////////////////////////////
 // TcpHeader methods
@@ -72,466 +94,2725 @@ void TcpHeader::hostToNetworkOrder()
     urgPtr = htons(urgPtr);
 }
 
+////////////////////////////////////////////
+// Tcb methods
+////////////////////////////////////////////
+
+/**
+ * Returns the TCB to its freshly constructed state (with a new ISS),
+ * keeping its buffers' storage, for reuse by another connection.
+ *
+ * NOTE: its timers must be disarmed, and it must be off any ready list.
+ */
+void Tcb::reset()
+{
+    sendStream.reset();
+    recvStream.reset();
+
+    sourceAddr = destAddr = 0;
+    sourcePort = destPort = 0;
+    state = CLOSED;
+    listener.reset();
+
+    readWaiter = writeWaiter = nullptr;
+    watchedEvents = 0;
+    readyEvents.store(0, std::memory_order_relaxed);
+    readyNext = nullptr;
+    readyRef.reset();
+
+    retransmits = 0;
+    ackPending = 0;
+    closeRequested = false;
+    finReceived = false;
+    poolNext = nullptr;
+}
+
+/**
+ * Slot of a handoff ring: a copy of the IP packet of a segment received
+ * for another engine's connection, as the link buffer it was received into
+ * is only valid until our next receive.
+ */
+struct HandoffSlot
+{
+    uint32_t size;
+    uint8_t *data;
+};
+
+/**
+ * Ring segments are handed over to another engine through, written into
+ * (and read from) its preallocated slots in place, so nothing is allocated
+ * (nor freed, by the other engine) per segment.
+ *
+ * Segments are handed over as received (i.e. before GRO), so none exceeds
+ * the link's frame: each slot's data is a `frameSize` slice of one buffer,
+ * rather than MTU-sized (N(N-1) rings of those would take GiBs).
+ */
+struct HandoffRing : SpscRing<HandoffSlot>
+{
+    HandoffRing(uint32_t size, uint32_t frameSize)
+        : SpscRing<HandoffSlot>(size), frameSize(frameSize),
+          frames(new uint8_t[(size_t)size * frameSize])
+    {
+        for (uint32_t i = 0; i < size; i++)
+            slot(i).data = frames.get() + (size_t)i * frameSize;
+    }
+
+    uint32_t frameSize;
+    std::unique_ptr<uint8_t[]> frames;
+};
+
 /**
  * Represents the TCP thread responsible for sending/receiving packets,
  * and updating the state accordingly.
  * 
  * Given we are doing this in userland, this separate thread mimics the role
  * that the kernel process plays in usual TCP stacks.
+ *
+ * One engine serves any number of connections over a single link backend,
+ * demultiplexing received segments by their 4-tuple.
  */
 class SegmentThread
 {
 public:
-    SegmentThread(std::shared_ptr<Tcb> tcb)
+    SegmentThread(LinkConfig &linkConfig)
     {
-        this->tcb = tcb;
-        this->sock = initialiseRawSocket();
-        if (this->sock < 0)
-            throw std::runtime_error("Failed socket creation");
+        this->link = LinkBackend::open(linkConfig);
+        this->engineId = linkConfig.queueIndex;
+        this->numEngines = linkConfig.numQueues;
+        this->pollTimeoutMs = linkConfig.pollTimeoutMs;
+        this->linkTimeoutMs = linkConfig.pollTimeoutMs;
+        this->busyPollNs = (uint64_t)linkConfig.busyPollUs * 1000;
+        if (!linkConfig.queueCpus.empty())
+            this->cpu = linkConfig.queueCpus[engineId % linkConfig.queueCpus.size()];
         return;
     }
 
-    void startThread()
+    /**
+     * Adds connection `tcb` to the engine, as a listener if it is in the
+     * LISTEN state with no remote port (i.e. an unspecified passive open).
+     *
+     * Connections in the CLOSED state are opened (i.e. send their SYN) once
+     * the engine has fewer than ENGINE_MAX_OPENING handshakes in flight.
+     *
+     * Must be called before the engine thread is started.
+     */
+    bool addConnection(std::shared_ptr<Tcb> tcb)
     {
-        run();
+        FlowKey key = flowKey(*tcb);
+        if (!isListener(*tcb) && !reuseTimeWait(*tcb))
+        {
+            std::cout << "Connection in TIME-WAIT" << std::endl;
+            return false;
+        }
+
+        bool res = isListener(*tcb)
+            ? listeners.insert(key.listenerKey(), tcb.get())
+            : connections.insert(key, tcb.get());
+        if (!res)
+        {
+            std::cout << "Connection already exists" << std::endl;
+            return false;
+        }
+
+        tcbs.push_back(tcb);
+        localPortsChanged = true;
+
+        if (tcb->state == CLOSED)
+            pendingOpens.push_back(tcb.get());
+        return true;
     }
 
-private:
     /**
-     * Transmission Control Block (TCB) of this connection.
+     * Connects the engine to the other engines of its group: `handoffIn[i]`
+     * carries segments engine i received for us, `handoffOut[i]` those we
+     * received for engine i (both nullptr for ourselves).
      */
-    std::shared_ptr<Tcb> tcb;
+    void setHandoffRings(std::vector<HandoffRing*> handoffIn,
+                         std::vector<HandoffRing*> handoffOut)
+    {
+        this->handoffIn = handoffIn;
+        this->handoffOut = handoffOut;
+    }
 
     /**
-     * Raw IP socket of this connection.
+     * Queues `command` for the engine thread (from any thread). It is
+     * carried out once the engine's current wait on its link returns.
+     *
+     * Returns false if the command queue is full.
      */
-    int sock;
+    bool submit(Command &command)
+    {
+        return commands.push(command);
+    }
 
     /**
-     * Opens and initialises this connection's raw IP socket.
+     * Queues coroutine `handle` to be resumed by the engine (engine thread
+     * only; other threads submit a RESUME command).
      */
-    int initialiseRawSocket()
+    void schedule(std::coroutine_handle<> handle)
     {
-        int sock = socket(AF_INET, SOCK_RAW, IPPROTO_TCP);
-        if (sock < 0)
-        {
-            perror("Failed socket creation");
-            return -1;
-        }
-
-        /**
-         * Bind to destination addr
-         */
-        struct sockaddr_in destAddr;
-        destAddr.sin_family = AF_INET;
-        destAddr.sin_addr.s_addr = inet_addr(tcb->sourceAddr.c_str());
-        socklen_t destAddrLen = sizeof(destAddr);
-
-        if (bind(sock, (struct sockaddr*)&destAddr, destAddrLen))
-        {
-            perror("Failed bind");
-            return -1;
-        }
-
-        return sock;
+        runQueue.push_back(handle);
     }
 
     /**
-     * Retreive a packet from `packetBuffer`, which holds the most
-     * recent packet from the raw IP socket.
+     * Starts operation `op` of a coroutine on connection `tcb` (engine
+     * thread only): makes what progress it can, and if that doesn't
+     * complete it, parks it on the connection until it does.
+     *
+     * Returns true if the operation completed at once.
      */
-    ssize_t retreivePacket(std::vector<uint8_t>& packetBuffer)
+    bool startOp(Tcb &tcb, AsyncOp *op)
     {
-        ssize_t packetSize = recvfrom(
-            sock, 
-            packetBuffer.data(), 
-            packetBuffer.size(),
-            0, 
-            NULL, 
-            NULL
-        );
+        bool done = op->tryComplete(tcb);
+        if (op->kind == AsyncOp::WRITE && canSend(tcb))
+            sendData(tcb);
 
-        if (packetSize < 0 || packetSize > packetBuffer.size())
+        if (!done)
         {
-            perror("Packet receive failed");
-            return -1;
+            AsyncOp *&waiter = op->kind == AsyncOp::READ ? tcb.readWaiter : tcb.writeWaiter;
+            waiter = op;
         }
-
-        return packetSize;
+        return done;
     }
 
     /**
-     * Send `packet` to the connection's raw IP socket.
+     * Carries out `command` (engine thread only).
      */
-    ssize_t sendPacket(Packet &packet, bool includeIpHeader = false)
+    void carryOut(Command &command)
     {
-        std::vector<uint8_t> packetBuffer = packet.serialise(includeIpHeader);
-
-        // destination info
-        struct sockaddr_in destAddr;
-        destAddr.sin_family = AF_INET;
-        destAddr.sin_port = htons(tcb->destPort);
-        destAddr.sin_addr.s_addr = inet_addr(tcb->destAddr.c_str());
-
-        ssize_t bytesSent = sendto(
-            sock,
-            packetBuffer.data(),
-            packetBuffer.size(),
-            0,
-            (struct sockaddr*)&destAddr,
-            sizeof(destAddr)
-        );
+        if (command.type == Command::RESUME)
+        {
+            schedule(command.handle);
+            return;
+        }
 
-        if (bytesSent < 0 || bytesSent != packetBuffer.size())
+        Tcb &tcb = *command.tcb;
+        switch (command.type)
         {
-            perror("sendto() failed");
-            return -1;
+            case Command::OPEN:
+                // a failed open still completes `op`, which finds the connection CLOSED
+                if (!addConnection(command.tcb) && command.op)
+                    schedule(command.op->handle);
+                else if (command.op && startOp(tcb, command.op))
+                    schedule(command.op->handle);
+                break;
+            case Command::SEND:
+                if (canSend(tcb))
+                    sendData(tcb);
+                break;
+            case Command::CLOSE:
+                closeConnection(tcb);
+                break;
+            case Command::ABORT:
+                abortConnection(tcb);
+                break;
+            case Command::SET_MSS:
+                tcb.sendStream.MSS = command.value;
+                break;
+            case Command::AWAIT:
+                if (startOp(tcb, command.op))
+                    schedule(command.op->handle);
+                break;
+            case Command::WATCH:
+                tcb.watchedEvents = command.value;
+                raiseEvents(tcb, currentEvents(tcb));
+                break;
+            default:
+                break;
         }
-        return bytesSent;
     }
 
-    bool packetValid(Packet &packet)
+    /**
+     * Engine the calling thread runs, if any.
+     */
+    static inline thread_local SegmentThread *current = nullptr;
+
+    void startThread()
     {
-        return (
-            packet.ipHeader.saddr == inet_addr(tcb->destAddr.c_str()) &&
-            packet.ipHeader.daddr == inet_addr(tcb->sourceAddr.c_str()) &&
-            packet.tcpHeader.sourcePort == tcb->destPort &&
-            packet.tcpHeader.destPort == tcb->sourcePort
-        );
+        if (cpu >= 0 && SystemUtils::pinThread(cpu))
+            std::cout << "Engine " << engineId << ": pinned to core " << cpu
+                      << " (NUMA node " << SystemUtils::getCpuNode(cpu) << ")" << std::endl;
+        run();
     }
 
-    void processAck(uint32_t ackNum)
+    /**
+     * Asks the engine thread to return (once its current batch is done).
+     */
+    void stop()
     {
-        // duplicate ACK - ignore
-        if (ackNum < tcb->sendStream.UNA)
-            return;
+        stopRequested.store(true, std::memory_order_relaxed);
+    }
 
-        // ACK'ing bytes not yet sent - send duplicate ACK
-        if (tcb->sendStream.NXT < ackNum)
-        {
-            /** TODO: send duplicate ACK */
-            return;
-        }
+    /**
+     * Trace each segment and state transition to stdout.
+     */
+    bool verbose = true;
 
-        /**
-         * Valid ACK. Update UNA and remove now-ack'd segments 
-         * from rtx queue.
-         * 
-         * TODO:
-         */
-        tcb->sendStream.UNA = ackNum;
-    }
+    /**
+     * Num. connections that reached ESTABLISHED (read by other threads).
+     */
+    std::atomic<uint64_t> connectionsEstablished{0};
 
-    void processRecveivedPayload(Packet &packet)
-    {
-        TcpHeader &segHdr = packet.tcpHeader;
+    /**
+     * Readiness notifications of the engine's connections, polled by the
+     * application's event loop.
+     */
+    ReadinessNotifier notifier;
 
-        // TODO
-        // verify SEG.SEQ is valid in the context of RCV.NXT and RCV.WND
-        // for now, no out-of-order reception
-        if (segHdr.seqNum != tcb->recvStream.NXT)
-        {
-            std::cout << "Invalid sequence number received" << std::endl;
-            return;
-        }
+private:
+    /**
+     * Transmission Control Blocks (TCBs) of the engine's connections.
+     */
+    std::vector<std::shared_ptr<Tcb>> tcbs;
 
-        // write payload to recv buffer
-        bool res = tcb->recvStream.writePayloadToRecvBuffer(packet.payload);
-        if (!res)
-            return;
+    /**
+     * Engine's connections, keyed on their 4-tuple, and listeners, keyed
+     * on their local address and port.
+     */
+    ConnectionTable connections;
+    ConnectionTable listeners;
 
-        // TODO
-        // notify user that some bytes are available to read
-    }
+    /**
+     * Connections in TIME_WAIT (dropped, but for a record of their tuple and
+     * sequence numbers), num. segments they received, and num. of their
+     * tuples taken over by a new connection.
+     */
+    TimeWaitTable timeWait;
+    uint64_t timeWaitSegments = 0;
+    uint64_t timeWaitReused = 0;
 
-    void closedHandler()
-    {
-        std::cout << "CLOSED: sending initial SYN" << std::endl;
-        std::cout << tcb->sendStream.toString() << std::endl;
+    /**
+     * TCBs of connections spawned by listeners, recycled as they're dropped.
+     */
+    std::shared_ptr<TcbPool> tcbPool = std::make_shared<TcbPool>();
 
-        /**
-         * Send initial SYN packet
-         */
-        TcpHeader h = {};
-        h.sourcePort = tcb->sourcePort;
-        h.destPort = tcb->destPort;
-        h.doff = sizeof(h) / 4;
+    /**
+     * Connections dropped during the current batch, kept alive until it
+     * is done with them.
+     */
+    std::vector<std::shared_ptr<Tcb>> released;
 
-        // advertise ISS and window size
-        h.SYN = 1;
-        h.seqNum = tcb->sendStream.ISS;
-        h.window = tcb->recvStream.WND;
+    /**
+     * Payload of a segment wrapping around a (flat) send buffer, copied out
+     * contiguously, as the segmenter takes it.
+     */
+    std::vector<uint8_t> wrappedPayload;
 
-        Packet packet;
-        packet.tcpHeader = h;
+    /**
+     * Link backend (raw IP socket, TUN queue, ...) shared by all connections.
+     */
+    std::unique_ptr<LinkBackend> link;
 
-        sendPacket(packet);
+    /**
+     * Num. received segments matching no connection or listener, and
+     * packets dropped as they weren't well-formed TCP/IP.
+     */
+    uint64_t segmentsUnmatched = 0;
+    uint64_t segmentsMalformed = 0;
 
-        // transition to SYN-RECEIVED state
-        tcb->state = SYN_SENT;
-    }
+    /**
+     * Num. connections spawned by listeners, and SYNs dropped (or
+     * handshakes reset) as the listener's accept queue was full.
+     */
+    uint64_t connectionsSpawned = 0;
+    uint64_t listenDrops = 0;
 
-    void listenHandler(Packet &packet)
-    {
-        std::cout << tcb->sendStream.toString() << std::endl;
+    /**
+     * Set when a local port was opened or closed, until the link is told.
+     */
+    bool localPortsChanged = false;
 
-        TcpHeader &segHdr = packet.tcpHeader;
+    /**
+     * Connections waiting to send their SYN, and num. handshakes we
+     * started that are still in flight.
+     */
+    std::deque<Tcb*> pendingOpens;
+    uint32_t numOpening = 0;
 
-        // received initial SYN
-        if (segHdr.SYN)
-        {
-            std::cout << "LISTEN: received SYN" << std::endl;
+    /**
+     * Commands application threads submitted, carried out by the engine
+     * thread before each batch.
+     */
+    MpscQueue<Command> commands{ENGINE_COMMAND_QUEUE_SIZE};
 
-            // initialse recv stream based on peer's ISS and window size
-            tcb->recvStream.IRS = segHdr.seqNum;
-            tcb->recvStream.NXT = segHdr.seqNum + 1;
-            tcb->recvStream.WND = segHdr.window;
+    /**
+     * Coroutines ready to be resumed by the engine thread.
+     */
+    std::deque<std::coroutine_handle<>> runQueue;
 
-            /**
-             * Build and send SYN-ACK
-             */
-            TcpHeader hdr = {};
-            hdr.sourcePort = tcb->sourcePort;
-            hdr.destPort = tcb->destPort;
-            hdr.doff = sizeof(hdr) / 4;
+    /**
+     * This engine's index in its group, and the group's size.
+     *
+     * Each engine owns the connections whose RSS hash maps to its index,
+     * and hands segments it receives for another engine's connections
+     * over to that engine, through the rings it shares with it.
+     */
+    uint32_t engineId;
+    uint32_t numEngines;
 
-            // advertise ISS and window size
-            hdr.SYN = 1;
-            hdr.seqNum = tcb->sendStream.ISS;
-            hdr.window = tcb->recvStream.WND;
+    /* core the engine thread is pinned to (-1 = unpinned) */
+    int cpu = -1;
 
-            // acknowledge peer's ISS
-            hdr.ACK = 1;
-            hdr.ackNum = tcb->recvStream.NXT;
+    std::vector<HandoffRing*> handoffIn;
+    std::vector<HandoffRing*> handoffOut;
 
-            Packet packet;
-            packet.tcpHeader = hdr;
+    /* num. segments handed over to other engines, or dropped as their ring was full */
+    uint64_t segmentsHandedOff = 0;
+    uint64_t handoffDrops = 0;
 
-            sendPacket(packet);
+    std::atomic<bool> stopRequested{false};
 
-            // transition to SYN-RECEIVED state
-            tcb->state = SYN_RECEIVED;
-        }
+    /* sink for traces when not verbose */
+    std::ostream quiet{nullptr};
 
-        else 
-        {
-            /**
-             * TODO: 
-             * 
-             * As we are in the LISTEN state, we reply to any
-             * non-SYN packets with a RST. 
-             */
-            std::cout << "LISTEN: non-SYN received, send RST" << std::endl;
-        }
+    std::ostream &log()
+    {
+        return verbose ? std::cout : quiet;
     }
 
-    void synSentHandler(Packet &packet)
-    {
-        TcpHeader &segHdr = packet.tcpHeader;
+    /**
+     * Merges in-order segments of each received batch (GRO).
+     */
+    Coalescer coalescer;
 
-        // received SYN-ACK
-        if (segHdr.SYN && segHdr.ACK)
-        {
-            std::cout << "SYN-SENT: received SYN-ACK" << std::endl;
+    /**
+     * Unix epoch time (secs) of the last engine stats report.
+     */
+    uint32_t lastStatsReport = 0;
 
-            /**
-             * Validate ack. num. is correct.
-             * 
-             * NOTE: 
-             * 
-             * We don't send any data whilst connection is being
-             * established, so: 
-             *      SEG.ACK == SND.NXT == ISS + 1
-             * should hold.
-             */
-            if (!(segHdr.ackNum == tcb->sendStream.NXT && 
-                  segHdr.ackNum == tcb->sendStream.ISS + 1))
-            {
-                std::cout << "SYN-SENT: bad ack, send RST, -> CLOSED" << std::endl;
-                std::cout << segHdr.ackNum << " " 
-                          << tcb->sendStream.NXT << " " 
-                          << tcb->sendStream.ISS + 1 
-                          << std::endl;
-                return;
-            }
+    /**
+     * Adaptive busy-polling: the link's poll timeout (i.e. how long a
+     * receive waits once we're idle), how long (ns) we spin after the last
+     * activity (0 = never), when that was (monotonic ns), and the timeout
+     * currently set on the link (0 while spinning).
+     */
+    int pollTimeoutMs;
+    uint64_t busyPollNs;
+    uint64_t lastActivity = 0;
+    int linkTimeoutMs;
 
-            // initialise recv stream based on peer's ISS and window size
-            tcb->recvStream.IRS = segHdr.seqNum;
-            tcb->recvStream.NXT = segHdr.seqNum + 1;
-            tcb->recvStream.WND = segHdr.window;
+    /**
+     * The engine's TCP timers (i.e. those of its connections), and the
+     * current tick (taken once per batch, see expireTimers()).
+     */
+    TimerWheel timers{currentTick()};
+    uint64_t tick = currentTick();
 
-            /**
-             * Send ACK
-             */
-            TcpHeader hdr = {};
-            hdr.sourcePort = tcb->sourcePort;
-            hdr.destPort = tcb->destPort;
-            hdr.doff = sizeof(hdr) / 4;
+    /* num. retransmission timeouts, and ACKs sent as their delay ran out */
+    uint64_t retransmitTimeouts = 0;
+    uint64_t delayedAcks = 0;
 
-            // acknowledge peer's ISS and window size
-            hdr.ACK = 1;
-            hdr.ackNum = tcb->recvStream.NXT;
+    /* num. segments received out of order (i.e. past a hole), and holes they were held until filled */
+    uint64_t segmentsOutOfOrder = 0;
+    uint64_t holesFilled = 0;
 
-            Packet packet;
-            packet.tcpHeader = hdr;
+    /**
+     * Num. receives that spun (and of those, that found packets), and that
+     * waited (i.e. slept, and of those, woken by packets rather than the
+     * poll timeout), and time (ns) spent spinning without finding packets.
+     */
+    uint64_t spins = 0;
+    uint64_t spinHits = 0;
+    uint64_t sleeps = 0;
+    uint64_t wakeups = 0;
+    uint64_t idleSpinNs = 0;
 
-            sendPacket(packet);
+    /**
+     * Restarts the busy-poll budget, as the engine just did some work.
+     */
+    void markActive()
+    {
+        if (busyPollNs)
+            lastActivity = TimeUtils::getMonotonicTimeNs();
+    }
 
-            // transition to established state
-            tcb->state = ESTABLISHED;
-            std::cout << "Connection established" << std::endl;
+    /**
+     * Retreive the next batch of packets from the link backend into `batch`,
+     * referencing them in the backend's memory (i.e. without copying).
+     *
+     * With busy-polling, spins on the link (i.e. receives without waiting)
+     * while within the busy-poll budget of the last activity, and only
+     * waits on it (for at most its poll timeout, cut short by the next
+     * timer expiry) once idle for longer.
+     *
+     * Returns num. packets retreived, or -1 on failure.
+     */
+    int retreivePackets(std::vector<LinkPacket> &batch)
+    {
+        uint64_t now = busyPollNs ? TimeUtils::getMonotonicTimeNs() : 0;
+        bool spin = busyPollNs && now - lastActivity < busyPollNs;
+        int timeoutMs = spin ? 0 : waitTimeout();
+        if (timeoutMs != linkTimeoutMs)
+        {
+            link->setPollTimeout(timeoutMs);
+            linkTimeoutMs = timeoutMs;
+        }
+
+        int n = link->recvBatch(batch.data(), batch.size());
+        if (spin)
+        {
+            spins++;
+            if (n > 0)
+                spinHits++;
+            else
+                idleSpinNs += TimeUtils::getMonotonicTimeNs() - now;
+        }
+        else
+        {
+            sleeps++;
+            if (n > 0)
+                wakeups++;
         }
+
+        if (n > 0)
+            markActive();
+        return n;
     }
 
-    void synReceivedHandler(Packet &packet)
+    /**
+     * Returns how long (ms) a receive may wait for packets: the link's
+     * poll timeout, cut short by the next timer expiry.
+     */
+    int waitTimeout()
     {
-        TcpHeader &segHdr = packet.tcpHeader;
+        uint64_t next = timers.nextExpiry();
+        if (next == TimerWheel::NEVER)
+            return pollTimeoutMs;
 
-        // received ACK
-        if (segHdr.ACK)
-        {
-            std::cout << "SYN-RECEIVED: received ACK" << std::endl;
+        uint64_t waitUs = next > tick ? (next - tick) * TIMER_WHEEL_TICK_US : 0;
+        int waitMs = (int)std::min<uint64_t>((waitUs + 999) / 1000, INT_MAX);
+        return pollTimeoutMs < 0 ? waitMs : std::min(pollTimeoutMs, waitMs);
+    }
 
-            /**
-             * Validate ack. num. is correct. 
-             * 
-             * NOTE:
-             * 
-             * See synSentHandler (above) for explanation of validation.
-             */
-            if (!(segHdr.ackNum == tcb->sendStream.NXT && 
-                  segHdr.ackNum == tcb->sendStream.ISS + 1))
+    /**
+     * Returns the current timer wheel tick (i.e. monotonic time, in
+     * TIMER_WHEEL_TICK_US ticks).
+     */
+    static uint64_t currentTick()
+    {
+        return TimeUtils::getMonotonicTimeNs() / (TIMER_WHEEL_TICK_US * 1000);
+    }
+
+    /**
+     * Arms (or re-arms) `timer` to expire in `us` microseconds.
+     */
+    void armTimer(Timer &timer, uint64_t us)
+    {
+        timers.arm(timer, tick + (us + TIMER_WHEEL_TICK_US - 1) / TIMER_WHEEL_TICK_US);
+    }
+
+    /**
+     * Fires the timers that expired by now, and forgets the connections
+     * whose TIME_WAIT ran out.
+     */
+    void expireTimers()
+    {
+        tick = currentTick();
+        timeWait.expire(tick);
+        timers.advance(tick, [this](Timer &timer) {
+            switch (timer.kind)
             {
-                std::cout << "SYN-RECEIVED: bad ack, send RST, -> LISTEN" << std::endl;
-                std::cout << segHdr.ackNum << " " 
-                          << tcb->sendStream.NXT << " " 
-                          << tcb->sendStream.ISS + 1 
-                          << std::endl;
-                return;
+                case Timer::RETRANSMIT:
+                    retransmit(*timer.tcb);
+                    break;
+                case Timer::DELAYED_ACK:
+                    delayedAcks++;
+                    sendAck(*timer.tcb);
+                    break;
             }
-
-            tcb->state = ESTABLISHED;
-            std::cout << "Connection established" << std::endl;
-        }
+        });
     }
 
-    void establishedHandler(Packet &packet)
+    /**
+     * Arms the retransmission timer of connection `tcb`, unless already
+     * armed, backing it off (doubling) with each retransmission.
+     */
+    void armRetransmit(Tcb &tcb)
     {
-        std::cout << "ESTABLISHED: received packet" << std::endl;
+        if (tcb.retransmitTimer.armed())
+            return;
 
-        TcpHeader &segHdr = packet.tcpHeader;
+        uint64_t rto = std::min<uint64_t>((uint64_t)TCP_INITIAL_RTO_US << tcb.retransmits, TCP_MAX_RTO_US);
+        armTimer(tcb.retransmitTimer, rto);
+    }
 
-        /**
-         * Handle RST set (i.e. reset request).
-         */
-        if (segHdr.RST)
+    /**
+     * Retransmission timeout of connection `tcb`: resends the oldest
+     * segment the peer hasn't acknowledged, or gives up on the connection
+     * after TCP_MAX_RETRANSMITS.
+     *
+     * Only that segment: the peer holds what it received past the hole
+     * (see RecvStream), so acknowledges it all once the hole fills, and the
+     * rest is resent from there (going back to the acknowledged byte).
+     *
+     * In FIN-WAIT-2, the timer is the wait for the peer's FIN instead.
+     */
+    void retransmit(Tcb &tcb)
+    {
+        if (tcb.state == FIN_WAIT_2)
         {
+            log() << "FIN-WAIT-2: peer's FIN timed out, -> CLOSED" << std::endl;
+            releaseConnection(tcb, CLOSED);
             return;
         }
 
-        /**
-         * Handle SYN set.
-         * 
-         * This is considered an error in the ESTABLISHED state,
-         * so we send a reset.
-         * 
-         * TODO:
-         */
-        if (segHdr.SYN)
+        retransmitTimeouts++;
+        if (++tcb.retransmits > TCP_MAX_RETRANSMITS)
         {
+            log() << "Retransmission limit reached, -> CLOSED" << std::endl;
+            raiseEvents(tcb, ReadyEvent::ERROR);
+            abortConnection(tcb);
             return;
         }
-        
-        /**
-         * Handle 'no-ACK' (i.e. ACK bit off).
-         * 
-         * This is considered an error in the ESTABLISHED state,
-         * so we drop the segment.
-         */
-        if (!segHdr.ACK)
+
+        switch (tcb.state)
         {
-            return;
+            case SYN_SENT:
+                sendSyn(tcb);
+                break;
+            case SYN_RECEIVED:
+                sendSynAck(tcb);
+                break;
+            case ESTABLISHED:
+            case CLOSE_WAIT:
+            case FIN_WAIT_1:
+            case CLOSING:
+            case LAST_ACK:
+            {
+                SendStream &sendStream = tcb.sendStream;
+                sendStream.NXT = sendStream.UNA;
+
+                // (with no bytes to resend, or the peer's window closed, sendData() resends our FIN, if any)
+                uint32_t payloadSize = std::min<uint32_t>({ sendStream.sendBuffer.availableToRead(),
+                                                            sendStream.MSS, sendStream.WND });
+                if (payloadSize > 0)
+                    sendSegment(tcb, sendStream.sendBuffer.readOffset(), payloadSize);
+                else
+                    sendData(tcb);
+                break;
+            }
+            default:
+                return;
         }
 
-        /* process acknowlegement */
-        processAck(segHdr.ackNum);
-
-        /* process payload, if any */
-        if (packet.payloadSize() > 0)
-            processRecveivedPayload(packet);
+        // still armed while the peer's window is closed (i.e. probing it)
+        armRetransmit(tcb);
     }
 
-    void run()
+    /**
+     * Acknowledges the bytes received on connection `tcb` (advertising our
+     * window) in a segment of its own.
+     */
+    void sendAck(Tcb &tcb)
     {
-        std::vector<uint8_t> packetBuffer(MTU);
-        
-        while (1)
-        {
-            Packet packet;
+        tcb.recvStream.WND = tcb.recvStream.recvBuffer.availableToWrite();
 
-            bool waitForPacket = true;
-            if (tcb->state == CLOSED)
-                waitForPacket = false;
+        sendPacket(tcb, HeaderTemplate::ACK, tcb.sendStream.NXT, tcb.recvStream.NXT);
+        ackSent(tcb);
+    }
 
-            if (waitForPacket)
-            {
-                ssize_t packetSize = retreivePacket(packetBuffer);
+    /**
+     * Notes a segment acknowledging all bytes received on connection `tcb`
+     * was sent, so none wait for a delayed ACK.
+     */
+    void ackSent(Tcb &tcb)
+    {
+        tcb.ackPending = 0;
+        timers.cancel(tcb.delayedAckTimer);
+    }
 
-                if (packetSize < 0) 
-                    return;
-                
-                packet = Packet::deserialise(packetBuffer, packetSize);
+    /**
+     * Queue a segment of connection `tcb` carrying no payload, with flags
+     * `flags` (see HeaderTemplate::Flags), sequence number `seqNum` and
+     * ack. number `ackNum`, advertising our window, on the link backend.
+     *
+     * Queued packets are sent together by flushPackets() once the
+     * current batch has been processed.
+     */
+    ssize_t sendPacket(Tcb &tcb, uint8_t flags, uint32_t seqNum, uint32_t ackNum)
+    {
+        return sendPacket(tcb.headerTemplate, tcb.destAddr, flags, seqNum, ackNum,
+                          tcb.recvStream.WND);
+    }
+
+    /**
+     * Queue a segment carrying no payload to `destAddr` (network order),
+     * its headers stamped from `headers` straight into a TX slot of the
+     * link backend (i.e. nothing is allocated).
+     */
+    ssize_t sendPacket(const HeaderTemplate &headers, in_addr_t destAddr, uint8_t flags,
+                       uint32_t seqNum, uint32_t ackNum, uint16_t window)
+    {
+        bool includeIpHeader = link->requiresIpHeader();
+        uint8_t *slot = link->txSlot(includeIpHeader ? HeaderTemplate::SIZE : sizeof(TcpHeader));
+        if (!slot)
+            return -1;
+
+        uint32_t size = headers.writeSegment(slot, includeIpHeader, seqNum, ackNum, window, flags);
+        return link->queueSlot(size, destAddr);
+    }
+
+    /**
+     * Send as much of the send buffer as the peer's window allows, as one
+     * super-segment, which the link segments into MSS-sized packets.
+     *
+     * Sent bytes stay in the send buffer until acknowledged (see
+     * processAck()), in case they must be retransmitted.
+     *
+     * Once the application closed the connection, and all bytes are sent,
+     * follows them with our FIN.
+     */
+    void sendData(Tcb &tcb)
+    {
+        SendStream &sendStream = tcb.sendStream;
+
+        // the application may have read (from its own thread) since we last advertised
+        tcb.recvStream.WND = tcb.recvStream.recvBuffer.availableToWrite();
+
+        // (a FIN in flight takes the sequence number after the buffer's last byte)
+        uint32_t buffered = sendStream.sendBuffer.availableToRead();
+        uint32_t inFlight = std::min(sendStream.NXT - sendStream.UNA, buffered);
+        uint32_t unsent = buffered - inFlight;
+        uint32_t window = sendStream.WND > inFlight ? sendStream.WND - inFlight : 0;
+        uint32_t maxPayload = GSO_MAX_SIZE - sizeof(IpHeader) - sizeof(TcpHeader);
+        uint32_t payloadSize = std::min({ unsent, window, maxPayload });
+        uint64_t next = sendStream.sendBuffer.readOffset() + inFlight;
+        if (payloadSize > 0 && !sendSegment(tcb, next, payloadSize))
+            return;
+
+        if (tcb.closeRequested && sendStream.NXT == sendStream.UNA + buffered)
+            sendFin(tcb);
+    }
+
+    /**
+     * Send `payloadSize` bytes of the send buffer, from stream offset
+     * `offset` on, as one super-segment.
+     *
+     * The payload is segmented straight from the send buffer, unless it
+     * wraps around (flat) storage.
+     */
+    bool sendSegment(Tcb &tcb, uint64_t offset, uint32_t payloadSize)
+    {
+        SendStream &sendStream = tcb.sendStream;
+
+        const uint8_t *payload = sendStream.sendBuffer.viewAt(offset, payloadSize);
+        if (!payload)
+        {
+            wrappedPayload.resize(payloadSize);
+            sendStream.sendBuffer.peekAt(wrappedPayload.data(), payloadSize, offset);
+            payload = wrappedPayload.data();
+        }
+
+        // the segmenter computes each packet's checksum, so skip the full one
+        uint8_t headers[HeaderTemplate::SIZE];
+        tcb.headerTemplate.writeHeaders(headers, sendStream.seqOf(offset), tcb.recvStream.NXT,
+                                        tcb.recvStream.WND, HeaderTemplate::ACK | HeaderTemplate::PSH,
+                                        payloadSize);
+        if (link->queueSuperSegment(headers, sizeof(headers), payload, payloadSize,
+                                    sendStream.MSS, tcb.destAddr) < 0)
+        {
+            std::cout << "Failed to queue super-segment" << std::endl;
+            return false;
+        }
+
+        sendStream.advance(payloadSize);
+        ackSent(tcb);
+        armRetransmit(tcb);
+        return true;
+    }
+
+    /**
+     * Send our FIN, after the last byte sent, moving on from ESTABLISHED
+     * (to FIN-WAIT-1) or CLOSE-WAIT (to LAST-ACK) as the first one goes.
+     */
+    void sendFin(Tcb &tcb)
+    {
+        sendPacket(tcb, HeaderTemplate::FIN | HeaderTemplate::ACK, tcb.sendStream.NXT,
+                   tcb.recvStream.NXT);
+
+        tcb.sendStream.advance(1);
+        ackSent(tcb);
+        armRetransmit(tcb);
+
+        if (tcb.state == ESTABLISHED)
+        {
+            log() << "ESTABLISHED: sent FIN, -> FIN-WAIT-1" << std::endl;
+            tcb.state = FIN_WAIT_1;
+        }
+        else if (tcb.state == CLOSE_WAIT)
+        {
+            log() << "CLOSE-WAIT: sent FIN, -> LAST-ACK" << std::endl;
+            tcb.state = LAST_ACK;
+        }
+    }
+
+    /**
+     * Returns true if connection `tcb` may send bytes the application
+     * writes, i.e. is established and we haven't sent our FIN.
+     */
+    static bool canSend(Tcb &tcb)
+    {
+        return tcb.state == ESTABLISHED || tcb.state == CLOSE_WAIT;
+    }
+
+    /**
+     * Returns true if connection `tcb`, having sent our FIN, went back to
+     * resend bytes (see retransmit()) it hasn't caught up with since.
+     */
+    static bool resending(Tcb &tcb)
+    {
+        bool finSent = tcb.state == FIN_WAIT_1 || tcb.state == CLOSING || tcb.state == LAST_ACK;
+        return finSent && tcb.sendStream.NXT != tcb.sendStream.MAX;
+    }
+
+    /**
+     * Reports those of `events` (see ReadyEvent) the application watches
+     * on connection `tcb`.
+     */
+    void raiseEvents(Tcb &tcb, uint32_t events)
+    {
+        events &= tcb.watchedEvents;
+        if (events)
+            notifier.notify(tcb, events);
+    }
+
+    /**
+     * Returns the readiness events connection `tcb` is ready for (i.e. as
+     * a level, reported as the application starts watching it).
+     */
+    static uint32_t currentEvents(Tcb &tcb)
+    {
+        uint32_t events = 0;
+        if (tcb.recvStream.recvBuffer.availableToRead() > 0)
+            events |= ReadyEvent::READABLE;
+        if (canSend(tcb) && tcb.sendStream.sendBuffer.availableToWrite() > 0)
+            events |= ReadyEvent::WRITABLE;
+        if (tcb.finReceived)
+            events |= ReadyEvent::HANGUP;
+        return events;
+    }
+
+    /**
+     * Send all packets queued while processing the current batch.
+     */
+    void flushPackets()
+    {
+        if (link->flush() < 0)
+            std::cout << "Failed to flush queued packets" << std::endl;
+    }
+
+    /**
+     * Push the engine's current set of local ports down to the link backend,
+     * so traffic to any other port is dropped before it reaches us (i.e.
+     * in the kernel, for the raw socket backends).
+     *
+     * Called once per batch whenever local ports were opened or closed.
+     */
+    void updateLocalPorts()
+    {
+        localPortsChanged = false;
+
+        std::vector<uint16_t> ports;
+        for (auto &tcb : tcbs)
+            ports.push_back(tcb->sourcePort);
+
+        std::sort(ports.begin(), ports.end());
+        ports.erase(std::unique(ports.begin(), ports.end()), ports.end());
+
+        if (!link->setLocalPorts(ports))
+            std::cout << "Failed to update link filter" << std::endl;
+    }
+
+    /**
+     * Periodically report engine (i.e. link batching) stats.
+     */
+    void reportStats()
+    {
+        uint32_t now = TimeUtils::getUnixEpochTime();
+        if (now - lastStatsReport < ENGINE_STATS_INTERVAL)
+            return;
+
+        lastStatsReport = now;
+        std::cout << "Engine stats (" << link->name() << ")" << "\n"
+                  << link->stats.toString()
+                  << "GRO: " << coalescer.segmentsMerged << " segments merged" << "\n"
+                  << "Connections: " << connections.size() << " ("
+                  << listeners.size() << " listening), "
+                  << segmentsUnmatched << " unmatched segments, "
+                  << segmentsMalformed << " malformed" << "\n"
+                  << "Listen: " << connectionsSpawned << " connections spawned, "
+                  << listenDrops << " SYNs dropped or handshakes reset (accept queue full)" << "\n"
+                  << "Handoff: " << segmentsHandedOff << " segments to other engines, "
+                  << handoffDrops << " dropped" << "\n"
+                  << "Busy-poll: " << spins << " spins (" << spinHits << " found packets, "
+                  << idleSpinNs / 1000 << " us idle), " << sleeps << " sleeps ("
+                  << wakeups << " woken by packets)" << "\n"
+                  << "Timers: " << timers.size() << " armed, " << retransmitTimeouts
+                  << " retransmission timeouts, " << delayedAcks << " delayed ACKs" << "\n"
+                  << "Reassembly: " << segmentsOutOfOrder << " segments out of order, "
+                  << holesFilled << " holes filled" << "\n"
+                  << "TIME-WAIT: " << timeWait.size() << " connections, " << timeWaitSegments
+                  << " segments received, " << timeWaitReused << " tuples reused" << "\n"
+                  << "TCB pool: " << tcbPool->allocated << " allocated, "
+                  << tcbPool->reused << " reused" << std::endl;
+    }
+
+    /**
+     * Returns true if `tcb` is a listener, i.e. a passive open not yet
+     * bound to a remote port.
+     */
+    static bool isListener(Tcb &tcb)
+    {
+        return tcb.state == LISTEN && tcb.destPort == 0;
+    }
+
+    /**
+     * Returns the engine owning the connection received segment `packet`
+     * belongs to.
+     */
+    uint32_t owningEngine(const PacketView &packet)
+    {
+        if (numEngines == 1)
+            return engineId;
+
+        uint32_t hash = Rss::hash(packet.saddr(), packet.daddr(),
+                                  packet.sourcePort(), packet.destPort());
+        return Rss::queue(hash, numEngines);
+    }
+
+    /**
+     * Copies received segment `packet` into a slot of the ring to engine
+     * `owner`. Returns false if the ring is full, or the packet exceeds
+     * its slots (see LinkConfig::maxFrameSize).
+     */
+    bool handOff(const PacketView &packet, uint32_t owner)
+    {
+        HandoffRing *ring = handoffOut[owner];
+        if (packet.size() > ring->frameSize)
+            return false;
+
+        HandoffSlot *slot = ring->claim();
+        if (!slot)
+            return false;
+
+        memcpy(slot->data, packet.data(), packet.size());
+        slot->size = packet.size();
+        ring->publish();
+        return true;
+    }
+
+    /**
+     * Views the segments other engines handed over to us in `segments`,
+     * from index `numSegments` on, while there's room, in the rings' slots
+     * (which stay ours until releaseHandoffSlots()).
+     *
+     * Returns the new num. segments.
+     */
+    int drainHandoffRings(std::vector<PacketView> &segments, int numSegments)
+    {
+        for (HandoffRing *ring : handoffIn)
+        {
+            HandoffSlot *slot;
+            while (ring && numSegments < (int)segments.size() && (slot = ring->peek()))
+            {
+                // validated by the engine handing it over
+                segments[numSegments].parse(slot->data, slot->size);
+                numSegments++;
+            }
+        }
+        return numSegments;
+    }
+
+    /**
+     * Hands the ring slots of the segments drained in the current batch
+     * back to the engines that handed them over.
+     */
+    void releaseHandoffSlots()
+    {
+        for (HandoffRing *ring : handoffIn)
+        {
+            if (ring)
+                ring->release();
+        }
+    }
+
+    /**
+     * Moves the stream buffers of connection `tcb`, allocated by whichever
+     * thread created it, to our (pinned) core's NUMA node, before they
+     * carry any bytes.
+     */
+    void adopt(Tcb &tcb)
+    {
+        tcb.sendStream.sendBuffer.reallocate();
+        tcb.recvStream.recvBuffer.reallocate();
+    }
+
+    /**
+     * Opens (i.e. sends the SYN of) pending connections, keeping at most
+     * ENGINE_MAX_OPENING handshakes in flight.
+     */
+    void openPendingConnections()
+    {
+        while (!pendingOpens.empty() && numOpening < ENGINE_MAX_OPENING)
+        {
+            if (cpu >= 0)
+                adopt(*pendingOpens.front());
+            closedHandler(*pendingOpens.front());
+            pendingOpens.pop_front();
+            numOpening++;
+        }
+    }
+
+    /**
+     * Makes progress on the operations waiting on connection `tcb`, and
+     * schedules the coroutines of those that complete.
+     */
+    void wakeWaiters(Tcb &tcb)
+    {
+        if (tcb.readWaiter && tcb.readWaiter->tryComplete(tcb))
+            schedule(std::exchange(tcb.readWaiter, nullptr)->handle);
+
+        if (tcb.writeWaiter)
+        {
+            bool done = tcb.writeWaiter->tryComplete(tcb);
+            if (canSend(tcb))
+                sendData(tcb);
+            if (done)
+                schedule(std::exchange(tcb.writeWaiter, nullptr)->handle);
+        }
+    }
+
+    /**
+     * Resumes the coroutines ready so far (not those they make ready in
+     * turn, which wait for the next batch, so none can starve the link).
+     */
+    void runReady()
+    {
+        for (size_t n = runQueue.size(); n > 0; n--)
+        {
+            std::coroutine_handle<> handle = runQueue.front();
+            runQueue.pop_front();
+            handle.resume();
+        }
+    }
+
+    /**
+     * Carries out the commands submitted since the last batch.
+     *
+     * Returns num. commands carried out.
+     */
+    uint32_t processCommands()
+    {
+        uint32_t n = 0;
+        Command command;
+        while (commands.pop(command))
+        {
+            carryOut(command);
+            command.tcb.reset();
+            n++;
+        }
+        return n;
+    }
+
+    /**
+     * Closes connection `tcb` as the application asked: once the bytes it
+     * wrote are sent, we send our FIN (see sendData()). A connection not
+     * yet established is aborted instead.
+     */
+    void closeConnection(Tcb &tcb)
+    {
+        switch (tcb.state)
+        {
+            case ESTABLISHED:
+            case CLOSE_WAIT:
+                tcb.closeRequested = true;
+                sendData(tcb);
+                break;
+            case CLOSED:
+            case LISTEN:
+            case SYN_SENT:
+            case SYN_RECEIVED:
+                abortConnection(tcb);
+                break;
+            default:
+                // closing already
+                break;
+        }
+    }
+
+    /**
+     * Resets (if it has a peer) and drops connection `tcb`, unless dropped
+     * already.
+     */
+    void abortConnection(Tcb &tcb)
+    {
+        if (!isAdded(tcb))
+            return;
+
+        if (tcb.state != CLOSED && tcb.state != LISTEN)
+        {
+            // (from MAX: having gone back to resend, NXT may be behind what the peer expects)
+            sendPacket(tcb.headerTemplate, tcb.destAddr, HeaderTemplate::RST | HeaderTemplate::ACK,
+                       tcb.sendStream.MAX, tcb.recvStream.NXT, 0);
+        }
+
+        releaseConnection(tcb, CLOSED);
+        raiseEvents(tcb, ReadyEvent::HANGUP);
+    }
+
+    /**
+     * Drops connection `tcb`, leaving it in final state `state` (CLOSED or
+     * TIME_WAIT): forgets its tuple, disarms its timers, and completes the
+     * operations waiting on it. The engine lets go of the TCB (back to its
+     * pool, if nobody else holds it) once the current batch is done.
+     */
+    void releaseConnection(Tcb &tcb, ConnectionState state)
+    {
+        if (tcb.state == SYN_SENT)
+            numOpening--;
+
+        timers.cancel(tcb.retransmitTimer);
+        timers.cancel(tcb.delayedAckTimer);
+
+        if (isListener(tcb))
+            listeners.erase(flowKey(tcb).listenerKey());
+        else
+            connections.erase(flowKey(tcb));
+
+        auto pending = std::find(pendingOpens.begin(), pendingOpens.end(), &tcb);
+        if (pending != pendingOpens.end())
+            pendingOpens.erase(pending);
+
+        tcb.state = state;
+
+        // waiting operations complete as the connection is closed
+        for (AsyncOp **waiter : { &tcb.readWaiter, &tcb.writeWaiter })
+        {
+            if (*waiter)
+                schedule(std::exchange(*waiter, nullptr)->handle);
+        }
+
+        for (size_t i = 0; i < tcbs.size(); i++)
+        {
+            if (tcbs[i].get() == &tcb)
+            {
+                released.push_back(std::move(tcbs[i]));
+                std::swap(tcbs[i], tcbs.back());
+                tcbs.pop_back();
+                break;
+            }
+        }
+        localPortsChanged = true;
+    }
+
+    /**
+     * Moves connection `tcb` to TIME-WAIT: drops it, keeping just a record
+     * of its tuple and sequence numbers for TCP_TIME_WAIT_US (2 MSL).
+     */
+    void enterTimeWait(Tcb &tcb)
+    {
+        log() << "-> TIME-WAIT" << std::endl;
+
+        uint64_t expiry = tick + TCP_TIME_WAIT_US / TIMER_WHEEL_TICK_US;
+        timeWait.insert({ flowKey(tcb), tcb.sendStream.NXT, tcb.recvStream.NXT, expiry });
+        releaseConnection(tcb, TIME_WAIT);
+    }
+
+    /**
+     * Returns true if connection `tcb` was added to the engine, and not
+     * dropped since.
+     */
+    bool isAdded(Tcb &tcb)
+    {
+        if (isListener(tcb))
+            return listeners.find(flowKey(tcb).listenerKey()) == &tcb;
+        return connections.find(flowKey(tcb)) == &tcb;
+    }
+
+    /**
+     * Returns the key of connection `tcb`.
+     */
+    static FlowKey flowKey(Tcb &tcb)
+    {
+        return { tcb.sourceAddr, tcb.destAddr, tcb.sourcePort, tcb.destPort };
+    }
+
+    /**
+     * Returns the key of the connection received segment `packet` belongs
+     * to.
+     */
+    static FlowKey flowKey(const PacketView &packet)
+    {
+        return {
+            packet.daddr(), packet.saddr(),
+            packet.destPort(), packet.sourcePort()
+        };
+    }
+
+    /**
+     * Returns the connection received segment `packet` belongs to, falling
+     * back to a listener on its destination address and port, or nullptr
+     * if there is neither.
+     */
+    Tcb* lookupConnection(const PacketView &packet)
+    {
+        FlowKey key = flowKey(packet);
+
+        Tcb *tcb = connections.find(key);
+        if (!tcb)
+            tcb = listeners.find(key.listenerKey());
+        return tcb;
+    }
+
+    /**
+     * Handles received segment `packet` if it belongs to a connection in
+     * TIME-WAIT: a retransmitted FIN (i.e. our ACK of it was lost) is
+     * acknowledged again, restarting the wait, and anything else dropped,
+     * but for
+     *
+     *   - a SYN of a new connection on the tuple, starting beyond the old
+     *     one's sequence space (RFC 1122, 4.2.2.13), which ends the wait.
+     *
+     *   - any other SYN, answered with an ACK, which a new connection's
+     *     opener (not knowing the old one) answers with a RST, and
+     *
+     *   - a RST with exactly the sequence number we expect (i.e. such an
+     *     answer), which ends the wait too, so the opener's next SYN gets
+     *     through (as Linux lets it).
+     *
+     * Returns false if the segment isn't (or is no longer) TIME-WAIT's.
+     */
+    bool timeWaitHandler(const PacketView &packet)
+    {
+        if (timeWait.size() == 0)
+            return false;
+
+        FlowKey key = flowKey(packet);
+        TimeWaitRecord *record = timeWait.find(key);
+        if (!record)
+            return false;
+
+        if (packet.SYN() && !packet.ACK() && record->acceptsSyn(packet.seqNum()))
+        {
+            log() << "TIME-WAIT: received new connection's SYN, reusing tuple" << std::endl;
+            timeWait.erase(key);
+            timeWaitReused++;
+            return false;
+        }
+
+        timeWaitSegments++;
+        if (packet.RST())
+        {
+            if (packet.seqNum() == record->rcvNxt)
+            {
+                log() << "TIME-WAIT: received RST, freeing tuple" << std::endl;
+                timeWait.erase(key);
+            }
+            return true;
+        }
+        if (!packet.SYN() && !packet.FIN())
+            return true;
+
+        log() << "TIME-WAIT: received " << (packet.SYN() ? "SYN" : "FIN again") << std::endl;
+
+        // (no connection to take the headers from)
+        HeaderTemplate headers;
+        headers.initialise(key.localAddr, key.remoteAddr, key.localPort, key.remotePort);
+        sendPacket(headers, key.remoteAddr, HeaderTemplate::ACK, record->sndNxt, record->rcvNxt, 0);
+        if (packet.SYN())
+            return true;
+
+        TimeWaitRecord restarted = *record;
+        restarted.expiry = tick + TCP_TIME_WAIT_US / TIMER_WHEEL_TICK_US;
+        timeWait.insert(restarted);
+        return true;
+    }
+
+    /**
+     * Processes the peer's RST, received in `packet` on a synchronized
+     * connection: unless outside the receive window (i.e. an old
+     * connection's, or a blind guess), the peer dropped the connection,
+     * so we drop it too (completing the operations waiting on it), and
+     * report it failed.
+     */
+    void processReset(Tcb &tcb, const PacketView &packet)
+    {
+        if (!tcb.recvStream.inWindow(packet.seqNum()))
+            return;
+
+        log() << "received RST, -> CLOSED" << std::endl;
+        releaseConnection(tcb, CLOSED);
+        raiseEvents(tcb, ReadyEvent::ERROR | ReadyEvent::HANGUP);
+    }
+
+    /**
+     * Lets connection `tcb`, about to be added, take over its tuple from a
+     * connection of ours in TIME-WAIT, if any: an active open (i.e. a
+     * fast reconnect) may, starting its sequence space beyond the old
+     * connection's, so neither end takes the old one's segments for its
+     * own (the peer, if in TIME-WAIT too, accepts our SYN for that).
+     *
+     * Returns false if the tuple is in TIME-WAIT and can't be taken over.
+     */
+    bool reuseTimeWait(Tcb &tcb)
+    {
+        if (timeWait.size() == 0)
+            return true;
+
+        FlowKey key = flowKey(tcb);
+        TimeWaitRecord *record = timeWait.find(key);
+        if (!record)
+            return true;
+        if (tcb.state != CLOSED)
+            return false;
+
+        SendStream &sendStream = tcb.sendStream;
+        if ((int32_t)(sendStream.ISS - record->sndNxt) <= 0)
+            sendStream.initialiseSequence(record->sndNxt + 1 + (sendStream.ISS >> 2));
+
+        timeWait.erase(key);
+        timeWaitReused++;
+        return true;
+    }
+
+    void processAck(Tcb &tcb, uint32_t ackNum, uint16_t window)
+    {
+        SendStream &sendStream = tcb.sendStream;
+
+        /**
+         * Move UNA (and the peer's window, which starts there), dropping
+         * the now-ack'd bytes from the send buffer.
+         *
+         * Duplicate ACKs, and those of bytes not yet sent, are ignored.
+         *
+         * TODO: send duplicate ACK for the latter
+         */
+        uint32_t una = sendStream.UNA;
+        if (!sendStream.acknowledge(ackNum))
+            return;
+
+        sendStream.WND = window;
+        if (sendStream.UNA == una)
+            return;
+
+        // restart the retransmission timer for what is still unacknowledged
+        tcb.retransmits = 0;
+        timers.cancel(tcb.retransmitTimer);
+        if (!sendStream.allAcknowledged())
+            armRetransmit(tcb);
+
+        // acknowledgement made room in the send buffer
+        if (canSend(tcb))
+            raiseEvents(tcb, ReadyEvent::WRITABLE);
+
+        // our FIN follows every byte, so is acknowledged once all sent is (not just every byte)
+        bool finSent = tcb.state == FIN_WAIT_1 || tcb.state == CLOSING || tcb.state == LAST_ACK;
+        if (finSent && sendStream.allAcknowledged())
+            finAcked(tcb);
+    }
+
+    /**
+     * Our FIN was acknowledged: the connection waits for the peer's FIN
+     * (for at most TCP_FIN_WAIT_2_US), or, if it has it, is done.
+     */
+    void finAcked(Tcb &tcb)
+    {
+        switch (tcb.state)
+        {
+            case FIN_WAIT_1:
+                log() << "FIN-WAIT-1: FIN acknowledged, -> FIN-WAIT-2" << std::endl;
+                tcb.state = FIN_WAIT_2;
+                armTimer(tcb.retransmitTimer, TCP_FIN_WAIT_2_US);
+                break;
+            case CLOSING:
+                log() << "CLOSING: FIN acknowledged" << std::endl;
+                enterTimeWait(tcb);
+                break;
+            case LAST_ACK:
+                log() << "LAST-ACK: FIN acknowledged, -> CLOSED" << std::endl;
+                releaseConnection(tcb, CLOSED);
+                break;
+            default:
+                break;
+        }
+    }
+
+    /**
+     * Processes the peer's FIN, received in `packet`, once every byte
+     * before it is: acknowledges it at once, and reports the connection
+     * closed (a read finds the end of the stream).
+     */
+    void processFin(Tcb &tcb, const PacketView &packet)
+    {
+        // retransmitted, as our ACK of it was lost
+        if (tcb.finReceived)
+        {
+            sendAck(tcb);
+            return;
+        }
+
+        // bytes before it are missing (and were asked for again)
+        if (packet.seqNum() + packet.payloadSize() != tcb.recvStream.NXT)
+            return;
+
+        tcb.recvStream.NXT++;
+        tcb.finReceived = true;
+        sendAck(tcb);
+        raiseEvents(tcb, ReadyEvent::READABLE | ReadyEvent::HANGUP);
+
+        switch (tcb.state)
+        {
+            case ESTABLISHED:
+                log() << "ESTABLISHED: received FIN, -> CLOSE-WAIT" << std::endl;
+                tcb.state = CLOSE_WAIT;
+                break;
+            case FIN_WAIT_1:
+                log() << "FIN-WAIT-1: received FIN, -> CLOSING" << std::endl;
+                tcb.state = CLOSING;
+                break;
+            case FIN_WAIT_2:
+                log() << "FIN-WAIT-2: received FIN" << std::endl;
+                enterTimeWait(tcb);
+                break;
+            default:
+                break;
+        }
+    }
+
+    /**
+     * Writes the payload of `packet` to the receive buffer, straight from
+     * the link's buffer, fragment by fragment (i.e. as received, before
+     * GRO merged them): in order, or past a hole (held there until the hole
+     * fills, see RecvStream).
+     */
+    void processRecveivedPayload(Tcb &tcb, const PacketView &packet)
+    {
+        RecvStream &recvStream = tcb.recvStream;
+
+        bool outOfOrder = (int32_t)(packet.seqNum() - recvStream.NXT) > 0;
+        uint32_t held = recvStream.reassembly.size();
+        uint32_t advanced = 0;
+        for (uint32_t i = 0; i < packet.numFragments(); i++)
+        {
+            const PacketView &fragment = packet.fragment(i);
+            std::span<const uint8_t> payload = fragment.payload();
+            advanced += recvStream.writeSegment(fragment.seqNum(), payload.data(), payload.size());
+        }
+
+        /**
+         * Nothing new in order (out of order, a duplicate, or beyond the
+         * window): re-acknowledge what we have at once (a duplicate ACK),
+         * so the peer learns where the hole is.
+         */
+        if (advanced == 0)
+        {
+            if (outOfOrder)
+            {
+                log() << "Out of order segment received" << std::endl;
+                segmentsOutOfOrder++;
+            }
+            sendAck(tcb);
+            return;
+        }
+
+        /**
+         * Having filled a hole, acknowledge the bytes held after it at
+         * once. Else acknowledge every few segments, else once the delay
+         * runs out (or with our next segment).
+         */
+        tcb.ackPending += advanced;
+        if (recvStream.reassembly.size() < held)
+        {
+            holesFilled++;
+            sendAck(tcb);
+        }
+        else if (tcb.ackPending >= TCP_DELAYED_ACK_SEGMENTS * tcb.sendStream.MSS)
+            sendAck(tcb);
+        else if (!tcb.delayedAckTimer.armed())
+            armTimer(tcb.delayedAckTimer, TCP_DELAYED_ACK_US);
+
+        // notify user that some bytes are available to read
+        raiseEvents(tcb, ReadyEvent::READABLE);
+    }
+
+    void closedHandler(Tcb &tcb)
+    {
+        log() << "CLOSED: sending initial SYN" << std::endl;
+        log() << tcb.sendStream.toString() << std::endl;
+
+        tcb.headerTemplate.initialise(tcb.sourceAddr, tcb.destAddr, tcb.sourcePort, tcb.destPort);
+        sendSyn(tcb);
+        armRetransmit(tcb);
+
+        // transition to SYN-SENT state
+        tcb.state = SYN_SENT;
+    }
+
+    /**
+     * Send the initial SYN of connection `tcb`.
+     */
+    void sendSyn(Tcb &tcb)
+    {
+        // advertise ISS and window size
+        sendPacket(tcb, HeaderTemplate::SYN, tcb.sendStream.ISS, 0);
+    }
+
+    /**
+     * Send the SYN-ACK of connection `tcb`, acknowledging the peer's SYN.
+     */
+    void sendSynAck(Tcb &tcb)
+    {
+        // advertise ISS and window size, acknowledging peer's ISS
+        sendPacket(tcb, HeaderTemplate::SYN | HeaderTemplate::ACK, tcb.sendStream.ISS,
+                   tcb.recvStream.NXT);
+    }
+
+    /**
+     * Spawns a connection of listener `tcb` to the sender of SYN `packet`,
+     * found by its 4-tuple from now on.
+     *
+     * Returns the connection (in the LISTEN state), or nullptr if the
+     * listener's accept queue is full.
+     */
+    Tcb* spawnConnection(Tcb &tcb, const PacketView &packet)
+    {
+        if (tcb.listener && tcb.listener->isFull(engineId))
+        {
+            listenDrops++;
+            return nullptr;
+        }
+
+        auto child = tcbPool->acquire();
+        child->state = LISTEN;
+        child->sourceAddr = tcb.sourceAddr;
+        child->sourcePort = tcb.sourcePort;
+        child->destAddr = packet.saddr();
+        child->destPort = packet.sourcePort();
+        child->listener = tcb.listener;
+        child->headerTemplate.initialise(child->sourceAddr, child->destAddr,
+                                         child->sourcePort, child->destPort);
+
+        connections.insert(flowKey(*child), child.get());
+        tcbs.push_back(child);
+        connectionsSpawned++;
+        return child.get();
+    }
+
+    void listenHandler(Tcb &tcb, const PacketView &packet)
+    {
+        // a listener hands each SYN to a connection of its own
+        if (isListener(tcb))
+        {
+            if (!packet.SYN())
+            {
+                log() << "LISTEN: non-SYN received, send RST" << std::endl;
+                return;
+            }
+
+            Tcb *child = spawnConnection(tcb, packet);
+            if (!child)
+            {
+                log() << "LISTEN: accept queue full, dropping SYN" << std::endl;
+                return;
+            }
+            listenHandler(*child, packet);
+            return;
+        }
+
+        log() << tcb.sendStream.toString() << std::endl;
+
+        // received initial SYN
+        if (packet.SYN())
+        {
+            log() << "LISTEN: received SYN" << std::endl;
+
+            // initialse recv stream based on peer's ISS and window size
+            tcb.recvStream.IRS = packet.seqNum();
+            tcb.recvStream.NXT = packet.seqNum() + 1;
+            tcb.recvStream.WND = packet.window();
+
+            sendSynAck(tcb);
+            armRetransmit(tcb);
+
+            // transition to SYN-RECEIVED state
+            tcb.state = SYN_RECEIVED;
+        }
+
+        else 
+        {
+            /**
+             * TODO: 
+             * 
+             * As we are in the LISTEN state, we reply to any
+             * non-SYN packets with a RST. 
+             */
+            log() << "LISTEN: non-SYN received, send RST" << std::endl;
+        }
+    }
+
+    void synSentHandler(Tcb &tcb, const PacketView &packet)
+    {
+        // the peer refused the connection (if answering our SYN, i.e. acknowledging it)
+        if (packet.RST())
+        {
+            if (packet.ACK() && packet.ackNum() == tcb.sendStream.NXT)
+            {
+                log() << "SYN-SENT: received RST, -> CLOSED" << std::endl;
+                releaseConnection(tcb, CLOSED);
+                raiseEvents(tcb, ReadyEvent::ERROR | ReadyEvent::HANGUP);
+            }
+            return;
+        }
+
+        // received SYN-ACK
+        if (packet.SYN() && packet.ACK())
+        {
+            log() << "SYN-SENT: received SYN-ACK" << std::endl;
+
+            /**
+             * Validate ack. num. is correct.
+             * 
+             * NOTE: 
+             * 
+             * We don't send any data whilst connection is being
+             * established, so: 
+             *      SEG.ACK == SND.NXT == ISS + 1
+             * should hold.
+             */
+            if (!(packet.ackNum() == tcb.sendStream.NXT && 
+                  packet.ackNum() == tcb.sendStream.ISS + 1))
+            {
+                log() << "SYN-SENT: bad ack, send RST, -> CLOSED" << std::endl;
+                log() << packet.ackNum() << " " 
+                          << tcb.sendStream.NXT << " " 
+                          << tcb.sendStream.ISS + 1 
+                          << std::endl;
+                raiseEvents(tcb, ReadyEvent::ERROR);
+                return;
+            }
+
+            // initialise recv stream based on peer's ISS and window size
+            tcb.recvStream.IRS = packet.seqNum();
+            tcb.recvStream.NXT = packet.seqNum() + 1;
+            tcb.recvStream.WND = packet.window();
+
+            // peer's window bounds what we may send
+            tcb.sendStream.WND = packet.window();
+
+            /**
+             * Send ACK
+             */
+
+            // acknowledge peer's ISS, and advertise our window size
+            sendPacket(tcb, HeaderTemplate::ACK, tcb.sendStream.NXT, tcb.recvStream.NXT);
+
+            // our SYN is acknowledged
+            tcb.sendStream.UNA = tcb.sendStream.NXT;
+            timers.cancel(tcb.retransmitTimer);
+            tcb.retransmits = 0;
+
+            // transition to established state
+            tcb.state = ESTABLISHED;
+            numOpening--;
+            connectionsEstablished.fetch_add(1, std::memory_order_relaxed);
+            log() << "Connection established" << std::endl;
+            raiseEvents(tcb, ReadyEvent::WRITABLE);
+        }
+
+        // an ACK of something else (i.e. from an old connection on the tuple): reset it
+        else if (packet.ACK() && packet.ackNum() != tcb.sendStream.NXT)
+        {
+            log() << "SYN-SENT: unacceptable ACK, send RST" << std::endl;
+
+            sendPacket(tcb.headerTemplate, tcb.destAddr, HeaderTemplate::RST, packet.ackNum(), 0, 0);
+        }
+    }
+
+    void synReceivedHandler(Tcb &tcb, const PacketView &packet)
+    {
+        if (packet.RST())
+        {
+            processReset(tcb, packet);
+            return;
+        }
+
+        // peer retransmitted its SYN, so lost our SYN-ACK
+        if (packet.SYN() && !packet.ACK())
+        {
+            log() << "SYN-RECEIVED: received SYN again" << std::endl;
+            sendSynAck(tcb);
+            return;
+        }
+
+        // received ACK
+        if (packet.ACK())
+        {
+            log() << "SYN-RECEIVED: received ACK" << std::endl;
+
+            /**
+             * Validate ack. num. is correct. 
+             * 
+             * NOTE:
+             * 
+             * See synSentHandler (above) for explanation of validation.
+             */
+            if (!(packet.ackNum() == tcb.sendStream.NXT && 
+                  packet.ackNum() == tcb.sendStream.ISS + 1))
+            {
+                log() << "SYN-RECEIVED: bad ack, send RST, -> LISTEN" << std::endl;
+                log() << packet.ackNum() << " " 
+                          << tcb.sendStream.NXT << " " 
+                          << tcb.sendStream.ISS + 1 
+                          << std::endl;
+                raiseEvents(tcb, ReadyEvent::ERROR);
+                return;
+            }
+
+            /**
+             * No room to queue the connection for accepting: reset it,
+             * rather than hold it open (the peer thinking it is) with
+             * nobody to ever accept it.
+             */
+            if (tcb.listener && tcb.listener->isFull(engineId))
+            {
+                log() << "SYN-RECEIVED: accept queue full, send RST, -> CLOSED" << std::endl;
+                listenDrops++;
+                abortConnection(tcb);
+                return;
+            }
+
+            // peer's window bounds what we may send
+            tcb.sendStream.WND = packet.window();
+
+            // our SYN is acknowledged
+            tcb.sendStream.UNA = tcb.sendStream.NXT;
+            timers.cancel(tcb.retransmitTimer);
+            tcb.retransmits = 0;
+
+            tcb.state = ESTABLISHED;
+            connectionsEstablished.fetch_add(1, std::memory_order_relaxed);
+            log() << "Connection established" << std::endl;
+
+            raiseEvents(tcb, ReadyEvent::WRITABLE);
+
+            // ready to be accepted (which our listening TCB reports)
+            if (tcb.listener)
+            {
+                // (only acceptors take from our shard, so the room found above is still there)
+                if (!tcb.listener->enqueue(engineId, tcb.shared_from_this()))
+                {
+                    log() << "SYN-RECEIVED: accept queue full, send RST, -> CLOSED" << std::endl;
+                    listenDrops++;
+                    abortConnection(tcb);
+                }
+                else if (Tcb *listening = listeners.find(flowKey(tcb).listenerKey()))
+                    raiseEvents(*listening, ReadyEvent::READABLE);
+            }
+        }
+    }
+
+    /**
+     * Handles segments of a synchronized connection (i.e. ESTABLISHED, or
+     * closing but for TIME-WAIT).
+     */
+    void establishedHandler(Tcb &tcb, const PacketView &packet)
+    {
+        log() << "ESTABLISHED: received packet" << std::endl;
+
+        /**
+         * Handle RST set (i.e. reset request).
+         */
+        if (packet.RST())
+        {
+            processReset(tcb, packet);
+            return;
+        }
+
+        /**
+         * Handle SYN set.
+         * 
+         * A retransmitted SYN-ACK means the peer lost our ACK of it, so
+         * we acknowledge it again. Otherwise, this is considered an error
+         * in the ESTABLISHED state, so we send a reset.
+         * 
+         * TODO: reset on other SYNs
+         */
+        if (packet.SYN())
+        {
+            if (packet.ACK() && packet.seqNum() == tcb.recvStream.IRS)
+                sendAck(tcb);
+            return;
+        }
+        
+        /**
+         * Handle 'no-ACK' (i.e. ACK bit off).
+         * 
+         * This is considered an error in the ESTABLISHED state,
+         * so we drop the segment.
+         */
+        if (!packet.ACK())
+        {
+            return;
+        }
+
+        /* process acknowlegement (which may complete our close) */
+        processAck(tcb, packet.ackNum(), packet.window());
+        if (tcb.state == CLOSED || tcb.state == TIME_WAIT)
+            return;
+
+        /* process payload, if any (none follows the peer's FIN) */
+        if (packet.payloadSize() > 0 && !tcb.finReceived)
+            processRecveivedPayload(tcb, packet);
+
+        /* process the peer's FIN */
+        if (packet.FIN())
+            processFin(tcb, packet);
+    }
+
+    /**
+     * Run `packet` through the state machine.
+     */
+    void processPacket(Tcb &tcb, const PacketView &packet)
+    {
+        switch(tcb.state)
+        {
+            case LISTEN:
+                listenHandler(tcb, packet);
+                break;
+            case SYN_SENT:
+                synSentHandler(tcb, packet);
+                break;
+            case SYN_RECEIVED:
+                synReceivedHandler(tcb, packet);
+                break;
+            case ESTABLISHED:
+            case CLOSE_WAIT:
+            case FIN_WAIT_1:
+            case FIN_WAIT_2:
+            case CLOSING:
+            case LAST_ACK:
+                establishedHandler(tcb, packet);
+                break;
+            default:
+                // shouldn't reach here
+                throw std::runtime_error("Undefined state reached");
+        }
+    }
+
+    /**
+     * Engine loop. 
+     * 
+     * Each iteration carries out the commands application threads submitted,
+     * resumes ready coroutines, drains a batch of packets from the link
+     * backend (spinning on it for a while after activity, if busy-polling,
+     * and waiting no longer than the next timer expiry), fires the timers
+     * that expired, hands
+     * segments of other engines' connections over to them (taking in those
+     * they handed to us), merges in-order segments (GRO), runs each through
+     * the state machine of the connection it belongs to (completing the
+     * operations coroutines wait on), resumes the coroutines that made ready,
+     * then flushes every segment the handlers and coroutines queued in one go.
+     */
+    void run()
+    {
+        std::vector<LinkPacket> batch(LINK_BATCH_SIZE);
+        std::vector<PacketView> segments(2 * LINK_BATCH_SIZE);
+        current = this;
+
+        while (!stopRequested.load(std::memory_order_relaxed))
+        {
+            if (processCommands() > 0 || !runQueue.empty())
+                markActive();
+            runReady();
+            if (localPortsChanged)
+                updateLocalPorts();
+            openPendingConnections();
+            flushPackets();
+
+            int batchSize = retreivePackets(batch);
+            if (batchSize < 0)
+                return;
+            expireTimers();
+
+            // keep our own connections' segments, hand the rest over to their engines
+            int numSegments = 0;
+            for (int i = 0; i < batchSize; i++)
+            {
+                PacketView &packet = segments[numSegments];
+                if (!packet.parse(batch[i].data, batch[i].size))
+                {
+                    segmentsMalformed++;
+                    continue;
+                }
+
+                uint32_t owner = owningEngine(packet);
+                if (owner == engineId)
+                {
+                    numSegments++;
+                    continue;
+                }
+
+                if (handOff(packet, owner))
+                    segmentsHandedOff++;
+                else
+                    handoffDrops++;
+            }
+            numSegments = drainHandoffRings(segments, numSegments);
+
+            // each segment GRO merged others into is followed by them
+            coalescer.coalesce(segments, numSegments);
+            for (int i = 0; i < numSegments; i += segments[i].numFragments())
+            {
+                Tcb *tcb = lookupConnection(segments[i]);
+                if ((!tcb || isListener(*tcb)) && timeWaitHandler(segments[i]))
+                    continue;
+                if (!tcb)
+                {
+                    segmentsUnmatched++;
+                    continue;
+                }
+
+                if (verbose)
+                    std::cout << segments[i].toString(false, true) << std::endl;
+                processPacket(*tcb, segments[i]);
+
+                if (canSend(*tcb) || resending(*tcb))
+                    sendData(*tcb);
+                wakeWaiters(*tcb);
+            }
+            releaseHandoffSlots();
+            runReady();
+
+            flushPackets();
+            released.clear();
+            reportStats();
+        }
+    }
+};
 
-                if (!packetValid(packet))
-                    continue;
-                
-                std::cout << packet.toString(false, true) << std::endl;
+/**
+ * Group of engines (i.e. one per core) sharing nothing on the data path.
+ *
+ * Each engine owns a disjoint partition of the connections (TCBs, buffers,
+ * timers), picked by the RSS hash of their 4-tuple, and its own queue of
+ * the link. Segments an engine receives for a connection it doesn't own
+ * (i.e. the link steers flows differently) are handed over to the owning
+ * engine through the single-producer/single-consumer ring between the two,
+ * so no locks are taken.
+ *
+ * The group is also the executor of the coroutines driving its connections
+ * (see TcpConnection): each runs on the engine owning the connection it
+ * awaits, so it never shares a connection with another thread.
+ *
+ * With cores given (`linkConfig.queueCpus`, engine i getting the i'th,
+ * wrapping around), each engine thread is pinned to its core, and the
+ * engine (i.e. its link queue, rings and pools) and the handoff rings it
+ * consumes are allocated from its core, so they land on its NUMA node.
+ */
+class EngineGroup : public Executor
+{
+public:
+    EngineGroup(LinkConfig &linkConfig, uint32_t numEngines)
+    {
+        if (numEngines == 0 || numEngines > ENGINE_MAX_ENGINES)
+            throw std::runtime_error("Unsupported num. engines");
+
+        std::vector<int> cpus;
+        for (uint32_t i = 0; i < numEngines && !linkConfig.queueCpus.empty(); i++)
+            cpus.push_back(linkConfig.queueCpus[i % linkConfig.queueCpus.size()]);
+
+        // ring [from * numEngines + to] carries segments engine `from` received for engine `to`
+        rings.resize(numEngines * numEngines);
+        for (uint32_t i = 0; i < numEngines; i++)
+        {
+            LinkConfig engineConfig = linkConfig;
+            engineConfig.queueCpus = cpus;
+            if (numEngines > 1)
+            {
+                engineConfig.queueIndex = i;
+                engineConfig.numQueues = numEngines;
+
+                // don't sleep on the link while other engines hand us segments
+                engineConfig.pollTimeoutMs = ENGINE_POLL_TIMEOUT_MS;
+
+                if (!linkConfig.capturePath.empty())
+                    engineConfig.capturePath += "." + std::to_string(i);
             }
-            
-            switch(tcb->state)
+
+            SystemUtils::ScopedAffinity affinity(cpus.empty() ? -1 : cpus[i]);
+            engines.push_back(std::make_unique<SegmentThread>(engineConfig));
+            for (uint32_t from = 0; from < numEngines; from++)
             {
-                case CLOSED:
-                    closedHandler();
-                    break;
-                case LISTEN:
-                    listenHandler(packet);
-                    break;
-                case SYN_SENT:
-                    synSentHandler(packet);
-                    break;
-                case SYN_RECEIVED:
-                    synReceivedHandler(packet);
-                    break;
-                case ESTABLISHED:
-                    establishedHandler(packet);
-                    break;
-                default:
-                    // shouldn't reach here
-                    throw std::runtime_error("Undefined state reached");
+                if (from != i)
+                    rings[from * numEngines + i] = std::make_unique<HandoffRing>(ENGINE_HANDOFF_RING_SIZE,
+                                                                                  linkConfig.maxFrameSize);
+            }
+        }
+
+        for (uint32_t i = 0; i < numEngines; i++)
+        {
+            std::vector<HandoffRing*> handoffIn(numEngines), handoffOut(numEngines);
+            for (uint32_t j = 0; j < numEngines; j++)
+            {
+                handoffIn[j] = rings[j * numEngines + i].get();
+                handoffOut[j] = rings[i * numEngines + j].get();
             }
+            engines[i]->setHandoffRings(handoffIn, handoffOut);
+        }
+    }
+
+    /**
+     * Listens on `localAddr` (network order) and `localPort`.
+     *
+     * A SYN to the port may land on any engine, so every engine gets a
+     * listening TCB, all sharing the returned listener, whose accept queues
+     * (one per engine) the connections they spawn end up on.
+     *
+     * Returns nullptr if the port is already listened on.
+     *
+     * The listening TCBs (remote port 0) raise readiness events
+     * `watchedEvents`, READABLE as connections are queued for accept.
+     *
+     * Must be called before the engines are started.
+     */
+    std::shared_ptr<Listener> listen(in_addr_t localAddr, uint16_t localPort,
+                                     uint32_t watchedEvents = 0)
+    {
+        auto listener = std::make_shared<Listener>(localAddr, localPort, engines.size());
+        for (auto &engine : engines)
+        {
+            auto tcb = std::make_shared<Tcb>();
+            tcb->state = LISTEN;
+            tcb->sourceAddr = localAddr;
+            tcb->sourcePort = localPort;
+            tcb->destAddr = 0;
+            tcb->destPort = 0;
+            tcb->listener = listener;
+            tcb->watchedEvents = watchedEvents;
+            if (!engine->addConnection(tcb))
+                return nullptr;
+        }
+        return listener;
+    }
+
+    /**
+     * Adds connection `tcb` (not a listener, see listen()) to the engine
+     * owning it.
+     *
+     * Must be called before the engines are started.
+     */
+    bool addConnection(std::shared_ptr<Tcb> tcb)
+    {
+        return owningEngine(*tcb).addConnection(tcb);
+    }
+
+    /**
+     * Queues `command` for the engine owning its connection (from any
+     * thread, once the engines are started). Connections are opened with
+     * an OPEN command.
+     *
+     * Returns false if the engine's command queue is full.
+     */
+    bool submit(Command command)
+    {
+        return owningEngine(*command.tcb).submit(command);
+    }
+
+    /**
+     * Has the engine owning `command.tcb` carry out `command`.
+     */
+    void execute(Command command) override
+    {
+        deliver(owningEngine(*command.tcb), command);
+    }
+
+    /**
+     * Watches readiness events `events` (see ReadyEvent) of connection
+     * `tcb`, reported by the notifier of the engine owning it (see
+     * notifier()), starting with those it is ready for already.
+     */
+    void watch(std::shared_ptr<Tcb> tcb, uint32_t events)
+    {
+        execute({ Command::WATCH, tcb, events });
+    }
+
+    /**
+     * Returns the readiness notifier of engine `engine`.
+     */
+    ReadinessNotifier &notifier(uint32_t engine)
+    {
+        return engines[engine]->notifier;
+    }
+
+    /**
+     * Returns the num. engines of the group.
+     */
+    uint32_t numEngines() override
+    {
+        return engines.size();
+    }
+
+    /**
+     * Starts operation `op` on `tcb`'s engine: right away if the caller
+     * runs that engine, else through its command queue.
+     *
+     * Returns false if `op` completed at once (so the caller needn't
+     * suspend).
+     */
+    bool await(const std::shared_ptr<Tcb> &tcb, AsyncOp *op) override
+    {
+        SegmentThread &engine = owningEngine(*tcb);
+        if (SegmentThread::current == &engine)
+            return !engine.startOp(*tcb, op);
+
+        Command command = { Command::AWAIT, tcb };
+        command.op = op;
+        deliver(engine, command);
+        return true;
+    }
+
+    /**
+     * Resumes coroutine `handle` on `tcb`'s engine (or the first engine,
+     * for no `tcb`).
+     */
+    void post(Tcb *tcb, std::coroutine_handle<> handle) override
+    {
+        SegmentThread &engine = tcb ? owningEngine(*tcb) : *engines[0];
+        Command command = { Command::RESUME };
+        command.handle = handle;
+        deliver(engine, command);
+    }
+
+    /**
+     * Resumes coroutine `handle` on engine `engine`.
+     */
+    void postTo(uint32_t engine, std::coroutine_handle<> handle) override
+    {
+        Command command = { Command::RESUME };
+        command.handle = handle;
+        deliver(*engines[engine], command);
+    }
+
+    /**
+     * Returns the index of the engine the calling thread runs, or 0 if it
+     * runs none of the group's.
+     */
+    uint32_t currentEngine() override
+    {
+        for (uint32_t i = 0; i < engines.size(); i++)
+        {
+            if (engines[i].get() == SegmentThread::current)
+                return i;
+        }
+        return 0;
+    }
+
+    /**
+     * Starts each engine on its own thread.
+     */
+    void start()
+    {
+        for (auto &engine : engines)
+        {
+            SegmentThread *e = engine.get();
+            threads.emplace_back([e] { e->startThread(); });
+        }
+    }
+
+    /**
+     * Asks all engines to stop, and waits for their threads.
+     */
+    void stop()
+    {
+        for (auto &engine : engines)
+            engine->stop();
+        join();
+    }
+
+    void join()
+    {
+        for (auto &thread : threads)
+            thread.join();
+        threads.clear();
+    }
+
+    void setVerbose(bool verbose)
+    {
+        for (auto &engine : engines)
+            engine->verbose = verbose;
+    }
+
+    /**
+     * Returns num. connections (of all engines) that reached ESTABLISHED.
+     */
+    uint64_t connectionsEstablished()
+    {
+        uint64_t n = 0;
+        for (auto &engine : engines)
+            n += engine->connectionsEstablished.load(std::memory_order_relaxed);
+        return n;
+    }
+
+private:
+    std::vector<std::unique_ptr<SegmentThread>> engines;
+    std::vector<std::unique_ptr<HandoffRing>> rings;
+
+    /**
+     * Returns the engine owning connection `tcb`, hashed as segments we
+     * receive on it are.
+     */
+    SegmentThread &owningEngine(Tcb &tcb)
+    {
+        uint32_t hash = Rss::hash(tcb.destAddr, tcb.sourceAddr, tcb.destPort, tcb.sourcePort);
+        return *engines[Rss::queue(hash, engines.size())];
+    }
+
+    /**
+     * Has `engine` carry out `command`: right away if the caller runs it
+     * (as it must not wait on its own queue), else through its command
+     * queue, waiting for room.
+     */
+    static void deliver(SegmentThread &engine, Command &command)
+    {
+        if (SegmentThread::current == &engine)
+        {
+            engine.carryOut(command);
+            return;
         }
+
+        while (!engine.submit(command))
+            std::this_thread::yield();
     }
+
+    std::vector<std::thread> threads;
 };
 
-int main()
+/* port the passive end of the test connections listens on */
+#define TEST_LISTEN_PORT 8101
+
+/**
+ * Initialise `tcb` as the active (i.e. connecting) end of test connection
+ * `index`, which connects from port 8100 + 2i to the passive end's
+ * listener (port 8101).
+ */
+void initialiseTcb(Tcb &tcb, const std::string &sourceAddr, const std::string &destAddr,
+                   uint32_t index = 0)
+{
+    tcb.state = CLOSED;
+    tcb.sourceAddr = inet_addr(sourceAddr.c_str());
+    tcb.sourcePort = 8100 + 2 * index;
+    tcb.destAddr = inet_addr(destAddr.c_str());
+    tcb.destPort = TEST_LISTEN_PORT;
+}
+
+/**
+ * Accepts connections of `listener` on the engine it runs on (leaving them
+ * open), until `accepted` counts `numConnections` between the acceptors
+ * of all engines.
+ */
+Task acceptConnections(Executor &executor, std::shared_ptr<Listener> listener,
+                       uint32_t numConnections, std::atomic<uint32_t> &accepted)
+{
+    TcpListener tcpListener(executor, listener);
+    while (true)
+    {
+        TcpConnection connection = co_await tcpListener.co_accept();
+        if (!connection.isOpen())
+            break;
+
+        // the last one: the other engines' acceptors are done too
+        if (accepted.fetch_add(1, std::memory_order_relaxed) + 1 == numConnections)
+        {
+            listener->stopWaiting();
+            break;
+        }
+    }
+}
+
+/**
+ * Reports how many connections `listener` had accepted from the accepting
+ * engine's own queue, and how many stolen from other engines' queues.
+ */
+void reportAccepts(const Listener &listener)
+{
+    uint64_t local = listener.acceptedLocal.load();
+    uint64_t stolen = listener.acceptedStolen.load();
+    std::cout << "Accepted " << local + stolen << " connections (" << local
+              << " from the engine's own queue, " << stolen
+              << " stolen from other engines' queues)" << std::endl;
+}
+
+/**
+ * Waits for `groups` to establish `numConnections` connections each, then
+ * reports the connection rate and stops them.
+ *
+ * With `listener` set (on `groups[0]`), accepts its connections meanwhile
+ * with an acceptor on each engine (see acceptConnections()), so they don't
+ * overflow its backlog.
+ */
+void runBenchmark(std::vector<EngineGroup*> groups, uint32_t numConnections,
+                  std::shared_ptr<Listener> listener = nullptr)
+{
+    std::atomic<uint32_t> accepted{0};
+    for (uint32_t i = 0; listener && i < groups[0]->numEngines(); i++)
+        groups[0]->spawnOn(acceptConnections(*groups[0], listener, numConnections, accepted), i);
+
+    uint64_t start = TimeUtils::getMonotonicTimeNs();
+    for (EngineGroup *group : groups)
+    {
+        while (group->connectionsEstablished() < numConnections)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    uint64_t elapsed = TimeUtils::getMonotonicTimeNs() - start;
+
+    std::cout << "Established " << numConnections << " connections in "
+              << elapsed / 1000 << " us ("
+              << (uint64_t)(numConnections * 1e9 / elapsed) << " connections/sec)" << std::endl;
+
+    // once they're all accepted, the acceptors are done
+    while (listener && accepted.load() < numConnections)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    for (EngineGroup *group : groups)
+        group->stop();
+
+    if (listener)
+        reportAccepts(*listener);
+}
+
+/**
+ * Echo server driven by an epoll loop (i.e. as an existing event-loop
+ * server would adopt the stack), rather than coroutines: accepts
+ * `numConnections` connections of `listener` (watched for READABLE, see
+ * EngineGroup::listen()), each echoing back the bytes it receives until it
+ * has echoed `bytesPerConnection` (then closing it).
+ *
+ * Runs on the calling thread, reading and writing the connections' stream
+ * buffers directly, as the engines' readiness notifications tell it to:
+ * bytes are copied straight from the receive buffer into the send buffer,
+ * left in the former until the latter has room.
+ */
+void serveEchoEpoll(EngineGroup &group, std::shared_ptr<Listener> listener,
+                    uint32_t numConnections, uint64_t bytesPerConnection, Echo::Stats &stats)
+{
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0)
+    {
+        perror("epoll_create1() failed");
+        return;
+    }
+
+    for (uint32_t i = 0; i < group.numEngines(); i++)
+    {
+        struct epoll_event event = {};
+        event.events = EPOLLIN | EPOLLET;
+        event.data.u32 = i;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, group.notifier(i).fd(), &event) < 0)
+        {
+            perror("epoll_ctl() failed");
+            close(epollFd);
+            return;
+        }
+    }
+
+    // bytes each connection echoed so far
+    struct Session
+    {
+        uint64_t echoed = 0;
+    };
+    std::unordered_map<Tcb*, Session> sessions;
+
+    uint32_t closed = 0;
+    std::vector<ReadyEvent> ready(LINK_BATCH_SIZE);
+    struct epoll_event fired[ENGINE_MAX_ENGINES];
+
+    while (closed < numConnections)
+    {
+        int numFired = epoll_wait(epollFd, fired, ENGINE_MAX_ENGINES, -1);
+        if (numFired < 0 && errno != EINTR)
+        {
+            perror("epoll_wait() failed");
+            break;
+        }
+
+        for (int i = 0; i < numFired; i++)
+        {
+            uint32_t engine = fired[i].data.u32;
+            int numReady;
+            while ((numReady = group.notifier(engine).poll(ready.data(), ready.size())) > 0)
+            {
+                for (int j = 0; j < numReady; j++)
+                {
+                    std::shared_ptr<Tcb> &tcb = ready[j].tcb;
+                    uint32_t events = ready[j].events;
+
+                    // a listening TCB: accept all we can
+                    if (tcb->destPort == 0)
+                    {
+                        while (std::shared_ptr<Tcb> child = listener->accept(engine))
+                        {
+                            sessions[child.get()];
+                            group.watch(child, ReadyEvent::READABLE | ReadyEvent::WRITABLE |
+                                               ReadyEvent::HANGUP);
+                        }
+                        continue;
+                    }
+
+                    auto session = sessions.find(tcb.get());
+                    if (session == sessions.end())
+                        continue;
+
+                    // the peer closed its end (or the connection was aborted): close ours
+                    if (events & ReadyEvent::HANGUP)
+                    {
+                        group.execute({ Command::CLOSE, tcb });
+                        sessions.erase(session);
+                        closed++;
+                        stats.sessionsDone.fetch_add(1, std::memory_order_relaxed);
+                        continue;
+                    }
+
+                    // echo what arrived, as far as the send buffer has room (at most two views, if flat)
+                    CircularBuffer &recvBuffer = tcb->recvStream.recvBuffer;
+                    CircularBuffer &sendBuffer = tcb->sendStream.sendBuffer;
+                    uint32_t sent = 0;
+                    while (1)
+                    {
+                        std::span<const uint8_t> received = recvBuffer.readableSpan();
+                        uint32_t toSend = std::min<size_t>(received.size(), sendBuffer.availableToWrite());
+                        if (toSend == 0)
+                            break;
+
+                        sendBuffer.writeN(received.data(), toSend);
+                        recvBuffer.discardN(toSend);
+                        sent += toSend;
+                    }
+                    if (sent == 0)
+                        continue;
+
+                    group.execute({ Command::SEND, tcb });
+
+                    session->second.echoed += sent;
+                    if (session->second.echoed >= bytesPerConnection && recvBuffer.availableToRead() == 0)
+                        group.execute({ Command::CLOSE, tcb });
+                }
+            }
+        }
+    }
+
+    close(epollFd);
+}
+
+/**
+ * Runs the echo benchmark (see Echo): `clientGroup` makes `rounds` round
+ * trips of `messageSize` bytes on each of `numConnections` test connections,
+ * echoed by the server `serverGroup` runs on `listener`, then reports the
+ * round trip rate and stops both. Either group may be run by another
+ * process instead (nullptr).
+ *
+ * With `epollServer` set, the server is serveEchoEpoll() on a thread of its
+ * own (the listener must be watched for READABLE), rather than coroutines.
+ */
+void runEcho(EngineGroup *serverGroup, std::shared_ptr<Listener> listener,
+             EngineGroup *clientGroup, const std::string &clientAddr, const std::string &serverAddr,
+             uint32_t numConnections, uint32_t messageSize, uint32_t rounds, bool epollServer)
+{
+    Echo::Stats stats;
+    uint64_t start = TimeUtils::getMonotonicTimeNs();
+
+    uint64_t bytesPerConnection = (uint64_t)messageSize * rounds;
+    std::thread serverThread;
+    if (serverGroup && epollServer)
+    {
+        serverThread = std::thread([&] {
+            serveEchoEpoll(*serverGroup, listener, numConnections, bytesPerConnection, stats);
+        });
+    }
+    else if (serverGroup)
+        Echo::server(*serverGroup, listener, numConnections, bytesPerConnection, stats);
+
+    if (clientGroup)
+    {
+        for (uint32_t i = 0; i < numConnections; i++)
+        {
+            clientGroup->spawn(Echo::client(*clientGroup,
+                                            inet_addr(clientAddr.c_str()), 8100 + 2 * i,
+                                            inet_addr(serverAddr.c_str()), TEST_LISTEN_PORT,
+                                            messageSize, rounds, stats));
+        }
+    }
+
+    // a client is done once its last message is echoed, a session once it echoed it
+    std::atomic<uint32_t> &done = clientGroup ? stats.clientsDone : stats.sessionsDone;
+    while (done.load() < numConnections)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    uint64_t elapsed = TimeUtils::getMonotonicTimeNs() - start;
+
+    if (clientGroup)
+    {
+        uint64_t roundTrips = stats.roundTrips.load();
+        std::cout << "Made " << roundTrips << " round trips of " << messageSize << " bytes over "
+                  << numConnections << " connections in " << elapsed / 1000 << " us ("
+                  << (uint64_t)(roundTrips * 1e9 / elapsed) << " round trips/sec, "
+                  << stats.clientsFailed.load() << " connections failed)" << std::endl;
+    }
+    else
+    {
+        std::cout << "Served " << numConnections << " echo connections in "
+                  << elapsed / 1000 << " us" << std::endl;
+    }
+    if (serverGroup)
+        reportAccepts(*listener);
+
+    if (serverThread.joinable())
+        serverThread.join();
+
+    for (EngineGroup *group : { serverGroup, clientGroup })
+    {
+        if (group)
+            group->stop();
+    }
+}
+
+/**
+ * Run both ends of the test connection(s) in-process, connected by a virtual
+ * wire with impairments `spec` (see VirtualWireConfig::parse()), each end
+ * on `numEngines` engines.
+ *
+ * With `numConnections` set, quietly opens that many connections, and
+ * reports how fast they were established (see runBenchmark()).
+ *
+ * With `echoRounds` set, runs the echo benchmark over the connections
+ * instead (see runEcho()), its server optionally an `epollServer`.
+ *
+ * No root or network interface needed.
+ */
+void runVirtual(const std::string &spec, uint32_t numEngines, uint32_t numConnections,
+                uint32_t echoRounds, uint32_t messageSize, bool epollServer, uint32_t busyPollUs,
+                uint32_t maxFrameSize, const std::vector<int> &cpus)
 {
+    auto wire = std::make_shared<VirtualWire>(VirtualWireConfig::parse(spec));
+    std::string activeAddr = "10.126.0.1";
+    std::string passiveAddr = "10.126.0.2";
+
+    LinkConfig activeConfig;
+    activeConfig.type = VIRTUAL;
+    activeConfig.sourceAddr = activeAddr;
+    activeConfig.wire = wire;
+    activeConfig.busyPollUs = busyPollUs;
+    activeConfig.maxFrameSize = maxFrameSize;
+    activeConfig.queueCpus = cpus;
+
+    // engines must notice runBenchmark() stopping them (and commands, for runEcho())
+    if (numConnections > 0 || echoRounds > 0)
+        activeConfig.pollTimeoutMs = ENGINE_POLL_TIMEOUT_MS;
+
+    LinkConfig passiveConfig = activeConfig;
+    passiveConfig.sourceAddr = passiveAddr;
+
+    // attach both ends before either sends anything
+    EngineGroup passive(passiveConfig, numEngines);
+    EngineGroup active(activeConfig, numEngines);
+
+    auto listener = passive.listen(inet_addr(passiveAddr.c_str()), TEST_LISTEN_PORT,
+                                   epollServer ? ReadyEvent::READABLE : 0);
+    for (uint32_t i = 0; i < std::max(numConnections, 1u) && echoRounds == 0; i++)
+    {
+        auto tcb = std::make_shared<Tcb>();
+        initialiseTcb(*tcb, activeAddr, passiveAddr, i);
+        active.addConnection(tcb);
+    }
+
+    bool verbose = numConnections == 0 && echoRounds == 0;
+    passive.setVerbose(verbose);
+    active.setVerbose(verbose);
+    passive.start();
+    active.start();
+
+    if (echoRounds > 0)
+        runEcho(&passive, listener, &active, activeAddr, passiveAddr,
+                std::max(numConnections, 1u), messageSize, echoRounds, epollServer);
+    else if (numConnections > 0)
+        runBenchmark({ &passive, &active }, numConnections, listener);
+    passive.join();
+    active.join();
+}
+
+/**
+ * Usage: thread{1,2} [raw|tun|packet|xdp|uring|uring-sqpoll] [interface] [queue] [peer MAC]
+ *        thread{1,2} pcap <capture file> [--timed] [--loops=N]
+ *        thread{1,2} virtual [impairments, e.g. rate=1gbit,delay=100us,loss=0.01]
+ *        thread{1,2} bench-buffer   (stream buffer microbenchmarks)
+ *        thread{1,2} test           (unit tests)
+ *
+ * Options:
+ *        --capture=FILE    record every packet sent/received to pcap file FILE
+ *        --timed           replay at the capture's timestamps (default: full speed)
+ *        --loops=N         replay the capture N times
+ *        --engines=N       spread connections over N engines (i.e. threads/link queues)
+ *        --connections=N   open N test connections, and report the connection rate
+ *        --echo            run the echo benchmark over the test connections (thread2
+ *                          echoes, thread1 sends), and report the round trip rate
+ *        --rounds=N        round trips per echo connection
+ *        --message-size=N  echo message size (bytes)
+ *        --epoll           serve echo connections from an epoll loop on the engines'
+ *                          readiness notifications, rather than coroutines
+ *        --busy-poll=US    engines spin on the link for US microseconds after activity
+ *                          before waiting on it again (trading CPU for latency)
+ *        --max-frame=N     largest received IP packet (bytes) engines hand over to
+ *                          each other, sizing their handoff rings (default 2048)
+ *        --cpus=LIST       pin engine i to the i'th core of LIST (i.e. "0,2,4-7"), and
+ *                          allocate its memory on that core's NUMA node
+ */
+int main(int argc, char **argv)
+{
+    LinkConfig linkConfig;
+    uint32_t numEngines = 1;
+    uint32_t numConnections = 0;
+    bool echo = false;
+    uint32_t echoRounds = ECHO_DEFAULT_ROUNDS;
+    uint32_t messageSize = ECHO_DEFAULT_MESSAGE_SIZE;
+    bool epollServer = false;
+    std::vector<std::string> args;
+    for (int i = 0; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--capture=", 0) == 0)
+            linkConfig.capturePath = arg.substr(strlen("--capture="));
+        else if (arg == "--timed")
+            linkConfig.replayTimed = true;
+        else if (arg.rfind("--loops=", 0) == 0)
+            linkConfig.replayLoops = std::stoul(arg.substr(strlen("--loops=")));
+        else if (arg.rfind("--engines=", 0) == 0)
+            numEngines = std::stoul(arg.substr(strlen("--engines=")));
+        else if (arg.rfind("--connections=", 0) == 0)
+            numConnections = std::stoul(arg.substr(strlen("--connections=")));
+        else if (arg == "--echo")
+            echo = true;
+        else if (arg.rfind("--rounds=", 0) == 0)
+            echoRounds = std::stoul(arg.substr(strlen("--rounds=")));
+        else if (arg.rfind("--message-size=", 0) == 0)
+            messageSize = std::stoul(arg.substr(strlen("--message-size=")));
+        else if (arg == "--epoll")
+            epollServer = true;
+        else if (arg.rfind("--busy-poll=", 0) == 0)
+            linkConfig.busyPollUs = std::stoul(arg.substr(strlen("--busy-poll=")));
+        else if (arg.rfind("--max-frame=", 0) == 0)
+            linkConfig.maxFrameSize = std::stoul(arg.substr(strlen("--max-frame=")));
+        else if (arg.rfind("--cpus=", 0) == 0)
+        {
+            if (!SystemUtils::parseCpuList(arg.substr(strlen("--cpus=")), linkConfig.queueCpus))
+            {
+                std::cout << "Invalid core list" << std::endl;
+                return 1;
+            }
+        }
+        else
+            args.push_back(arg);
+    }
+
+    if (numConnections > (65535 - 8101) / 2)
+    {
+        std::cout << "Too many test connections" << std::endl;
+        return 1;
+    }
+
+    // a message must fit the peer's receive buffer, as it advertises no more
+    if (echo && (messageSize == 0 || messageSize > RECV_BUFFER_CAPACITY || echoRounds == 0))
+    {
+        std::cout << "Unsupported echo message size or num. rounds" << std::endl;
+        return 1;
+    }
+    if (!echo)
+        echoRounds = 0;
+
+    if (args.size() > 1 && args[1] == "bench-buffer")
+    {
+        CircularBufferBenchmarks::runAll();
+        return 0;
+    }
+
+    if (args.size() > 1 && args[1] == "test")
+    {
+        CircularBufferTests::runAll();
+        IntervalSetTests::runAll();
+        SendStreamTests::runAll();
+        RecvStreamTests::runAll();
+        TimerWheelTests::runAll();
+        ConnectionTableTests::runAll();
+        TimeWaitTableTests::runAll();
+        PacketViewTests::runAll();
+        HeaderTemplateTests::runAll();
+        return 0;
+    }
+
+    if (args.size() > 1 && args[1] == "virtual")
+    {
+        runVirtual(args.size() > 2 ? args[2] : "", numEngines, numConnections, echoRounds, messageSize,
+                   epollServer, linkConfig.busyPollUs, linkConfig.maxFrameSize, linkConfig.queueCpus);
+        return 0;
+    }
+
     std::string ip = "10.126.0.2";
-    auto tcb = std::make_shared<Tcb>();
 
+    linkConfig.sourceAddr = ip;
+    if (args.size() > 1)
+    {
+        linkConfig.type = LinkConfig::parseType(args[1]);
+        linkConfig.sqPoll = args[1] == "uring-sqpoll";
+    }
+    if (args.size() > 2)
+    {
+        linkConfig.interfaceName = args[2];
+        linkConfig.replayPath = args[2];
+    }
+    if (args.size() > 3)
+        linkConfig.queueIndex = std::stoul(args[3]);
+    if (args.size() > 4)
+        linkConfig.peerMac = args[4];
+
+    std::vector<std::shared_ptr<Tcb>> tcbs;
 #ifdef THREAD1
-    tcb->state = CLOSED;
-    tcb->sourceAddr = ip;
-    tcb->sourcePort = 8100;
-    tcb->destAddr = ip;
-    tcb->destPort = 8101;
+    // echo clients open their own connections
+    for (uint32_t i = 0; i < std::max(numConnections, 1u) && echoRounds == 0; i++)
+    {
+        auto tcb = std::make_shared<Tcb>();
+        initialiseTcb(*tcb, ip, ip, i);
+        linkConfig.localPorts.push_back(tcb->sourcePort);
+        tcbs.push_back(tcb);
+    }
 #else // THREAD2
-    tcb->state = LISTEN;
-    tcb->sourceAddr = ip;
-    tcb->sourcePort = 8101;
-    tcb->destAddr = ip;
-    tcb->destPort = 8100;
+    linkConfig.localPorts.push_back(TEST_LISTEN_PORT);
+#endif
+
+    // engines must notice runBenchmark() stopping them (and commands, for runEcho())
+    if (numConnections > 0 || echoRounds > 0)
+        linkConfig.pollTimeoutMs = ENGINE_POLL_TIMEOUT_MS;
+
+    EngineGroup group(linkConfig, numEngines);
+    for (auto &tcb : tcbs)
+        group.addConnection(tcb);
+
+    std::shared_ptr<Listener> listener;
+#ifdef THREAD2
+    listener = group.listen(inet_addr(ip.c_str()), TEST_LISTEN_PORT,
+                            epollServer ? ReadyEvent::READABLE : 0);
 #endif
 
-    SegmentThread st(tcb);
-    st.startThread();
-}
\ No newline at end of file
+    group.setVerbose(numConnections == 0 && echoRounds == 0);
+    group.start();
+
+    if (echoRounds > 0)
+    {
+#ifdef THREAD1
+        runEcho(nullptr, nullptr, &group, ip, ip, std::max(numConnections, 1u), messageSize, echoRounds,
+                epollServer);
+#else // THREAD2
+        runEcho(&group, listener, nullptr, ip, ip, std::max(numConnections, 1u), messageSize, echoRounds,
+                epollServer);
+#endif
+    }
+    else if (numConnections > 0)
+        runBenchmark({ &group }, numConnections, listener);
+    group.join();
+}
@@ -1,12 +1,19 @@
 #pragma once
 
+#include <atomic>
+#include <coroutine>
 #include <cstdint>
-#include <mutex>
+#include <memory>
 #include <netinet/ip.h>
 
 #include "buffer.hpp"
 #include "config.hpp"
+#include "header_template.hpp"
 #include "stream.hpp"
+#include "timer_wheel.hpp"
+
+class Listener;
+struct AsyncOp;
 
 /**
  * TCP header
@@ -61,23 +68,94 @@ enum ConnectionState
 
 /**
  * Transmission Control Block (TCB)
+ *
+ * Owned by the connection's engine: the only state an application thread
+ * touches directly is the stream buffers, as the writer of the send buffer
+ * and the reader of the receive buffer (see CircularBuffer). Everything
+ * else it asks of the engine through a Command.
  */
-struct Tcb
+struct Tcb : std::enable_shared_from_this<Tcb>
 {
     SendStream sendStream;
     RecvStream recvStream;
 
-    std::string sourceAddr;
-    std::string destAddr;
+    in_addr_t sourceAddr;   // network order
+    in_addr_t destAddr;     // network order
     uint16_t sourcePort;
     uint16_t destPort;
+
+    /* headers of the connection's segments, built as it's opened (or spawned) */
+    HeaderTemplate headerTemplate;
     
     ConnectionState state;
 
-    std::mutex mutex;
+    /* listener the connection listens for (or was spawned by), if any */
+    std::shared_ptr<Listener> listener;
+
+    /* operations (of coroutines) waiting for the connection to become readable / writable */
+    AsyncOp *readWaiter = nullptr;
+    AsyncOp *writeWaiter = nullptr;
+
+    /* readiness events (see ReadyEvent) the application watches, set before the connection is added or by a WATCH command */
+    uint32_t watchedEvents = 0;
+
+    /* events raised since the application last polled, and link of the engine's ready list (see ReadinessNotifier) */
+    std::atomic<uint32_t> readyEvents{0};
+    Tcb *readyNext = nullptr;
+    std::shared_ptr<Tcb> readyRef;
+
+    /* retransmission timer (armed while bytes we sent are unacknowledged), and num. retransmissions since the peer last acknowledged any */
+    Timer retransmitTimer;
+    uint32_t retransmits = 0;
+
+    /* delayed ACK timer (armed while bytes we received are unacknowledged), and num. such bytes */
+    Timer delayedAckTimer;
+    uint32_t ackPending = 0;
+
+    /* the application closed the connection (our FIN follows the send buffer's bytes), and the peer did (we received its FIN) */
+    bool closeRequested = false;
+    bool finReceived = false;
+
+    /* link of the free list of the pool the TCB came from, if any (see TcbPool) */
+    Tcb *poolNext = nullptr;
 
     /* Default constructor */
     Tcb()
-    : sendStream(SEND_BUFFER_CAPACITY),
-      recvStream(RECV_BUFFER_CAPACITY) {}
-};
\ No newline at end of file
+    : sendStream(SEND_BUFFER_CAPACITY, STREAM_BUFFERS_MIRRORED),
+      recvStream(RECV_BUFFER_CAPACITY, STREAM_BUFFERS_MIRRORED),
+      retransmitTimer(Timer::RETRANSMIT, this),
+      delayedAckTimer(Timer::DELAYED_ACK, this) {}
+
+    /**
+     * Returns the TCB to its freshly constructed state (with a new ISS),
+     * keeping its buffers' storage, for reuse by another connection.
+     *
+     * NOTE: must be kept in step with the fields above.
+     */
+    void reset();
+};
+
+/**
+ * Control operation an application thread asks a connection's engine to
+ * carry out (see EngineGroup::submit()).
+ */
+struct Command
+{
+    enum Type
+    {
+        OPEN,       // add the connection (and send its SYN, if CLOSED)
+        SEND,       // bytes were written to the send buffer
+        CLOSE,      // close the connection (FIN), once the send buffer's bytes are sent
+        ABORT,      // abort the connection (RST), dropping it
+        SET_MSS,    // set the max. segment size to `value`
+        AWAIT,      // start operation `op` of a coroutine on the connection
+        RESUME,     // resume coroutine `handle` on the engine
+        WATCH       // watch readiness events `value`, raising those already due
+    };
+
+    Type type;
+    std::shared_ptr<Tcb> tcb;
+    uint32_t value = 0;
+    AsyncOp *op = nullptr;
+    std::coroutine_handle<> handle;
+};
@@ -1,83 +1,263 @@
 #include <netinet/ip.h>
+#include <algorithm>
 #include <memory>
+#include <string.h>
+#include <vector>
 
 #include "tcp_connection.hpp"
 #include "tcp.hpp"
 
 ////////////////////////////////////////////
-// TcpConnection private methods
+// TcpConnection operations
 ////////////////////////////////////////////
+TcpConnection::Op::Op(Kind kind, Executor &executor, std::shared_ptr<Tcb> tcb)
+    : AsyncOp(kind),
+      executor(executor),
+      tcb(std::move(tcb))
+{
+}
+
+/**
+ * Hands the operation to the connection's engine, suspending the
+ * coroutine unless it completes at once.
+ *
+ * NOTE: once handed over, the coroutine may be resumed (on the engine)
+ * before we return, so the operation must not be touched again.
+ */
+bool TcpConnection::Op::await_suspend(std::coroutine_handle<> handle)
+{
+    this->handle = handle;
+    return executor.await(tcb, this);
+}
+
+/**
+ * Opens the connection on its engine, which starts the operation once
+ * it has (or resumes the coroutine if it could not).
+ */
+void TcpConnection::ConnectOp::await_suspend(std::coroutine_handle<> handle)
+{
+    this->handle = handle;
+
+    Command command = { Command::OPEN, tcb };
+    command.op = this;
+    executor.execute(command);
+}
+
+TcpConnection TcpConnection::ConnectOp::await_resume()
+{
+    if (tcb->state == CLOSED)
+        return TcpConnection();
+    return TcpConnection(executor, tcb);
+}
+
+bool TcpConnection::ConnectOp::tryComplete(Tcb &tcb)
+{
+    // a connection failing to establish is aborted, which completes us anyway
+    return tcb.state != CLOSED && tcb.state != SYN_SENT;
+}
 
-void TcpConnection::initialise()
+TcpConnection::SendOp::SendOp(Executor &executor, std::shared_ptr<Tcb> tcb,
+                              const void *buffer, uint32_t N)
+    : Op(WRITE, executor, std::move(tcb)),
+      buffer(static_cast<const uint8_t*>(buffer)),
+      N(N)
 {
-    this->tcb = std::make_shared<Tcb>();
+}
+
+bool TcpConnection::SendOp::tryComplete(Tcb &tcb)
+{
+    if (tcb.state == CLOSED)
+        return true;
+
+    CircularBuffer &sendBuffer = tcb.sendStream.sendBuffer;
+    uint32_t chunkSize = std::min(N - sent, sendBuffer.availableToWrite());
+    if (chunkSize > 0)
+    {
+        sendBuffer.writeN(buffer + sent, chunkSize);
+        sent += chunkSize;
+    }
+    return sent == N;
+}
+
+TcpConnection::RecvOp::RecvOp(Executor &executor, std::shared_ptr<Tcb> tcb,
+                              void *buffer, uint32_t N)
+    : Op(READ, executor, std::move(tcb)),
+      buffer(static_cast<uint8_t*>(buffer)),
+      N(N)
+{
+}
+
+bool TcpConnection::RecvOp::tryComplete(Tcb &tcb)
+{
+    CircularBuffer &recvBuffer = tcb.recvStream.recvBuffer;
+    uint32_t chunkSize = std::min(N, recvBuffer.availableToRead());
+    if (chunkSize == 0)
+        return tcb.state == CLOSED || tcb.finReceived;
+
+    recvBuffer.readN(buffer, chunkSize);
+    received = chunkSize;
+
+    // reading made room, which we advertise from now on
+    tcb.recvStream.WND = recvBuffer.availableToWrite();
+    return true;
+}
+
+TcpConnection::RecvViewOp::RecvViewOp(Executor &executor, std::shared_ptr<Tcb> tcb)
+    : Op(READ, executor, std::move(tcb))
+{
+}
+
+bool TcpConnection::RecvViewOp::tryComplete(Tcb &tcb)
+{
+    view = tcb.recvStream.recvBuffer.readableSpan();
+    if (view.empty())
+        return tcb.state == CLOSED || tcb.finReceived;
+    return true;
 }
 
 ////////////////////////////////////////////
-// TcpConnection public methods
+// TcpConnection methods
 ////////////////////////////////////////////
+TcpConnection::TcpConnection(Executor &executor, std::shared_ptr<Tcb> tcb)
+    : tcb(std::move(tcb)),
+      executor(&executor)
+{
+}
 
 /**
- * Opens a TCP connection.
- * 
- * Optionally provide `destAddr` and `destPort` for an active connection 
- * (i.e. connect to existing peer), omit them for a passive connection 
- * (i.e. listen for incoming connections)
+ * Connects from `sourceAddr`:`sourcePort` to `destAddr`:`destPort`
+ * (addresses in network order).
  */
-TcpConnection TcpConnection::open(
+TcpConnection::ConnectOp TcpConnection::co_connect(
+    Executor &executor,
     in_addr_t sourceAddr,
     uint16_t sourcePort,
     in_addr_t destAddr,
     uint16_t destPort
 )
 {
-    TcpConnection tcpConnection;
-    return tcpConnection;
+    auto tcb = std::make_shared<Tcb>();
+    tcb->state = CLOSED;
+    tcb->sourceAddr = sourceAddr;
+    tcb->sourcePort = sourcePort;
+    tcb->destAddr = destAddr;
+    tcb->destPort = destPort;
+
+    return ConnectOp(AsyncOp::WRITE, executor, tcb);
 }
 
 /**
  * Send `N` bytes from `buffer` to the tcp peer.
- * 
- * NOTE: TODO: also takes 'push' and 'urgent' flags
  */
-void TcpConnection::send(void *buffer, int N)
+TcpConnection::SendOp TcpConnection::co_send(const void *buffer, uint32_t N)
 {
+    return SendOp(*executor, tcb, buffer, N);
+}
 
+/**
+ * Read up to `N` bytes into `buffer` from the tcp peer.
+ */
+TcpConnection::RecvOp TcpConnection::co_recv(void *buffer, uint32_t N)
+{
+    return RecvOp(*executor, tcb, buffer, N);
 }
 
 /**
- * Read `N` bytes into `buffer` from the tcp peer.
+ * Read bytes from the tcp peer in place, in the receive buffer.
  */
-void TcpConnection::recv(void *buffer, int N)
+TcpConnection::RecvViewOp TcpConnection::co_recvView()
 {
+    return RecvViewOp(*executor, tcb);
+}
 
+/**
+ * Hand the first `N` bytes read in place back to the receive buffer.
+ */
+void TcpConnection::consume(uint32_t N)
+{
+    CircularBuffer &recvBuffer = tcb->recvStream.recvBuffer;
+    recvBuffer.discardN(N);
+
+    // consuming made room, which we advertise from now on
+    tcb->recvStream.WND = recvBuffer.availableToWrite();
 }
 
 /**
- * Close the tcp connection.
+ * Close the tcp connection: bytes already sent are still delivered,
+ * followed by our FIN.
  */
 void TcpConnection::close()
 {
+    if (!tcb)
+        return;
 
+    executor->execute({ Command::CLOSE, tcb });
+    tcb.reset();
+}
+
+/**
+ * Abort the tcp connection (RST), dropping bytes not yet sent.
+ */
+void TcpConnection::abort()
+{
+    if (!tcb)
+        return;
+
+    executor->execute({ Command::ABORT, tcb });
+    tcb.reset();
 }
 
 ////////////////////////////////////////////
-// Run
+// TcpListener methods
 ////////////////////////////////////////////
+TcpListener::AcceptOp::AcceptOp(Executor &executor, Listener &listener)
+    : executor(executor),
+      listener(listener)
+{
+}
 
-void run()
+/**
+ * Takes a connection from the accept queue of the engine we run on (or
+ * another's), else waits to be handed the next one.
+ */
+bool TcpListener::AcceptOp::await_suspend(std::coroutine_handle<> handle)
+{
+    this->handle = handle;
+
+    // once we wait, accepted() may resume us before acceptOrWait() returns
+    std::shared_ptr<Tcb> ready = listener.acceptOrWait(executor.currentEngine(), this);
+    if (!ready)
+        return !turnedAway;
+
+    tcb = std::move(ready);
+    return false;
+}
+
+TcpConnection TcpListener::AcceptOp::await_resume()
+{
+    return TcpConnection(executor, tcb);
+}
+
+/**
+ * Resumes the acceptor, on the engine it waits on, with established
+ * connection `tcb` (or none).
+ */
+void TcpListener::AcceptOp::accepted(std::shared_ptr<Tcb> tcb)
 {
-    in_addr_t sourceAddr;
-    uint16_t sourcePort;
+    this->tcb = std::move(tcb);
+    executor.postTo(shard, handle);
+}
 
-    TcpConnection tcpConnection = TcpConnection::open(
-        sourceAddr,
-        sourcePort
-    );
+TcpListener::TcpListener(Executor &executor, std::shared_ptr<Listener> listener)
+    : executor(executor),
+      listener(std::move(listener))
+{
 }
 
-// int main()
-// {
-//     run();
-//     return 0;
-// }
\ No newline at end of file
+/**
+ * Accept the next connection.
+ */
+TcpListener::AcceptOp TcpListener::co_accept()
+{
+    return AcceptOp(executor, *listener);
+}
@@ -1,53 +1,207 @@
 #pragma once
+#include <coroutine>
 #include <cstdint>
 #include <memory>
+#include <span>
 #include <netinet/ip.h>
 
+#include "executor.hpp"
+#include "listener.hpp"
 #include "tcp.hpp"
 
 /**
- * Represents a single TCP connection
+ * Represents a single TCP connection, driven by coroutines.
+ *
+ * Each operation is awaited (e.g. `co_await connection.co_recv(buffer, N)`):
+ * it is carried out by the engine owning the connection, and the awaiting
+ * coroutine is resumed by that engine once it completes, so one engine
+ * thread multiplexes any number of connections, with no threads or
+ * callbacks of their own.
+ *
+ * At most one coroutine may await a read, and one a write, on a
+ * connection at a time.
  */
 class TcpConnection
 {
-private:
+public:
+    /**
+     * Operation awaited on a connection.
+     */
+    struct Op : AsyncOp
+    {
+        Op(Kind kind, Executor &executor, std::shared_ptr<Tcb> tcb);
 
-    /* Transmission control block (TCB) of the connection */
-    std::shared_ptr<Tcb> tcb;
+        bool await_ready() { return false; }
+        bool await_suspend(std::coroutine_handle<> handle);
 
-    // SegmentThread segmentThread; 
+        Executor &executor;
+        std::shared_ptr<Tcb> tcb;
+    };
+
+    /**
+     * Opens the connection, completing once it is established (or fails).
+     */
+    struct ConnectOp : Op
+    {
+        using Op::Op;
+
+        void await_suspend(std::coroutine_handle<> handle);
+        TcpConnection await_resume();
+        bool tryComplete(Tcb &tcb) override;
+    };
+
+    /**
+     * Copies `N` bytes into the send buffer, as room is made.
+     */
+    struct SendOp : Op
+    {
+        SendOp(Executor &executor, std::shared_ptr<Tcb> tcb, const void *buffer, uint32_t N);
+
+        uint32_t await_resume() { return sent; }
+        bool tryComplete(Tcb &tcb) override;
+
+        const uint8_t *buffer;
+        uint32_t N;
+        uint32_t sent = 0;
+    };
+
+    /**
+     * Copies up to `N` bytes out of the receive buffer, once any arrive.
+     */
+    struct RecvOp : Op
+    {
+        RecvOp(Executor &executor, std::shared_ptr<Tcb> tcb, void *buffer, uint32_t N);
+
+        uint32_t await_resume() { return received; }
+        bool tryComplete(Tcb &tcb) override;
+
+        uint8_t *buffer;
+        uint32_t N;
+        uint32_t received = 0;
+    };
 
-    void initialise();
-    
-public:
     /**
-     * Opens a TCP connection.
-     * 
-     * Optionally provide `destAddr` and `destPort` for an active connection 
-     * (i.e. connect to existing peer), omit them for a passive connection 
-     * (i.e. listen for incoming connections)
+     * Waits for bytes in the receive buffer, handing them out in place.
      */
-    static TcpConnection open(
+    struct RecvViewOp : Op
+    {
+        RecvViewOp(Executor &executor, std::shared_ptr<Tcb> tcb);
+
+        std::span<const uint8_t> await_resume() { return view; }
+        bool tryComplete(Tcb &tcb) override;
+
+        std::span<const uint8_t> view;
+    };
+
+    /* a connection not (or no longer) open */
+    TcpConnection() = default;
+
+    TcpConnection(Executor &executor, std::shared_ptr<Tcb> tcb);
+
+    /**
+     * Connects from `sourceAddr`:`sourcePort` to `destAddr`:`destPort`
+     * (addresses in network order), on the engine of `executor` owning
+     * the connection.
+     *
+     * Awaits the connection, not open if it could not be established.
+     */
+    static ConnectOp co_connect(
+        Executor &executor,
         in_addr_t sourceAddr,
         uint16_t sourcePort,
-        in_addr_t destAddr = 0,
-        uint16_t destPort = 0
+        in_addr_t destAddr,
+        uint16_t destPort
     );
 
     /**
      * Send `N` bytes from `buffer` to the tcp peer.
-     * 
-     * NOTE: also takes 'push' and 'urgent' flags
+     *
+     * Awaits the num. bytes sent, i.e. `N`, or fewer if the connection
+     * was closed meanwhile.
+     */
+    SendOp co_send(const void *buffer, uint32_t N);
+
+    /**
+     * Read up to `N` bytes into `buffer` from the tcp peer.
+     *
+     * Awaits the num. bytes read, or 0 if the connection was closed.
+     */
+    RecvOp co_recv(void *buffer, uint32_t N);
+
+    /**
+     * Read bytes from the tcp peer in place, in the receive buffer (see
+     * CircularBuffer::readableSpan(): with mirrored buffers, all bytes
+     * received so far, else those up to the buffer's wrap).
+     *
+     * Awaits the bytes, or none if the connection was closed. They stay
+     * valid, and in the buffer, until consume()d.
      */
-    void send(void *buffer, int N);
+    RecvViewOp co_recvView();
 
     /**
-     * Read `N` bytes into `buffer` from the tcp peer.
+     * Hand the first `N` bytes read in place back to the receive buffer.
      */
-    void recv(void *buffer, int N);
+    void consume(uint32_t N);
 
     /**
-     * Close the tcp connection.
+     * Close the tcp connection: bytes already sent are still delivered,
+     * followed by our FIN.
      */
     void close();
-};
\ No newline at end of file
+
+    /**
+     * Abort the tcp connection (RST), dropping bytes not yet sent.
+     */
+    void abort();
+
+    /**
+     * Returns true if the connection was opened (and not closed since).
+     */
+    bool isOpen() const { return tcb != nullptr; }
+
+    /* Transmission control block (TCB) of the connection */
+    std::shared_ptr<Tcb> tcb;
+
+private:
+    Executor *executor = nullptr;
+};
+
+/**
+ * Accepts connections of a listener, driven by coroutines.
+ */
+class TcpListener
+{
+public:
+    /**
+     * Takes the next established connection, waiting for one if there is
+     * none yet. The awaiting coroutine is resumed on the engine it awaited
+     * on (so an acceptor per engine stays on its own accept queue), with
+     * no connection if the listener stopped waits (see
+     * Listener::stopWaiting()).
+     */
+    struct AcceptOp : AcceptWaiter
+    {
+        AcceptOp(Executor &executor, Listener &listener);
+
+        bool await_ready() { return false; }
+        bool await_suspend(std::coroutine_handle<> handle);
+        TcpConnection await_resume();
+        void accepted(std::shared_ptr<Tcb> tcb) override;
+
+        Executor &executor;
+        Listener &listener;
+        std::coroutine_handle<> handle;
+        std::shared_ptr<Tcb> tcb;
+    };
+
+    TcpListener(Executor &executor, std::shared_ptr<Listener> listener);
+
+    /**
+     * Accept the next connection.
+     */
+    AcceptOp co_accept();
+
+private:
+    Executor &executor;
+    std::shared_ptr<Listener> listener;
+};
@@ -0,0 +1,283 @@
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <functional>
+#include <arpa/inet.h>
+
+#include "time_wait.hpp"
+
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// TimeWaitTable methods
+////////////////////////////////////////////
+TimeWaitTable::TimeWaitTable(uint32_t initialCapacity)
+{
+    uint32_t capacity = 1;
+    while (capacity < initialCapacity)
+        capacity <<= 1;
+
+    slots.assign(capacity, Slot{});
+    mask = capacity - 1;
+    numEntries = 0;
+}
+
+uint32_t TimeWaitTable::probe(const FlowKey &key, uint32_t hash)
+{
+    uint32_t i = hash & mask;
+    while (slots[i].used && !(slots[i].hash == hash && slots[i].record.key == key))
+        i = (i + 1) & mask;
+    return i;
+}
+
+TimeWaitRecord* TimeWaitTable::find(const FlowKey &key)
+{
+    Slot &slot = slots[probe(key, key.hash())];
+    return slot.used ? &slot.record : nullptr;
+}
+
+void TimeWaitTable::insert(const TimeWaitRecord &record)
+{
+    // keep load factor at most 1/2, so probe runs stay short
+    if (2 * (numEntries + 1) > slots.size())
+        grow();
+
+    uint32_t hash = record.key.hash();
+    uint32_t i = probe(record.key, hash);
+    if (!slots[i].used)
+        numEntries++;
+
+    slots[i] = { record, hash, true };
+    expiries.push_back({ record.key, record.expiry });
+}
+
+bool TimeWaitTable::erase(const FlowKey &key)
+{
+    uint32_t i = probe(key, key.hash());
+    if (!slots[i].used)
+        return false;
+
+    eraseSlot(i);
+    return true;
+}
+
+/**
+ * Removes the records expiring by tick `now`.
+ *
+ * Returns num. records removed.
+ */
+uint32_t TimeWaitTable::expire(uint64_t now)
+{
+    uint32_t n = 0;
+    while (!expiries.empty() && expiries.front().expiry <= now)
+    {
+        Expiry &due = expiries.front();
+
+        // skip entries of records removed (or replaced) since
+        uint32_t i = probe(due.key, due.key.hash());
+        if (slots[i].used && slots[i].record.expiry == due.expiry)
+        {
+            eraseSlot(i);
+            n++;
+        }
+        expiries.pop_front();
+    }
+    return n;
+}
+
+void TimeWaitTable::eraseSlot(uint32_t i)
+{
+    /**
+     * Backward shift deletion: move later entries of the probe run into
+     * the hole, if doing so doesn't put them before their home slot.
+     */
+    uint32_t j = i;
+    while (1)
+    {
+        j = (j + 1) & mask;
+        if (!slots[j].used)
+            break;
+
+        uint32_t home = slots[j].hash & mask;
+        bool movable = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+        if (movable)
+        {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+
+    slots[i] = Slot{};
+    numEntries--;
+}
+
+void TimeWaitTable::grow()
+{
+    std::vector<Slot> old = std::move(slots);
+    slots.assign(old.size() * 2, Slot{});
+    mask = slots.size() - 1;
+
+    for (Slot &slot : old)
+    {
+        if (!slot.used)
+            continue;
+        uint32_t i = slot.hash & mask;
+        while (slots[i].used)
+            i = (i + 1) & mask;
+        slots[i] = slot;
+    }
+}
+
+////////////////////////////////////////////
+// TimeWaitTable tests
+////////////////////////////////////////////
+
+namespace TimeWaitTableTests
+{
+    /**
+     * Returns the record of the `n`th connection from the same local port,
+     * expiring at tick `expiry`.
+     */
+    TimeWaitRecord recordOf(uint16_t n, uint64_t expiry)
+    {
+        FlowKey key = { inet_addr("10.0.0.1"), inet_addr("10.0.0.2"), 8080, (uint16_t)(40000 + n) };
+        return { key, 5000u + n, 9000u + n, expiry };
+    }
+
+    void testAcceptsSyn()
+    {
+        TimeWaitTable table;
+        table.insert(recordOf(0, 100));
+        TimeWaitRecord *record = table.find(recordOf(0, 100).key);
+        ASSERT_THAT(record && record->rcvNxt == 9000);
+
+        /**
+         * A SYN starting beyond the old connection's sequence space may
+         * reuse the tuple; an old duplicate (or a retransmitted FIN's
+         * sequence number) may not
+         */
+        ASSERT_THAT(record->acceptsSyn(9001));
+        ASSERT_THAT(record->acceptsSyn(9000u + 0x7fffffff));
+        ASSERT_THAT(!record->acceptsSyn(9000));
+        ASSERT_THAT(!record->acceptsSyn(8999));
+        ASSERT_THAT(!record->acceptsSyn(9000u + 0x80000000));
+
+        /**
+         * Across the wrap of the sequence space
+         */
+        record->rcvNxt = 0xfffffff0;
+        ASSERT_THAT(record->acceptsSyn(0xfffffff1));
+        ASSERT_THAT(record->acceptsSyn(5));
+        ASSERT_THAT(!record->acceptsSyn(0xffffffe0));
+        ASSERT_THAT(!record->acceptsSyn(0x7ffffff0));
+    }
+
+    void testExpireInOrder()
+    {
+        TimeWaitTable table;
+        for (uint16_t n = 0; n < 5; n++)
+            table.insert(recordOf(n, 10 * (n + 1)));
+        ASSERT_THAT(table.size() == 5);
+
+        /**
+         * Only the records due go, oldest first
+         */
+        ASSERT_THAT(table.expire(9) == 0);
+        ASSERT_THAT(table.expire(10) == 1);
+        ASSERT_THAT(!table.find(recordOf(0, 0).key));
+        ASSERT_THAT(table.find(recordOf(1, 0).key));
+
+        ASSERT_THAT(table.expire(35) == 2);
+        ASSERT_THAT(table.size() == 2);
+        for (uint16_t n = 0; n < 5; n++)
+            ASSERT_THAT((table.find(recordOf(n, 0).key) != nullptr) == (n >= 3));
+
+        ASSERT_THAT(table.expire(35) == 0);
+        ASSERT_THAT(table.expire(1000) == 2);
+        ASSERT_THAT(table.size() == 0);
+    }
+
+    void testReplaceAndErase()
+    {
+        TimeWaitTable table;
+        table.insert(recordOf(0, 10));
+        table.insert(recordOf(1, 15));
+        table.insert(recordOf(2, 18));
+
+        /**
+         * A record re-added (i.e. its wait restarted) outlives its first
+         * expiry, and one erased (i.e. its tuple reused) doesn't count as
+         * expiring
+         */
+        table.insert(recordOf(0, 20));
+        ASSERT_THAT(table.size() == 3);
+        ASSERT_THAT(table.erase(recordOf(2, 0).key));
+        ASSERT_THAT(!table.erase(recordOf(2, 0).key));
+        ASSERT_THAT(table.size() == 2);
+
+        ASSERT_THAT(table.expire(10) == 0);
+        TimeWaitRecord *record = table.find(recordOf(0, 0).key);
+        ASSERT_THAT(record && record->expiry == 20);
+
+        ASSERT_THAT(table.expire(18) == 1);
+        ASSERT_THAT(!table.find(recordOf(1, 0).key));
+        ASSERT_THAT(table.expire(20) == 1);
+        ASSERT_THAT(table.size() == 0);
+
+        /**
+         * A tuple reused, then in TIME-WAIT again, expires at its new expiry
+         */
+        table.insert(recordOf(3, 30));
+        ASSERT_THAT(table.erase(recordOf(3, 0).key));
+        table.insert(recordOf(3, 40));
+        ASSERT_THAT(table.expire(30) == 0);
+        ASSERT_THAT(table.find(recordOf(3, 0).key));
+        ASSERT_THAT(table.expire(40) == 1);
+    }
+
+    void testGrow()
+    {
+        const uint16_t N = 1000;
+
+        TimeWaitTable table(4);
+        for (uint16_t n = 0; n < N; n++)
+            table.insert(recordOf(n, n));
+        ASSERT_THAT(table.size() == N);
+
+        for (uint16_t n = 0; n < N; n++)
+        {
+            TimeWaitRecord *record = table.find(recordOf(n, 0).key);
+            ASSERT_THAT(record && record->sndNxt == 5000u + n && record->expiry == n);
+        }
+
+        for (uint16_t n = 0; n < N; n++)
+        {
+            ASSERT_THAT(table.expire(n) == 1);
+            ASSERT_THAT(!table.find(recordOf(n, 0).key));
+            if (n + 1 < N)
+                ASSERT_THAT(table.find(recordOf(n + 1, 0).key));
+        }
+        ASSERT_THAT(table.size() == 0);
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "TimeWaitTable Tests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = 
+        {
+            TEST(testAcceptsSyn),
+            TEST(testExpireInOrder),
+            TEST(testReplaceAndErase),
+            TEST(testGrow)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+    }
+};
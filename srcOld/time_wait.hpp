@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "config.hpp"
+#include "connection_table.hpp"
+
+/**
+ * What an engine remembers of a connection in TIME_WAIT: just enough to
+ * acknowledge a retransmitted FIN, and to tell a new incarnation's SYN
+ * from an old duplicate.
+ */
+struct TimeWaitRecord
+{
+    FlowKey key;
+    uint32_t sndNxt;    // our SND.NXT (i.e. past our FIN)
+    uint32_t rcvNxt;    // our RCV.NXT (i.e. past the peer's FIN)
+    uint64_t expiry;    // timer wheel tick TIME_WAIT ends at (entered TCP_TIME_WAIT_US before)
+
+    /**
+     * Returns true if a SYN with sequence number `seqNum` is a new
+     * connection's, which may take over the tuple: i.e. it starts beyond
+     * the old connection's sequence space (rather than being an old
+     * duplicate).
+     */
+    bool acceptsSyn(uint32_t seqNum) const
+    {
+        return (int32_t)(seqNum - rcvNxt) > 0;
+    }
+};
+
+/**
+ * Connections in TIME_WAIT, keyed on their 4-tuple.
+ *
+ * A closed connection's TCB (buffers and all) is dropped as it enters
+ * TIME_WAIT, leaving a 32-byte record here for the 2 MSL it lingers, so a
+ * server churning through connections holds kilobytes, not megabytes.
+ *
+ * Records live in an open addressing table (linear probing, backward shift
+ * deletion, as ConnectionTable), and, as every record lingers as long, in
+ * a FIFO of expiries in the order they were entered, so expiring them
+ * takes only the ones due. A record removed early (i.e. its tuple reused)
+ * leaves its FIFO entry behind, skipped once it comes up.
+ */
+class TimeWaitTable
+{
+public:
+    TimeWaitTable(uint32_t initialCapacity = TIME_WAIT_TABLE_INITIAL_CAPACITY);
+
+    /**
+     * Returns the record of `key`, or nullptr if it isn't in TIME_WAIT.
+     */
+    TimeWaitRecord *find(const FlowKey &key);
+
+    /**
+     * Adds `record`, replacing any of its key. Records must be added in
+     * expiry order.
+     */
+    void insert(const TimeWaitRecord &record);
+
+    /**
+     * Removes the record of `key`. Returns false if there is none.
+     */
+    bool erase(const FlowKey &key);
+
+    /**
+     * Removes the records expiring by tick `now`.
+     *
+     * Returns num. records removed.
+     */
+    uint32_t expire(uint64_t now);
+
+    uint32_t size() { return numEntries; }
+
+private:
+    struct Slot
+    {
+        TimeWaitRecord record;
+        uint32_t hash;
+        bool used;
+    };
+
+    struct Expiry
+    {
+        FlowKey key;
+        uint64_t expiry;
+    };
+
+    std::vector<Slot> slots;
+    uint32_t mask;              // capacity - 1 (capacity is a power of 2)
+    uint32_t numEntries;
+
+    std::deque<Expiry> expiries;
+
+    /**
+     * Returns the index of the slot holding `key`, or of the empty slot
+     * ending its probe run if `key` isn't present.
+     */
+    uint32_t probe(const FlowKey &key, uint32_t hash);
+
+    /**
+     * Empties slot `i`, shifting the rest of its probe run back.
+     */
+    void eraseSlot(uint32_t i);
+
+    /**
+     * Doubles the table's capacity, rehashing every entry.
+     */
+    void grow();
+};
+
+namespace TimeWaitTableTests
+{
+    void testAcceptsSyn();
+    void testExpireInOrder();
+    void testReplaceAndErase();
+    void testGrow();
+
+    void runAll();
+};
@@ -0,0 +1,373 @@
+#include <bit>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include "timer_wheel.hpp"
+
+#include "test_utils.hpp"
+
+////////////////////////////////////////////
+// TimerWheel methods
+////////////////////////////////////////////
+TimerWheel::TimerWheel(uint64_t now)
+{
+    current = now;
+    for (uint32_t level = 0; level < LEVELS; level++)
+    {
+        for (uint32_t slot = 0; slot < SLOTS; slot++)
+            slots[level][slot].prev = slots[level][slot].next = &slots[level][slot];
+    }
+}
+
+/**
+ * Arms `timer` to expire at tick `expiry` (at the next advance() if
+ * already past), re-arming it if it is armed.
+ */
+void TimerWheel::arm(Timer &timer, uint64_t expiry)
+{
+    if (timer.armed())
+        unlink(timer);
+    else
+        numTimers++;
+
+    timer.expiry = expiry;
+    place(timer, current + 1);
+}
+
+/**
+ * Disarms `timer`, if armed.
+ *
+ * NOTE: its slot stays marked occupied until the wheel next finds it empty.
+ */
+void TimerWheel::cancel(Timer &timer)
+{
+    if (!timer.armed())
+        return;
+
+    unlink(timer);
+    numTimers--;
+}
+
+/**
+ * Returns the earliest tick advance() may have to act at (i.e. a lower
+ * bound on the next expiry), or NEVER if no timer is armed.
+ *
+ * That is, for each level, the first tick from the next one on that
+ * starts one of the level's occupied slots (a level-0 slot fires, a
+ * higher level's cascades).
+ */
+uint64_t TimerWheel::nextExpiry()
+{
+    if (numTimers == 0)
+        return NEVER;
+
+    uint64_t base = current + 1;
+    uint64_t next = NEVER;
+    for (uint32_t level = 0; level < LEVELS; level++)
+    {
+        if (!occupied[level])
+            continue;
+
+        // first tick from `base` on starting one of the level's slots, and the slot it starts
+        uint32_t shift = level * SLOT_BITS;
+        uint64_t start = ((base + (1ULL << shift) - 1) >> shift) << shift;
+        uint32_t slot = (start >> shift) & (SLOTS - 1);
+
+        uint64_t ahead = std::rotr(occupied[level], slot);
+        uint64_t tick = start + ((uint64_t)std::countr_zero(ahead) << shift);
+        if (tick < next)
+            next = tick;
+    }
+    return next;
+}
+
+/**
+ * Files armed `timer` in the slot its expiry falls into, as seen from
+ * tick `base` (the next tick to be processed, at the latest).
+ *
+ * The level is picked by how far ahead the timer expires, and the slot by
+ * its expiry's bits for that level, so the slot is next reached (i.e. its
+ * start tick comes round) after `base` and by the expiry.
+ */
+void TimerWheel::place(Timer &timer, uint64_t base)
+{
+    uint64_t expiry = timer.expiry > base ? timer.expiry : base;
+
+    // beyond the wheel's range: wait in the last level, to be re-filed from there
+    const uint64_t range = 1ULL << (LEVELS * SLOT_BITS);
+    if (expiry - base >= range)
+        expiry = base + range - 1;
+
+    uint32_t level = 0;
+    while (level < LEVELS - 1 && expiry - base >= (1ULL << ((level + 1) * SLOT_BITS)))
+        level++;
+
+    uint32_t slot = (expiry >> (level * SLOT_BITS)) & (SLOTS - 1);
+    link(slots[level][slot], timer);
+    occupied[level] |= 1ULL << slot;
+}
+
+/**
+ * Re-files the timers of the slots tick `tick` starts (in each level above
+ * 0) into lower levels, highest level first (a timer moved down may land
+ * in a lower level's slot that `tick` starts too).
+ */
+void TimerWheel::cascade(uint64_t tick)
+{
+    for (uint32_t level = LEVELS - 1; level > 0; level--)
+    {
+        uint32_t shift = level * SLOT_BITS;
+        if (tick & ((1ULL << shift) - 1))
+            continue;
+
+        uint32_t slot = (tick >> shift) & (SLOTS - 1);
+        Timer moved;
+        takeSlot(slots[level][slot], moved, level, slot);
+        while (moved.next != &moved)
+        {
+            Timer *timer = moved.next;
+            unlink(*timer);
+            place(*timer, tick);
+        }
+    }
+}
+
+/**
+ * Moves the timers of slot `slot` (of `level`), headed by `head`, onto
+ * empty list `list`.
+ */
+void TimerWheel::takeSlot(Timer &head, Timer &list, uint32_t level, uint32_t slot)
+{
+    occupied[level] &= ~(1ULL << slot);
+    if (head.next == &head)
+    {
+        list.prev = list.next = &list;
+        return;
+    }
+
+    list.next = head.next;
+    list.prev = head.prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    head.prev = head.next = &head;
+}
+
+void TimerWheel::link(Timer &head, Timer &timer)
+{
+    timer.prev = head.prev;
+    timer.next = &head;
+    head.prev->next = &timer;
+    head.prev = &timer;
+}
+
+void TimerWheel::unlink(Timer &timer)
+{
+    timer.prev->next = timer.next;
+    timer.next->prev = timer.prev;
+    timer.prev = timer.next = nullptr;
+}
+
+////////////////////////////////////////////
+// TimerWheel tests
+////////////////////////////////////////////
+
+namespace TimerWheelTests
+{
+    /**
+     * Advances `wheel` to tick `now`, returning the timers fired, in order.
+     */
+    std::vector<Timer*> advance(TimerWheel &wheel, uint64_t now)
+    {
+        std::vector<Timer*> fired;
+        wheel.advance(now, [&](Timer &timer) { fired.push_back(&timer); });
+        return fired;
+    }
+
+    /**
+     * Returns true if `timer` fires exactly at its expiry: not on advancing
+     * `wheel` to the tick before, and alone on advancing to it.
+     */
+    bool firesAtExpiry(TimerWheel &wheel, Timer &timer)
+    {
+        if (!advance(wheel, timer.expiry - 1).empty())
+            return false;
+
+        std::vector<Timer*> fired = advance(wheel, timer.expiry);
+        return fired.size() == 1 && fired[0] == &timer && !timer.armed();
+    }
+
+    void testArmCancelRearm()
+    {
+        TimerWheel wheel(0);
+        Timer a, b, c;
+
+        /**
+         * Arm and cancel
+         */
+        wheel.arm(a, 10);
+        wheel.arm(b, 20);
+        ASSERT_THAT(wheel.size() == 2 && a.armed() && b.armed());
+
+        wheel.cancel(b);
+        ASSERT_THAT(wheel.size() == 1 && !b.armed());
+        wheel.cancel(b);
+        ASSERT_THAT(wheel.size() == 1);
+
+        ASSERT_THAT(firesAtExpiry(wheel, a));
+        ASSERT_THAT(advance(wheel, 100).empty());
+        ASSERT_THAT(wheel.size() == 0);
+        ASSERT_THAT(wheel.nextExpiry() == TimerWheel::NEVER);
+
+        /**
+         * Re-arming an armed timer moves it (earlier or later), without
+         * counting it twice
+         */
+        wheel.arm(a, 500);
+        wheel.arm(a, 150);
+        ASSERT_THAT(wheel.size() == 1);
+        ASSERT_THAT(firesAtExpiry(wheel, a));
+
+        wheel.arm(a, 200);
+        wheel.arm(a, 5000);
+        ASSERT_THAT(advance(wheel, 4999).empty());
+        ASSERT_THAT(advance(wheel, 5000).size() == 1);
+
+        /**
+         * Timers may be re-armed, and others cancelled, as they fire
+         */
+        wheel.arm(a, 5010);
+        wheel.arm(c, 5012);
+        uint32_t fires = 0;
+        wheel.advance(5100, [&](Timer &timer) {
+            ASSERT_THAT(&timer == &a);
+            if (++fires < 3)
+                wheel.arm(a, timer.expiry + 40);
+            wheel.cancel(c);
+        });
+        ASSERT_THAT(fires == 3 && !c.armed());
+        ASSERT_THAT(wheel.size() == 0);
+    }
+
+    void testCascade()
+    {
+        /**
+         * From an unaligned start, timers filed in each level cascade down
+         * and fire at their expiry, in expiry order
+         */
+        uint64_t now = 12345;
+        TimerWheel wheel(now);
+
+        std::vector<uint64_t> aheads = {
+            3,                      // level 0
+            64 + 7,                 // level 1
+            (1ULL << 12) + 99,      // level 2
+            (1ULL << 18) + 4321,    // level 3
+            (1ULL << 24) + 100      // beyond the wheel's range
+        };
+        std::vector<Timer> timers(aheads.size());
+        for (uint32_t i = aheads.size(); i-- > 0; )
+            wheel.arm(timers[i], now + aheads[i]);
+        ASSERT_THAT(wheel.size() == aheads.size());
+
+        // nextExpiry() is a lower bound on the earliest expiry
+        ASSERT_THAT(wheel.nextExpiry() <= now + aheads[0]);
+
+        std::vector<Timer*> fired = advance(wheel, now + aheads.back());
+        ASSERT_THAT(fired.size() == timers.size());
+        for (uint32_t i = 0; i < timers.size(); i++)
+            ASSERT_THAT(fired[i] == &timers[i]);
+
+        /**
+         * One at a time, none fires early
+         */
+        for (uint32_t i = 0; i < aheads.size(); i++)
+            wheel.arm(timers[i], now + aheads.back() + aheads[i]);
+        for (uint32_t i = 0; i < timers.size(); i++)
+            ASSERT_THAT(firesAtExpiry(wheel, timers[i]));
+    }
+
+    void testLevelBoundaries()
+    {
+        /**
+         * Timers expiring either side of each level's range (as seen from
+         * the next tick), from starts either side of slot boundaries
+         */
+        std::vector<uint64_t> aheads;
+        for (uint32_t level = 1; level <= TimerWheel::LEVELS; level++)
+        {
+            uint64_t range = 1ULL << (level * TimerWheel::SLOT_BITS);
+            aheads.push_back(range - 1);
+            aheads.push_back(range);
+            aheads.push_back(range + 1);
+        }
+
+        for (uint64_t now : { 0ULL, 62ULL, 63ULL, 64ULL, 4095ULL, (1ULL << 18) - 1, 1000003ULL })
+        {
+            TimerWheel wheel(now);
+            std::vector<Timer> timers(aheads.size());
+            for (uint32_t i = 0; i < aheads.size(); i++)
+                wheel.arm(timers[i], now + 1 + aheads[i]);
+
+            for (uint32_t i = 0; i < timers.size(); i++)
+                ASSERT_THAT(firesAtExpiry(wheel, timers[i]));
+            ASSERT_THAT(wheel.size() == 0);
+        }
+    }
+
+    void testAdvanceByZero()
+    {
+        TimerWheel wheel(100);
+        Timer due, past, later;
+
+        /**
+         * Advancing to the current tick (or before it) fires nothing, even
+         * timers armed for it, or for a tick gone
+         */
+        wheel.arm(due, 100);
+        wheel.arm(past, 50);
+        wheel.arm(later, 101);
+        ASSERT_THAT(advance(wheel, 100).empty());
+        ASSERT_THAT(advance(wheel, 99).empty());
+        ASSERT_THAT(wheel.size() == 3);
+
+        /**
+         * The next tick fires them all, as armed
+         */
+        ASSERT_THAT(wheel.nextExpiry() == 101);
+        std::vector<Timer*> fired = advance(wheel, 101);
+        ASSERT_THAT(fired.size() == 3);
+        ASSERT_THAT(fired[0] == &due && fired[1] == &past && fired[2] == &later);
+
+        /**
+         * Advancing by 0 ticks again (time doesn't go back) fires a timer
+         * armed since for the tick just reached only on the next one
+         */
+        wheel.arm(due, 101);
+        ASSERT_THAT(advance(wheel, 101).empty());
+        ASSERT_THAT(advance(wheel, 50).empty());
+        ASSERT_THAT(advance(wheel, 102).size() == 1);
+        ASSERT_THAT(wheel.size() == 0);
+    }
+
+    void runAll()
+    {
+        std::cerr << "###################################" << std::endl;
+        std::cerr << "TimerWheel Tests" << std::endl;
+        std::cerr << "###################################" << std::endl;
+
+        std::vector<std::pair<std::string, std::function<void()>>> tests = 
+        {
+            TEST(testArmCancelRearm),
+            TEST(testCascade),
+            TEST(testLevelBoundaries),
+            TEST(testAdvanceByZero)
+        };
+
+        for (auto &[name, func] : tests)
+        {
+            TestUtils::runTest(name, func);
+        }
+    }
+};
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstdint>
+
+struct Tcb;
+
+/**
+ * Timer, embedded in the object it times (i.e. a TCB), and linked into a
+ * TimerWheel slot while armed, so arming one never allocates.
+ */
+struct Timer
+{
+    enum Kind : uint8_t
+    {
+        RETRANSMIT,     // resend what the peer hasn't acknowledged
+        DELAYED_ACK     // acknowledge received bytes no segment of ours carried an ACK for
+    };
+
+    Kind kind;
+
+    /* connection the timer belongs to */
+    Tcb *tcb;
+
+    /* tick the timer expires at, and its links in a wheel slot (nullptr while not armed) */
+    uint64_t expiry = 0;
+    Timer *prev = nullptr;
+    Timer *next = nullptr;
+
+    Timer(Kind kind = RETRANSMIT, Tcb *tcb = nullptr)
+        : kind(kind), tcb(tcb) {}
+
+    Timer(const Timer&) = delete;
+    Timer &operator=(const Timer&) = delete;
+
+    bool armed() const { return next != nullptr; }
+};
+
+/**
+ * Hierarchical timing wheel, in ticks of a caller-chosen length.
+ *
+ * Level L has 64 slots, each spanning 64^L ticks, so 4 levels cover 2^24
+ * ticks ahead (timers further out wait in the last level, and are moved
+ * down as it turns). A timer is filed in the lowest level whose range
+ * covers its expiry, and, as time reaches the slot it was filed in,
+ * cascades to a lower level, until it fires from level 0.
+ *
+ * Each slot is an intrusive, circular, doubly linked list, so arming,
+ * cancelling and re-arming a timer are O(1), and each level keeps a bitmap
+ * of its non-empty slots, so advancing over idle time, and finding the
+ * next expiry (to bound how long the engine may wait for packets), are
+ * O(levels) rather than O(ticks).
+ *
+ * Not thread-safe: one engine owns the wheel and all timers armed on it.
+ */
+class TimerWheel
+{
+public:
+    static const uint32_t LEVELS = 4;
+    static const uint32_t SLOT_BITS = 6;
+    static const uint32_t SLOTS = 1 << SLOT_BITS;
+
+    /* returned by nextExpiry() when no timer is armed */
+    static const uint64_t NEVER = UINT64_MAX;
+
+    /**
+     * Starts the wheel at tick `now`.
+     */
+    TimerWheel(uint64_t now);
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel &operator=(const TimerWheel&) = delete;
+
+    /**
+     * Arms `timer` to expire at tick `expiry` (at the next advance() if
+     * already past), re-arming it if it is armed.
+     */
+    void arm(Timer &timer, uint64_t expiry);
+
+    /**
+     * Disarms `timer`, if armed.
+     */
+    void cancel(Timer &timer);
+
+    /**
+     * Returns the earliest tick advance() may have to act at (i.e. a
+     * lower bound on the next expiry), or NEVER if no timer is armed.
+     */
+    uint64_t nextExpiry();
+
+    /**
+     * Advances the wheel to tick `now`, calling `fire(timer)` for each
+     * timer expiring by then, in expiry order. `fire` may arm and cancel
+     * any timers, including the one it is called for.
+     */
+    template <typename Fire>
+    void advance(uint64_t now, Fire &&fire)
+    {
+        while (numTimers > 0)
+        {
+            uint64_t tick = nextExpiry();
+            if (tick > now)
+                break;
+
+            current = tick;
+            cascade(tick);
+
+            Timer expired;
+            takeSlot(slots[0][tick & (SLOTS - 1)], expired, 0, tick & (SLOTS - 1));
+            while (expired.next != &expired)
+            {
+                Timer *timer = expired.next;
+                unlink(*timer);
+                numTimers--;
+                fire(*timer);
+            }
+        }
+
+        if (now > current)
+            current = now;
+    }
+
+    /**
+     * Returns num. armed timers.
+     */
+    uint32_t size() { return numTimers; }
+
+private:
+    /* list heads (sentinels) of each level's slots */
+    Timer slots[LEVELS][SLOTS];
+
+    /* bit s set if slot s of the level may be non-empty (cleared lazily as empty slots are found) */
+    uint64_t occupied[LEVELS] = {};
+
+    /* last tick processed: timers expiring at or before it have fired */
+    uint64_t current;
+
+    uint32_t numTimers = 0;
+
+    /**
+     * Files armed `timer` in the slot its expiry falls into, as seen from
+     * tick `base` (the next tick to be processed, at the latest).
+     */
+    void place(Timer &timer, uint64_t base);
+
+    /**
+     * Re-files the timers of the slots tick `tick` starts (in each level
+     * above 0) into lower levels, highest level first.
+     */
+    void cascade(uint64_t tick);
+
+    /**
+     * Moves the timers of slot `slot` (of `level`) onto empty list `list`.
+     */
+    void takeSlot(Timer &head, Timer &list, uint32_t level, uint32_t slot);
+
+    static void link(Timer &head, Timer &timer);
+    static void unlink(Timer &timer);
+};
+
+namespace TimerWheelTests
+{
+    void testArmCancelRearm();
+    void testCascade();
+    void testLevelBoundaries();
+    void testAdvanceByZero();
+
+    void runAll();
+};
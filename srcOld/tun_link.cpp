@@ -0,0 +1,152 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+#include <netinet/ip.h>
+#include <stdexcept>
+
+#include "tun_link.hpp"
+
+////////////////////////////////////////////
+// TunLink methods
+////////////////////////////////////////////
+TunLink::TunLink(const std::string &interfaceName, uint32_t queueIndex)
+{
+    this->interfaceName = interfaceName;
+    this->queueIndex = queueIndex;
+    this->fd = initialiseTunQueue(interfaceName);
+    if (this->fd < 0)
+        throw std::runtime_error("Failed TUN queue creation");
+}
+
+TunLink::~TunLink()
+{
+    if (fd >= 0)
+        close(fd);
+}
+
+/**
+ * Attaches a new queue to the (multi-queue) TUN device `interfaceName`.
+ *
+ * NOTE:
+ *
+ * Every open of /dev/net/tun with IFF_MULTI_QUEUE under the same device
+ * name attaches one more queue, and the kernel spreads flows across queues
+ * by flow hash. Hence, one queue per engine thread.
+ */
+int TunLink::initialiseTunQueue(const std::string &interfaceName)
+{
+    if (interfaceName.empty() || interfaceName.size() >= IFNAMSIZ)
+    {
+        fprintf(stderr, "Invalid TUN device name: '%s'\n", interfaceName.c_str());
+        return -1;
+    }
+
+    int fd = ::open("/dev/net/tun", O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        perror("Failed to open /dev/net/tun");
+        return -1;
+    }
+
+    struct ifreq ifr = {};
+    ifr.ifr_flags = IFF_TUN | IFF_NO_PI | IFF_MULTI_QUEUE;
+    strncpy(ifr.ifr_name, interfaceName.c_str(), IFNAMSIZ - 1);
+
+    if (ioctl(fd, TUNSETIFF, &ifr) < 0)
+    {
+        perror("TUNSETIFF failed");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Receive a single IP packet into `packetBuffer`.
+ *
+ * Anything that isn't an IPv4 TCP packet (e.g. IPv6 router solicitations
+ * the kernel sends once the device is up) is skipped.
+ *
+ * Returns the packet size, or -1 on failure.
+ */
+ssize_t TunLink::recvPacket(std::vector<uint8_t> &packetBuffer)
+{
+    while (1)
+    {
+        ssize_t packetSize = read(fd, packetBuffer.data(), packetBuffer.size());
+        stats.rxSyscalls++;
+        if (packetSize < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("TUN read failed");
+            return -1;
+        }
+
+        if (packetSize < sizeof(struct iphdr))
+            continue;
+
+        struct iphdr *ip = (struct iphdr*)packetBuffer.data();
+        if (ip->version != 4 || ip->protocol != IPPROTO_TCP)
+            continue;
+
+        stats.rxPackets++;
+        return packetSize;
+    }
+}
+
+/**
+ * Send the serialised packet `packet` of size `size` to `destAddr`.
+ *
+ * `packet` must carry its own IP header, so `destAddr` is unused.
+ *
+ * Returns num. bytes sent, or -1 on failure.
+ */
+ssize_t TunLink::sendPacket(const uint8_t *packet, size_t size, in_addr_t destAddr)
+{
+    ssize_t bytesSent = write(fd, packet, size);
+    stats.txSyscalls++;
+    if (bytesSent < 0 || bytesSent != size)
+    {
+        perror("TUN write failed");
+        return -1;
+    }
+
+    stats.txPackets++;
+    return bytesSent;
+}
+
+/**
+ * Receive a single IP packet into `packets`, waiting for at most the poll
+ * timeout, if set.
+ *
+ * Returns num. packets received (0 on timeout), or -1 on failure.
+ */
+int TunLink::recvBatch(LinkPacket *packets, int maxPackets)
+{
+    if (pollTimeoutMs >= 0)
+    {
+        stats.rxSyscalls++;
+        int ret = waitReadable(fd);
+        if (ret <= 0)
+            return ret;
+    }
+
+    return LinkBackend::recvBatch(packets, maxPackets);
+}
+
+/**
+ * Each engine attaches its own queue of the device, and the kernel spreads
+ * flows over the device's queues (by its flow hash), so sharing is free.
+ *
+ * NOTE: the kernel, not `queueIndex`, decides which flows are ours.
+ */
+bool TunLink::setQueue(uint32_t queueIndex, uint32_t numQueues)
+{
+    return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "link.hpp"
+
+/**
+ * TUN device backend.
+ *
+ * The device is opened with IFF_TUN | IFF_NO_PI | IFF_MULTI_QUEUE, so reads
+ * and writes are bare IP packets, and each engine thread attaches its own
+ * queue of the device. The kernel only routes packets to and from the device,
+ * so we own the whole L3 path (i.e. the kernel TCP stack never sees our traffic).
+ *
+ * The device itself is expected to be configured (address, route, up)
+ * externally, e.g.
+ *
+ *      ip tuntap add dev rack0 mode tun multi_queue
+ *      ip addr add 10.126.0.1/24 dev rack0
+ *      ip link set rack0 up
+ */
+class TunLink : public LinkBackend
+{
+public:
+    TunLink(const std::string &interfaceName, uint32_t queueIndex);
+    ~TunLink();
+
+    ssize_t recvPacket(std::vector<uint8_t> &packetBuffer) override;
+    ssize_t sendPacket(const uint8_t *packet, size_t size, in_addr_t destAddr) override;
+    int recvBatch(LinkPacket *packets, int maxPackets) override;
+    bool setQueue(uint32_t queueIndex, uint32_t numQueues) override;
+    bool requiresIpHeader() override { return true; }
+    std::string name() override { return "tun"; }
+
+private:
+    /* file descriptor of our queue of the device */
+    int fd;
+
+    std::string interfaceName;
+    uint32_t queueIndex;
+
+    /**
+     * Attaches a new queue to the (multi-queue) TUN device `interfaceName`.
+     */
+    int initialiseTunQueue(const std::string &interfaceName);
+};
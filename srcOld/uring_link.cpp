@@ -0,0 +1,601 @@
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+#include <stdexcept>
+#include <algorithm>
+
+#include "uring_link.hpp"
+
+#include "config.hpp"
+
+#define URING_BUF_GROUP 0
+
+/* completion tags (upper 32 bits of user_data) */
+#define URING_TAG_RX 1ULL
+#define URING_TAG_TX 2ULL
+
+////////////////////////////////////////////
+// UringLink methods
+////////////////////////////////////////////
+UringLink::UringLink(in_addr_t bindAddr, bool sqPoll)
+{
+    this->bindAddr = bindAddr;
+    this->queueIndex = 0;
+    this->numQueues = 1;
+    this->sqPoll = sqPoll;
+    this->ringFd = -1;
+    this->sqMap = MAP_FAILED;
+    this->cqMap = MAP_FAILED;
+    this->sqes = (struct io_uring_sqe*)MAP_FAILED;
+    this->bufRing = (struct io_uring_buf_ring*)MAP_FAILED;
+    this->bufRingTail = 0;
+    this->sqPending = 0;
+    this->rxArmed = false;
+    this->rxMultishot = true;
+    this->txQueued = 0;
+
+    this->sock = RawSocketLink::openRawSocket(bindAddr);
+    if (this->sock < 0)
+        throw std::runtime_error("Failed socket creation");
+
+    if (!initialiseRing() || !probeOpcodes() || !initialiseBufferRing())
+    {
+        teardown();
+        throw std::runtime_error("Failed io_uring initialisation");
+    }
+
+    rxReady.reserve(URING_RX_BUFFERS);
+    rxReadyBuffers.reserve(URING_RX_BUFFERS);
+    rxHeldBuffers.reserve(URING_RX_BUFFERS);
+
+    /**
+     * Each TX slot owns an MTU-sized slice of one contiguous buffer, plus the
+     * msghdr the kernel reads asynchronously (so it must outlive submission).
+     */
+    txBuffers.resize((size_t)URING_TX_SLOTS * MTU);
+    txIovecs.resize(URING_TX_SLOTS);
+    txAddrs.resize(URING_TX_SLOTS);
+    txMsgs.resize(URING_TX_SLOTS);
+    txFreeSlots.reserve(URING_TX_SLOTS);
+    for (int i = URING_TX_SLOTS - 1; i >= 0; i--)
+    {
+        txIovecs[i].iov_base = txBuffers.data() + (size_t)i * MTU;
+        txAddrs[i] = {};
+        txAddrs[i].sin_family = AF_INET;
+        txMsgs[i] = {};
+        txMsgs[i].msg_iov = &txIovecs[i];
+        txMsgs[i].msg_iovlen = 1;
+        txMsgs[i].msg_name = &txAddrs[i];
+        txMsgs[i].msg_namelen = sizeof(txAddrs[i]);
+        txFreeSlots.push_back(i);
+    }
+
+    armRecv();
+}
+
+UringLink::~UringLink()
+{
+    teardown();
+}
+
+/**
+ * Releases all io_uring resources.
+ */
+void UringLink::teardown()
+{
+    if (bufRing != MAP_FAILED)
+        munmap(bufRing, bufRingSize);
+    if (sqes != MAP_FAILED)
+        munmap(sqes, sqesSize);
+    if (cqMap != MAP_FAILED && cqMap != sqMap)
+        munmap(cqMap, cqMapSize);
+    if (sqMap != MAP_FAILED)
+        munmap(sqMap, sqMapSize);
+    bufRing = (struct io_uring_buf_ring*)MAP_FAILED;
+    sqes = (struct io_uring_sqe*)MAP_FAILED;
+    sqMap = cqMap = MAP_FAILED;
+
+    if (ringFd >= 0)
+        close(ringFd);
+    if (sock >= 0)
+        close(sock);
+    ringFd = sock = -1;
+}
+
+/**
+ * Sets up the ring and maps its submission/completion queues.
+ */
+bool UringLink::initialiseRing()
+{
+    struct io_uring_params params = {};
+    if (sqPoll)
+    {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = URING_SQPOLL_IDLE_MS;
+    }
+
+    ringFd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ringFd < 0)
+    {
+        perror("io_uring_setup failed");
+        return false;
+    }
+
+    sqMapSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMap)
+        sqMapSize = cqMapSize = std::max(sqMapSize, cqMapSize);
+
+    sqMap = mmap(NULL, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 ringFd, IORING_OFF_SQ_RING);
+    if (sqMap == MAP_FAILED)
+    {
+        perror("Failed SQ ring mmap");
+        return false;
+    }
+
+    cqMap = singleMap ? sqMap : mmap(NULL, cqMapSize, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    if (cqMap == MAP_FAILED)
+    {
+        perror("Failed CQ ring mmap");
+        return false;
+    }
+
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe*)mmap(NULL, sqesSize, PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        perror("Failed SQE array mmap");
+        return false;
+    }
+
+    uint8_t *sq = (uint8_t*)sqMap;
+    sqHead = (uint32_t*)(sq + params.sq_off.head);
+    sqTail = (uint32_t*)(sq + params.sq_off.tail);
+    sqFlags = (uint32_t*)(sq + params.sq_off.flags);
+    sqArray = (uint32_t*)(sq + params.sq_off.array);
+    sqMask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+    sqEntries = *(uint32_t*)(sq + params.sq_off.ring_entries);
+
+    uint8_t *cq = (uint8_t*)cqMap;
+    cqHead = (uint32_t*)(cq + params.cq_off.head);
+    cqTail = (uint32_t*)(cq + params.cq_off.tail);
+    cqMask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+/**
+ * Checks the kernel supports the opcodes we use.
+ */
+bool UringLink::probeOpcodes()
+{
+    const int numOps = 256;
+    std::vector<uint8_t> buffer(sizeof(struct io_uring_probe) + numOps * sizeof(struct io_uring_probe_op));
+    auto *probe = (struct io_uring_probe*)buffer.data();
+
+    if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, numOps) < 0)
+    {
+        perror("IORING_REGISTER_PROBE failed");
+        return false;
+    }
+
+    for (uint8_t op : { IORING_OP_RECV, IORING_OP_SENDMSG })
+    {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+        {
+            fprintf(stderr, "io_uring opcode %d not supported\n", op);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Registers the provided buffer ring, and fills it with every RX buffer.
+ */
+bool UringLink::initialiseBufferRing()
+{
+    bufRingSize = URING_RX_BUFFERS * sizeof(struct io_uring_buf);
+    bufRing = (struct io_uring_buf_ring*)mmap(NULL, bufRingSize, PROT_READ | PROT_WRITE,
+                                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufRing == MAP_FAILED)
+    {
+        perror("Failed buffer ring mmap");
+        return false;
+    }
+
+    struct io_uring_buf_reg reg = {};
+    reg.ring_addr = (uint64_t)bufRing;
+    reg.ring_entries = URING_RX_BUFFERS;
+    reg.bgid = URING_BUF_GROUP;
+    if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        perror("IORING_REGISTER_PBUF_RING failed");
+        return false;
+    }
+
+    rxBuffers.resize((size_t)URING_RX_BUFFERS * MTU);
+    for (uint16_t bid = 0; bid < URING_RX_BUFFERS; bid++)
+        recycleBuffer(bid);
+
+    return true;
+}
+
+/**
+ * Returns the next free (zeroed) SQE, submitting pending ones if the
+ * queue is full. It is only handed to the kernel by pushSqe().
+ */
+struct io_uring_sqe *UringLink::getSqe()
+{
+    uint32_t tail = *sqTail;
+    while (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+        enter(0);
+
+    uint32_t index = tail & sqMask;
+    struct io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    return sqe;
+}
+
+/**
+ * Publishes the SQE returned by the last getSqe() call.
+ */
+void UringLink::pushSqe()
+{
+    __atomic_store_n(sqTail, *sqTail + 1, __ATOMIC_RELEASE);
+    sqPending++;
+}
+
+/**
+ * Arms the (multishot) recv on the socket.
+ *
+ * Buffers are picked from the provided buffer ring by the kernel.
+ */
+void UringLink::armRecv()
+{
+    struct io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sock;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->ioprio = rxMultishot ? IORING_RECV_MULTISHOT : 0;
+    sqe->user_data = URING_TAG_RX << 32;
+    pushSqe();
+
+    rxArmed = true;
+}
+
+/**
+ * Returns RX buffer `bid` to the provided buffer ring.
+ */
+void UringLink::recycleBuffer(uint16_t bid)
+{
+    /**
+     * Index the entries off the ring base ourselves: in C++, the header's
+     * flexible array sits behind a (1-byte) empty struct, i.e. `bufRing->bufs`
+     * is 8 bytes off from where the kernel reads the entries.
+     */
+    struct io_uring_buf *bufs = (struct io_uring_buf*)bufRing;
+    struct io_uring_buf &buf = bufs[bufRingTail & (URING_RX_BUFFERS - 1)];
+    buf.addr = (uint64_t)(rxBuffers.data() + (size_t)bid * MTU);
+    buf.len = MTU;
+    buf.bid = bid;
+
+    bufRingTail++;
+    __atomic_store_n(&bufRing->tail, bufRingTail, __ATOMIC_RELEASE);
+}
+
+/**
+ * Submits pending SQEs, optionally waiting for `minComplete` completions.
+ *
+ * With SQPOLL, the kernel thread picks up SQEs by itself, so we only
+ * enter to wake it up (once idle), or to wait for completions.
+ *
+ * Returns num. SQEs submitted, or -1 on failure.
+ */
+int UringLink::enter(uint32_t minComplete)
+{
+    uint32_t flags = minComplete ? IORING_ENTER_GETEVENTS : 0;
+
+    if (sqPoll)
+    {
+        // order our SQ tail store before the flags load
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(sqFlags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)
+            flags |= IORING_ENTER_SQ_WAKEUP;
+
+        sqPending = 0;
+        if (flags == 0)
+            return 0;
+    }
+    else if (sqPending == 0 && minComplete == 0)
+        return 0;
+
+    int ret = syscall(__NR_io_uring_enter, ringFd, sqPending, minComplete, flags, NULL, 0);
+    if (minComplete)
+        stats.rxSyscalls++;
+    else
+        stats.txSyscalls++;
+
+    if (ret < 0)
+    {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+            return 0;
+        perror("io_uring_enter failed");
+        return -1;
+    }
+
+    if (!sqPoll)
+        sqPending -= std::min<uint32_t>(ret, sqPending);
+    return ret;
+}
+
+/**
+ * Reaps all available completions, moving received packets onto the
+ * ready list and freeing completed TX slots.
+ *
+ * Returns false on failure.
+ */
+bool UringLink::reapCompletions()
+{
+    uint32_t head = *cqHead;
+    uint32_t tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe *cqe = &cqes[head & cqMask];
+
+        if ((cqe->user_data >> 32) == URING_TAG_TX)
+        {
+            txFreeSlots.push_back(cqe->user_data & 0xffff);
+            if (cqe->res < 0)
+                fprintf(stderr, "io_uring sendmsg failed: %s\n", strerror(-cqe->res));
+            continue;
+        }
+
+        // recv terminated (single-shot, out of buffers, or error) - re-arm below
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            rxArmed = false;
+
+        if (cqe->res < 0)
+        {
+            if (cqe->res == -EINVAL && rxMultishot)
+            {
+                // pre-6.0 kernel: no multishot recv
+                rxMultishot = false;
+                continue;
+            }
+            if (cqe->res == -ENOBUFS)
+                continue;
+
+            fprintf(stderr, "io_uring recv failed: %s\n", strerror(-cqe->res));
+            __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+            return false;
+        }
+
+        if (!(cqe->flags & IORING_CQE_F_BUFFER))
+            continue;
+
+        uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (cqe->res == 0)
+        {
+            recycleBuffer(bid);
+            continue;
+        }
+
+        LinkPacket packet;
+        packet.data = rxBuffers.data() + (size_t)bid * MTU;
+        packet.size = cqe->res;
+        rxReady.push_back(packet);
+        rxReadyBuffers.push_back(bid);
+    }
+
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+    if (!rxArmed)
+        armRecv();
+    return true;
+}
+
+/**
+ * Receive a single IP packet into `packetBuffer`.
+ *
+ * Returns the packet size, or -1 on failure.
+ */
+ssize_t UringLink::recvPacket(std::vector<uint8_t> &packetBuffer)
+{
+    LinkPacket packet;
+    int n;
+    while ((n = recvBatch(&packet, 1)) == 0)
+        ;
+    if (n < 0)
+        return -1;
+
+    if (packet.size > packetBuffer.size())
+    {
+        fprintf(stderr, "Packet receive failed: packet larger than buffer\n");
+        return -1;
+    }
+
+    memcpy(packetBuffer.data(), packet.data, packet.size);
+    return packet.size;
+}
+
+/**
+ * Receive up to `maxPackets` IP packets into `packets`, without copying
+ * them (they reference the provided buffers they were received into).
+ * Blocks until at least one packet is available. The buffers go back to
+ * the kernel on the next receive call.
+ *
+ * Returns num. packets received, or -1 on failure.
+ */
+int UringLink::recvBatch(LinkPacket *packets, int maxPackets)
+{
+    for (uint16_t bid : rxHeldBuffers)
+        recycleBuffer(bid);
+    rxHeldBuffers.clear();
+
+    while (rxReady.empty())
+    {
+        if (!reapCompletions())
+            return -1;
+        if (!rxReady.empty())
+            break;
+
+        // nothing completed yet - submit pending SQEs and wait
+        if (pollTimeoutMs < 0)
+        {
+            if (enter(1) < 0)
+                return -1;
+            continue;
+        }
+
+        // with a poll timeout, wait in poll() (the ring is readable once its CQ isn't empty)
+        if (enter(0) < 0)
+            return -1;
+        stats.rxSyscalls++;
+        int ret = waitReadable(ringFd);
+        if (ret <= 0)
+            return ret;
+    }
+
+    int n = std::min<int>(maxPackets, rxReady.size());
+    for (int i = 0; i < n; i++)
+    {
+        packets[i] = rxReady[i];
+        rxHeldBuffers.push_back(rxReadyBuffers[i]);
+    }
+    rxReady.erase(rxReady.begin(), rxReady.begin() + n);
+    rxReadyBuffers.erase(rxReadyBuffers.begin(), rxReadyBuffers.begin() + n);
+
+    stats.rxPackets += n;
+    return n;
+}
+
+/**
+ * Send the serialised packet `packet` of size `size` to `destAddr`.
+ *
+ * Returns num. bytes sent, or -1 on failure.
+ */
+ssize_t UringLink::sendPacket(const uint8_t *packet, size_t size, in_addr_t destAddr)
+{
+    if (queuePacket(packet, size, destAddr) < 0 || flush() < 0)
+        return -1;
+    return size;
+}
+
+/**
+ * Copy the serialised packet `packet` of size `size` into a free TX slot,
+ * and queue a sendmsg SQE for it, to be submitted on the next flush().
+ *
+ * Returns num. bytes queued, or -1 on failure.
+ */
+ssize_t UringLink::queuePacket(const uint8_t *packet, size_t size, in_addr_t destAddr)
+{
+    uint8_t *slot = txSlot(size);
+    if (!slot)
+        return -1;
+
+    memcpy(slot, packet, size);
+    return queueSlot(size, destAddr);
+}
+
+/**
+ * Returns the buffer of a free TX slot (taken by queueSlot()), waiting for
+ * in-flight sends to complete if there is none.
+ */
+uint8_t *UringLink::txSlot(size_t size)
+{
+    if (size > MTU)
+    {
+        fprintf(stderr, "Packet too large to queue\n");
+        return nullptr;
+    }
+
+    // all slots in flight - submit, and wait for some to complete
+    while (txFreeSlots.empty())
+    {
+        if (flush() < 0 || enter(1) < 0 || !reapCompletions())
+            return nullptr;
+    }
+
+    return (uint8_t*)txIovecs[txFreeSlots.back()].iov_base;
+}
+
+/**
+ * Queue a sendmsg SQE for the packet written into the free TX slot
+ * txSlot() returned, to be submitted on the next flush().
+ */
+ssize_t UringLink::queueSlot(size_t size, in_addr_t destAddr)
+{
+    uint16_t slot = txFreeSlots.back();
+    txFreeSlots.pop_back();
+
+    txIovecs[slot].iov_len = size;
+    txAddrs[slot].sin_addr.s_addr = destAddr;
+
+    struct io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = sock;
+    sqe->addr = (uint64_t)&txMsgs[slot];
+    sqe->len = 1;
+    sqe->user_data = (URING_TAG_TX << 32) | slot;
+    pushSqe();
+
+    txQueued++;
+    return size;
+}
+
+/**
+ * Submit every queued SQE with (at most) a single io_uring_enter().
+ *
+ * Returns num. packets sent, or -1 on failure.
+ */
+int UringLink::flush()
+{
+    if (txQueued == 0)
+        return 0;
+
+    int queued = txQueued;
+    txQueued = 0;
+
+    if (enter(0) < 0)
+        return -1;
+
+    stats.txPackets += queued;
+    return queued;
+}
+
+/**
+ * Regenerates the raw socket's classic BPF filter for the local ports `ports`.
+ *
+ * Returns false on failure.
+ */
+bool UringLink::setLocalPorts(const std::vector<uint16_t> &ports)
+{
+    localPorts = ports;
+    return RawSocketLink::attachFilter(sock, bindAddr, localPorts, queueIndex, numQueues);
+}
+
+/**
+ * Regenerates the raw socket's classic BPF filter to only accept flows of
+ * queue `queueIndex` (of `numQueues`), by the kernel's flow hash.
+ *
+ * Returns false on failure.
+ */
+bool UringLink::setQueue(uint32_t queueIndex, uint32_t numQueues)
+{
+    this->queueIndex = queueIndex;
+    this->numQueues = numQueues;
+    if (numQueues > 1 && !RawSocketLink::setReceiveBuffer(sock, SOCKET_SHARED_RCVBUF))
+        return false;
+    return RawSocketLink::attachFilter(sock, bindAddr, localPorts, queueIndex, numQueues);
+}
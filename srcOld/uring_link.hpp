@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <netinet/ip.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+#include "link.hpp"
+
+/**
+ * io_uring driver for the raw IP socket.
+ *
+ * RX is a single multishot recv, which picks its buffers from a provided
+ * buffer ring: every received packet just shows up as a completion, with
+ * no SQE (or syscall) per packet. TX queues one sendmsg SQE per packet, and
+ * flush() submits all of them with a single io_uring_enter().
+ *
+ * With SQPOLL, a kernel thread polls the submission queue, so in steady
+ * state (i.e. completions keep arriving) the engine thread issues no
+ * syscalls at all.
+ *
+ * NOTE:
+ *
+ * Construction fails (throws) if the kernel lacks the opcodes or buffer
+ * rings we rely on, so the caller can fall back to the plain raw socket.
+ * Kernels with buffer rings but without multishot recv (< 6.0) fall back
+ * to re-arming a single-shot recv per packet.
+ */
+class UringLink : public LinkBackend
+{
+public:
+    UringLink(in_addr_t bindAddr, bool sqPoll);
+    ~UringLink();
+
+    ssize_t recvPacket(std::vector<uint8_t> &packetBuffer) override;
+    ssize_t sendPacket(const uint8_t *packet, size_t size, in_addr_t destAddr) override;
+    int recvBatch(LinkPacket *packets, int maxPackets) override;
+    ssize_t queuePacket(const uint8_t *packet, size_t size, in_addr_t destAddr) override;
+    uint8_t *txSlot(size_t size) override;
+    ssize_t queueSlot(size_t size, in_addr_t destAddr) override;
+    int flush() override;
+    bool setLocalPorts(const std::vector<uint16_t> &ports) override;
+    bool setQueue(uint32_t queueIndex, uint32_t numQueues) override;
+    bool requiresIpHeader() override { return false; }
+    std::string name() override { return sqPoll ? "uring-sqpoll" : "uring"; }
+
+private:
+    /* raw IP socket, and the address it is bound to */
+    int sock;
+    in_addr_t bindAddr;
+
+    /* raw socket filter state (see RawSocketLink::attachFilter()) */
+    std::vector<uint16_t> localPorts;
+    uint32_t queueIndex;
+    uint32_t numQueues;
+
+    /* io_uring instance */
+    int ringFd;
+    bool sqPoll;
+
+    /* submission queue */
+    void *sqMap;
+    size_t sqMapSize;
+    uint32_t *sqHead;
+    uint32_t *sqTail;
+    uint32_t *sqFlags;
+    uint32_t *sqArray;
+    uint32_t sqMask;
+    uint32_t sqEntries;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    uint32_t sqPending;                         // SQEs queued since the last submit
+
+    /* completion queue */
+    void *cqMap;
+    size_t cqMapSize;
+    uint32_t *cqHead;
+    uint32_t *cqTail;
+    uint32_t cqMask;
+    struct io_uring_cqe *cqes;
+
+    /* provided buffer ring (RX) */
+    struct io_uring_buf_ring *bufRing;
+    size_t bufRingSize;
+    uint16_t bufRingTail;
+    std::vector<uint8_t> rxBuffers;
+    std::vector<LinkPacket> rxReady;            // reaped, not yet handed out packets ...
+    std::vector<uint16_t> rxReadyBuffers;       // ... and their buffer ids
+    std::vector<uint16_t> rxHeldBuffers;        // buffer ids handed out by the last receive
+    bool rxArmed;
+    bool rxMultishot;
+
+    /* TX slots: packet copy, destination and msghdr of each in-flight sendmsg */
+    std::vector<uint8_t> txBuffers;
+    std::vector<struct iovec> txIovecs;
+    std::vector<struct sockaddr_in> txAddrs;
+    std::vector<struct msghdr> txMsgs;
+    std::vector<uint16_t> txFreeSlots;
+    uint32_t txQueued;                          // sendmsg SQEs queued since the last flush
+
+    /**
+     * Sets up the ring and maps its submission/completion queues.
+     */
+    bool initialiseRing();
+
+    /**
+     * Checks the kernel supports the opcodes we use.
+     */
+    bool probeOpcodes();
+
+    /**
+     * Registers the provided buffer ring, and fills it with every RX buffer.
+     */
+    bool initialiseBufferRing();
+
+    /**
+     * Returns the next free (zeroed) SQE, submitting pending ones if the
+     * queue is full. It is only handed to the kernel by pushSqe().
+     */
+    struct io_uring_sqe *getSqe();
+
+    /**
+     * Publishes the SQE returned by the last getSqe() call.
+     */
+    void pushSqe();
+
+    /**
+     * Arms the (multishot) recv on the socket.
+     */
+    void armRecv();
+
+    /**
+     * Returns RX buffer `bid` to the provided buffer ring.
+     */
+    void recycleBuffer(uint16_t bid);
+
+    /**
+     * Submits pending SQEs, optionally waiting for `minComplete` completions.
+     */
+    int enter(uint32_t minComplete);
+
+    /**
+     * Reaps all available completions, moving received packets onto the
+     * ready list and freeing completed TX slots.
+     *
+     * Returns false on failure.
+     */
+    bool reapCompletions();
+
+    /**
+     * Releases all io_uring resources.
+     */
+    void teardown();
+};
@@ -1,8 +1,11 @@
 #include <sys/ioctl.h>
+#include <pthread.h>
+#include <dirent.h>
 #include <net/if.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <string>
 
 #include "utils.hpp"
@@ -34,6 +37,132 @@ namespace SystemUtils
         close(sock);
         return ifr.ifr_mtu;
     }
+
+    /**
+     * Retreive the 6-byte MAC address of network interface `interface_name`
+     * into `mac`.
+     */
+    bool getMacAddress(std::string interface_name, uint8_t *mac)
+    {
+        int sock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sock < 0) 
+        {
+            perror("Socket creation failed");
+            return false;
+        }
+
+        struct ifreq ifr = {};
+        strncpy(ifr.ifr_name, interface_name.c_str(), IFNAMSIZ - 1);
+
+        if (ioctl(sock, SIOCGIFHWADDR, &ifr) == -1) 
+        {
+            perror("ioctl failed");
+            close(sock);
+            return false;
+        }
+
+        close(sock);
+        memcpy(mac, ifr.ifr_hwaddr.sa_data, 6);
+        return true;
+    }
+
+    /**
+     * Parse MAC address string `macStr` (i.e. "aa:bb:cc:dd:ee:ff") into `mac`.
+     */
+    bool parseMacAddress(const std::string &macStr, uint8_t *mac)
+    {
+        int n = sscanf(macStr.c_str(), "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+                       &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]);
+        return n == 6;
+    }
+
+    /**
+     * Pin the calling thread to core `cpu`.
+     */
+    bool pinThread(int cpu)
+    {
+        if (cpu < 0 || cpu >= CPU_SETSIZE)
+        {
+            fprintf(stderr, "Invalid core %d\n", cpu);
+            return false;
+        }
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0)
+        {
+            fprintf(stderr, "pthread_setaffinity_np() failed: %s\n", strerror(err));
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Retreive the NUMA node of core `cpu` (0 if the system isn't NUMA).
+     *
+     * NOTE: the core's sysfs directory links the node it belongs to (i.e. "node<N>").
+     */
+    int getCpuNode(int cpu)
+    {
+        std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+        DIR *dir = opendir(path.c_str());
+        if (!dir)
+            return 0;
+
+        int node = 0;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr)
+        {
+            if (sscanf(entry->d_name, "node%d", &node) == 1)
+                break;
+        }
+        closedir(dir);
+        return node;
+    }
+
+    /**
+     * Parse comma-separated core list `cpuList` (i.e. "0,2,4-7") into `cpus`.
+     */
+    bool parseCpuList(const std::string &cpuList, std::vector<int> &cpus)
+    {
+        std::stringstream ss(cpuList);
+        std::string range;
+        while (std::getline(ss, range, ','))
+        {
+            int first, last;
+            int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+            if (n == 1)
+                last = first;
+            if (n < 1 || first < 0 || last < first || last >= CPU_SETSIZE)
+                return false;
+
+            for (int cpu = first; cpu <= last; cpu++)
+                cpus.push_back(cpu);
+        }
+        return !cpus.empty();
+    }
+
+    ////////////////////////////////////////////
+    // ScopedAffinity methods
+    ////////////////////////////////////////////
+    ScopedAffinity::ScopedAffinity(int cpu)
+    {
+        if (cpu < 0)
+            return;
+
+        if (pthread_getaffinity_np(pthread_self(), sizeof(previous), &previous) != 0)
+            return;
+        pinned = pinThread(cpu);
+    }
+
+    ScopedAffinity::~ScopedAffinity()
+    {
+        if (pinned)
+            pthread_setaffinity_np(pthread_self(), sizeof(previous), &previous);
+    }
 }
 
 namespace TimeUtils
@@ -45,4 +174,14 @@ namespace TimeUtils
     {
         return static_cast<uint32_t>(time(nullptr));
     }
+
+    /**
+     * Retreive monotonic (i.e. CLOCK_MONOTONIC) time, in nanoseconds.
+     */
+    uint64_t getMonotonicTimeNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <sched.h>
 #include <string>
 #include <map>
 #include <unordered_set>
@@ -16,6 +17,51 @@ namespace SystemUtils
      * Retreive MTU from network interface `interface_name`.
      */
     int getMTU(std::string interface_name);
+
+    /**
+     * Retreive the 6-byte MAC address of network interface `interface_name`
+     * into `mac`.
+     */
+    bool getMacAddress(std::string interface_name, uint8_t *mac);
+
+    /**
+     * Parse MAC address string `macStr` (i.e. "aa:bb:cc:dd:ee:ff") into `mac`.
+     */
+    bool parseMacAddress(const std::string &macStr, uint8_t *mac);
+
+    /**
+     * Pin the calling thread to core `cpu`.
+     */
+    bool pinThread(int cpu);
+
+    /**
+     * Retreive the NUMA node of core `cpu` (0 if the system isn't NUMA).
+     */
+    int getCpuNode(int cpu);
+
+    /**
+     * Parse comma-separated core list `cpuList` (i.e. "0,2,4-7") into `cpus`.
+     */
+    bool parseCpuList(const std::string &cpuList, std::vector<int> &cpus);
+
+    /**
+     * Pins the calling thread to core `cpu` (if >= 0) while in scope,
+     * restoring its previous affinity after, so memory it first touches
+     * meanwhile is placed on that core's NUMA node.
+     */
+    class ScopedAffinity
+    {
+    public:
+        ScopedAffinity(int cpu);
+        ~ScopedAffinity();
+
+        ScopedAffinity(const ScopedAffinity&) = delete;
+        ScopedAffinity &operator=(const ScopedAffinity&) = delete;
+
+    private:
+        cpu_set_t previous;
+        bool pinned = false;
+    };
 };
 
 namespace TimeUtils
@@ -24,6 +70,11 @@ namespace TimeUtils
      * Retreive 32-bit unix epoch time.
      */
     uint32_t getUnixEpochTime();
+
+    /**
+     * Retreive monotonic (i.e. CLOCK_MONOTONIC) time, in nanoseconds.
+     */
+    uint64_t getMonotonicTimeNs();
 }
 
 namespace PrintUtils {
@@ -0,0 +1,463 @@
+#include <string.h>
+#include <arpa/inet.h>
+#include <stdexcept>
+#include <algorithm>
+#include <sstream>
+#include <thread>
+#include <chrono>
+
+#include "virtual_link.hpp"
+
+#include "rss.hpp"
+
+#include "config.hpp"
+#include "utils.hpp"
+
+namespace
+{
+    /**
+     * Parse `value` with one of the (suffix, multiplier) units `units`.
+     */
+    uint64_t parseWithUnit(const std::string &key, const std::string &value,
+                           std::initializer_list<std::pair<const char*, double>> units)
+    {
+        size_t end;
+        double number;
+        try
+        {
+            number = std::stod(value, &end);
+        }
+        catch (const std::exception &)
+        {
+            throw std::runtime_error("Bad value for " + key + ": " + value);
+        }
+
+        std::string suffix = value.substr(end);
+        for (auto &unit : units)
+        {
+            if (suffix == unit.first)
+                return (uint64_t)(number * unit.second);
+        }
+        throw std::runtime_error("Bad unit for " + key + ": " + value);
+    }
+
+    /**
+     * Heap ordering, putting the frame due first on top.
+     */
+    bool deliversLater(const VirtualFrame *a, const VirtualFrame *b)
+    {
+        return a->deliverAt > b->deliverAt;
+    }
+}
+
+////////////////////////////////////////////
+// VirtualWireConfig methods
+////////////////////////////////////////////
+
+/**
+ * Parse impairments spec `spec`, a comma-separated list of key=value pairs.
+ *
+ * Throws a runtime error if the spec is malformed.
+ */
+VirtualWireConfig VirtualWireConfig::parse(const std::string &spec)
+{
+    VirtualWireConfig config;
+
+    std::istringstream iss(spec);
+    std::string pair;
+    while (std::getline(iss, pair, ','))
+    {
+        if (pair.empty())
+            continue;
+
+        size_t eq = pair.find('=');
+        if (eq == std::string::npos)
+            throw std::runtime_error("Bad impairment: " + pair);
+        std::string key = pair.substr(0, eq);
+        std::string value = pair.substr(eq + 1);
+
+        auto timeUnits = { std::make_pair("ns", 1.0), std::make_pair("us", 1e3),
+                           std::make_pair("ms", 1e6), std::make_pair("s", 1e9) };
+
+        if (key == "rate")
+            config.rateBps = parseWithUnit(key, value, { {"bit", 1.0}, {"kbit", 1e3},
+                                                         {"mbit", 1e6}, {"gbit", 1e9} });
+        else if (key == "delay")
+            config.delayNs = parseWithUnit(key, value, timeUnits);
+        else if (key == "jitter")
+            config.jitterNs = parseWithUnit(key, value, timeUnits);
+        else if (key == "loss")
+            config.loss = std::stod(value);
+        else if (key == "dup")
+            config.duplicate = std::stod(value);
+        else if (key == "reorder")
+            config.reorder = std::stod(value);
+        else if (key == "seed")
+            config.seed = std::stoull(value);
+        else
+            throw std::runtime_error("Unknown impairment: " + key);
+    }
+
+    if (config.jitterNs > config.delayNs)
+        config.jitterNs = config.delayNs;
+    return config;
+}
+
+////////////////////////////////////////////
+// VirtualWireStats methods
+////////////////////////////////////////////
+std::string VirtualWireStats::toString()
+{
+    std::ostringstream oss;
+    oss << "Wire: " << sent << " sent, " << delivered << " delivered, "
+        << lost << " lost, " << duplicated << " duplicated, "
+        << reordered << " reordered, " << overflowed << " overflowed" << "\n";
+    return oss.str();
+}
+
+////////////////////////////////////////////
+// VirtualWireQueue methods
+////////////////////////////////////////////
+VirtualWireQueue::VirtualWireQueue(uint32_t size, uint32_t frameSize)
+    : slots(size)
+{
+    if (size & (size - 1))
+        throw std::runtime_error("Virtual wire queue size must be a power of two");
+
+    this->frameSize = frameSize;
+    this->mask = size - 1;
+    this->frameBuffer.resize((size_t)size * frameSize);
+
+    for (uint32_t i = 0; i < size; i++)
+    {
+        slots[i].seq.store(i, std::memory_order_relaxed);
+        slots[i].data = frameBuffer.data() + (size_t)i * frameSize;
+    }
+
+    enqueuePos.store(0, std::memory_order_relaxed);
+    dequeuePos = 0;
+}
+
+/**
+ * Claims a free slot (producer).
+ *
+ * Returns the slot, or nullptr if the queue is full.
+ */
+VirtualFrame *VirtualWireQueue::reserve()
+{
+    uint64_t pos = enqueuePos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        VirtualFrame *frame = &slots[pos & mask];
+        uint64_t seq = frame->seq.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)(seq - pos);
+
+        if (diff == 0)
+        {
+            // slot free for `pos` - try claiming it
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                frame->pos = pos;
+                return frame;
+            }
+        }
+        else if (diff < 0)
+            return nullptr;     // slot still held from the previous lap
+        else
+            pos = enqueuePos.load(std::memory_order_relaxed);
+    }
+}
+
+/**
+ * Makes claimed slot `frame` visible to the consumer (producer).
+ */
+void VirtualWireQueue::publish(VirtualFrame *frame)
+{
+    frame->seq.store(frame->pos + 1, std::memory_order_release);
+}
+
+/**
+ * Pops the next published frame (consumer).
+ *
+ * Returns the frame, or nullptr if the queue is empty.
+ */
+VirtualFrame *VirtualWireQueue::pop()
+{
+    VirtualFrame *frame = &slots[dequeuePos & mask];
+    if (frame->seq.load(std::memory_order_acquire) != dequeuePos + 1)
+        return nullptr;
+
+    dequeuePos++;
+    return frame;
+}
+
+/**
+ * Hands popped frame `frame` back to producers (consumer).
+ */
+void VirtualWireQueue::release(VirtualFrame *frame)
+{
+    frame->seq.store(frame->pos + mask + 1, std::memory_order_release);
+}
+
+////////////////////////////////////////////
+// VirtualWire methods
+////////////////////////////////////////////
+VirtualWire::VirtualWire(const VirtualWireConfig &config)
+{
+    this->config = config;
+    this->endpointCount.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * Attaches a new endpoint with address `addr`.
+ *
+ * Returns the endpoint id, or -1 if the wire is full.
+ */
+int VirtualWire::attach(in_addr_t addr)
+{
+    std::lock_guard<std::mutex> lock(attachMutex);
+
+    int id = endpointCount.load(std::memory_order_relaxed);
+    if (id == VIRTUAL_WIRE_MAX_ENDPOINTS)
+        return -1;
+
+    endpointAddrs[id] = addr;
+    endpointQueues[id] = std::make_unique<VirtualWireQueue>(VIRTUAL_WIRE_QUEUE_SIZE, MTU);
+
+    // publish the endpoint to senders
+    endpointCount.store(id + 1, std::memory_order_release);
+    return id;
+}
+
+////////////////////////////////////////////
+// VirtualLink methods
+////////////////////////////////////////////
+VirtualLink::VirtualLink(std::shared_ptr<VirtualWire> wire, in_addr_t addr)
+    : uniform(0.0, 1.0)
+{
+    if (!wire)
+        throw std::runtime_error("No virtual wire to attach to");
+
+    this->wire = wire;
+    this->id = wire->attach(addr);
+    if (this->id < 0)
+        throw std::runtime_error("Virtual wire full");
+
+    this->rxQueue = &wire->endpointQueue(this->id);
+    this->rxPending.reserve(VIRTUAL_WIRE_QUEUE_SIZE);
+    this->rxHeld.reserve(VIRTUAL_WIRE_QUEUE_SIZE);
+    this->txBusyUntil = 0;
+    this->rng.seed(wire->config.seed + this->id);
+}
+
+VirtualLink::~VirtualLink()
+{
+    releaseRxFrames();
+}
+
+/**
+ * Returns the frames handed out by the last receive call to the queue.
+ */
+void VirtualLink::releaseRxFrames()
+{
+    for (VirtualFrame *frame : rxHeld)
+        rxQueue->release(frame);
+    rxHeld.clear();
+}
+
+/**
+ * Receive a single IP packet into `packetBuffer`.
+ *
+ * Returns the packet size, or -1 on failure.
+ */
+ssize_t VirtualLink::recvPacket(std::vector<uint8_t> &packetBuffer)
+{
+    LinkPacket packet;
+    int n;
+    while ((n = recvBatch(&packet, 1)) == 0)
+        ;
+    if (n < 0)
+        return -1;
+
+    if (packet.size > packetBuffer.size())
+    {
+        fprintf(stderr, "Packet receive failed: packet larger than buffer\n");
+        return -1;
+    }
+
+    memcpy(packetBuffer.data(), packet.data, packet.size);
+    return packet.size;
+}
+
+/**
+ * Receive up to `maxPackets` IP packets into `packets`, without copying
+ * them (they reference the queue slots they were sent into). Blocks until
+ * at least one packet is due. The slots go back to the queue on the next
+ * receive call.
+ *
+ * Returns num. packets received, or -1 on failure.
+ */
+int VirtualLink::recvBatch(LinkPacket *packets, int maxPackets)
+{
+    releaseRxFrames();
+
+    uint64_t deadline = UINT64_MAX;
+    if (pollTimeoutMs >= 0)
+        deadline = TimeUtils::getMonotonicTimeNs() + (uint64_t)pollTimeoutMs * 1000000;
+
+    for (;;)
+    {
+        VirtualFrame *frame;
+        while ((frame = rxQueue->pop()) != nullptr)
+        {
+            rxPending.push_back(frame);
+            std::push_heap(rxPending.begin(), rxPending.end(), deliversLater);
+        }
+
+        uint64_t now = TimeUtils::getMonotonicTimeNs();
+        int n = 0;
+        while (n < maxPackets && !rxPending.empty() && rxPending.front()->deliverAt <= now)
+        {
+            std::pop_heap(rxPending.begin(), rxPending.end(), deliversLater);
+            frame = rxPending.back();
+            rxPending.pop_back();
+
+            packets[n].data = frame->data;
+            packets[n].size = frame->size;
+            rxHeld.push_back(frame);
+            n++;
+        }
+
+        if (n > 0)
+        {
+            stats.rxPackets += n;
+            wire->stats.delivered += n;
+            return n;
+        }
+
+        if (now >= deadline)
+            return 0;
+
+        // nothing due - sleep until the next packet is, or for a poll interval
+        uint64_t wait = VIRTUAL_WIRE_POLL_NS;
+        if (!rxPending.empty())
+            wait = std::min<uint64_t>(wait, rxPending.front()->deliverAt - now);
+        std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+    }
+}
+
+/**
+ * Returns the time (ns) a `size`-byte packet sent now reaches the receiver.
+ */
+uint64_t VirtualLink::deliveryTime(size_t size)
+{
+    VirtualWireConfig &config = wire->config;
+    uint64_t now = TimeUtils::getMonotonicTimeNs();
+
+    // serialisation, behind whatever our transmitter is still sending
+    uint64_t sentAt = now;
+    if (config.rateBps)
+    {
+        txBusyUntil = std::max(txBusyUntil, now) + size * 8 * 1000000000ULL / config.rateBps;
+        sentAt = txBusyUntil;
+    }
+
+    // reordered packets overtake those still propagating
+    if (config.reorder > 0 && uniform(rng) < config.reorder)
+    {
+        wire->stats.reordered++;
+        return sentAt;
+    }
+
+    int64_t jitter = 0;
+    if (config.jitterNs)
+        jitter = (int64_t)((uniform(rng) * 2 - 1) * config.jitterNs);
+    return sentAt + config.delayNs + jitter;
+}
+
+/**
+ * Queues a copy of `packet` on every other endpoint with address `destAddr`.
+ */
+void VirtualLink::transmit(const uint8_t *packet, size_t size, in_addr_t destAddr, uint64_t deliverAt)
+{
+    // receiving endpoints (i.e. the queues of the destination "NIC")
+    int queues[VIRTUAL_WIRE_MAX_ENDPOINTS];
+    int numQueues = 0;
+    int numEndpoints = wire->numEndpoints();
+    for (int i = 0; i < numEndpoints; i++)
+    {
+        if (i != id && wire->endpointAddr(i) == destAddr)
+            queues[numQueues++] = i;
+    }
+    if (numQueues == 0)
+        return;
+
+    int target = queues[0];
+    if (numQueues > 1)
+    {
+        const struct iphdr *ip = (const struct iphdr*)packet;
+        const uint8_t *tcp = packet + ip->ihl * 4;
+        uint16_t ports[2];
+        memcpy(ports, tcp, sizeof(ports));
+
+        uint32_t hash = Rss::hash(ip->saddr, ip->daddr, ntohs(ports[0]), ntohs(ports[1]));
+        target = queues[Rss::queue(hash, numQueues)];
+    }
+
+    VirtualFrame *frame = wire->endpointQueue(target).reserve();
+    if (!frame)
+    {
+        wire->stats.overflowed++;
+        return;
+    }
+
+    memcpy(frame->data, packet, size);
+    frame->size = size;
+    frame->deliverAt = deliverAt;
+    wire->endpointQueue(target).publish(frame);
+}
+
+/**
+ * The wire steers packets over endpoints sharing an address by RSS hash,
+ * exactly as the engines partition flows, provided the engines attach in
+ * queue order.
+ */
+bool VirtualLink::setQueue(uint32_t queueIndex, uint32_t numQueues)
+{
+    return true;
+}
+
+/**
+ * Send the serialised packet `packet` of size `size` to `destAddr`,
+ * applying the wire's impairments.
+ *
+ * Returns num. bytes sent (including packets the wire lost), or -1 on failure.
+ */
+ssize_t VirtualLink::sendPacket(const uint8_t *packet, size_t size, in_addr_t destAddr)
+{
+    if (size > rxQueue->frameSize)
+    {
+        fprintf(stderr, "Packet too large for virtual wire\n");
+        return -1;
+    }
+
+    VirtualWireConfig &config = wire->config;
+    stats.txPackets++;
+    wire->stats.sent++;
+
+    if (config.loss > 0 && uniform(rng) < config.loss)
+    {
+        wire->stats.lost++;
+        return size;
+    }
+
+    transmit(packet, size, destAddr, deliveryTime(size));
+
+    if (config.duplicate > 0 && uniform(rng) < config.duplicate)
+    {
+        wire->stats.duplicated++;
+        transmit(packet, size, destAddr, deliveryTime(size));
+    }
+
+    return size;
+}
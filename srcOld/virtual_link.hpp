@@ -0,0 +1,243 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+#include <netinet/ip.h>
+
+#include "link.hpp"
+
+/**
+ * Impairments applied to every packet crossing a virtual wire
+ * (in the spirit of netem).
+ */
+struct VirtualWireConfig
+{
+    /* bandwidth of each endpoint's transmitter, in bits/sec (0 = unlimited) */
+    uint64_t rateBps = 0;
+
+    /* one-way propagation delay, and max. (uniform) jitter around it */
+    uint64_t delayNs = 0;
+    uint64_t jitterNs = 0;
+
+    /* per-packet probabilities, in [0, 1] */
+    double loss = 0;
+    double duplicate = 0;
+    double reorder = 0;
+
+    /* PRNG seed (each endpoint uses `seed` + its id) */
+    uint64_t seed = 1;
+
+    /**
+     * Parse impairments spec `spec`, a comma-separated list of key=value
+     * pairs, e.g. "rate=1gbit,delay=100us,jitter=10us,loss=0.01,dup=0.001,reorder=0.05".
+     *
+     * Rates take a bit/kbit/mbit/gbit suffix, times a ns/us/ms/s suffix.
+     *
+     * Throws a runtime error if the spec is malformed.
+     */
+    static VirtualWireConfig parse(const std::string &spec);
+};
+
+/**
+ * Virtual wire counters (updated concurrently by all endpoints)
+ */
+struct VirtualWireStats
+{
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> delivered{0};
+    std::atomic<uint64_t> lost{0};
+    std::atomic<uint64_t> duplicated{0};
+    std::atomic<uint64_t> reordered{0};
+    std::atomic<uint64_t> overflowed{0};
+
+    std::string toString();
+};
+
+/**
+ * Packet in flight on a virtual wire, i.e. a slot of its receiver's queue.
+ */
+struct VirtualFrame
+{
+    /* slot sequence number (see VirtualWireQueue) */
+    std::atomic<uint64_t> seq;
+
+    /* queue position the slot was claimed at */
+    uint64_t pos;
+
+    /* monotonic time (ns) the packet reaches the receiver */
+    uint64_t deliverAt;
+
+    uint32_t size;
+    uint8_t *data;
+};
+
+/**
+ * Bounded, lock-free multi-producer/single-consumer frame queue.
+ *
+ * Each slot carries a sequence number telling producers and the consumer
+ * whose turn it is (i.e. Vyukov's bounded queue): slot `pos & mask` is free
+ * for position `pos` once its sequence number is `pos`, and published once
+ * it is `pos + 1`.
+ *
+ * Unlike a plain FIFO, the consumer may hold popped frames and release them
+ * in any order (releasing a slot only hands it back for the position one
+ * lap ahead), which lets the receiver deliver packets out of order without
+ * copying them out of the queue.
+ */
+class VirtualWireQueue
+{
+public:
+    VirtualWireQueue(uint32_t size, uint32_t frameSize);
+
+    /**
+     * Claims a free slot (producer).
+     *
+     * Returns the slot, or nullptr if the queue is full.
+     */
+    VirtualFrame *reserve();
+
+    /**
+     * Makes claimed slot `frame` visible to the consumer (producer).
+     */
+    void publish(VirtualFrame *frame);
+
+    /**
+     * Pops the next published frame (consumer).
+     *
+     * Returns the frame, or nullptr if the queue is empty.
+     */
+    VirtualFrame *pop();
+
+    /**
+     * Hands popped frame `frame` back to producers (consumer).
+     */
+    void release(VirtualFrame *frame);
+
+    uint32_t frameSize;
+
+private:
+    std::vector<VirtualFrame> slots;
+    std::vector<uint8_t> frameBuffer;
+    uint32_t mask;
+
+    /* producers' and consumer's positions, on separate cache lines */
+    alignas(64) std::atomic<uint64_t> enqueuePos;
+    alignas(64) uint64_t dequeuePos;
+};
+
+/**
+ * In-process virtual wire (i.e. a hub), connecting two or more stack
+ * instances without any kernel involvement.
+ *
+ * Each attached endpoint owns a receive queue, and a packet sent to some
+ * address lands in the queue of another endpoint with that address.
+ *
+ * Endpoints sharing an address act as the queues of one multi-queue NIC
+ * (in attach order), each packet being steered to one of them by the RSS
+ * hash of its 4-tuple (see Rss).
+ */
+class VirtualWire
+{
+public:
+    VirtualWire(const VirtualWireConfig &config);
+
+    /**
+     * Attaches a new endpoint with address `addr`.
+     *
+     * Returns the endpoint id, or -1 if the wire is full.
+     */
+    int attach(in_addr_t addr);
+
+    /**
+     * Returns num. attached endpoints. Endpoints [0, numEndpoints()) are
+     * fully initialised.
+     */
+    int numEndpoints() { return endpointCount.load(std::memory_order_acquire); }
+
+    in_addr_t endpointAddr(int id) { return endpointAddrs[id]; }
+    VirtualWireQueue &endpointQueue(int id) { return *endpointQueues[id]; }
+
+    VirtualWireConfig config;
+    VirtualWireStats stats;
+
+private:
+    in_addr_t endpointAddrs[VIRTUAL_WIRE_MAX_ENDPOINTS];
+    std::unique_ptr<VirtualWireQueue> endpointQueues[VIRTUAL_WIRE_MAX_ENDPOINTS];
+    std::atomic<int> endpointCount;
+
+    /* serialises attach() (the data path never takes it) */
+    std::mutex attachMutex;
+};
+
+/**
+ * Virtual wire backend.
+ *
+ * Impairments are applied on the sending side, which stamps each packet
+ * with the time it reaches the receiver: after the transmitter has
+ * serialised it at `rateBps` (queueing behind earlier packets), plus the
+ * propagation delay and jitter. Lost packets are never queued, duplicated
+ * packets are queued twice, and reordered packets skip the propagation
+ * delay (i.e. overtake packets in flight, as with netem).
+ *
+ * The receiver moves published frames into a heap ordered by delivery
+ * time, and hands out those that are due, straight from the queue slots.
+ *
+ * NOTE:
+ *
+ * Waiting for packets sleeps in VIRTUAL_WIRE_POLL_NS steps (or until the
+ * next packet is due), so latencies below that are only meaningful when
+ * the receiver is busy.
+ */
+class VirtualLink : public LinkBackend
+{
+public:
+    VirtualLink(std::shared_ptr<VirtualWire> wire, in_addr_t addr);
+    ~VirtualLink();
+
+    ssize_t recvPacket(std::vector<uint8_t> &packetBuffer) override;
+    ssize_t sendPacket(const uint8_t *packet, size_t size, in_addr_t destAddr) override;
+    int recvBatch(LinkPacket *packets, int maxPackets) override;
+    bool setQueue(uint32_t queueIndex, uint32_t numQueues) override;
+    bool requiresIpHeader() override { return true; }
+    std::string name() override { return "virtual"; }
+
+private:
+    std::shared_ptr<VirtualWire> wire;
+    int id;
+
+    /* our receive queue */
+    VirtualWireQueue *rxQueue;
+
+    /* popped frames not yet due (min-heap on delivery time) */
+    std::vector<VirtualFrame*> rxPending;
+
+    /* frames handed out by the last receive call */
+    std::vector<VirtualFrame*> rxHeld;
+
+    /* time (ns) our transmitter finishes serialising queued packets */
+    uint64_t txBusyUntil;
+
+    std::mt19937_64 rng;
+    std::uniform_real_distribution<double> uniform;
+
+    /**
+     * Returns the time (ns) a `size`-byte packet sent now reaches the receiver.
+     */
+    uint64_t deliveryTime(size_t size);
+
+    /**
+     * Queues a copy of `packet` on the (RSS-selected) endpoint with
+     * address `destAddr`.
+     */
+    void transmit(const uint8_t *packet, size_t size, in_addr_t destAddr, uint64_t deliverAt);
+
+    /**
+     * Returns the frames handed out by the last receive call to the queue.
+     */
+    void releaseRxFrames();
+};
@@ -0,0 +1,839 @@
+#include <unistd.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <mutex>
+#include <memory>
+#include <stdexcept>
+#include <algorithm>
+#include <unordered_map>
+
+#include "xdp_link.hpp"
+
+#include "config.hpp"
+#include "utils.hpp"
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+////////////////////////////////////////////
+// BPF helpers
+////////////////////////////////////////////
+namespace
+{
+    int bpf(int cmd, union bpf_attr *attr)
+    {
+        return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+    }
+
+    int createMap(bpf_map_type type, uint32_t keySize, uint32_t valueSize, uint32_t maxEntries)
+    {
+        union bpf_attr attr = {};
+        attr.map_type = type;
+        attr.key_size = keySize;
+        attr.value_size = valueSize;
+        attr.max_entries = maxEntries;
+        return bpf(BPF_MAP_CREATE, &attr);
+    }
+
+    int updateMap(int mapFd, const void *key, const void *value)
+    {
+        union bpf_attr attr = {};
+        attr.map_fd = mapFd;
+        attr.key = (uint64_t)key;
+        attr.value = (uint64_t)value;
+        attr.flags = BPF_ANY;
+        return bpf(BPF_MAP_UPDATE_ELEM, &attr);
+    }
+
+    int deleteMapElem(int mapFd, const void *key)
+    {
+        union bpf_attr attr = {};
+        attr.map_fd = mapFd;
+        attr.key = (uint64_t)key;
+        return bpf(BPF_MAP_DELETE_ELEM, &attr);
+    }
+
+    struct bpf_insn insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+    {
+        struct bpf_insn i = {};
+        i.code = code;
+        i.dst_reg = dst;
+        i.src_reg = src;
+        i.off = off;
+        i.imm = imm;
+        return i;
+    }
+
+    /**
+     * Assembles the XDP program:
+     *
+     *      if (eth.proto == IPv4 && ip.protocol == TCP && ports[tcp.dest])
+     *          return bpf_redirect_map(xsks, ctx->rx_queue_index, XDP_PASS);
+     *      return XDP_PASS;
+     *
+     * where `ports` is keyed on (network order) local ports.
+     */
+    std::vector<struct bpf_insn> assembleRedirectProgram(int portsMapFd, int xskMapFd)
+    {
+        const uint8_t R0 = 0, R1 = 1, R2 = 2, R3 = 3, R4 = 4, R5 = 5, R6 = 6, R10 = 10;
+
+        std::vector<struct bpf_insn> prog;
+        std::vector<size_t> jumpsToPass;
+        auto jumpToPass = [&](uint8_t code, uint8_t dst, uint8_t src, int32_t imm)
+        {
+            jumpsToPass.push_back(prog.size());
+            prog.push_back(insn(BPF_JMP | code, dst, src, 0, imm));
+        };
+        auto loadMapFd = [&](uint8_t dst, int fd)
+        {
+            prog.push_back(insn(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd));
+            prog.push_back(insn(0, 0, 0, 0, 0));
+        };
+
+        // r6 = ctx, r2 = data, r3 = data_end
+        prog.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_X, R6, R1, 0, 0));
+        prog.push_back(insn(BPF_LDX | BPF_MEM | BPF_W, R2, R6, offsetof(struct xdp_md, data), 0));
+        prog.push_back(insn(BPF_LDX | BPF_MEM | BPF_W, R3, R6, offsetof(struct xdp_md, data_end), 0));
+
+        // bounds check Ethernet + minimal IP header
+        prog.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_X, R4, R2, 0, 0));
+        prog.push_back(insn(BPF_ALU64 | BPF_ADD | BPF_K, R4, 0, 0, ETH_HLEN + sizeof(struct iphdr)));
+        jumpToPass(BPF_JGT | BPF_X, R4, R3, 0);
+
+        // IPv4 ?
+        prog.push_back(insn(BPF_LDX | BPF_MEM | BPF_H, R5, R2, offsetof(struct ethhdr, h_proto), 0));
+        jumpToPass(BPF_JNE | BPF_K, R5, 0, htons(ETH_P_IP));
+
+        // TCP ?
+        prog.push_back(insn(BPF_LDX | BPF_MEM | BPF_B, R5, R2, ETH_HLEN + offsetof(struct iphdr, protocol), 0));
+        jumpToPass(BPF_JNE | BPF_K, R5, 0, IPPROTO_TCP);
+
+        // skip IP header (r2 = data + ihl * 4), bounds check TCP ports
+        prog.push_back(insn(BPF_LDX | BPF_MEM | BPF_B, R5, R2, ETH_HLEN, 0));
+        prog.push_back(insn(BPF_ALU64 | BPF_AND | BPF_K, R5, 0, 0, 0x0f));
+        prog.push_back(insn(BPF_ALU64 | BPF_LSH | BPF_K, R5, 0, 0, 2));
+        prog.push_back(insn(BPF_ALU64 | BPF_ADD | BPF_X, R2, R5, 0, 0));
+        prog.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_X, R4, R2, 0, 0));
+        prog.push_back(insn(BPF_ALU64 | BPF_ADD | BPF_K, R4, 0, 0, ETH_HLEN + 4));
+        jumpToPass(BPF_JGT | BPF_X, R4, R3, 0);
+
+        // ports[tcp.dest] ?
+        prog.push_back(insn(BPF_LDX | BPF_MEM | BPF_H, R5, R2, ETH_HLEN + 2, 0));
+        prog.push_back(insn(BPF_STX | BPF_MEM | BPF_H, R10, R5, -2, 0));
+        loadMapFd(R1, portsMapFd);
+        prog.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_X, R2, R10, 0, 0));
+        prog.push_back(insn(BPF_ALU64 | BPF_ADD | BPF_K, R2, 0, 0, -2));
+        prog.push_back(insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem));
+        jumpToPass(BPF_JEQ | BPF_K, R0, 0, 0);
+
+        // return bpf_redirect_map(xsks, ctx->rx_queue_index, XDP_PASS)
+        prog.push_back(insn(BPF_LDX | BPF_MEM | BPF_W, R2, R6, offsetof(struct xdp_md, rx_queue_index), 0));
+        loadMapFd(R1, xskMapFd);
+        prog.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_K, R3, 0, 0, XDP_PASS));
+        prog.push_back(insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map));
+        prog.push_back(insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+
+        // pass:
+        size_t pass = prog.size();
+        prog.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_K, R0, 0, 0, XDP_PASS));
+        prog.push_back(insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+
+        for (size_t i : jumpsToPass)
+            prog[i].off = pass - (i + 1);
+
+        return prog;
+    }
+
+    /**
+     * Maps the ring at page offset `pgoff` of `fd`, described by `off`,
+     * with `size` descriptors of size `descSize`.
+     */
+    bool mapRing(XskRing &ring, int fd, uint64_t pgoff, struct xdp_ring_offset &off,
+                 uint32_t size, size_t descSize)
+    {
+        ring.mapSize = off.desc + size * descSize;
+        ring.map = mmap(NULL, ring.mapSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, pgoff);
+        if (ring.map == MAP_FAILED)
+        {
+            perror("Failed XSK ring mmap");
+            return false;
+        }
+
+        uint8_t *base = (uint8_t*)ring.map;
+        ring.producer = (uint32_t*)(base + off.producer);
+        ring.consumer = (uint32_t*)(base + off.consumer);
+        ring.flags = (uint32_t*)(base + off.flags);
+        ring.descs = base + off.desc;
+        ring.size = size;
+        ring.mask = size - 1;
+        return true;
+    }
+
+    void unmapRing(XskRing &ring)
+    {
+        if (ring.map != nullptr && ring.map != MAP_FAILED)
+            munmap(ring.map, ring.mapSize);
+    }
+
+    /* attached programs, by interface index */
+    std::mutex programsMutex;
+    std::unordered_map<unsigned int, std::weak_ptr<XdpProgram>> programs;
+}
+
+////////////////////////////////////////////
+// XdpProgram methods
+////////////////////////////////////////////
+
+/**
+ * Returns the program of interface `ifIndex`, loading and attaching it
+ * unless already attached.
+ *
+ * Returns nullptr on failure.
+ */
+std::shared_ptr<XdpProgram> XdpProgram::attach(unsigned int ifIndex)
+{
+    std::lock_guard<std::mutex> lock(programsMutex);
+
+    std::shared_ptr<XdpProgram> program = programs[ifIndex].lock();
+    if (program)
+        return program;
+
+    program.reset(new XdpProgram(ifIndex));
+    if (!program->load())
+        return nullptr;
+
+    programs[ifIndex] = program;
+    return program;
+}
+
+XdpProgram::~XdpProgram()
+{
+    // closing the BPF link detaches the program
+    if (bpfLinkFd >= 0)
+        close(bpfLinkFd);
+    if (progFd >= 0)
+        close(progFd);
+    if (xskMapFd >= 0)
+        close(xskMapFd);
+    if (portsMapFd >= 0)
+        close(portsMapFd);
+}
+
+/**
+ * Creates the BPF maps, loads the XDP redirect program and attaches it
+ * to the interface in generic (SKB) mode.
+ */
+bool XdpProgram::load()
+{
+    portsMapFd = createMap(BPF_MAP_TYPE_HASH, sizeof(uint16_t), sizeof(uint8_t), XSK_MAX_LOCAL_PORTS);
+    xskMapFd = createMap(BPF_MAP_TYPE_XSKMAP, sizeof(uint32_t), sizeof(uint32_t), XSK_MAX_QUEUES);
+    if (portsMapFd < 0 || xskMapFd < 0)
+    {
+        perror("Failed BPF map creation");
+        return false;
+    }
+
+    std::vector<struct bpf_insn> prog = assembleRedirectProgram(portsMapFd, xskMapFd);
+    std::vector<char> log(1 << 16);
+    const char *license = "GPL";
+
+    union bpf_attr attr = {};
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insn_cnt = prog.size();
+    attr.insns = (uint64_t)prog.data();
+    attr.license = (uint64_t)license;
+    attr.log_buf = (uint64_t)log.data();
+    attr.log_size = log.size();
+    attr.log_level = 1;
+    progFd = bpf(BPF_PROG_LOAD, &attr);
+    if (progFd < 0)
+    {
+        perror("Failed XDP program load");
+        fprintf(stderr, "%s\n", log.data());
+        return false;
+    }
+
+    attr = {};
+    attr.link_create.prog_fd = progFd;
+    attr.link_create.target_ifindex = ifIndex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+    bpfLinkFd = bpf(BPF_LINK_CREATE, &attr);
+    if (bpfLinkFd < 0)
+    {
+        perror("Failed XDP program attach");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Redirects frames received on queue `queueIndex` to socket `xsk`.
+ */
+bool XdpProgram::registerSocket(uint32_t queueIndex, int xsk)
+{
+    if (updateMap(xskMapFd, &queueIndex, &xsk) < 0)
+    {
+        perror("Failed XSK map update");
+        return false;
+    }
+    return true;
+}
+
+void XdpProgram::unregisterSocket(uint32_t queueIndex)
+{
+    deleteMapElem(xskMapFd, &queueIndex);
+}
+
+/**
+ * Start redirecting frames destined to local port `port`.
+ */
+bool XdpProgram::addPort(uint16_t port)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint32_t &users = portUsers[port];
+    if (users == 0)
+    {
+        uint16_t key = htons(port);
+        uint8_t value = 1;
+        if (updateMap(portsMapFd, &key, &value) < 0)
+        {
+            perror("Failed ports map update");
+            portUsers.erase(port);
+            return false;
+        }
+    }
+    users++;
+    return true;
+}
+
+/**
+ * Stop redirecting frames destined to local port `port`, once no link
+ * uses it.
+ */
+void XdpProgram::removePort(uint16_t port)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto users = portUsers.find(port);
+    if (users == portUsers.end() || --users->second > 0)
+        return;
+
+    uint16_t key = htons(port);
+    deleteMapElem(portsMapFd, &key);
+    portUsers.erase(users);
+}
+
+////////////////////////////////////////////
+// XdpLink methods
+////////////////////////////////////////////
+XdpLink::XdpLink(const std::string &interfaceName, uint32_t queueIndex,
+                 const std::string &peerMac, const std::vector<uint16_t> &localPorts)
+{
+    this->queueIndex = queueIndex;
+    this->xsk = -1;
+    this->umem = (uint8_t*)MAP_FAILED;
+    this->fillRing = {};
+    this->completionRing = {};
+    this->rxRing = {};
+    this->txRing = {};
+    this->txQueued = 0;
+    this->socketRegistered = false;
+
+    this->ifIndex = if_nametoindex(interfaceName.c_str());
+    if (this->ifIndex == 0)
+        throw std::runtime_error("Unknown interface: " + interfaceName);
+
+    // Ethernet header template
+    if (!SystemUtils::getMacAddress(interfaceName, ethHeader.h_source))
+        throw std::runtime_error("Failed Ethernet header initialisation");
+    memset(ethHeader.h_dest, 0xff, ETH_ALEN);
+    if (!peerMac.empty() && !SystemUtils::parseMacAddress(peerMac, ethHeader.h_dest))
+        throw std::runtime_error("Invalid peer MAC: " + peerMac);
+    ethHeader.h_proto = htons(ETH_P_IP);
+
+    this->xsk = socket(AF_XDP, SOCK_RAW, 0);
+    if (this->xsk < 0)
+    {
+        perror("Failed socket creation");
+        teardown();
+        throw std::runtime_error("Failed XSK creation");
+    }
+
+    if (!initialiseUmemAndRings() || !bindSocket())
+    {
+        teardown();
+        throw std::runtime_error("Failed XSK initialisation");
+    }
+
+    if (!setLocalPorts(localPorts))
+    {
+        teardown();
+        throw std::runtime_error("Failed to register local ports");
+    }
+}
+
+XdpLink::~XdpLink()
+{
+    teardown();
+}
+
+/**
+ * Unregisters from the program (detached once no link uses it), and
+ * releases the rings and the UMEM.
+ */
+void XdpLink::teardown()
+{
+    if (program)
+    {
+        for (uint16_t port : localPorts)
+            program->removePort(port);
+        if (socketRegistered)
+            program->unregisterSocket(queueIndex);
+    }
+    localPorts.clear();
+    socketRegistered = false;
+    program.reset();
+
+    unmapRing(fillRing);
+    unmapRing(completionRing);
+    unmapRing(rxRing);
+    unmapRing(txRing);
+    fillRing = completionRing = rxRing = txRing = {};
+
+    if (xsk >= 0)
+        close(xsk);
+    xsk = -1;
+
+    if (umem != MAP_FAILED)
+        munmap(umem, umemSize);
+    umem = (uint8_t*)MAP_FAILED;
+}
+
+/**
+ * Allocates and registers the UMEM, and sets up and maps all four rings.
+ */
+bool XdpLink::initialiseUmemAndRings()
+{
+    umemSize = (size_t)XSK_NUM_FRAMES * XSK_FRAME_SIZE;
+    umem = (uint8_t*)mmap(NULL, umemSize, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (umem == MAP_FAILED)
+    {
+        perror("Failed UMEM mmap");
+        return false;
+    }
+
+    struct xdp_umem_reg reg = {};
+    reg.addr = (uint64_t)umem;
+    reg.len = umemSize;
+    reg.chunk_size = XSK_FRAME_SIZE;
+    reg.headroom = 0;
+    if (setsockopt(xsk, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0)
+    {
+        perror("XDP_UMEM_REG failed");
+        return false;
+    }
+
+    uint32_t ringSize = XSK_RING_SIZE;
+    if (setsockopt(xsk, SOL_XDP, XDP_UMEM_FILL_RING, &ringSize, sizeof(ringSize)) < 0 ||
+        setsockopt(xsk, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ringSize, sizeof(ringSize)) < 0 ||
+        setsockopt(xsk, SOL_XDP, XDP_RX_RING, &ringSize, sizeof(ringSize)) < 0 ||
+        setsockopt(xsk, SOL_XDP, XDP_TX_RING, &ringSize, sizeof(ringSize)) < 0)
+    {
+        perror("XSK ring setup failed");
+        return false;
+    }
+
+    struct xdp_mmap_offsets off = {};
+    socklen_t optlen = sizeof(off);
+    if (getsockopt(xsk, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0)
+    {
+        perror("XDP_MMAP_OFFSETS failed");
+        return false;
+    }
+
+    if (!mapRing(fillRing, xsk, XDP_UMEM_PGOFF_FILL_RING, off.fr, ringSize, sizeof(uint64_t)) ||
+        !mapRing(completionRing, xsk, XDP_UMEM_PGOFF_COMPLETION_RING, off.cr, ringSize, sizeof(uint64_t)) ||
+        !mapRing(rxRing, xsk, XDP_PGOFF_RX_RING, off.rx, ringSize, sizeof(struct xdp_desc)) ||
+        !mapRing(txRing, xsk, XDP_PGOFF_TX_RING, off.tx, ringSize, sizeof(struct xdp_desc)))
+        return false;
+
+    /**
+     * First half of the UMEM goes to the fill ring (RX),
+     * second half to the TX free list.
+     */
+    uint32_t rxFrames = XSK_NUM_FRAMES / 2;
+    for (uint32_t i = 0; i < rxFrames; i++)
+        refillFrame((uint64_t)i * XSK_FRAME_SIZE);
+
+    rxHeldFrames.reserve(XSK_RING_SIZE);
+    txFreeFrames.reserve(XSK_NUM_FRAMES - rxFrames);
+    for (uint32_t i = rxFrames; i < XSK_NUM_FRAMES; i++)
+        txFreeFrames.push_back((uint64_t)i * XSK_FRAME_SIZE);
+
+    return true;
+}
+
+/**
+ * Binds the socket to our queue, and registers it with the interface's XDP
+ * program.
+ */
+bool XdpLink::bindSocket()
+{
+    struct sockaddr_xdp addr = {};
+    addr.sxdp_family = AF_XDP;
+    addr.sxdp_ifindex = ifIndex;
+    addr.sxdp_queue_id = queueIndex;
+    addr.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+    if (bind(xsk, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        perror("Failed XSK bind");
+        return false;
+    }
+
+    program = XdpProgram::attach(ifIndex);
+    if (!program || !program->registerSocket(queueIndex, xsk))
+        return false;
+
+    socketRegistered = true;
+    return true;
+}
+
+/**
+ * Start redirecting frames destined to local port `port` to our socket.
+ */
+bool XdpLink::addLocalPort(uint16_t port)
+{
+    if (std::find(localPorts.begin(), localPorts.end(), port) != localPorts.end())
+        return true;
+
+    if (!program->addPort(port))
+        return false;
+
+    localPorts.push_back(port);
+    return true;
+}
+
+/**
+ * Stop redirecting frames destined to local port `port` to our socket.
+ */
+bool XdpLink::removeLocalPort(uint16_t port)
+{
+    auto it = std::find(localPorts.begin(), localPorts.end(), port);
+    if (it == localPorts.end())
+        return false;
+
+    localPorts.erase(it);
+    program->removePort(port);
+    return true;
+}
+
+/**
+ * Syncs the ports map with the local ports `ports`, i.e. only frames
+ * destined to one of them are redirected to our socket.
+ *
+ * Returns false on failure.
+ */
+bool XdpLink::setLocalPorts(const std::vector<uint16_t> &ports)
+{
+    std::vector<uint16_t> stalePorts;
+    for (uint16_t port : localPorts)
+    {
+        if (std::find(ports.begin(), ports.end(), port) == ports.end())
+            stalePorts.push_back(port);
+    }
+    for (uint16_t port : stalePorts)
+        removeLocalPort(port);
+
+    for (uint16_t port : ports)
+    {
+        if (!addLocalPort(port))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Returns RX frame `addr` to the kernel via the fill ring.
+ *
+ * NOTE: the fill ring holds every RX frame, so it never overflows.
+ */
+void XdpLink::refillFrame(uint64_t addr)
+{
+    uint32_t prod = *fillRing.producer;
+    ((uint64_t*)fillRing.descs)[prod & fillRing.mask] = addr & ~((uint64_t)XSK_FRAME_SIZE - 1);
+    __atomic_store_n(fillRing.producer, prod + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Moves TX frames the kernel has finished with back to the free list.
+ */
+void XdpLink::reclaimTxFrames()
+{
+    uint32_t cons = *completionRing.consumer;
+    uint32_t prod = __atomic_load_n(completionRing.producer, __ATOMIC_ACQUIRE);
+
+    for (; cons != prod; cons++)
+        txFreeFrames.push_back(((uint64_t*)completionRing.descs)[cons & completionRing.mask]);
+
+    __atomic_store_n(completionRing.consumer, cons, __ATOMIC_RELEASE);
+}
+
+/**
+ * Asks the kernel to transmit pending TX descriptors.
+ */
+void XdpLink::kickTx()
+{
+    if (!(__atomic_load_n(txRing.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP))
+        return;
+
+    stats.txSyscalls++;
+    if (sendto(xsk, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+        errno != EAGAIN && errno != EBUSY && errno != ENOBUFS && errno != ENETDOWN)
+        perror("XSK TX kick failed");
+}
+
+/**
+ * Returns the RX frames handed out by the last receive call to the kernel.
+ */
+void XdpLink::releaseRxFrames()
+{
+    for (uint64_t addr : rxHeldFrames)
+        refillFrame(addr);
+    rxHeldFrames.clear();
+}
+
+/**
+ * Only the NIC's RSS decides which flows reach our queue, so the engine's
+ * queue must be the one we are bound to.
+ */
+bool XdpLink::setQueue(uint32_t queueIndex, uint32_t numQueues)
+{
+    return queueIndex == this->queueIndex;
+}
+
+/**
+ * Waits (for at most the poll timeout, if set) for the RX ring to be
+ * non-empty.
+ *
+ * Returns 1 once non-empty, 0 on timeout, or -1 on failure.
+ */
+int XdpLink::waitForRx()
+{
+    while (*rxRing.consumer == __atomic_load_n(rxRing.producer, __ATOMIC_ACQUIRE))
+    {
+        stats.rxSyscalls++;
+        int ret = waitReadable(xsk);
+        if (ret < 0)
+            return -1;
+        if (ret == 0 && pollTimeoutMs >= 0)
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * Consumes the next RX descriptor, pointing `packet` at its IP packet.
+ *
+ * Returns the packet size, or -1 if the frame was malformed (and has
+ * already been returned to the fill ring).
+ */
+ssize_t XdpLink::consumeRxFrame(const uint8_t **packet)
+{
+    uint32_t cons = *rxRing.consumer;
+    struct xdp_desc desc = ((struct xdp_desc*)rxRing.descs)[cons & rxRing.mask];
+    __atomic_store_n(rxRing.consumer, cons + 1, __ATOMIC_RELEASE);
+
+    // our program only redirects IPv4 TCP, but the IP length still needs checking
+    uint8_t *data = umem + desc.addr + ETH_HLEN;
+    uint32_t dataSize = desc.len - ETH_HLEN;
+    if (desc.len < ETH_HLEN + sizeof(struct iphdr) || 
+        ntohs(((struct iphdr*)data)->tot_len) > dataSize)
+    {
+        refillFrame(desc.addr);
+        return -1;
+    }
+
+    rxHeldFrames.push_back(desc.addr);
+    *packet = data;
+    return ntohs(((struct iphdr*)data)->tot_len);
+}
+
+/**
+ * Receive a single IP packet into `packetBuffer`.
+ *
+ * Returns the packet size, or -1 on failure.
+ */
+ssize_t XdpLink::recvPacket(std::vector<uint8_t> &packetBuffer)
+{
+    const uint8_t *packet;
+    ssize_t packetSize = peekPacket(&packet);
+    if (packetSize < 0)
+        return -1;
+
+    if (packetSize > packetBuffer.size())
+    {
+        fprintf(stderr, "Packet receive failed: packet larger than buffer\n");
+        return -1;
+    }
+
+    memcpy(packetBuffer.data(), packet, packetSize);
+    return packetSize;
+}
+
+/**
+ * Receive a single IP packet without copying it, pointing `packet` at
+ * the packet in the UMEM. The packet stays valid until the next receive
+ * call, at which point its frame goes back to the fill ring.
+ *
+ * Returns the packet size, or -1 on failure.
+ */
+ssize_t XdpLink::peekPacket(const uint8_t **packet)
+{
+    releaseRxFrames();
+
+    while (1)
+    {
+        int ret = waitForRx();
+        if (ret < 0)
+            return -1;
+        if (ret == 0)
+            continue;
+
+        ssize_t packetSize = consumeRxFrame(packet);
+        if (packetSize < 0)
+            continue;
+
+        stats.rxPackets++;
+        return packetSize;
+    }
+}
+
+/**
+ * Receive up to `maxPackets` IP packets into `packets`, without copying
+ * them, blocking only until the first one arrives. The packets' frames
+ * go back to the fill ring on the next receive call.
+ *
+ * Returns num. packets received, or -1 on failure.
+ */
+int XdpLink::recvBatch(LinkPacket *packets, int maxPackets)
+{
+    releaseRxFrames();
+
+    int n = 0;
+    while (n == 0)
+    {
+        int ret = waitForRx();
+        if (ret <= 0)
+            return ret;
+
+        uint32_t avail = __atomic_load_n(rxRing.producer, __ATOMIC_ACQUIRE) - *rxRing.consumer;
+        for (uint32_t i = 0; i < avail && n < maxPackets; i++)
+        {
+            const uint8_t *packet;
+            ssize_t packetSize = consumeRxFrame(&packet);
+            if (packetSize < 0)
+                continue;
+
+            packets[n].data = packet;
+            packets[n].size = packetSize;
+            n++;
+        }
+    }
+
+    stats.rxPackets += n;
+    return n;
+}
+
+/**
+ * Send the serialised packet `packet` of size `size` to `destAddr`.
+ *
+ * `packet` must carry its own IP header, so `destAddr` is unused.
+ *
+ * Returns num. bytes sent, or -1 on failure.
+ */
+ssize_t XdpLink::sendPacket(const uint8_t *packet, size_t size, in_addr_t destAddr)
+{
+    if (queuePacket(packet, size, destAddr) < 0 || flush() < 0)
+        return -1;
+    return size;
+}
+
+/**
+ * Copy the serialised packet `packet` of size `size` into a free TX frame
+ * and post it to the TX ring, to be sent on the next flush().
+ *
+ * Returns num. bytes queued, or -1 on failure.
+ */
+ssize_t XdpLink::queuePacket(const uint8_t *packet, size_t size, in_addr_t destAddr)
+{
+    size_t frameLen = sizeof(ethHeader) + size;
+    if (frameLen > XSK_FRAME_SIZE)
+    {
+        fprintf(stderr, "Packet too large for UMEM frame\n");
+        return -1;
+    }
+
+    // wait for a free TX frame and TX descriptor
+    while (1)
+    {
+        reclaimTxFrames();
+        uint32_t cons = __atomic_load_n(txRing.consumer, __ATOMIC_ACQUIRE);
+        if (!txFreeFrames.empty() && *txRing.producer - cons < txRing.size)
+            break;
+
+        stats.txSyscalls++;
+        if (sendto(xsk, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 && errno != EAGAIN && errno != EBUSY)
+        {
+            perror("XSK TX kick failed");
+            return -1;
+        }
+    }
+
+    uint64_t addr = txFreeFrames.back();
+    txFreeFrames.pop_back();
+
+    memcpy(umem + addr, &ethHeader, sizeof(ethHeader));
+    memcpy(umem + addr + sizeof(ethHeader), packet, size);
+
+    uint32_t prod = *txRing.producer;
+    struct xdp_desc &desc = ((struct xdp_desc*)txRing.descs)[prod & txRing.mask];
+    desc.addr = addr;
+    desc.len = frameLen;
+    desc.options = 0;
+    __atomic_store_n(txRing.producer, prod + 1, __ATOMIC_RELEASE);
+
+    txQueued++;
+    return size;
+}
+
+/**
+ * Kick the kernel to transmit all posted TX descriptors.
+ *
+ * Returns num. packets sent, or -1 on failure.
+ */
+int XdpLink::flush()
+{
+    if (txQueued == 0)
+        return 0;
+
+    int queued = txQueued;
+    txQueued = 0;
+
+    kickTx();
+    stats.txPackets += queued;
+    return queued;
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <linux/if_ether.h>
+#include <linux/if_xdp.h>
+
+#include "link.hpp"
+
+/**
+ * Single producer/consumer ring shared with the kernel by an AF_XDP socket
+ * (i.e. the fill, completion, RX and TX rings).
+ */
+struct XskRing
+{
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *descs;
+    uint32_t size;
+    uint32_t mask;
+
+    /* mapping backing the ring */
+    void *map;
+    size_t mapSize;
+};
+
+/**
+ * The XDP redirect program of an interface, and its maps, shared by the
+ * XdpLinks of all its queues (i.e. one per engine).
+ *
+ * An interface runs one XDP program, so it's loaded and attached as the
+ * first link opens, and detached as the last closes. Each link only
+ * registers its own socket in the XSK map (under its queue), and its
+ * local ports in the ports map. Ports are counted, as engines may share
+ * one (e.g. a listener's).
+ */
+class XdpProgram
+{
+public:
+    /**
+     * Returns the program of interface `ifIndex`, loading and attaching
+     * it unless already attached.
+     *
+     * Returns nullptr on failure.
+     */
+    static std::shared_ptr<XdpProgram> attach(unsigned int ifIndex);
+    ~XdpProgram();
+
+    XdpProgram(const XdpProgram&) = delete;
+    XdpProgram &operator=(const XdpProgram&) = delete;
+
+    /**
+     * Redirects frames received on queue `queueIndex` to socket `xsk`
+     * (or stops to).
+     */
+    bool registerSocket(uint32_t queueIndex, int xsk);
+    void unregisterSocket(uint32_t queueIndex);
+
+    /**
+     * Start (or stop, once no link uses it) redirecting frames destined
+     * to local port `port`.
+     */
+    bool addPort(uint16_t port);
+    void removePort(uint16_t port);
+
+private:
+    XdpProgram(unsigned int ifIndex) : ifIndex(ifIndex) {}
+
+    unsigned int ifIndex;
+
+    /* BPF objects: local ports map, XSK map, XDP program and its link */
+    int portsMapFd = -1;
+    int xskMapFd = -1;
+    int progFd = -1;
+    int bpfLinkFd = -1;
+
+    /* num. links using each port in the ports map (guarded by mutex) */
+    std::unordered_map<uint16_t, uint32_t> portUsers;
+    std::mutex mutex;
+
+    /**
+     * Creates the BPF maps, loads the XDP redirect program and attaches it
+     * to the interface in generic (SKB) mode.
+     */
+    bool load();
+};
+
+/**
+ * AF_XDP (XSK) backend.
+ *
+ * Frames are received into, and sent from, a UMEM region we share with the
+ * kernel. A small XDP program, attached in generic (SKB) mode, redirects
+ * IPv4 TCP frames destined to one of our local ports to the socket of the
+ * queue they arrived on, and passes everything else up the kernel stack
+ * (see XdpProgram, shared by the links of all queues).
+ *
+ * Half the UMEM frames are used for RX (cycled through the fill ring),
+ * the other half for TX (reclaimed through the completion ring).
+ *
+ * As generic mode works on any interface, this can be exercised over the
+ * same veth/netns setup as the AF_PACKET backend (see packet_ring_link.hpp).
+ *
+ * NOTE:
+ *
+ * Generic mode always copies frames into the UMEM. Native zero-copy mode
+ * only needs a driver that supports it (and XDP_ZEROCOPY on bind).
+ */
+class XdpLink : public LinkBackend
+{
+public:
+    XdpLink(const std::string &interfaceName, uint32_t queueIndex,
+            const std::string &peerMac, const std::vector<uint16_t> &localPorts);
+    ~XdpLink();
+
+    ssize_t recvPacket(std::vector<uint8_t> &packetBuffer) override;
+    ssize_t peekPacket(const uint8_t **packet) override;
+    ssize_t sendPacket(const uint8_t *packet, size_t size, in_addr_t destAddr) override;
+    int recvBatch(LinkPacket *packets, int maxPackets) override;
+    ssize_t queuePacket(const uint8_t *packet, size_t size, in_addr_t destAddr) override;
+    int flush() override;
+    bool setLocalPorts(const std::vector<uint16_t> &ports) override;
+    bool setQueue(uint32_t queueIndex, uint32_t numQueues) override;
+    bool requiresIpHeader() override { return true; }
+    std::string name() override { return "xdp"; }
+
+    /**
+     * Start (or stop) redirecting frames destined to local port `port`
+     * to our socket.
+     */
+    bool addLocalPort(uint16_t port);
+    bool removeLocalPort(uint16_t port);
+
+private:
+    /* AF_XDP socket */
+    int xsk;
+
+    unsigned int ifIndex;
+    uint32_t queueIndex;
+
+    /* UMEM region */
+    uint8_t *umem;
+    size_t umemSize;
+
+    /* rings */
+    XskRing fillRing;
+    XskRing completionRing;
+    XskRing rxRing;
+    XskRing txRing;
+
+    /* UMEM addresses of the RX frames handed out by the last receive call */
+    std::vector<uint64_t> rxHeldFrames;
+
+    /* UMEM addresses of free TX frames */
+    std::vector<uint64_t> txFreeFrames;
+
+    /* TX descriptors posted since the last flush */
+    uint32_t txQueued;
+
+    /* local ports currently in the ports map */
+    std::vector<uint16_t> localPorts;
+
+    /* the interface's XDP program (nullptr until attached) */
+    std::shared_ptr<XdpProgram> program;
+    bool socketRegistered;
+
+    /* Ethernet header prepended to each outgoing packet */
+    struct ethhdr ethHeader;
+
+    /**
+     * Unregisters from the program (detached once no link uses it), and
+     * releases the rings and the UMEM.
+     */
+    void teardown();
+
+    /**
+     * Allocates and registers the UMEM, and sets up and maps all four rings.
+     */
+    bool initialiseUmemAndRings();
+
+    /**
+     * Binds the socket to our queue, and registers it with the interface's
+     * XDP program (attached, unless already).
+     */
+    bool bindSocket();
+
+    /**
+     * Returns RX frame `addr` to the kernel via the fill ring.
+     */
+    void refillFrame(uint64_t addr);
+
+    /**
+     * Moves TX frames the kernel has finished with back to the free list.
+     */
+    void reclaimTxFrames();
+
+    /**
+     * Asks the kernel to transmit pending TX descriptors.
+     */
+    void kickTx();
+
+    /**
+     * Returns the RX frames handed out by the last receive call to the kernel.
+     */
+    void releaseRxFrames();
+
+    /**
+     * Waits (for at most the poll timeout, if set) for the RX ring to be
+     * non-empty.
+     *
+     * Returns 1 once non-empty, 0 on timeout, or -1 on failure.
+     */
+    int waitForRx();
+
+    /**
+     * Consumes the next RX descriptor, pointing `packet` at its IP packet.
+     *
+     * Returns the packet size, or -1 if the frame was malformed.
+     */
+    ssize_t consumeRxFrame(const uint8_t **packet);
+};